@@ -0,0 +1,134 @@
+#ifndef KOBRA_ATLAS_H_
+#define KOBRA_ATLAS_H_
+
+// Standard headers
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GLM headers
+#include <glm/glm.hpp>
+
+namespace kobra {
+
+// Texture atlases
+//	small textures are packed into sheets by the bake tool, so that
+//	they share an image, a sampler and a descriptor. Each texture sits
+//	in a cell of whole blocks (at every level), surrounded by a gutter
+//	of its own texels, wrapped around; levels of a sheet are assembled
+//	from the chains of its textures, so that neighbours never bleed
+//	into each other. Shaders map coordinates into a region with its
+//	transform (scale in xy, offset in zw), repeating within it
+namespace atlas {
+
+// Levels of a sheet; coarser levels are not worth the gutters
+static constexpr uint32_t levels = 3;
+
+// Gutters are a texel wide at the last level, and cells are whole
+// (4x4) blocks there, so that sheets can be block compressed
+static constexpr uint32_t gutter = 1u << (levels - 1);
+static constexpr uint32_t cell = 4u << (levels - 1);
+
+// Textures no larger than this (on either side) are packed into
+// sheets of at most max_size texels on a side
+static constexpr uint32_t threshold = 256;
+static constexpr uint32_t max_size = 2048;
+
+struct Extent {
+	uint32_t	width;
+	uint32_t	height;
+};
+
+struct Rect {
+	uint32_t	x = 0;
+	uint32_t	y = 0;
+	uint32_t	width = 0;
+	uint32_t	height = 0;
+};
+
+// Whether a texture can be packed: small enough, and with sides
+// that halve exactly down to the last level
+inline bool eligible(const Extent &extent, uint32_t limit = threshold) {
+	return extent.width <= limit && extent.height <= limit
+		&& extent.width >= gutter && extent.height >= gutter
+		&& extent.width % gutter == 0 && extent.height % gutter == 0;
+}
+
+// Skyline packer (bottom left): the top of the packed rectangles is
+// kept as a list of horizontal segments, and rectangles are placed
+// where they rest lowest, on the narrowest segment for ties
+class Skyline {
+	struct Segment {
+		uint32_t	x;
+		uint32_t	y;
+		uint32_t	width;
+	};
+
+	uint32_t		_width;
+	uint32_t		_height;
+	std::vector <Segment>	_segments;
+
+	// Height at which a rectangle would rest on a segment (and
+	// those to its right); false if it does not fit there
+	bool _fit(size_t, uint32_t, uint32_t, uint32_t &) const;
+public:
+	Skyline(uint32_t, uint32_t);
+
+	// Place a rectangle; false if there is no room left for it
+	bool insert(uint32_t, uint32_t, Rect &);
+};
+
+// A sheet, with the textures packed into it (as indices into the
+// packed extents) and their regions (without gutters); sheets are
+// trimmed to whole cells
+struct Sheet {
+	uint32_t		width = 0;
+	uint32_t		height = 0;
+	std::vector <size_t>	textures;
+	std::vector <Rect>	rects;
+};
+
+// Pack textures (which must be eligible) into as few sheets as
+// possible, tallest first
+std::vector <Sheet> pack(const std::vector <Extent> &, uint32_t = max_size);
+
+// Levels of a sheet (RGBA8, packed as in mip::layout), from the chains
+// of its textures (in the order of the sheet, each with at least as
+// many levels as a sheet)
+std::vector <uint8_t> compose(const Sheet &, const std::vector <const uint8_t *> &);
+
+// Transform of a region into texture coordinates of its sheet
+inline glm::vec4 transform(const Rect &rect, uint32_t width, uint32_t height) {
+	return {
+		float(rect.width)/float(width),
+		float(rect.height)/float(height),
+		float(rect.x)/float(width),
+		float(rect.y)/float(height)
+	};
+}
+
+// Regions of the textures of a baked sheet, stored after its levels:
+//	"KATL", count, then for each texture the region (x, y, width and
+//	height), the length of its path and the path itself (all 32-bit)
+struct Region {
+	std::string	path;
+	Rect		rect;
+};
+
+std::string write_regions(const std::vector <Region> &);
+bool read_regions(const char *, size_t, std::vector <Region> &);
+
+// Where a texture was packed by the bake tool, if its sheet is up to
+// date; lookups are cached, so sheets are only read once
+struct Placement {
+	std::string	sheet;
+	glm::vec4	transform;
+};
+
+bool lookup(const std::string &, Placement &);
+
+}
+
+}
+
+#endif
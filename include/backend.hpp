@@ -2,6 +2,7 @@
 #define BACKEND_H_
 
 // Standard headers
+#include <algorithm>
 #include <cstring>
 #include <exception>
 #include <fstream>
@@ -24,6 +25,7 @@
 #include <GLFW/glfw3.h>
 
 // Engine headers
+#include "block_compression.hpp"
 #include "common.hpp"
 #include "core.hpp"
 #include "logger.hpp"
@@ -364,7 +366,9 @@ inline void transition_image_layout(const vk::raii::CommandBuffer &cmd,
 		const vk::Image &image,
 		const vk::Format &format,
 		const vk::ImageLayout old_layout,
-		const vk::ImageLayout new_layout)
+		const vk::ImageLayout new_layout,
+		uint32_t levels = 1,
+		uint32_t base = 0)
 {
 	// Source stage
 	vk::AccessFlags src_access_mask = {};
@@ -373,6 +377,9 @@ inline void transition_image_layout(const vk::raii::CommandBuffer &cmd,
 	case vk::ImageLayout::eTransferDstOptimal:
 		src_access_mask = vk::AccessFlagBits::eTransferWrite;
 		break;
+	case vk::ImageLayout::eTransferSrcOptimal:
+		src_access_mask = vk::AccessFlagBits::eTransferRead;
+		break;
 	case vk::ImageLayout::ePreinitialized:
 		src_access_mask = vk::AccessFlagBits::eHostWrite;
 		break;
@@ -395,6 +402,7 @@ inline void transition_image_layout(const vk::raii::CommandBuffer &cmd,
 		source_stage = vk::PipelineStageFlagBits::eHost;
 		break;
 	case vk::ImageLayout::eTransferDstOptimal:
+	case vk::ImageLayout::eTransferSrcOptimal:
 		source_stage = vk::PipelineStageFlagBits::eTransfer;
 		break;
 	case vk::ImageLayout::eUndefined:
@@ -466,10 +474,10 @@ inline void transition_image_layout(const vk::raii::CommandBuffer &cmd,
 		aspect_mask = vk::ImageAspectFlagBits::eColor;
 	}
 
-	// Create the barrier
+	// Create the barrier (for a few mip levels, from the base)
 	vk::ImageSubresourceRange image_subresource_range {
 		aspect_mask,
-			0, 1, 0, 1
+			base, levels, 0, 1
 	};
 
 	vk::ImageMemoryBarrier barrier {
@@ -492,6 +500,7 @@ struct ImageData {
 	vk::ImageLayout  	layout;
 	vk::MemoryPropertyFlags	properties;
 	vk::ImageAspectFlags	aspect_mask;
+	uint32_t		mip_levels = 1;
 	vk::raii::Image		image = nullptr;
 	vk::raii::DeviceMemory	memory = nullptr;
 	vk::raii::ImageView	view = nullptr;
@@ -505,7 +514,8 @@ struct ImageData {
 			vk::ImageUsageFlags usage_,
 			vk::ImageLayout initial_layout_,
 			vk::MemoryPropertyFlags memory_properties_,
-			vk::ImageAspectFlags aspect_mask_)
+			vk::ImageAspectFlags aspect_mask_,
+			uint32_t mip_levels_ = 1)
 			: format {fmt_},
 			extent {ext_},
 			tiling {tiling_},
@@ -513,13 +523,14 @@ struct ImageData {
 			layout {initial_layout_},
 			properties {memory_properties_},
 			aspect_mask {aspect_mask_},
+			mip_levels {mip_levels_},
 			image {device_,
 				{
 					vk::ImageCreateFlags(),
 					vk::ImageType::e2D,
 					format,
 					vk::Extent3D( extent, 1 ),
-					1,
+					mip_levels,
 					1,
 					vk::SampleCountFlagBits::e1,
 					tiling,
@@ -542,7 +553,7 @@ struct ImageData {
 			device_,
 			vk::ImageViewCreateInfo {
 				{}, *image, vk::ImageViewType::e2D,
-				format, {}, {aspect_mask, 0, 1, 0, 1}
+				format, {}, {aspect_mask, 0, mip_levels, 0, 1}
 			}
 		};
 	}
@@ -552,7 +563,7 @@ struct ImageData {
 	// Transition the image to a new layout
 	void transition_layout(const vk::raii::CommandBuffer &cmd,
 				const vk::ImageLayout &new_layout) {
-		transition_image_layout(cmd, *image, format, layout, new_layout);
+		transition_image_layout(cmd, *image, format, layout, new_layout, mip_levels);
 		layout = new_layout;
 	}
 
@@ -842,12 +853,22 @@ public:
 vk::DeviceAddress buffer_addr(const vk::raii::Device &, const BufferData &);
 vk::DeviceAddress acceleration_structure_addr(const vk::raii::Device &, const vk::raii::AccelerationStructureKHR &);
 
-// Copy data to an image
+// Copy data to an image (a mip level, from an offset in the buffer)
 void copy_data_to_image(const vk::raii::CommandBuffer &,
 		const vk::raii::Buffer &,
 		const vk::raii::Image &,
 		const vk::Format &,
-		uint32_t, uint32_t);
+		uint32_t, uint32_t,
+		uint32_t = 0, vk::DeviceSize = 0);
+
+// Whether the mip levels of images of a format
+// can be generated on the GPU, with linear blits
+bool supports_mip_blit(const vk::raii::PhysicalDevice &, const vk::Format &);
+
+// Fill the mip levels of an image from the first one; all levels
+// must be in the transfer destination layout, and are left in the
+// shader read layout
+void blit_mips(const vk::raii::CommandBuffer &, ImageData &);
 
 // Create ImageData object from byte data
 ImageData make_image(const vk::raii::CommandBuffer &,
@@ -874,6 +895,85 @@ ImageData make_image(const vk::raii::CommandBuffer &,
 		vk::MemoryPropertyFlags,
 		vk::ImageAspectFlags);
 
+// Block compression of textures loaded from files; compressed
+// textures are cached on disk (in the bake directory), keyed by
+// the contents of their source
+struct TextureCompression {
+	bool		enabled = true;
+	bc::Preset	preset = bc::Preset::eFast;
+};
+
+// Pixels of a texture file, with the mip levels that are available
+// (baked, stored in a container, or generated on the CPU); levels
+// point into the storage below, so these are moved rather than copied
+struct TexturePixels {
+	uint32_t		width = 0;
+	uint32_t		height = 0;
+	uint32_t		levels = 0;		// levels in data
+	uint32_t		mip_levels = 0;		// levels of the image
+	bool			blit = false;		// remaining levels on the GPU
+	bool			flip = false;		// rows are top down
+	vk::Format		format = vk::Format::eR8G8B8A8Unorm;
+
+	std::vector <mip::Level>	layout;		// levels in staging memory
+	std::vector <const byte *>	sources;	// where each level is read from
+	vk::DeviceSize			size = 0;	// bytes of staging memory
+
+	vfs::File		file;
+	std::vector <byte>	chain;
+};
+
+// Vulkan format of (possibly compressed) texture pixels
+vk::Format texture_format(bc::Format);
+
+// Whether images of a format can be sampled
+bool supports_compression(const vk::raii::PhysicalDevice &, vk::Format);
+
+inline bool supports_compression(const vk::raii::PhysicalDevice &phdev, bc::Format format)
+{
+	return format == bc::Format::eNone
+		|| supports_compression(phdev, texture_format(format));
+}
+
+// Copy some levels of texture pixels into (mapped) staging
+// memory, as laid out from the first of them
+void copy_texture_pixels(const TexturePixels &, byte *, uint32_t = 0, uint32_t = ~0u);
+
+// Bytes of staging memory for some levels of texture pixels
+inline vk::DeviceSize staging_size(const TexturePixels &pixels, uint32_t first, uint32_t count)
+{
+	count = std::min(count, pixels.levels - first);
+
+	const mip::Level &last = pixels.layout[first + count - 1];
+	return last.offset + ((last.size + 15) & ~vk::DeviceSize(15))
+		- pixels.layout[first].offset;
+}
+
+// Decode a texture file (from any thread), for a role in a material;
+// false if it could not be read
+bool load_texture_pixels(const vk::raii::PhysicalDevice &,
+		const std::string &,
+		vk::ImageTiling,
+		TexturePixels &,
+		const TextureCompression & = TextureCompression {},
+		TextureRole = TextureRole::eColor);
+
+// Record the upload of decoded pixels, which are at an offset of
+// a staging buffer; the image only has the levels from the first
+// one down, so that finer levels take no memory until another
+// image is made with them
+ImageData upload_texture(const vk::raii::CommandBuffer &,
+		const vk::raii::PhysicalDevice &,
+		const vk::raii::Device &,
+		const TexturePixels &,
+		const BufferData &,
+		vk::DeviceSize,
+		vk::ImageTiling,
+		vk::ImageUsageFlags,
+		vk::MemoryPropertyFlags,
+		vk::ImageAspectFlags,
+		uint32_t = 0);
+
 // Create ImageData object from a file (without hastle of extra arguments)
 // TODO: source file
 inline ImageData make_image(const vk::raii::PhysicalDevice &phdev,
@@ -984,29 +1084,36 @@ inline ImageData make_image(const vk::raii::PhysicalDevice &phdev,
 	return img;
 }
 
+// Sampler state for images; views already end at the last level,
+// so the maximum LOD is left unclamped, and images with any number
+// of levels can share samplers (see SamplerCache)
+inline vk::SamplerCreateInfo sampler_info()
+{
+	return vk::SamplerCreateInfo {
+		{},
+		vk::Filter::eLinear,
+		vk::Filter::eLinear,
+		vk::SamplerMipmapMode::eLinear,
+		vk::SamplerAddressMode::eRepeat,
+		vk::SamplerAddressMode::eRepeat,
+		vk::SamplerAddressMode::eRepeat,
+		0.0f,
+		VK_FALSE,
+		0.0f,
+		VK_FALSE,
+		vk::CompareOp::eNever,
+		0.0f,
+		VK_LOD_CLAMP_NONE,
+		vk::BorderColor::eIntOpaqueBlack,
+		VK_FALSE
+	};
+}
+
 // Create a sampler from an ImageData object
 inline vk::raii::Sampler make_sampler(const vk::raii::Device &device, const ImageData &image)
 {
 	return vk::raii::Sampler {
-		device,
-		vk::SamplerCreateInfo {
-			{},
-			vk::Filter::eLinear,
-			vk::Filter::eLinear,
-			vk::SamplerMipmapMode::eLinear,
-			vk::SamplerAddressMode::eRepeat,
-			vk::SamplerAddressMode::eRepeat,
-			vk::SamplerAddressMode::eRepeat,
-			0.0f,
-			VK_FALSE,
-			0.0f,
-			VK_FALSE,
-			vk::CompareOp::eNever,
-			0.0f,
-			0.0f,
-			vk::BorderColor::eIntOpaqueBlack,
-			VK_FALSE
-		}
+		device, sampler_info()
 	};
 }
 
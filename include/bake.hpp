@@ -0,0 +1,103 @@
+#ifndef KOBRA_BAKE_H_
+#define KOBRA_BAKE_H_
+
+// Standard headers
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace kobra {
+
+// Offline baking of derived assets
+//	outputs derived from source assets (imported meshes, decoded
+//	textures, ...) are written into a cache directory by the bake
+//	tool, along with a manifest of the files that each output was
+//	built from; loaders check the cache first, and only use outputs
+//	whose dependencies have not changed since
+namespace bake {
+
+// Version of the baked formats; bumping it invalidates the cache
+static constexpr uint32_t version = 3;
+
+// Kinds of outputs
+static constexpr char mesh[] = "mesh";
+static constexpr char texture[] = "texture";
+static constexpr char atlas[] = "atlas";
+
+// Baked textures: pixels in upload order, for each mip level
+// (largest first, packed as in bc::layout); RGBA8 unless they
+// are block compressed
+struct TextureHeader {
+	char		magic[4];	// "KTEX"
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	channels;
+	uint32_t	levels;
+	uint32_t	format;		// bc::Format
+};
+
+// Baked atlases (see atlas.hpp) are baked textures, followed by the
+// regions of the textures packed into them; their dependencies are
+// those textures
+
+// File that an output depends on, and its state when baked
+struct Dependency {
+	std::string	path;
+	uint64_t	size = 0;
+	int64_t		mtime = 0;
+	uint64_t	hash = 0;
+};
+
+// A baked output
+struct Record {
+	std::string			kind;
+	std::string			source;
+	std::string			output;		// in the cache directory
+	uint64_t			key = 0;
+	std::vector <Dependency>	dependencies;
+};
+
+// Records by kind and source (see id)
+using Manifest = std::map <std::string, Record>;
+
+inline std::string id(const std::string &kind, const std::string &source) {
+	return kind + ":" + source;
+}
+
+// Cache directory ($KOBRA_CACHE, or .kobra_cache)
+const std::string &directory();
+
+// Content hashes
+uint64_t hash(const char *, size_t, uint64_t = 0);
+bool hash_file(const std::string &, uint64_t &);
+
+// Faster hash for large contents (four independent lanes, like
+// xxHash64), to tell copies of a file apart from different files
+uint64_t fingerprint(const char *, size_t, uint64_t = 0);
+
+// Size and modification time of a file
+bool stat(const std::string &, Dependency &);
+
+// Key of an output, from its kind and the contents
+// of its dependencies
+uint64_t key(const std::string &, const std::vector <Dependency> &);
+
+// Manifest of a cache directory
+Manifest read_manifest(const std::string &);
+bool write_manifest(const std::string &, const Manifest &);
+
+// Path of the baked output of a source, if it is up to date (as far
+// as the sizes and modification times of its dependencies tell);
+// empty otherwise
+std::string lookup(const std::string &, const std::string &);
+
+// Same, for outputs built from several sources (atlases): the output
+// that has a source among its dependencies
+std::string lookup_member(const std::string &, const std::string &);
+
+}
+
+}
+
+#endif
@@ -24,6 +24,49 @@ struct BoundingBox {
 
 		return 2.0f * (xy + yz + xz);
 	}
+
+	// Whether the box fully contains another
+	bool contains(const BoundingBox &b) const {
+		return glm::all(glm::lessThanEqual(min, b.min))
+			&& glm::all(glm::greaterThanEqual(max, b.max));
+	}
+
+	// Whether two boxes overlap
+	bool intersects(const BoundingBox &b) const {
+		return glm::all(glm::lessThanEqual(min, b.max))
+			&& glm::all(glm::greaterThanEqual(max, b.min));
+	}
+
+	// Squared distance from a point to the box (zero if inside)
+	float distance2(const glm::vec3 &p) const {
+		glm::vec3 d = glm::max(glm::vec3 {0.0f}, glm::max(min - p, p - max));
+		return glm::dot(d, d);
+	}
+
+	// Union of two boxes
+	static BoundingBox merge(const BoundingBox &a, const BoundingBox &b) {
+		return BoundingBox {glm::min(a.min, b.min), glm::max(a.max, b.max)};
+	}
+
+	// Bounds of the box after a transformation
+	BoundingBox transform(const glm::mat4 &m) const {
+		glm::vec3 tmin = glm::vec3(m * glm::vec4(min, 1.0f));
+		glm::vec3 tmax = tmin;
+
+		for (int i = 1; i < 8; i++) {
+			glm::vec3 corner {
+				(i & 1) ? max.x : min.x,
+				(i & 2) ? max.y : min.y,
+				(i & 4) ? max.z : min.z
+			};
+
+			glm::vec3 p = glm::vec3(m * glm::vec4(corner, 1.0f));
+			tmin = glm::min(tmin, p);
+			tmax = glm::max(tmax, p);
+		}
+
+		return BoundingBox {tmin, tmax, id};
+	}
 };
 
 }
@@ -0,0 +1,76 @@
+#ifndef KOBRA_BLOCK_COMPRESSION_H_
+#define KOBRA_BLOCK_COMPRESSION_H_
+
+// Standard headers
+#include <cstdint>
+#include <vector>
+
+// Engine headers
+#include "mipmap.hpp"
+
+namespace kobra {
+
+// Block compression of RGBA8 textures
+//	images are split into 4x4 blocks (edges are padded by repeating
+//	the last row or column), which are compressed independently, in
+//	parallel. All formats are treated as UNORM, like the uncompressed
+//	textures, so sampling returns the same (encoded) values
+namespace bc {
+
+enum class Format : uint32_t {
+	eNone,		// uncompressed RGBA8
+	eBC1,		// RGB, 8 bytes per block
+	eBC3,		// RGBA (BC1 color and BC4 alpha), 16 bytes
+	eBC4,		// single channel, 8 bytes
+	eBC5,		// two channels (normal maps), 16 bytes
+	eBC7		// RGBA (mode 6 only), 16 bytes
+};
+
+enum class Preset {
+	eFast,		// endpoints from the principal axis
+	eQuality	// refined endpoints, exhaustive index search
+};
+
+// Bytes per block (or pixel, for uncompressed textures)
+inline size_t block_bytes(Format format) {
+	switch (format) {
+	case Format::eBC1:
+	case Format::eBC4:
+		return 8;
+	case Format::eBC3:
+	case Format::eBC5:
+	case Format::eBC7:
+		return 16;
+	default:
+		break;
+	}
+
+	return 4;
+}
+
+const char *name(Format);
+
+// Layout of a chain of some number of levels; levels are
+// packed one after the other, each a whole number of blocks
+std::vector <mip::Level> layout(Format, uint32_t, uint32_t, uint32_t);
+
+// Format for a texture, from its role and contents (RGBA8):
+//	normal maps are BC5 (shaders rebuild the third component),
+//	opaque grayscale maps are BC4, and the rest are BC7, or BC1
+//	(BC3 with alpha) for the fast preset
+Format select(TextureRole, const uint8_t *, uint32_t, uint32_t, Preset);
+
+// Compress a chain of RGBA8 levels (packed as in mip::layout)
+std::vector <uint8_t> compress(const uint8_t *, uint32_t, uint32_t, uint32_t,
+	Format, Preset = Preset::eFast);
+
+// Decompress a chain back to RGBA8 (packed as in mip::layout), for
+// devices without BC support; single channel formats are replicated
+// into RGB, as sampling through a swizzled view would
+std::vector <uint8_t> decompress(const uint8_t *, uint32_t, uint32_t, uint32_t, Format);
+
+}
+
+}
+
+#endif
@@ -10,6 +10,7 @@
 
 // Engine headers
 #include "common.hpp"
+#include "pool.hpp"
 #include "transform.hpp"
 
 namespace kobra {
@@ -90,7 +91,7 @@ struct Camera {
 	}
 };
 
-using CameraPtr = std::shared_ptr <Camera>;
+using CameraPtr = PoolPtr <Camera>;
 
 }
 
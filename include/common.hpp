@@ -2,6 +2,8 @@
 #define COMMON_H_
 
 // Standard headers
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdarg.h>
@@ -13,50 +15,73 @@
 
 // Engine headers
 #include "logger.hpp"
+#include "vfs.hpp"
 
 namespace kobra {
 
 namespace common {
 
-// Check if a file exists
+// Check if a file exists (in a mounted pack or on disk)
 inline bool file_exists(const std::string &file)
 {
-	std::ifstream f(file);
-	return f.good();
+	return vfs::exists(file);
 }
 
 // Read file into a string
 inline std::string read_file(const std::string &file)
 {
-	std::ifstream f(file);
-	if (!f.good()) {
+	vfs::File f = vfs::open(file);
+	if (!f.valid()) {
 		KOBRA_LOG_FUNC(error) << "Could not open file: " << file << std::endl;
 		return "";
 	}
 
-	std::stringstream s;
-	s << f.rdbuf();
-	return s.str();
+	return std::string(f.view());
+}
+
+// Write a whole file to disk, replacing the previous one atomically
+// (through a temporary file, renamed once it has been written)
+inline bool write_file(const std::string &path, const std::string &data)
+{
+	std::string tmp = path + ".tmp";
+
+	{
+		std::ofstream fout(tmp, std::ios::binary);
+		if (!fout.is_open()) {
+			KOBRA_LOG_FUNC(error) << "Failed to open file: " << tmp << std::endl;
+			return false;
+		}
+
+		fout.write(data.data(), data.size());
+		fout.flush();
+
+		if (!fout.good()) {
+			KOBRA_LOG_FUNC(error) << "Failed to write file: " << tmp << std::endl;
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		KOBRA_LOG_FUNC(error) << "Failed to replace file: " << path << std::endl;
+		std::remove(tmp.c_str());
+		return false;
+	}
+
+	return true;
 }
 
 // Read file glob
 inline std::vector <unsigned int> read_glob(const std::string &path)
 {
-	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	vfs::File file = vfs::open(path);
 
 	// Check that the file exists
-	KOBRA_ASSERT(file.is_open(), "Failed to open file: " + path);
-
-	// Get the file size
-	size_t fsize = file.tellg();
-	file.seekg(0);
-
-	// Allocate memory for the file
-	std::vector <unsigned int> buffer(fsize/sizeof(unsigned int));
+	KOBRA_ASSERT(file.valid(), "Failed to open file: " + path);
 
-	// Read the file
-	file.read((char *) buffer.data(), fsize);
-	file.close();
+	// Copy the file (the data may not be aligned)
+	std::vector <unsigned int> buffer(file.size()/sizeof(unsigned int));
+	std::memcpy(buffer.data(), file.data(), buffer.size() * sizeof(unsigned int));
 
 	return buffer;
 }
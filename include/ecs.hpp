@@ -2,6 +2,9 @@
 #define KOBRA_ECS_H_
 
 // Standard headers
+#include <array>
+#include <atomic>
+#include <deque>
 #include <map>
 #include <memory>
 #include <vector>
@@ -48,6 +51,31 @@ KOBRA_COMPONENT_STRING(Rasterizer)
 KOBRA_COMPONENT_STRING(Raytracer)
 KOBRA_COMPONENT_STRING(Transform)
 
+// Component indices, used for per-component bookkeeping
+// such as change tracking
+static constexpr int component_count = 7;
+
+template <typename T>
+constexpr int component_index()
+{
+	return -1;
+}
+
+#define KOBRA_COMPONENT_INDEX(T, I)			\
+	template <>					\
+	constexpr int component_index <T> ()		\
+	{						\
+		return I;				\
+	}
+
+KOBRA_COMPONENT_INDEX(Camera, 0)
+KOBRA_COMPONENT_INDEX(Light, 1)
+KOBRA_COMPONENT_INDEX(Material, 2)
+KOBRA_COMPONENT_INDEX(Mesh, 3)
+KOBRA_COMPONENT_INDEX(Rasterizer, 4)
+KOBRA_COMPONENT_INDEX(Raytracer, 5)
+KOBRA_COMPONENT_INDEX(Transform, 6)
+
 // Components which all entities must have
 // are stored by value
 //
@@ -55,6 +83,10 @@ KOBRA_COMPONENT_STRING(Transform)
 template <class T>
 using Archetype = std::vector <T>;
 
+// Components are stored densely: the i-th element of every archetype belongs
+// to the i-th live entity. Entities refer to a slot, which maps to the dense
+// index; a slot's generation is bumped on destruction so that stale handles
+// can be detected
 class ECS {
 	Archetype <CameraPtr>		cameras;
 	Archetype <LightPtr>		lights;
@@ -66,10 +98,72 @@ class ECS {
 
 	Archetype <Entity>		entities;
 
-	std::map <std::string, int>	name_map;
+	// Slot --> dense index (-1 if free) and generation
+	struct _slot {
+		int32_t		index = -1;
+		uint32_t	generation = 0;
+	};
+
+	std::vector <_slot>		slots;
+	std::vector <int32_t>		free_slots;
+
+	// Name --> slot
+	std::map <std::string, int32_t>	name_map;
+
+	// Change tracking: every mutable access stamps the component
+	// with a new version, so that consumers can ask for what has
+	// changed since the version they last saw
+	//	the counters are atomic, since systems may write
+	//	(different) components concurrently
+	using Versions = std::array <Archetype <uint64_t>, component_count>;
+
+	std::atomic <uint64_t>		_version = 0;
+	uint64_t			_structure_version = 0;
+	Versions			_versions;
+	std::array <std::atomic <uint64_t>, component_count>
+					_type_versions {};
+
+	template <class T>
+	void _touch(int i) {
+		static_assert(component_index <T> () >= 0,
+			"Component type has no index");
+
+		uint64_t v = ++_version;
+		_versions[component_index <T> ()][i] = v;
+
+		// Keep the maximum
+		auto &tv = _type_versions[component_index <T> ()];
+
+		uint64_t p = tv.load();
+		while (p < v && !tv.compare_exchange_weak(p, v));
+	}
+
+	// Renderers of destroyed entities, kept until the frames
+	// that may still use their buffers are done
+	struct _garbage {
+		std::vector <RasterizerPtr>	rasterizers;
+		std::vector <RaytracerPtr>	raytracers;
+	};
+
+	std::deque <_garbage>		_retired;
+
+	// Keep a replaced or removed renderer alive until then
+	void _retire(RasterizerPtr &&);
+	void _retire(RaytracerPtr &&);
+
+	// Other components have nothing on the GPU
+	template <class T>
+	void _retire(T &&) {}
 
 	// Private helpers
 	void _expand_all();
+	void _remove_all(int);
+
+	int _index(const Entity &) const;
+
+	// Entities resolve their handles through the ECS
+	friend class Entity;
+	friend class SpatialIndex;
 
 	// For construction of components
 	template <class T>
@@ -114,12 +208,15 @@ class ECS {
 	};
 public:
 	// The get functions will need to be specialized
+	//	the mutable version marks the component as changed
 	template <class T>
 	T &get(int i) {
 		// TODO: check index and show warningi with name
 		if (!_ref <T>::exists(this, i)) {
 			KOBRA_LOG_FUNC(warn) << "Entity " << i << " does not have component "
 				<< component_string <T> () << ".\n";
+		} else {
+			_touch <T> (i);
 		}
 
 		return _ref <T> ::get(this, i);
@@ -141,93 +238,122 @@ public:
 		return _ref <T> ::exists(this, i);
 	}
 
-	// Add a component
+	// Add a component; a renderer that it replaces is
+	// released once the frames in flight are done
 	template <class T, class ... Args>
 	void add(int i, Args ... args) {
-		_ref <T> ::ref(this, i) = _constructor <T> ::make(args ...);
+		auto &ref = _ref <T> ::ref(this, i);
+		_retire(std::move(ref));
+		ref = _constructor <T> ::make(args ...);
+		_touch <T> (i);
 	}
 
-	// Size of ECS
-	int size() const {
-		return entities.size();
+	// Explicitly mark a component as changed (e.g. when
+	// it was modified through a pointer)
+	template <class T>
+	void touch(int i) {
+		_touch <T> (i);
 	}
 
-	// Get entity
-	Entity &get_entity(int i) {
-		return entities[i];
+	// Remove a component, handing it over to the caller (e.g. to keep
+	// its GPU resources alive until frames in flight are done)
+	template <class T>
+	auto take(int i) {
+		auto component = std::move(_ref <T> ::ref(this, i));
+		_touch <T> (i);
+		return component;
 	}
 
-	const Entity &get_entity(int i) const {
-		return entities[i];
+	// Current version; consumers store this and later
+	// query what has changed since
+	uint64_t version() const {
+		return _version;
 	}
 
-	// Get entity by name
-	Entity &get_entity(const std::string &name) {
-		return entities[name_map.at(name)];
+	// Whether any component of the type has changed since
+	template <class T>
+	bool changed(uint64_t since) const {
+		return _type_versions[component_index <T> ()] > since;
 	}
 
-	const Entity &get_entity(const std::string &name) const {
-		return entities[name_map.at(name)];
+	// Whether a specific component has changed since
+	template <class T>
+	bool changed(int i, uint64_t since) const {
+		return _versions[component_index <T> ()][i] > since;
 	}
 
-	// Create a new entity
-	Entity &make_entity(const std::string &name = "Entity");
-
-	// Display info for one component
-	template <class T>
-	void info() const;
-};
+	// Whether any component of an entity has changed since
+	bool entity_changed(int i, uint64_t since) const {
+		for (const auto &versions : _versions) {
+			if (versions[i] > since)
+				return true;
+		}
 
-// _constructor specializations
-// TODO: macros?
-template <>
-struct ECS::_constructor <Mesh> {
-	template <class ... Args>
-	static MeshPtr make(Args ... args) {
-		return std::make_shared <Mesh> (args ...);
+		return false;
 	}
-};
 
-template <>
-struct ECS::_constructor <Rasterizer> {
-	template <class ... Args>
-	static RasterizerPtr make(Args ... args) {
-		return std::make_shared <Rasterizer> (args ...);
+	// Whether entities have been created or destroyed since
+	// (dense indices are only stable between such changes)
+	bool structure_changed(uint64_t since) const {
+		return _structure_version > since;
 	}
-};
 
-template <>
-struct ECS::_constructor <Raytracer> {
-	template <class ... Args>
-	static RaytracerPtr make(Args ... args) {
-		return std::make_shared <Raytracer> (args ...);
+	// Number of live entities
+	int size() const {
+		return entities.size();
 	}
-};
 
-template <>
-struct ECS::_constructor <Camera> {
-	template <class ... Args>
-	static CameraPtr make(Args ... args) {
-		return std::make_shared <Camera> (args ...);
-	}
-};
+	// Get entity (handles are returned by value, since
+	// the dense arrays are reordered on destruction)
+	Entity get_entity(int) const;
+	Entity get_entity(const std::string &) const;
 
-template <>
-struct ECS::_constructor <Light> {
-	template <class ... Args>
-	static LightPtr make(Args ... args) {
-		return std::make_shared <Light> (args ...);
+	// Whether an entity with the name exists
+	bool has_entity(const std::string &name) const {
+		return name_map.count(name) > 0;
 	}
-};
 
-template <>
-struct ECS::_constructor <Material> {
-	template <class ... Args>
-	static MaterialPtr make(Args ... args) {
-		return std::make_shared <Material> (args ...);
-	}
+	// Create a new entity
+	Entity make_entity(const std::string &name = "Entity");
+
+	// Destroy an entity, recycling its slot; its renderers are
+	// only released MAX_FRAMES_IN_FLIGHT frames later
+	void destroy_entity(const Entity &);
+
+	// Advance a frame (once per recorded frame), releasing the
+	// renderers that no frame in flight can refer to anymore
+	void frame();
+
+	// Check that a handle still refers to a live entity
+	bool valid(const Entity &) const;
+
+	// Display info for one component
+	template <class T>
+	void info() const;
+
+	// Allocation statistics of the component pools
+	static void pool_info();
 };
 
+// _constructor specializations
+//	components that are not stored by value
+//	are allocated from their per type pools
+#define KOBRA_POOLED_CONSTRUCTOR(T)				\
+	template <>						\
+	struct ECS::_constructor <T> {				\
+		template <class ... Args>			\
+		static T##Ptr make(Args ... args) {		\
+			return make_pooled <T> (args ...);	\
+		}						\
+	};
+
+KOBRA_POOLED_CONSTRUCTOR(Camera)
+KOBRA_POOLED_CONSTRUCTOR(Light)
+KOBRA_POOLED_CONSTRUCTOR(Material)
+KOBRA_POOLED_CONSTRUCTOR(Mesh)
+KOBRA_POOLED_CONSTRUCTOR(Rasterizer)
+KOBRA_POOLED_CONSTRUCTOR(Raytracer)
+
 // _ref specializations
 // TODO: another header
 template <>
@@ -369,9 +495,10 @@ struct ECS::_ref <Material> {
 	}
 };
 
-// Entity class, acts like a pointer to a component
+// Entity class, acts like a (generational) handle to a set of components
 class Entity {
 	int32_t		id = -1;
+	uint32_t	generation = 0;
 	ECS		*ecs = nullptr;
 
 	// Assert valid ECS
@@ -389,10 +516,18 @@ class Entity {
 				+ std::to_string(id)
 				+ ") has invalid id"
 		);
+
+		KOBRA_ASSERT(
+			ecs->valid(*this),
+			"Entity \"" + name + "\" (id="
+				+ std::to_string(id)
+				+ ", generation=" + std::to_string(generation)
+				+ ") has been destroyed"
+		);
 	}
 
-	Entity(std::string name_, uint32_t id_, ECS *ecs_)
-		: name(name_), id(id_), ecs(ecs_) {}
+	Entity(std::string name_, int32_t id_, uint32_t generation_, ECS *ecs_)
+		: name(name_), id(id_), generation(generation_), ecs(ecs_) {}
 public:
 	std::string	name = "";
 
@@ -403,40 +538,81 @@ public:
 	Entity(const Entity &) = default;
 	Entity &operator=(const Entity &) = default;
 
-	// Unmoveable
-	Entity(Entity &&) = delete;
-	Entity &operator=(Entity &&) = delete;
+	// Move
+	Entity(Entity &&) = default;
+	Entity &operator=(Entity &&) = default;
+
+	// Whether the handle still refers to a live entity
+	bool valid() const {
+		return (ecs != nullptr) && ecs->valid(*this);
+	}
 
 	// Get for entities
 	template <class T>
 	T &get() {
 		_assert();
-		return ecs->get <T> (id);
+		return ecs->get <T> (ecs->_index(*this));
 	}
 
 	template <class T>
 	const T &get() const {
 		_assert();
-		return ecs->get <T> (id);
+
+		// Through a const ECS, so that nothing is marked as changed
+		const ECS *cecs = ecs;
+		return cecs->get <T> (ecs->_index(*this));
 	}
 
 	// Existence check
 	template <class T>
 	bool exists() const {
 		_assert();
-		return ecs->exists <T> (id);
+		return ecs->exists <T> (ecs->_index(*this));
 	}
 
 	// Add a component
 	template <class T, class ... Args>
 	void add(Args ... args) {
 		_assert();
-		ecs->add <T> (id, args ...);
+		ecs->add <T> (ecs->_index(*this), args ...);
+	}
+
+	// Mark a component as changed
+	template <class T>
+	void touch() {
+		_assert();
+		ecs->touch <T> (ecs->_index(*this));
+	}
+
+	// Remove a component, handing it over
+	template <class T>
+	auto take() {
+		_assert();
+		return ecs->take <T> (ecs->_index(*this));
+	}
+
+	// Whether a component has changed since
+	template <class T>
+	bool changed(uint64_t since) const {
+		_assert();
+		return ecs->changed <T> (ecs->_index(*this), since);
+	}
+
+	// Comparison (same slot and generation)
+	bool operator==(const Entity &other) const {
+		return (ecs == other.ecs)
+			&& (id == other.id)
+			&& (generation == other.generation);
+	}
+
+	bool operator!=(const Entity &other) const {
+		return !(*this == other);
 	}
 
 	// Friend the ECS class
 	friend class ECS;
 	friend class Scene;
+	friend class SpatialIndex;
 };
 
 template <class T>
@@ -11,6 +11,14 @@ enum RasterMode {
 	eWireframe,
 };
 
+// What a texture of a material holds, which decides how its levels
+// are filtered and how it is compressed: color is sRGB encoded, while
+// normal maps are (tangent space) vectors
+enum class TextureRole {
+	eColor,
+	eNormal
+};
+
 }
 
 #endif
@@ -18,6 +18,7 @@
 // Engine headers
 #include "../common.hpp"
 #include "../logger.hpp"
+#include "../sampler_cache.hpp"
 // #include "../sampler.hpp"
 #include "gui.hpp"
 
@@ -142,7 +143,6 @@ class Font {
 	// Font bitmap data
 	std::vector <ImageData>	_bitmaps;
 	std::vector <vk::raii::DescriptorSet> _glyph_ds;
-	std::vector <vk::raii::Sampler>	_glyph_samplers;
 
 	// Character to index map
 	std::map <char, uint32_t> _char_to_index;
@@ -178,9 +178,15 @@ class Font {
 		FT_Library library;
 		check_error(FT_Init_FreeType(&library));
 
-		// Load font
+		// Load font (FreeType reads from the buffer
+		// until the face is done)
+		vfs::File data = vfs::open(file);
+
 		FT_Face face;
-		check_error(FT_New_Face(library, file.c_str(), 0, &face));
+		check_error(FT_New_Memory_Face(library,
+			(const FT_Byte *) data.data(), data.size(),
+			0, &face
+		));
 
 		// Set font size
 		check_error(FT_Set_Char_Size(face, 0, 1000 * 64, 96, 96));
@@ -233,8 +239,8 @@ class Font {
 				);
 			}
 
-			// Create sampler handle
-			vk::raii::Sampler sampler = make_sampler(device, img);
+			// Sampler handle, shared by all glyphs
+			const vk::raii::Sampler &sampler = SamplerCache::get(device, sampler_info());
 
 			// Create descriptor set and bind it
 			// TODO: preallocate all needed descriptor sets, and
@@ -249,7 +255,6 @@ class Font {
 
 			// Store everything
 			_glyph_ds.emplace_back(std::move(dset));
-			_glyph_samplers.emplace_back(std::move(sampler));
 			_bitmaps.emplace_back(std::move(img));
 
 			_metrics[' '] = FT_Glyph_Metrics {
@@ -287,8 +292,8 @@ class Font {
 				vk::ImageAspectFlagBits::eColor
 			);
 
-			// Create sampler handle
-			vk::raii::Sampler sampler = make_sampler(device, img);
+			// Sampler handle, shared by all glyphs
+			const vk::raii::Sampler &sampler = SamplerCache::get(device, sampler_info());
 
 			// Create descriptor set and bind it
 			vk::raii::DescriptorSets dsets = vk::raii::DescriptorSets {
@@ -301,11 +306,14 @@ class Font {
 
 			// Store everything
 			_glyph_ds.emplace_back(std::move(dset));
-			_glyph_samplers.emplace_back(std::move(sampler));
 			_bitmaps.emplace_back(std::move(img));
 			_metrics[c] = face->glyph->metrics;
 			_char_to_index[c] = _glyph_ds.size() - 1;
 		}
+
+		// The glyphs have been copied out
+		FT_Done_Face(face);
+		FT_Done_FreeType(library);
 	}
 public:
 	Font() {}
@@ -3,6 +3,7 @@
 
 // Engine headers
 #include "../include/coords.hpp"
+#include "../sampler_cache.hpp"
 // #include "../sampler.hpp"
 #include "gui.hpp"
 
@@ -49,9 +50,9 @@ protected:
 	// Vulkan device
 	const vk::raii::Device &_device = nullptr;
 
-	// Image data and sampler
+	// Image data and sampler (from the sampler cache)
 	ImageData _image_data = nullptr;
-	vk::raii::Sampler _sampler = nullptr;
+	const vk::raii::Sampler *_sampler = nullptr;
 
 	// Descriptor set
 	vk::raii::DescriptorSet _ds = nullptr;
@@ -134,7 +135,7 @@ public:
 				vk::ImageAspectFlagBits::eColor
 			);
 
-			_sampler = make_sampler(device, _image_data);
+			_sampler = &SamplerCache::get(device, sampler_info());
 		}
 	}
 
@@ -167,7 +168,7 @@ public:
 				vk::ImageAspectFlagBits::eColor
 			);
 
-			_sampler = make_sampler(device, _image_data);
+			_sampler = &SamplerCache::get(device, sampler_info());
 		}
 	}
 
@@ -186,7 +187,7 @@ public:
 				vk::ImageAspectFlagBits::eColor
 			);
 
-			_sampler = make_sampler(device, _image_data);
+			_sampler = &SamplerCache::get(device, sampler_info());
 		}
 	}
 
@@ -0,0 +1,63 @@
+#ifndef KOBRA_KPAK_H_
+#define KOBRA_KPAK_H_
+
+// Standard headers
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kobra {
+
+// Packed asset archives (.kpak)
+//	a header, then the entries, each starting on a page boundary
+//	so that they can be used straight from a mapping, then the
+//	index (sorted by path hash) and the string table of paths
+namespace kpak {
+
+static constexpr char		magic[4] = {'K', 'P', 'A', 'K'};
+static constexpr uint32_t	version = 1;
+static constexpr uint64_t	alignment = 4096;
+
+// Entry flags
+enum : uint32_t {
+	eCompressed = 1 << 0	// zlib stream
+};
+
+struct Header {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	entries;
+	uint32_t	reserved;
+	uint64_t	index;
+	uint64_t	strings;
+	uint64_t	strings_size;
+};
+
+struct Entry {
+	uint64_t	hash;
+	uint64_t	offset;
+	uint64_t	size;		// as stored
+	uint64_t	original_size;
+	uint32_t	flags;
+	uint32_t	path;		// offset in the string table
+};
+
+static_assert(sizeof(Header) == 40, "Unexpected kpak header size");
+static_assert(sizeof(Entry) == 40, "Unexpected kpak entry size");
+
+// Paths are stored relative and normalized ("./a//b" --> "a/b")
+std::string normalize(const std::string &);
+
+// Hash of a normalized path (FNV-1a)
+uint64_t hash(std::string_view);
+
+// Pack files into an archive; entries are compressed if
+// requested, and if that makes them noticeably smaller
+bool build(const std::string &, const std::vector <std::string> &, bool = false);
+
+}
+
+}
+
+#endif
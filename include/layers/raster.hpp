@@ -3,6 +3,8 @@
 
 // Standard headers
 #include <map>
+#include <set>
+#include <unordered_map>
 
 // Engine headers
 // TODO: move layer.hpp to this directory
@@ -10,6 +12,8 @@
 
 #include "../backend.hpp"
 #include "../ecs.hpp"
+#include "../scheduler.hpp"
+#include "../spatial.hpp"
 #include "../../shaders/raster/bindings.h"
 #include "../../shaders/raster/constants.h"
 #include "../vertex.hpp"
@@ -19,6 +23,27 @@ namespace kobra {
 namespace layers {
 
 class Raster {
+public:
+	// Creation and eviction of rasterizer buffers
+	struct Residency {
+		// Bytes of buffers that may exist; only buffers unused for
+		// at least evict_after frames are evicted to stay within it
+		size_t		budget = size_t(1) << 30;
+		uint64_t	evict_after = 120;
+
+		// Bytes of buffers created per frame (at least one
+		// rasterizer's worth, so that everything gets drawn)
+		size_t		batch = size_t(64) << 20;
+	};
+
+	struct ResidencyStats {
+		size_t		resident = 0;
+		size_t		bytes = 0;
+		size_t		pending = 0;
+		size_t		uploads = 0;
+		size_t		evictions = 0;
+	};
+private:
 	// Push constants
 	struct PushConstants;
 
@@ -41,20 +66,84 @@ class Raster {
 	// Bind pipeline from raster mode
 	const vk::raii::Pipeline &get_pipeline(RasterMode);
 
-	// Descriptor set layout and bindings
+	// Descriptor set layout and bindings; the set of the lights is
+	// the only one of this layer, textures are in the texture table
 	vk::raii::DescriptorSetLayout	_dsl = nullptr;
+	vk::raii::DescriptorSet		_ds_lights = nullptr;
 
 	static const std::vector <DSLB>	_dsl_bindings;
 
-	// Create a descriptor set
-	vk::raii::DescriptorSet	_make_ds() const;
-
-	// Rasterizer components to descriptor set
-	std::map <const Rasterizer *, vk::raii::DescriptorSet>
-					_ds_components;
+	bool _textures_loaded(const Rasterizer *) const;
+	std::pair <int, int> _texture_slots(const Rasterizer *) const;
+	float _footprint(const Camera &, const Entity &) const;
+	void _load_textures(const std::vector <const Rasterizer *> &);
 
 	// Box mesh for area lights
+	Mesh				_area_light_box = Mesh::box({0, 0, 0}, {0.5, 0.01, 0.5});
 	Rasterizer			*_area_light;
+
+	// Last ECS version that was consumed
+	uint64_t			_version = 0;
+
+	// Rasterizers whose buffers this layer created, with their
+	// size, the last frame they were drawn in and their entity
+	// (as of the last frame, to write them through when evicting)
+	struct _residence {
+		size_t		bytes;
+		uint64_t	frame;
+		int		entity;
+	};
+
+	std::map <const Rasterizer *, _residence>	_resident;
+	uint64_t			_frame = 0;
+
+	Residency			_residency;
+	ResidencyStats			_residency_stats;
+
+	void _update_residency(Scheduler::Access &, const std::vector <bool> &);
+
+	// Spatial index for frustum culling
+	SpatialIndex			_spatial;
+
+	// Texture slots and regions of a rasterizer's material; they
+	// are resolved again only if the material (or rasterizer) changed
+	// since, or if the texture manager moved a texture to another slot
+	struct _texture_state {
+		int		albedo = -1;
+		int		normal = -1;
+		glm::vec4	albedo_region {1, 1, 0, 0};
+		glm::vec4	normal_region {1, 1, 0, 0};
+
+		uint64_t	version = 0;	// ECS version when resolved
+		uint64_t	slots = 0;	// version of the texture slots
+		uint64_t	frame = 0;	// last frame it was drawn in
+	};
+
+	std::unordered_map <const Rasterizer *, _texture_state>
+					_texture_states;
+
+	const _texture_state &_resolve_textures(const ECS &, int, const Rasterizer *, uint64_t);
+
+	// State of the frame being recorded, filled in by the systems of
+	// the layer; recording then only walks the list of draws
+	struct _draw {
+		const Rasterizer		*rasterizer;
+		glm::mat4			model;
+		const _texture_state		*textures;
+	};
+
+	struct _frame_state {
+		Camera					camera;
+		bool					found_camera = false;
+		std::vector <std::pair <Transform, glm::vec3>>	area_lights;
+		std::vector <bool>			visible;
+		std::vector <_draw>			draws;
+	};
+
+	_frame_state			_state;
+	Scheduler			_systems;
+
+	void _add_systems();
 public:
 	// Default constructor
 	Raster() = default;
@@ -62,10 +151,24 @@ public:
 	// Constructors
 	Raster(const Context &, const vk::AttachmentLoadOp &);
 
-	// Render
+	// Systems refer to the layer, so it stays in place
+	Raster(Raster &&) = delete;
+	Raster &operator=(Raster &&) = delete;
+
+	// Residency of rasterizer buffers
+	void residency(const Residency &residency) {
+		_residency = residency;
+	}
+
+	ResidencyStats residency_stats() const {
+		return _residency_stats;
+	}
+
+	// Render; the buffers of rasterizers are created
+	// (and evicted) as needed, hence the mutable ECS
 	void render(const vk::raii::CommandBuffer &,
 			const vk::raii::Framebuffer &,
-			const ECS &,
+			ECS &,
 			const RenderArea & = RenderArea {{-1, -1}, {-1, -1}});
 };
 
@@ -2,6 +2,7 @@
 #define KOBRA_LAYERS_RAYTRACER_H_
 
 // Standard headers
+#include <map>
 #include <vector>
 
 // Engine headers
@@ -110,11 +111,9 @@ class Raytracer {
 		vk::raii::Sampler	result = nullptr;
 	} _samplers;
 
-	using ImageDescriptors = std::vector <vk::DescriptorImageInfo>;
-
-	// Vector of image descriptors
-	ImageDescriptors	_albedo_image_descriptors;
-	ImageDescriptors	_normal_image_descriptors;
+	// Environment map, and the generation of its bound image
+	std::string			_environment;
+	uint64_t			_environment_generation = 0;
 
 	// Reference to SyncQueue
 	SyncQueue			*_sync_queue;
@@ -127,14 +126,41 @@ class Raytracer {
 	int		_offsetx = 0;
 	int		_offsety = 0;
 
-	// TODO: the following should be kept in a cache structure
-	std::vector <Transform> _p_light_transforms;
-	std::vector <const kobra::Raytracer *> _p_raytracers;
+	// Last ECS version that was consumed
+	uint64_t	_version = 0;
+
+	// Raytracer components as serialized (in world space) when this
+	// layer first needed them; they are serialized again only if the
+	// component, its mesh, material or transform change, and dropped
+	// along with the component
+	struct _serialized {
+		std::vector <aligned_vec4>	vertices;
+		std::vector <aligned_vec4>	triangles;	// mesh-local indices
+		std::vector <kobra::Raytracer::_material> materials;
+		std::vector <aligned_mat4>	transforms;
+
+		// Slots of the textures in the materials
+		std::pair <int, int>		slots {-1, -1};
+	};
+
+	std::map <const kobra::Raytracer *, _serialized> _serialized_cache;
+
+	// Entities per parallel chunk when gathering
+	static constexpr size_t _chunk = 256;
+
+	// Textures to load, with their roles in the materials
+	struct _texture_list {
+		std::vector <std::string>	paths;
+		std::vector <TextureRole>	roles;
+	};
 
 	// Helper functions
 	void _initialize_vuklan_structures(const vk::AttachmentLoadOp &);
 	std::vector <BoundingBox> _get_bboxes(const kobra::Raytracer::HostBuffers &) const;
-	void _update_samplers(const ImageDescriptors &, uint32_t);
+	_texture_list _textures(const std::vector <const kobra::Raytracer *> &,
+		const std::vector <bool> &) const;
+	bool _textures_loaded(const kobra::Raytracer *) const;
+	std::pair <int, int> _texture_slots(const kobra::Raytracer *) const;
 public:
 	// Default constructor
 	Raytracer() = default;
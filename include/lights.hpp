@@ -7,6 +7,9 @@
 // GLM headers
 #include <glm/glm.hpp>
 
+// Engine headers
+#include "pool.hpp"
+
 namespace kobra {
 
 // General light class
@@ -26,7 +29,7 @@ struct Light {
 	float		power {1.0f};
 };
 
-using LightPtr = std::shared_ptr <Light>;
+using LightPtr = PoolPtr <Light>;
 
 }
 
@@ -0,0 +1,53 @@
+#ifndef KOBRA_MAPPED_FILE_H_
+#define KOBRA_MAPPED_FILE_H_
+
+// Standard headers
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace kobra {
+
+// Read-only memory mapped file
+class MappedFile {
+	void	*_data = nullptr;
+	size_t	_size = 0;
+public:
+	// Constructors
+	MappedFile() = default;
+	MappedFile(const std::string &);
+
+	// Move only
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	MappedFile(MappedFile &&);
+	MappedFile &operator=(MappedFile &&);
+
+	// Destructor
+	~MappedFile();
+
+	// Unmap the file
+	void reset();
+
+	// Properties
+	bool valid() const {
+		return _data != nullptr;
+	}
+
+	const char *data() const {
+		return (const char *) _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	std::string_view view() const {
+		return std::string_view(data(), _size);
+	}
+};
+
+}
+
+#endif
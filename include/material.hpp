@@ -11,6 +11,7 @@
 // #include "backend.hpp"
 #include "common.hpp"
 #include "core.hpp"
+#include "pool.hpp"
 #include "types.hpp"
 
 namespace kobra {
@@ -47,7 +48,7 @@ struct Material {
 	static Material from_file(std::ifstream &, const std::string &, bool &);
 };
 
-using MaterialPtr = std::shared_ptr <Material>;
+using MaterialPtr = PoolPtr <Material>;
 
 }
 
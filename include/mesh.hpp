@@ -2,11 +2,14 @@
 #define KOBRA_MESH_H_
 
 // Standard headers
+#include <string>
+#include <string_view>
 #include <vector>
 
 // Engine headers
 #include "bbox.hpp"
 #include "bvh.hpp"
+#include "pool.hpp"
 #include "transform.hpp"
 #include "vertex.hpp"
 
@@ -79,6 +82,22 @@ public:
 		return indices.size()/3;
 	}
 
+	// Bounding box in local space
+	BoundingBox bbox() const {
+		if (vertices.empty())
+			return BoundingBox {glm::vec3 {0.0f}, glm::vec3 {0.0f}};
+
+		glm::vec3 min = vertices[0].position;
+		glm::vec3 max = vertices[0].position;
+
+		for (const auto &v : vertices) {
+			min = glm::min(min, v.position);
+			max = glm::max(max, v.position);
+		}
+
+		return BoundingBox {min, max};
+	}
+
 	// Generate a BVH for this submesh
 	BVHPtr bvh(const Transform &transform) const {
 		// Generate list of bounding boxes
@@ -159,6 +178,18 @@ public:
 		return submeshes[i];
 	}
 
+	// Bounding box in local space
+	BoundingBox bbox() const {
+		if (submeshes.empty())
+			return BoundingBox {glm::vec3 {0.0f}, glm::vec3 {0.0f}};
+
+		BoundingBox box = submeshes[0].bbox();
+		for (int i = 1; i < submeshes.size(); i++)
+			box = BoundingBox::merge(box, submeshes[i].bbox());
+
+		return box;
+	}
+
 	// Generate a BVH for this mesh
 	BVHPtr bvh(const Transform &transform) const {
 		if (submeshes.size() == 1)
@@ -178,10 +209,20 @@ public:
 	// TODO: clean up and put into source file
 	static Mesh box(const glm::vec3 &, const glm::vec3 &);
 	static Mesh sphere(const glm::vec3 &, float, int = 16, int = 16);
-	static std::optional <Mesh> load(const std::string &);
+
+	// Import a model; a baked version is used instead if there is an
+	// up to date one, unless the files that the model is read from
+	// are requested (which is how the bake tool imports it)
+	static std::optional <Mesh> load(const std::string &,
+		std::vector <std::string> * = nullptr);
+
+	// Baked form: the submeshes as they are in memory, so
+	// that nothing needs to be computed again when loading
+	std::string bake() const;
+	static std::optional <Mesh> from_baked(std::string_view, const std::string &);
 };
 
-using MeshPtr = std::shared_ptr <Mesh>;
+using MeshPtr = PoolPtr <Mesh>;
 
 }
 
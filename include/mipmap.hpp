@@ -0,0 +1,55 @@
+#ifndef KOBRA_MIPMAP_H_
+#define KOBRA_MIPMAP_H_
+
+// Standard headers
+#include <cstdint>
+#include <vector>
+
+// Engine headers
+#include "enums.hpp"
+
+namespace kobra {
+
+// Mip chain generation for RGBA8 images
+//	each level is filtered from the one above it with a separable
+//	kernel (wrapping around the edges, like the samplers do); color
+//	content is filtered in linear space and encoded back to sRGB,
+//	while data (normal maps, alpha) is filtered as is
+namespace mip {
+
+enum class Filter {
+	eBox,		// 2x2 average; fastest
+	eKaiser,	// Kaiser windowed sinc; sharp, little ringing
+	eLanczos	// Lanczos 3; sharpest
+};
+
+// A level of a chain; levels are packed one after the other
+struct Level {
+	uint32_t	width;
+	uint32_t	height;
+	size_t		offset;		// bytes, from the first level
+	size_t		size;
+};
+
+// Number of levels down to 1x1
+uint32_t count(uint32_t, uint32_t);
+
+// Layout of a chain of some number of levels, for a pixel size
+// (bytes); the size of the whole chain is that of the last level
+// plus its offset
+std::vector <Level> layout(uint32_t, uint32_t, uint32_t, size_t = 4);
+
+// Full chain of an RGBA8 image; the first level is a copy
+std::vector <uint8_t> generate(const uint8_t *, uint32_t, uint32_t,
+	Filter = Filter::eKaiser, bool = true);
+
+// Whether a texture holds color (sRGB encoded) rather than data
+inline bool is_srgb(TextureRole role) {
+	return role == TextureRole::eColor;
+}
+
+}
+
+}
+
+#endif
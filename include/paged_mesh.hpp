@@ -0,0 +1,286 @@
+#ifndef KOBRA_PAGED_MESH_H_
+#define KOBRA_PAGED_MESH_H_
+
+// Standard headers
+#include <fstream>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Engine headers
+#include "bbox.hpp"
+#include "common.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+
+namespace kobra {
+
+// Out-of-core mesh, for geometry that does not fit in memory
+//	submeshes are split into spatially coherent pages (of a bounded
+//	number of triangles), which are stored in a memory mapped file.
+//	Pages are pinned while they are used; pages that are not pinned
+//	are evicted, least recently used first, once the resident pages
+//	exceed a budget. A BVH over the page bounds lets queries fault in
+//	only the pages that they touch
+class PagedMesh {
+public:
+	// File format ("KPMS"): header, pages, then the page table;
+	// pages are aligned so that they can be evicted on their own
+	static constexpr uint32_t version = 1;
+	static constexpr size_t alignment = 4096;
+
+	struct Header {
+		char		magic[4];
+		uint32_t	version;
+		uint32_t	pages;
+		uint32_t	submeshes;
+		uint64_t	vertices;
+		uint64_t	indices;
+		uint64_t	table;		// offset of the page table
+	};
+
+	static_assert(sizeof(Header) == 40, "Unexpected paged mesh header size");
+
+	// Page table entry; a page is its vertices, then its
+	// indices (relative to the first vertex of the page)
+	struct Entry {
+		float		min[3];
+		float		max[3];
+		uint32_t	submesh;
+		uint32_t	vertices;
+		uint32_t	indices;
+		uint32_t	reserved;
+		uint64_t	offset;
+	};
+
+	static_assert(sizeof(Entry) == 48, "Unexpected paged mesh entry size");
+
+	// Contents of a page, valid while it is pinned
+	struct Page {
+		BoundingBox	box;
+		uint32_t	submesh;
+
+		const Vertex	*vertices;
+		uint32_t	vertex_count;
+
+		const uint32_t	*indices;
+		uint32_t	index_count;
+	};
+
+	// Result of a ray query
+	struct Hit {
+		float		t;
+		float		u;
+		float		v;
+		uint32_t	page;
+		uint32_t	triangle;	// within the page
+		uint32_t	submesh;
+	};
+
+	struct Stats {
+		size_t	pages = 0;
+		size_t	resident = 0;
+		size_t	pinned = 0;
+		size_t	resident_bytes = 0;
+		size_t	faults = 0;
+		size_t	evictions = 0;
+	};
+
+	// Pages of a submesh have at most this many triangles by default
+	static constexpr size_t default_page_triangles = 4096;
+
+	// Writes a paged mesh a submesh at a time; the writer itself
+	// only keeps a centroid per triangle and a remap entry per vertex
+	// of the submesh that is being split
+	class Writer {
+		std::string		_path;
+		std::ofstream		_fout;
+		size_t			_triangles;
+		uint64_t		_offset = 0;
+
+		Header			_header {};
+		std::vector <Entry>	_entries;
+		bool			_good = false;
+
+		bool _page(const Vertex *, const uint32_t *,
+			const std::vector <uint32_t> &,
+			std::vector <uint32_t> &);
+		bool _pad();
+	public:
+		Writer(const std::string &, size_t = default_page_triangles);
+
+		// Split and write a submesh
+		bool add(const Submesh &);
+
+		// Same, from raw arrays (e.g. a mapped file), so that
+		// the submesh does not have to be read into memory
+		bool add(const Vertex *, size_t, const uint32_t *, size_t);
+
+		// Write the page table; the file only
+		// replaces the previous one if this succeeds
+		bool finish();
+	};
+
+	// Write a mesh that is in memory
+	static bool write(const std::string &, const Mesh &,
+		size_t = default_page_triangles);
+
+	// Pinned page; unpinned on destruction
+	class Pin {
+		PagedMesh	*_mesh = nullptr;
+		uint32_t	_index = 0;
+		Page		_page {};
+	public:
+		Pin() = default;
+		Pin(PagedMesh *mesh, uint32_t index, const Page &page)
+			: _mesh(mesh), _index(index), _page(page) {}
+
+		// Move only
+		Pin(const Pin &) = delete;
+		Pin &operator=(const Pin &) = delete;
+
+		Pin(Pin &&other) : _mesh(other._mesh), _index(other._index),
+				_page(other._page) {
+			other._mesh = nullptr;
+		}
+
+		Pin &operator=(Pin &&other) {
+			if (this != &other) {
+				reset();
+				_mesh = other._mesh;
+				_index = other._index;
+				_page = other._page;
+				other._mesh = nullptr;
+			}
+
+			return *this;
+		}
+
+		~Pin() {
+			reset();
+		}
+
+		void reset() {
+			if (_mesh)
+				_mesh->_unpin(_index);
+
+			_mesh = nullptr;
+		}
+
+		const Page &operator*() const {
+			return _page;
+		}
+
+		const Page *operator->() const {
+			return &_page;
+		}
+	};
+private:
+	struct _page {
+		BoundingBox	box;
+		Entry		entry;
+		size_t		bytes;
+
+		int		pins = 0;
+		bool		resident = false;
+
+		// Position in the LRU list (only if resident and unpinned)
+		std::list <uint32_t> ::iterator	lru;
+	};
+
+	// Flattened BVH over the pages
+	struct _node {
+		BoundingBox	box;
+		int		left = -1;
+		int		right = -1;
+		int		page = -1;
+	};
+
+	MappedFile		_file;
+	Header			_header {};
+	std::vector <_page>	_pages;
+	std::vector <_node>	_nodes;
+	BoundingBox		_box {glm::vec3 {0.0f}, glm::vec3 {0.0f}};
+
+	// Resident pages that are not pinned, most recent first
+	std::list <uint32_t>	_lru;
+	size_t			_budget;
+
+	mutable std::mutex	_mutex;
+	Stats			_stats;
+
+	Page _pin(uint32_t);
+	void _unpin(uint32_t);
+	void _evict();
+
+	int _flatten(const BVHPtr &);
+public:
+	// Open a paged mesh, with a budget for resident pages (bytes);
+	// its whole page table and indices are checked (and the mesh
+	// left invalid if they are out of range)
+	PagedMesh(const std::string &, size_t = size_t(256) << 20);
+
+	// Non-copyable (pins refer to the mesh)
+	PagedMesh(const PagedMesh &) = delete;
+	PagedMesh &operator=(const PagedMesh &) = delete;
+
+	bool valid() const {
+		return _file.valid();
+	}
+
+	// Properties
+	uint32_t pages() const {
+		return _pages.size();
+	}
+
+	uint64_t vertices() const {
+		return _header.vertices;
+	}
+
+	uint64_t indices() const {
+		return _header.indices;
+	}
+
+	const BoundingBox &bbox() const {
+		return _box;
+	}
+
+	const BoundingBox &bbox(uint32_t i) const {
+		return _pages[i].box;
+	}
+
+	// Change the budget; evicts right away if needed
+	void budget(size_t);
+
+	// Pin a page, faulting it in if needed
+	Pin pin(uint32_t);
+
+	// Pages overlapping a box
+	std::vector <uint32_t> query(const BoundingBox &) const;
+
+	// Closest triangle hit by a ray (in the space of the mesh);
+	// pages are visited front to back, and only while they
+	// may contain a closer hit
+	std::optional <Hit> raycast(const Ray &,
+		float = std::numeric_limits <float> ::max());
+
+	// Fill (device local) vertex and index buffers through a staging
+	// buffer of bounded size; pages are pinned only while they are
+	// copied into it, and the copies are submitted whenever it fills
+	// up. Indices are made relative to the start of the vertex
+	// buffer, so that the whole mesh can be drawn at once
+	void upload(const vk::raii::PhysicalDevice &,
+		const vk::raii::Device &,
+		const vk::raii::CommandPool &,
+		BufferData &, BufferData &,
+		size_t = size_t(16) << 20);
+
+	Stats stats() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef KOBRA_PARTITION_H_
+#define KOBRA_PARTITION_H_
+
+// Standard headers
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// GLM headers
+#include <glm/glm.hpp>
+
+// Engine headers
+#include "bbox.hpp"
+#include "scene.hpp"
+
+namespace kobra {
+
+// Streams a large scene in and out of the ECS by regions
+//	entities with a mesh are grouped into the cells of a uniform grid
+//	(by position); cells near the camera are loaded in the background
+//	(meshes are imported by loader threads) and added to the ECS
+//	within a time budget, and far away cells are removed, so that
+//	layers only ever see the resident cells. Everything else (cameras,
+//	lights without meshes) is always resident
+class WorldPartition {
+public:
+	struct Settings {
+		float	cell_size = 32.0f;
+
+		// Cells closer than the load radius are loaded; cells
+		// farther than the unload radius are unloaded
+		float	load_radius = 64.0f;
+		float	unload_radius = 96.0f;
+
+		// Mesh data that may be resident (bytes); the farthest
+		// cells are unloaded first when it is exceeded. Once over
+		// budget, nothing is requested until residency is below
+		// the resume fraction of it, and cells that were unloaded
+		// for the budget are only requested again once they have
+		// left the load radius
+		size_t	budget = size_t(512) << 20;
+		float	resume = 0.9f;
+
+		// Time spent adding loaded entities to the ECS, per
+		// update (milliseconds), loads in flight, and threads
+		// (not the thread pool's, whose workers frames need)
+		float	stream_budget = 2.0f;
+		size_t	max_loads = 4;
+		size_t	loaders = 2;
+	};
+
+	struct Stats {
+		size_t	cells = 0;
+		size_t	resident = 0;
+		size_t	loading = 0;
+		size_t	entities = 0;
+		size_t	resident_bytes = 0;
+		size_t	loads = 0;
+		size_t	unloads = 0;
+	};
+private:
+	enum class State {
+		eUnloaded,
+		eLoading,
+		eReady,
+		eResident
+	};
+
+	struct _cell {
+		BoundingBox			box;
+		std::vector <size_t>		entities;	// descriptions
+
+		State				state = State::eUnloaded;
+		size_t				bytes = 0;
+		float				distance = 0.0f;
+
+		// Bumped on unload, so that late results are dropped
+		uint32_t			generation = 0;
+
+		// Unloaded for the budget while in range
+		bool				evicted = false;
+
+		// Loaded descriptions, and the live entities
+		std::vector <SceneEntity>	ready;
+		std::vector <Entity>		live;
+	};
+
+	// Request for, and result of, a background load
+	struct _request {
+		size_t		cell;
+		uint32_t	generation;
+	};
+
+	struct _result {
+		size_t				cell;
+		uint32_t			generation;
+		std::vector <SceneEntity>	entities;
+		size_t				bytes;
+	};
+
+	Scene				&_scene;
+	Device				_dev;
+	Settings			_settings;
+
+	std::vector <SceneEntity>	_descriptions;
+	std::vector <_cell>		_cells;
+
+	// Cell by grid coordinates
+	std::unordered_map <int64_t, size_t>	_grid;
+
+	// Background loads; cells themselves are only
+	// touched on the thread that calls update()
+	std::vector <std::thread>	_loaders;
+	std::deque <_request>		_requests;
+	std::deque <_result>		_results;
+	std::mutex			_mutex;
+	std::condition_variable		_cv;
+	bool				_stop = false;
+
+	Stats				_stats;
+	bool				_valid = false;
+
+	// Whether requests are held back after going over budget
+	bool				_throttled = false;
+
+	void _loader();
+	void _unload(size_t, bool);
+public:
+	WorldPartition(Scene &, const Device &, const std::string &, const Settings & = {});
+
+	// Non-copyable (loaders refer to the partition)
+	WorldPartition(const WorldPartition &) = delete;
+	WorldPartition &operator=(const WorldPartition &) = delete;
+
+	// Stops the loaders (resident cells stay in the ECS)
+	~WorldPartition();
+
+	// Whether the scene could be read
+	bool valid() const {
+		return _valid;
+	}
+
+	// Load and unload cells around a position (the camera's);
+	// call once per frame, between frames (unloaded entities
+	// leave the ECS right away, which keeps their buffers until
+	// the frames in flight are done). Statistics go to the
+	// profiler as counters
+	void update(const glm::vec3 &);
+
+	Stats stats() const {
+		return _stats;
+	}
+};
+
+}
+
+#endif
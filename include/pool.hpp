@@ -0,0 +1,216 @@
+#ifndef KOBRA_POOL_H_
+#define KOBRA_POOL_H_
+
+// Standard headers
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kobra {
+
+// Allocation statistics of a pool
+struct PoolStats {
+	size_t	chunks = 0;		// Number of chunks allocated
+	size_t	capacity = 0;		// Number of slots in all chunks
+	size_t	live = 0;		// Number of live objects
+	size_t	peak = 0;		// Maximum number of live objects
+	size_t	allocations = 0;	// Total number of allocations
+	size_t	releases = 0;		// Total number of releases
+	size_t	bytes = 0;		// Bytes reserved by the chunks
+
+	std::string str() const {
+		return "chunks=" + std::to_string(chunks)
+			+ " capacity=" + std::to_string(capacity)
+			+ " live=" + std::to_string(live)
+			+ " peak=" + std::to_string(peak)
+			+ " allocations=" + std::to_string(allocations)
+			+ " releases=" + std::to_string(releases)
+			+ " bytes=" + std::to_string(bytes);
+	}
+};
+
+// Per type pool allocator: objects live in fixed size chunks, so their
+// addresses are stable and neighbouring components are close in memory
+template <class T>
+class Pool {
+public:
+	static constexpr size_t chunk_size = 64;
+private:
+	// Raw storage for a chunk of objects
+	struct _chunk {
+		alignas(T) unsigned char storage[chunk_size * sizeof(T)];
+
+		T *slot(size_t i) {
+			return reinterpret_cast <T *> (storage + i * sizeof(T));
+		}
+	};
+
+	std::vector <std::unique_ptr <_chunk>>	_chunks;
+	std::vector <T *>			_free;
+	PoolStats				_stats;
+	mutable std::mutex			_mutex;
+
+	// Allocate a new chunk and add its slots to the free list
+	void _grow() {
+		_chunks.emplace_back(new _chunk);
+
+		// Reverse order so that slots are handed out in order
+		_chunk *chunk = _chunks.back().get();
+		for (size_t i = chunk_size; i > 0; i--)
+			_free.push_back(chunk->slot(i - 1));
+
+		_stats.chunks++;
+		_stats.capacity += chunk_size;
+		_stats.bytes += sizeof(_chunk);
+	}
+public:
+	// Default constructor
+	Pool() = default;
+
+	// Non-copyable
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	// Allocate and construct an object
+	template <class ... Args>
+	T *allocate(Args && ... args) {
+		T *ptr = nullptr;
+
+		{
+			std::lock_guard <std::mutex> lock(_mutex);
+			if (_free.empty())
+				_grow();
+
+			ptr = _free.back();
+			_free.pop_back();
+		}
+
+		try {
+			new (ptr) T(std::forward <Args> (args)...);
+		} catch (...) {
+			std::lock_guard <std::mutex> lock(_mutex);
+			_free.push_back(ptr);
+			throw;
+		}
+
+		std::lock_guard <std::mutex> lock(_mutex);
+		_stats.live++;
+		_stats.allocations++;
+		_stats.peak = std::max(_stats.peak, _stats.live);
+
+		return ptr;
+	}
+
+	// Destroy an object and return its slot
+	void release(T *ptr) {
+		ptr->~T();
+
+		std::lock_guard <std::mutex> lock(_mutex);
+		_free.push_back(ptr);
+
+		_stats.live--;
+		_stats.releases++;
+	}
+
+	// Allocation statistics
+	PoolStats stats() const {
+		std::lock_guard <std::mutex> lock(_mutex);
+		return _stats;
+	}
+
+	// Singleton
+	static Pool &one() {
+		static Pool pool;
+		return pool;
+	}
+};
+
+// Owning handle to a pooled object; move-only, so there is
+// no reference count to maintain
+template <class T>
+class PoolPtr {
+	T *_ptr = nullptr;
+public:
+	// Constructors
+	PoolPtr() = default;
+	PoolPtr(std::nullptr_t) {}
+
+	explicit PoolPtr(T *ptr) : _ptr(ptr) {}
+
+	// Move only
+	PoolPtr(const PoolPtr &) = delete;
+	PoolPtr &operator=(const PoolPtr &) = delete;
+
+	PoolPtr(PoolPtr &&other) noexcept : _ptr(other._ptr) {
+		other._ptr = nullptr;
+	}
+
+	PoolPtr &operator=(PoolPtr &&other) noexcept {
+		if (this != &other) {
+			reset();
+			_ptr = other._ptr;
+			other._ptr = nullptr;
+		}
+
+		return *this;
+	}
+
+	PoolPtr &operator=(std::nullptr_t) {
+		reset();
+		return *this;
+	}
+
+	// Destructor
+	~PoolPtr() {
+		reset();
+	}
+
+	// Release the object back to its pool
+	void reset() {
+		if (_ptr)
+			Pool <T> ::one().release(_ptr);
+
+		_ptr = nullptr;
+	}
+
+	// Access
+	T *get() const {
+		return _ptr;
+	}
+
+	T &operator*() const {
+		return *_ptr;
+	}
+
+	T *operator->() const {
+		return _ptr;
+	}
+
+	explicit operator bool() const {
+		return _ptr != nullptr;
+	}
+
+	bool operator==(std::nullptr_t) const {
+		return _ptr == nullptr;
+	}
+
+	bool operator!=(std::nullptr_t) const {
+		return _ptr != nullptr;
+	}
+};
+
+// Allocate an object from its pool
+template <class T, class ... Args>
+PoolPtr <T> make_pooled(Args && ... args)
+{
+	return PoolPtr <T> (Pool <T> ::one().allocate(std::forward <Args> (args)...));
+}
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 // Standard headers
 #include <cmath>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <stack>
@@ -43,8 +44,11 @@ private:
 
 	Timer::time_point	_start;
 
+	// Latest values of counters, by name
+	std::map <std::string, double>	_counters;
+
 	// Mutex
-	std::mutex		_mutex;
+	mutable std::mutex	_mutex;
 public:
 	// Constructor
 	Profiler() {
@@ -87,6 +91,33 @@ public:
 		_mutex.unlock();
 	}
 
+	// Record a frame that was timed elsewhere (e.g. on another
+	// thread) as a child of the current frame
+	void record(const std::string &name, double time) {
+		Frame frame {name, _timer.now()};
+		frame.time = time;
+
+		_mutex.lock();
+		if (_stack.empty())
+			_frames.push(frame);
+		else
+			_stack.top().children.push_back(frame);
+		_mutex.unlock();
+	}
+
+	// Set a counter (e.g. of resident bytes); only the
+	// latest value of each counter is kept
+	void counter(const std::string &name, double value) {
+		_mutex.lock();
+		_counters[name] = value;
+		_mutex.unlock();
+	}
+
+	std::map <std::string, double> counters() const {
+		std::lock_guard <std::mutex> lock(_mutex);
+		return _counters;
+	}
+
 	// Return front of queue
 	Frame pop() {
 		Frame frame = _frames.front();
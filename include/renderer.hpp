@@ -6,6 +6,7 @@
 #include "enums.hpp"
 #include "material.hpp"
 #include "mesh.hpp"
+#include "pool.hpp"
 
 namespace kobra {
 
@@ -29,11 +30,21 @@ struct Renderer {
 };
 
 // Rasterizer component
-// 	the entity must have a Mesh component
+// 	the vertex and index buffers are a copy of the Mesh component of
+// 	the entity, which layers create when they first need it (and may
+// 	evict again); the mesh is looked up through the entity each time,
+// 	so that replacing the Mesh component does not leave the rasterizer
+// 	referring to the old one
 class Rasterizer : public Renderer {
+	Device		_dev;
+
+	// Buffers, created on demand
 	BufferData	vertex_buffer = nullptr;
 	BufferData	index_buffer = nullptr;
 	size_t		indices = 0;
+	size_t		_bytes = 0;
+	bool		_resident = false;
+	bool		_prefetch = false;
 public:
 	// Raster mode
 	RasterMode mode = RasterMode::eAlbedo;
@@ -41,18 +52,49 @@ public:
 	// No default constructor
 	Rasterizer() = delete;
 
-	// Constructor initializes the buffers
-	Rasterizer(const Device &, const Mesh &, Material *);
-
-	// Bind resources to a descriptor set
+	// Constructor creates no buffers
+	Rasterizer(const Device &, Material *);
+
+	// Whether the buffers exist
+	bool resident() const {
+		return _resident;
+	}
+
+	// Size of the buffers, once created
+	size_t bytes() const {
+		return _bytes;
+	}
+
+	// Size of the buffers for a mesh
+	static size_t bytes(const Mesh &mesh) {
+		return size_t(mesh.vertices()) * sizeof(Vertex)
+			+ size_t(mesh.indices()) * sizeof(uint32_t);
+	}
+
+	// Hint that the buffers will be needed soon; layers
+	// create them along with those of visible entities
+	void prefetch() {
+		_prefetch = true;
+	}
+
+	bool prefetching() const {
+		return _prefetch && !_resident;
+	}
+
+	// Create the buffers from the mesh of the entity, or release
+	// them; releasing is only safe once no frame in flight
+	// refers to them
+	void upload(const Mesh &);
+	void evict();
+
+	// Bind vertex and index buffers
 	void bind_buffers(const vk::raii::CommandBuffer &) const;
-	void bind_material(const Device &, const vk::raii::DescriptorSet &) const;
 
 	// Friends
 	friend class layers::Raster;
 };
 
-using RasterizerPtr = std::shared_ptr <Rasterizer>;
+using RasterizerPtr = PoolPtr <Rasterizer>;
 
 // Raytracer component
 // 	Wrapper around methods for raytracing
@@ -66,9 +108,13 @@ class Raytracer : public Renderer {
 		float shininess;
 		float roughness;
 		float refraction;
-		int albedo;
+		int albedo;	// slots in the texture table, or -1
 		int normal;
 		int type;
+
+		// Regions of the textures in their images (atlases)
+		alignas(16) glm::vec4 albedo_region;
+		alignas(16) glm::vec4 normal_region;
 	};
 
 	struct HostBuffers {
@@ -83,9 +129,6 @@ class Raytracer : public Renderer {
 
 		std::vector <aligned_mat4>	transforms;
 
-		std::vector <vk::DescriptorImageInfo> &albedo_textures;
-		std::vector <vk::DescriptorImageInfo> &normal_textures;
-
 		int id;
 	};
 
@@ -108,7 +151,7 @@ public:
 	friend class layers::Raytracer;
 };
 
-using RaytracerPtr = std::shared_ptr <Raytracer>;
+using RaytracerPtr = PoolPtr <Raytracer>;
 
 }
 
@@ -0,0 +1,54 @@
+#ifndef KOBRA_SAMPLER_CACHE_H_
+#define KOBRA_SAMPLER_CACHE_H_
+
+// Standard headers
+#include <array>
+#include <map>
+#include <mutex>
+
+// Engine headers
+#include "backend.hpp"
+
+namespace kobra {
+
+// Sampler objects, shared by everything that samples with the same
+// state (filters, address modes, anisotropy, LOD range and so on);
+// devices limit how many samplers may exist at once, as few as 4000,
+// which textures and glyphs would otherwise run out of. Samplers live
+// as long as the cache, so references to them stay valid
+class SamplerCache {
+public:
+	struct Stats {
+		size_t		samplers = 0;	// distinct sampler objects
+		size_t		requests = 0;	// lookups, shared or not
+		uint32_t	limit = 0;	// maxSamplerAllocationCount
+	};
+
+	// Samplers beyond this many are logged, as a
+	// quarter of the smallest limit a device may have
+	static constexpr size_t warn_at = 1000;
+private:
+	// Generic device map
+	template <class T>
+	using DeviceMap = std::map <vk::Device, T>;
+
+	// Every field of the create info, floats by their bits;
+	// chained structures (pNext) are not supported
+	using Key = std::array <uint32_t, 15>;
+
+	static Key _key(const vk::SamplerCreateInfo &);
+
+	static DeviceMap <std::map <Key, vk::raii::Sampler>>	_samplers;
+	static DeviceMap <Stats>				_stats;
+	static std::mutex					_mutex;
+public:
+	// Sampler with some state, created on first use
+	static const vk::raii::Sampler &get(const vk::raii::Device &, const vk::SamplerCreateInfo &);
+
+	// Counts of a device, with its limit
+	static Stats stats(const vk::raii::PhysicalDevice &, const vk::raii::Device &);
+};
+
+}
+
+#endif
@@ -2,7 +2,13 @@
 #define KOBRA_SCENE_H_
 
 // Standard headers
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
+#include <unordered_map>
 
 // Engine headers
 #include "backend.hpp"
@@ -10,6 +16,72 @@
 
 namespace kobra {
 
+// Description of an entity as it is stored in a scene file; it holds
+// no GPU resources, so it can be produced away from the main thread
+struct SceneEntity {
+	std::string			name;
+	Transform			transform;
+
+	std::optional <Material>	material;
+	std::optional <Mesh>		mesh;
+	std::string			mesh_source;
+	std::optional <RasterMode>	rasterizer;
+	bool				raytracer = false;
+	std::optional <Light>		light;
+	std::optional <Camera>		camera;
+
+	// Inline geometry of a snapshot (see Scene::describe), shared
+	// with later snapshots instead of copied for each of them
+	std::shared_ptr <const Mesh>	shared_mesh;
+
+	// Geometry to write, if any; meshes with a source
+	// are written as their source alone
+	const Mesh *geometry() const {
+		return mesh ? &*mesh : shared_mesh.get();
+	}
+
+	bool has_mesh() const {
+		return geometry() || !mesh_source.empty();
+	}
+};
+
+// Names of the rasterizer modes and light types, as in the text format
+inline const std::array <std::string, 4> rasterizer_modes {
+	"Phong",
+	"Normal",
+	"Albedo",
+	"Wireframe"
+};
+
+inline const std::array <std::string, 4> light_types {
+	"Point",
+	"Spot",
+	"Directional",
+	"Area"
+};
+
+// Progress of an asynchronous load
+struct SceneProgress {
+	size_t	bytes_read = 0;
+	size_t	bytes_total = 0;
+	size_t	entities_parsed = 0;
+	size_t	entities_loaded = 0;
+	bool	done = false;
+	bool	cancelled = false;
+
+	// Fraction of the file that has been read and instantiated
+	float fraction() const {
+		if (bytes_total == 0)
+			return done ? 1.0f : 0.0f;
+
+		float read = float(bytes_read)/float(bytes_total);
+		if (entities_parsed == 0)
+			return read;
+
+		return read * float(entities_loaded)/float(entities_parsed);
+	}
+};
+
 // Scene class
 struct Scene {
 	ECS ecs;
@@ -17,9 +89,115 @@ struct Scene {
 	// Other scene-local data
 	std::string p_environment_map;
 
-	// Saving and loading
+	// Constructors
+	Scene();
+
+	// Non-copyable (the ECS owns its components)
+	Scene(const Scene &) = delete;
+	Scene &operator=(const Scene &) = delete;
+
+	// Destructor (cancels any load in progress, and stops watching)
+	~Scene();
+
+	// Saving and loading; paths ending in .kobrab
+	// use the binary format, others the text format
 	void save(const std::string &);
 	void load(const Device &, const std::string &);
+
+	// Binary format
+	void save_binary(const std::string &);
+	void load_binary(const Device &, const std::string &);
+
+	// Non-blocking save: a snapshot of the components is taken on the
+	// calling thread (call it between frames), then serialized and
+	// written on a worker thread; the file is replaced atomically once
+	// it has been written. In incremental mode, only the entities that
+	// changed since the last save to the same path are serialized again
+	// (text format only)
+	void save_async(const std::string &, bool = true);
+	bool saving() const;
+	void wait_save();
+
+	// Description of an entity currently in the ECS; meshes with a
+	// source are described by it alone, and inline geometry is only
+	// copied again once it has changed
+	SceneEntity describe(int) const;
+
+	// Whether a path refers to a binary scene
+	static bool is_binary(const std::string &path) {
+		static const std::string ext = ".kobrab";
+		return path.size() >= ext.size()
+			&& path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+	}
+
+	// Convert between the text and binary formats (the formats
+	// are deduced from the paths); on the host alone, as meshes
+	// with a source file are written as their source
+	static bool convert(const std::string &, const std::string &);
+
+	// Asynchronous loading: a background thread parses the file and
+	// imports the meshes, while stream() adds the entities that are
+	// ready to the ECS, within a time budget (in milliseconds)
+	void load_async(const Device &, const std::string &);
+	void stream(float = 4.0f);
+	void cancel();
+
+	bool loading() const;
+	SceneProgress progress() const;
+
+	// Hot reloading: a background thread watches the scene file and
+	// the assets it references, and reads the scene again when they
+	// change. reload() applies the differences to the ECS (call it
+	// between frames): entities are matched by name, and only the
+	// components that changed in the file are written, so that layers
+	// keep whatever state did not change. Only modified meshes are
+	// imported again, and modified textures are reloaded in place
+	void watch(const Device &, const std::string &);
+	void unwatch();
+	bool watching() const;
+	bool reload();
+
+	// Add a described entity to the ECS
+	Entity instantiate(const Device &, SceneEntity &&);
+
+	// Read the entity descriptions of a scene file, in order; the
+	// callback returns false to stop early. The number of bytes read
+	// so far is reported through the counter, if any. Without imports,
+	// meshes with a source file are only described by mesh_source
+	using Emit = std::function <bool (SceneEntity &&)>;
+
+	static bool parse(const std::string &, std::string &, const Emit &,
+		std::atomic <size_t> * = nullptr, bool = true);
+	static bool parse_binary(const std::string &, std::string &, const Emit &,
+		std::atomic <size_t> * = nullptr, bool = true);
+
+	// Contents of a text or binary scene file
+	static std::string write_text(const std::string &, const std::vector <SceneEntity> &);
+	static std::string write_binary(const std::string &, const std::vector <SceneEntity> &);
+private:
+	// State of an asynchronous load
+	struct _loader;
+
+	std::unique_ptr <_loader> _async;
+
+	// State of asynchronous saves
+	struct _saver;
+
+	std::unique_ptr <_saver> _save_state;
+
+	// Inline geometry of the last descriptions, by entity slot
+	struct _mesh_snapshot {
+		uint32_t			generation = 0;
+		uint64_t			version = 0;
+		std::shared_ptr <const Mesh>	mesh;
+	};
+
+	mutable std::unordered_map <int32_t, _mesh_snapshot> _mesh_snapshots;
+
+	// State of the file watcher
+	struct _watcher;
+
+	std::unique_ptr <_watcher> _watch_state;
 };
 
 }
@@ -0,0 +1,147 @@
+#ifndef KOBRA_SCHEDULER_H_
+#define KOBRA_SCHEDULER_H_
+
+// Standard headers
+#include <bitset>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Engine headers
+#include "ecs.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+
+namespace kobra {
+
+// Component access declarations for systems
+template <class ... Ts>
+struct Reads {};
+
+template <class ... Ts>
+struct Writes {};
+
+// Schedules systems over an ECS: systems declare which components they
+// read and write, and those that do not conflict run in parallel. Systems
+// that conflict run in the order they were added, so results do not
+// depend on the timing of the workers. Systems that share data outside
+// of the ECS (e.g. one fills what another reads) name the systems they
+// must come after.
+//
+// NOTE: systems must not create or destroy entities
+class Scheduler {
+public:
+	using Mask = std::bitset <component_count>;
+
+	// What a system may do with the ECS: read anything through the
+	// const ECS (which marks nothing as changed), and get mutable
+	// access only to the components that it declared as written; so
+	// systems that run at the same time never stamp the same versions
+	class Access {
+		ECS		*_ecs;
+		const ECS	*_cecs;
+		Mask		_writes;
+	public:
+		Access(ECS *ecs, const ECS *cecs, const Mask &writes)
+			: _ecs(ecs), _cecs(cecs), _writes(writes) {}
+
+		const ECS &ecs() const {
+			return *_cecs;
+		}
+
+		template <class T>
+		T &write(int i) {
+			KOBRA_ASSERT(_ecs && _writes.test(component_index <T> ()),
+				"System does not write " + component_string <T> ());
+			return _ecs->get <T> (i);
+		}
+	};
+
+	using Run = std::function <void (Access &)>;
+
+	struct System {
+		std::string			name;
+		Mask				reads;
+		Mask				writes;
+		std::vector <std::string>	after;
+		Run				run;
+	};
+private:
+	// Component masks from access declarations
+	template <class>
+	struct _access;
+
+	template <template <class ...> class L, class ... Ts>
+	struct _access <L <Ts ...>> {
+		static Mask mask() {
+			Mask m;
+			(m.set(component_index <Ts> ()), ...);
+			return m;
+		}
+	};
+
+	std::vector <System>			_systems;
+	ThreadPool				*_pool = nullptr;
+
+	// Dependency graph (edges from earlier to later systems)
+	std::vector <std::vector <size_t>>	_dependents;
+	std::vector <size_t>			_dependencies;
+	bool					_dirty = true;
+
+	// Timings of the last run (in microseconds)
+	std::vector <double>			_timings;
+
+	void _build_graph();
+	void _run(ECS *, const ECS &, Profiler *);
+public:
+	// Constructor
+	Scheduler(ThreadPool &pool = ThreadPool::one()) : _pool(&pool) {}
+
+	// Add a system, e.g.
+	//	add <Reads <Transform>, Writes <Light>> ("lights", ftn)
+	// systems named in after must have been added before
+	template <class R, class W>
+	void add(const std::string &name, const Run &run,
+			const std::vector <std::string> &after = {}) {
+		_systems.push_back(System {
+			name,
+			_access <R> ::mask(),
+			_access <W> ::mask(),
+			after,
+			run
+		});
+
+		_dirty = true;
+	}
+
+	// Whether two systems cannot run at the same time
+	static bool conflict(const System &a, const System &b) {
+		return (a.writes & (b.reads | b.writes)).any()
+			|| (b.writes & a.reads).any();
+	}
+
+	// Run all systems; timings are recorded into the
+	// profiler (if any) in the order the systems were added
+	void run(ECS &ecs, Profiler *profiler = nullptr) {
+		_run(&ecs, ecs, profiler);
+	}
+
+	// Run systems that only read
+	void run(const ECS &ecs, Profiler *profiler = nullptr) {
+		_run(nullptr, ecs, profiler);
+	}
+
+	// Timings of the last run
+	const std::vector <double> &timings() const {
+		return _timings;
+	}
+
+	// Systems
+	const std::vector <System> &systems() const {
+		return _systems;
+	}
+};
+
+}
+
+#endif
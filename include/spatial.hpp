@@ -0,0 +1,165 @@
+#ifndef KOBRA_SPATIAL_H_
+#define KOBRA_SPATIAL_H_
+
+// Standard headers
+#include <limits>
+#include <vector>
+
+// GLM headers
+#include <glm/glm.hpp>
+
+// Engine headers
+#include "bbox.hpp"
+#include "common.hpp"
+#include "ecs.hpp"
+
+namespace kobra {
+
+// View frustum, as six planes (ax + by + cz + d >= 0 inside)
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// Extract the planes from a view-projection matrix
+	static Frustum from(const glm::mat4 &);
+
+	// Whether a box is (at least partially) inside
+	bool intersects(const BoundingBox &) const;
+};
+
+// Spatial index over the entities of an ECS: a dynamic AABB tree whose
+// leaves are the world space bounds of the entities (mesh bounds under the
+// transform, or the position for entities without a mesh). Leaves store
+// fattened bounds, so that small movements do not restructure the tree.
+//
+// Queries return dense entity indices, which are valid until entities are
+// created or destroyed (i.e. until the next update after such a change).
+class SpatialIndex {
+public:
+	// Result of a ray query
+	struct Hit {
+		int	index;
+		float	t;
+	};
+
+	// Fattening of leaf bounds, relative to their extent
+	static constexpr float fat_ratio = 0.1f;
+	static constexpr float fat_min = 0.05f;
+private:
+	// Tree node
+	struct _node {
+		BoundingBox	box;		// Fattened for leaves
+		BoundingBox	tight;		// Exact bounds (leaves only)
+		BoundingBox	local;		// Mesh bounds (leaves only)
+		bool		has_mesh = false;
+
+		int		parent = -1;
+		int		left = -1;
+		int		right = -1;
+		int		height = 0;
+
+		// Entity
+		int32_t		slot = -1;
+		uint32_t	generation = 0;
+		int		index = -1;
+		uint64_t	stamp = 0;
+
+		bool leaf() const {
+			return left == -1;
+		}
+	};
+
+	std::vector <_node>	_nodes;
+	std::vector <int>	_free;
+	int			_root = -1;
+
+	// Entity slot --> leaf node (-1 if none)
+	std::vector <int>	_leaves;
+	size_t			_count = 0;
+
+	// Last ECS version that was consumed
+	uint64_t		_version = 0;
+	uint64_t		_stamp = 0;
+	bool			_initialized = false;
+
+	// Node management
+	int _allocate();
+	void _release(int);
+
+	// Tree operations
+	void _insert(int);
+	void _remove(int);
+	void _move(int, const BoundingBox &);
+	int _balance(int);
+	void _refit(int);
+
+	// World space bounds of a leaf
+	static BoundingBox _bounds(const _node &, const Transform &);
+	static BoundingBox _fatten(const BoundingBox &);
+
+	// Generic traversal: visits leaves whose bounds pass the test
+	template <class Test, class Visit>
+	void _traverse(const Test &test, const Visit &visit) const {
+		if (_root == -1)
+			return;
+
+		std::vector <int> stack {_root};
+		while (!stack.empty()) {
+			int i = stack.back();
+			stack.pop_back();
+
+			const _node &node = _nodes[i];
+			if (!test(node.box))
+				continue;
+
+			if (node.leaf()) {
+				if (test(node.tight))
+					visit(node);
+			} else {
+				stack.push_back(node.left);
+				stack.push_back(node.right);
+			}
+		}
+	}
+public:
+	// Default constructor
+	SpatialIndex() = default;
+
+	// Bring the index up to date with the ECS; only entities
+	// whose transform or mesh have changed are revisited
+	void update(const ECS &);
+
+	// Remove everything
+	void clear();
+
+	// Entities overlapping a box
+	std::vector <int> query(const BoundingBox &) const;
+
+	// Entities (partially) inside a frustum
+	std::vector <int> query(const Frustum &) const;
+
+	// Entities overlapping a sphere
+	std::vector <int> query(const glm::vec3 &, float) const;
+
+	// Entities hit by a ray, sorted by distance along the ray
+	std::vector <Hit> raycast(const Ray &,
+		float = std::numeric_limits <float> ::max()) const;
+
+	// The k entities closest to a point, closest first
+	std::vector <int> nearest(const glm::vec3 &, int) const;
+
+	// World space bounds of an entity's mesh; false if it
+	// has no mesh, or is not indexed (yet)
+	bool bounds(const Entity &, BoundingBox &) const;
+
+	// Number of indexed entities
+	size_t size() const;
+
+	// Height of the tree
+	int height() const {
+		return (_root == -1) ? 0 : _nodes[_root].height;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef KOBRA_TEXTURE_CONTAINER_H_
+#define KOBRA_TEXTURE_CONTAINER_H_
+
+// Standard headers
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Vulkan headers
+#include <vulkan/vulkan.hpp>
+
+// Engine headers
+#include "mipmap.hpp"
+
+namespace kobra {
+
+// KTX2 and DDS texture containers
+//	only the headers are parsed; the levels are described by their
+//	offsets in the file, so that they can be copied straight from a
+//	mapping into a staging buffer. Only 2D textures are supported (no
+//	arrays, cubemaps or volumes), and KTX2 files must not be
+//	supercompressed
+namespace container {
+
+struct Texture {
+	vk::Format			format = vk::Format::eUndefined;
+	uint32_t			width = 0;
+	uint32_t			height = 0;
+	bool				top_down = true;	// first row is the top one
+	std::vector <mip::Level>	levels;			// offsets are in the file
+};
+
+// Whether a file is a container, from its extension
+bool is_container(const std::string &);
+
+// Parse a container; false (and logs) if it is malformed or unsupported
+bool parse_ktx2(const char *, size_t, Texture &);
+bool parse_dds(const char *, size_t, Texture &);
+bool parse(const std::string &, const char *, size_t, Texture &);
+
+}
+
+}
+
+#endif
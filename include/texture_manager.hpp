@@ -2,39 +2,224 @@
 #define KOBRA_TEXTURE_MANAGER_H_
 
 // Standard headers
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 // Engine headers
 #include "backend.hpp"
+#include "sampler_cache.hpp"
 
 namespace kobra {
 
 // Caches all loaded textures , globally
-// TODO: later also allow multihreaded loading
 // TODO: remove this class, and put everything in the shared namespace
 class TextureManager {
-	// TODO: parallel processing with multiple command pools
+public:
+	// Memory budget for textures; only textures unused for at least
+	// evict_after frames are evicted (least recently used first) to
+	// stay within it, and they are loaded again on their next use
+	struct Budget {
+		size_t		bytes = size_t(2) << 30;
+		uint64_t	evict_after = 300;
+	};
+
+	// Streaming of mip levels: textures are first uploaded from the
+	// level that fits in initial texels, and finer levels follow (at
+	// most batch bytes per frame) as they are requested. Images only
+	// hold the levels that were streamed, and are made again with the
+	// finer ones. Decoded levels that wait on the host are dropped
+	// once none was requested for drop_after frames, and decoded
+	// again on the next request (levels of mapped files are kept)
+	struct Streaming {
+		bool		enabled = true;
+		uint32_t	initial = 128;
+		size_t		batch = size_t(32) << 20;
+		uint64_t	drop_after = 600;
+	};
 
+	struct Stats {
+		size_t		resident = 0;
+		size_t		bytes = 0;
+		size_t		evictions = 0;
+		size_t		reloads = 0;
+		size_t		streaming = 0;	// textures with levels to stream
+		size_t		streamed = 0;	// bytes of streamed levels
+		size_t		duplicates = 0;	// paths sharing another's image
+		size_t		saved = 0;	// bytes they did not upload
+	};
+private:
 	// Generic device map
 	template <class T>
 	using DeviceMap = std::map <vk::Device, T>;
 
-	// Map of image path --> image index
+	// Map of image path --> image index; paths to files with the
+	// same contents have the same index
 	using ImageMap = std::unordered_map <std::string, size_t>;
 
-	// Map of image path --> image sampler
-	using SamplerMap = std::map <std::string, vk::raii::Sampler>;
+	// Map of content hash --> image index
+	using ContentMap = std::unordered_map <uint64_t, size_t>;
 
-	// Per device maps
+	// Per device maps; images are in a deque so that
+	// references to them survive later insertions
 	static DeviceMap <vk::raii::CommandPool>	_command_pools;
 	static DeviceMap <ImageMap>			_image_map;
-	static DeviceMap <std::vector <ImageData>>	_images;
-	static DeviceMap <SamplerMap>			_samplers;
+	static DeviceMap <ContentMap>			_content_map;
+	static DeviceMap <std::deque <ImageData>>	_images;
 	static DeviceMap <std::mutex>			_mutexes;
 
+	// Size, last frame of use and generation of each image (indexed
+	// like the images); generations are unique per upload (including
+	// streamed levels), and zero for images that are evicted
+	struct _residence {
+		size_t		bytes = 0;
+		uint64_t	frame = 0;
+		uint64_t	generation = 0;
+		uint32_t	base = 0;	// finest level on the GPU
+		uint32_t	wanted = ~0u;	// finest level requested this frame
+		uint64_t	content = 0;	// hash of the file (and role)
+		size_t		paths = 0;	// paths that refer to the image
+		TextureRole	role = TextureRole::eColor;
+
+		// Streamed textures: the file, the size of the finest level
+		// and the number of levels, and the last frame in which a
+		// level finer than the base was requested
+		std::string	source;
+		uint32_t	extent = 0;
+		uint32_t	levels = 0;
+		uint64_t	refined = 0;
+	};
+
+	static DeviceMap <std::deque <_residence>>	_residences;
+	static DeviceMap <uint64_t>			_frames;
+	static DeviceMap <uint64_t>			_generations;
+	static DeviceMap <uint64_t>			_slot_versions;
+	static DeviceMap <Stats>			_stats;
+
+	// Images that were evicted or replaced, kept alive
+	// until the frames that may still refer to them are done
+	struct _garbage {
+		std::vector <ImageData>		images;
+	};
+
+	static DeviceMap <std::deque <_garbage>>	_retired;
+
+	// Pixels of the levels that are not on the GPU yet, by image
+	static DeviceMap <std::unordered_map <size_t, TexturePixels>>
+							_streams;
+
+	// Pixels that were dropped, being decoded again on a streaming
+	// thread; they are picked up by the first frame after they are done
+	struct _decode {
+		std::atomic <bool>	done = false;
+		bool			loaded = false;
+		uint64_t		content = 0;
+		TexturePixels		pixels;
+	};
+
+	static DeviceMap <std::unordered_map <size_t, std::shared_ptr <_decode>>>
+							_decodes;
+
+	// Levels being streamed, at most one batch at a time, each into
+	// a new image that replaces the old one once the batch is done;
+	// the batch is checked (not waited for) every frame
+	struct _stream_batch {
+		struct Upload {
+			size_t		index;
+			uint64_t	generation;
+			uint32_t	base;
+			size_t		bytes;
+			ImageData	image;
+		};
+
+		std::vector <Upload>		uploads;
+		vk::raii::CommandBuffer		cmd = nullptr;
+		vk::raii::Fence			fence = nullptr;
+	};
+
+	static DeviceMap <_stream_batch>		_stream_batches;
+	static DeviceMap <BufferData>			_stream_staging;
+
+	// Staging memory, reused by every batch; uploads (and the
+	// command pool) are guarded by their own lock, so that cached
+	// textures can be looked up while a batch is in flight
+	static DeviceMap <BufferData>			_staging;
+	static DeviceMap <std::mutex>			_upload_mutexes;
+
+	// Keep an image alive until no frame in flight can use it
+	// (the caller holds the device lock)
+	static _garbage &_garbage_bin(const vk::Device &dev) {
+		auto &retired = _retired[dev];
+		if (retired.empty())
+			retired.emplace_back();
+
+		return retired.back();
+	}
+
+	static void _retire(const vk::Device &dev, ImageData &&image) {
+		_garbage_bin(dev).images.emplace_back(std::move(image));
+	}
+
+	// Texture table of a device, with a copy per frame in flight;
+	// writes are queued for every copy, and applied to a copy when
+	// the frame that records with it opens it (the frame that used
+	// it last is done by then). The open copy is written right away
+	struct _table {
+		vk::raii::DescriptorPool		pool = nullptr;
+		vk::raii::DescriptorSetLayout		layout = nullptr;
+		std::vector <vk::raii::DescriptorSet>	sets;
+		std::vector <std::set <size_t>>		dirty;
+		uint32_t				capacity = 0;
+		uint32_t				current = 0;
+		bool					open = false;
+	};
+
+	static DeviceMap <_table>			_tables;
+
+	// Table of a device, created on first use
+	static _table &_get_table
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &);
+
+	// Queue the slot of an image to be written, and apply the
+	// queued writes of a copy (the caller holds the device lock)
+	static void _write_slot(const vk::raii::Device &, size_t);
+	static void _flush_table(const vk::raii::Device &, uint32_t);
+
+	// Staging memory of at least some size, grown geometrically so
+	// that a few large batches do not each reallocate (the caller
+	// holds the upload lock)
+	static BufferData &_staging_buffer
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &,
+			DeviceMap <BufferData> &,
+			vk::DeviceSize);
+
+	// Finish the batch of streamed levels if it is done, and
+	// start another one for the levels that are requested; also
+	// drops idle pixels, and decodes dropped ones on request
+	static void _stream_levels
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &);
+
+	// Textures packed into atlases are stored (and sampled) as their
+	// sheets; paths are resolved once, for every device
+	struct _alias {
+		std::string	key;
+		glm::vec4	transform {1, 1, 0, 0};
+	};
+
+	static std::unordered_map <std::string, _alias>	_aliases;
+	static std::mutex					_alias_mutex;
+
+	static _alias _resolve(const std::string &);
+
 	// Create a new command pool for the given device if it doesn't exist yet
 	static vk::raii::CommandPool &get_command_pool
 			(const vk::raii::PhysicalDevice &phdev,
@@ -52,14 +237,126 @@ class TextureManager {
 
 		return _command_pools.at(*dev);
 	}
+
+	// Image of a texture, from its base level; the pixels are
+	// kept if finer levels are still to be streamed
+	struct _texture {
+		ImageData	image = nullptr;
+		uint32_t	base = 0;
+		TexturePixels	pixels;
+	};
+
+	// Create the images for a batch of textures: decodes in parallel,
+	// then uploads everything with a single submission; images of
+	// textures that failed to load are null
+	static std::vector <_texture> _make_textures
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &,
+			const std::vector <std::string> &,
+			const std::vector <TextureRole> &);
+
+	// Place a new texture, with the hash of its contents (the
+	// caller holds the device lock)
+	static void _place(const vk::raii::Device &, size_t, uint64_t, _texture &&);
+
+	// Refer to an image from another path, whose file has the same
+	// contents (the caller holds the device lock)
+	static void _share(const vk::Device &, const std::string &, size_t);
 public:
-	// Load a texture
+	// Compression of textures that are loaded from now on
+	static TextureCompression compression;
+
+	// Texture memory budget and streaming (for every device)
+	static Budget budget;
+	static Streaming streaming;
+
+	static Stats stats(const vk::raii::Device &dev) {
+		std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+		return _stats[*dev];
+	}
+
+	// Advance a frame (after it was submitted); streams requested
+	// levels, evicts textures when over budget, and releases the
+	// images that no frame in flight can refer to anymore
+	static void frame(const vk::raii::PhysicalDevice &, const vk::raii::Device &);
+
+	// Request the levels of a texture needed for a footprint of some
+	// number of pixels on screen (across); requests last a frame
+	static void request(const vk::raii::Device &, const std::string &, float);
+
+	// Region of a texture in its image (scale in xy, offset in zw);
+	// the whole image, unless the texture was packed into an atlas
+	static glm::vec4 region(const std::string &path) {
+		return _resolve(path).transform;
+	}
+
+	// Mark a texture as used in the current frame; returns the
+	// generation of its image (zero if it is not loaded, or was
+	// evicted), so that descriptors written with an older
+	// generation can be written again
+	static uint64_t use(const vk::raii::Device &, const std::string &);
+
+	// Bindless texture table: a single array of combined image
+	// samplers (set 1, binding 0 of the layers that sample textures)
+	// in which every image has a slot, its index. Materials refer to
+	// textures by slot, and the table follows loads, replacements,
+	// evictions and streamed levels by itself; at most table_size
+	// slots, fewer if the device cannot index as many
+	static constexpr uint32_t table_size = 1u << 16;
+
+	static const vk::raii::DescriptorSetLayout &table_layout
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &);
+
+	// Copy of the table for the frame being recorded (the fence of
+	// its last use must have been waited for), bound once per frame
+	static const vk::raii::DescriptorSet &table
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &);
+
+	// Version of the slots of paths; it only changes when a path
+	// moves to another slot, so slots (and regions, which never
+	// change) can be kept by callers until it does
+	static uint64_t slot_version(const vk::raii::Device &dev) {
+		std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+		return _slot_versions[*dev];
+	}
+
+	// Slot of a texture in the table, loading it if needed (-1 if
+	// the table is full); a path keeps its slot, unless it is
+	// reloaded while others share its image
+	static int slot(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &,
+			const std::string &,
+			TextureRole = TextureRole::eColor);
+
+	// Load a texture; its role in the material decides how it is
+	// filtered and compressed, and only matters for its first load
 	static const ImageData &load_texture
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &,
+			const std::string &,
+			TextureRole = TextureRole::eColor);
+
+	// Load a batch of textures (those that are not cached yet), with
+	// their roles (color if there are none); the cache only sees
+	// them once the whole batch is on the GPU
+	static void load_textures
+			(const vk::raii::PhysicalDevice &,
+			const vk::raii::Device &,
+			const std::vector <std::string> &,
+			const std::vector <TextureRole> & = {});
+
+	// Load a texture again after its file has changed (in the same
+	// role); the old image is released once the frames in flight are
+	// done, and descriptors referring to it must be written again.
+	// Returns false if the texture was never loaded
+	static bool reload_texture
 			(const vk::raii::PhysicalDevice &,
 			const vk::raii::Device &,
 			const std::string &);
 
-	// Create a sampler
+	// Sampler of a texture, loading it if needed
 	static const vk::raii::Sampler &load_sampler
 			(const vk::raii::PhysicalDevice &,
 			const vk::raii::Device &,
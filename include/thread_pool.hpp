@@ -0,0 +1,100 @@
+#ifndef KOBRA_THREAD_POOL_H_
+#define KOBRA_THREAD_POOL_H_
+
+// Standard headers
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kobra {
+
+// Work-stealing thread pool
+//	each worker owns a queue; it pops its own tasks from the back
+//	and steals from the front of the other queues when empty
+class ThreadPool {
+public:
+	using Task = std::function <void ()>;
+private:
+	// Task, and the counter of the batch it belongs to (if any)
+	struct _entry {
+		Task				task;
+		const std::atomic <size_t>	*batch = nullptr;
+	};
+
+	// Per worker queue
+	struct _queue {
+		std::deque <_entry>	tasks;
+		std::mutex		mutex;
+	};
+
+	std::vector <std::unique_ptr <_queue>>	_queues;
+	std::vector <std::thread>		_threads;
+
+	// Sleeping workers
+	std::mutex				_mutex;
+	std::condition_variable			_cv;
+	std::atomic <size_t>			_queued = 0;
+	std::atomic <size_t>			_next = 0;
+	bool					_stop = false;
+
+	// Worker loop
+	void _worker(size_t);
+
+	// Pop a task from the queue of the given worker, or steal one;
+	// only tasks of the given batch, unless it is null
+	bool _pop(size_t, Task &, const std::atomic <size_t> * = nullptr);
+
+	void _push(const Task &, const std::atomic <size_t> *);
+public:
+	// Constructor
+	ThreadPool(size_t = std::thread::hardware_concurrency());
+
+	// Non-copyable
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	// Destructor
+	~ThreadPool();
+
+	// Number of workers
+	size_t size() const {
+		return _threads.size();
+	}
+
+	// Push a task; tasks pushed from a worker go to its own queue
+	void push(const Task &);
+
+	// Push a task of a batch, whose counter is waited on
+	void push(const Task &, const std::atomic <size_t> &);
+
+	// Run a pending task of a batch on the calling thread, if there
+	// is any; used to help out while waiting on the batch
+	bool run_one(const std::atomic <size_t> &);
+
+	// Wait until the counter of a batch reaches zero, helping out
+	// with its tasks meanwhile (never with others, which may be long)
+	void wait(const std::atomic <size_t> &);
+
+	// Run a function over [0, n) in chunks, as (chunk index, begin,
+	// end); chunks are fixed by the arguments so that callers can
+	// merge per-chunk results in a deterministic order
+	void parallel_for(size_t, size_t,
+		const std::function <void (size_t, size_t, size_t)> &);
+
+	// Number of chunks that parallel_for will use
+	static size_t chunks(size_t n, size_t chunk) {
+		return (chunk == 0) ? 0 : (n + chunk - 1)/chunk;
+	}
+
+	// Singleton
+	static ThreadPool &one();
+};
+
+}
+
+#endif
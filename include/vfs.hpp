@@ -0,0 +1,80 @@
+#ifndef KOBRA_VFS_H_
+#define KOBRA_VFS_H_
+
+// Standard headers
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Engine headers
+#include "mapped_file.hpp"
+
+namespace kobra {
+
+// Virtual file layer: files are looked up in the mounted packs
+// (.kpak) first, then on disk, so that loaders do not need to
+// know where their data comes from
+namespace vfs {
+
+// Forward declarations
+struct Pack;
+
+// Contents of a file; uncompressed entries of a pack are
+// views into its mapping, which they keep alive
+class File {
+	std::shared_ptr <const Pack>	_pack;
+	MappedFile			_mapped;
+	std::vector <char>		_buffer;
+
+	const char			*_data = nullptr;
+	size_t				_size = 0;
+	bool				_valid = false;
+public:
+	File() = default;
+
+	// From a pack entry (either a view or a decompressed buffer)
+	File(std::shared_ptr <const Pack>, const char *, size_t);
+	File(std::vector <char> &&);
+
+	// From a file on disk
+	File(MappedFile &&);
+
+	// Properties
+	bool valid() const {
+		return _valid;
+	}
+
+	const char *data() const {
+		return _data;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	std::string_view view() const {
+		return std::string_view(_data, _size);
+	}
+};
+
+// Mount a pack; packs mounted later take precedence
+bool mount(const std::string &);
+
+// Unmount all packs (open files stay valid)
+void unmount();
+
+// Whether a file exists, in a pack or on disk
+bool exists(const std::string &);
+
+// Open a file, in a pack or on disk
+File open(const std::string &);
+
+// Whole file as a string (empty if it could not be opened)
+std::string read(const std::string &);
+
+}
+
+}
+
+#endif
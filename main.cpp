@@ -8,6 +8,8 @@
 #include "include/layers/raytracer.hpp"
 #include "include/layers/shape_renderer.hpp"
 #include "include/logger.hpp"
+#include "include/partition.hpp"
+#include "include/profiler.hpp"
 #include "include/renderer.hpp"
 #include "include/scene.hpp"
 #include "include/transform.hpp"
@@ -23,6 +25,10 @@ using namespace kobra;
 // Scene path
 std::string scene_path = "scenes/scene.kobra";
 
+// Stream the scene by regions around the camera, for scenes
+// too large to keep in memory (no hot reloading then)
+bool partition_scene = false;
+
 // Test app
 struct ECSApp : public BaseApp {
 	layers::Raster	rasterizer;
@@ -31,6 +37,7 @@ struct ECSApp : public BaseApp {
 	layers::ShapeRenderer shape_renderer;
 
 	Scene scene;
+	std::unique_ptr <WorldPartition> partition;
 
 	// TODO: will later also need a project manager
 	Entity camera;
@@ -83,7 +90,7 @@ struct ECSApp : public BaseApp {
 				float y = 10;
 
 				for (int i = 0; i < ecs.size(); i++) {
-					auto &e = ecs.get_entity(i);
+					auto e = ecs.get_entity(i);
 
 					struct _on_click {
 						int index;
@@ -133,7 +140,7 @@ struct ECSApp : public BaseApp {
 			float minh = 30.0f;
 
 			for (int i = 0; i < ecs.size(); i++) {
-				auto &e = ecs.get_entity(i);
+				auto e = ecs.get_entity(i);
 
 				auto t = ui::Text {
 					.text = e.name,
@@ -172,16 +179,18 @@ struct ECSApp : public BaseApp {
 			font_renderer(get_context(), render_pass, "resources/fonts/noto_sans.ttf"),
 			shape_renderer(get_context(), render_pass),
 			scene_graph(scene.ecs, font_renderer, io.mouse_events) {
-		scene.load(get_device(), scene_path);
+		// Entities are added as they are loaded (see record)
+		if (partition_scene) {
+			partition = std::make_unique <WorldPartition> (scene, get_device(), scene_path);
+		} else {
+			scene.load_async(get_device(), scene_path);
+
+			// Pick up edits to the scene and its assets
+			scene.watch(get_device(), scene_path);
+		}
 		// raytracer.environment_map(scene.p_environment_map);
 		raytracer.environment_map("resources/skies/background_1.jpg");
 
-		// Camera
-		camera = scene.ecs.get_entity("Camera");
-
-		// TODO: set camera properties (aspect)
-		camera.get <Camera> ().tunings.aspect = (render_max.x - render_min.x)/(render_max.y - render_min.y);
-
 		// Color picker
 		color = glm::vec3 {0.86f, 0.13f, 0.13f};
 		color_picker = ui::ColorPicker {
@@ -208,6 +217,21 @@ struct ECSApp : public BaseApp {
 		scene.ecs.info <Mesh> ();
 	}
 
+	// Find the camera, once it has been loaded
+	bool find_camera() {
+		if (camera.valid())
+			return true;
+
+		if (!scene.ecs.has_entity("Camera"))
+			return false;
+
+		camera = scene.ecs.get_entity("Camera");
+
+		// TODO: set camera properties (aspect)
+		camera.get <Camera> ().tunings.aspect = (render_max.x - render_min.x)/(render_max.y - render_min.y);
+		return true;
+	}
+
 	int mode = 0;	// 0 for raster, 1 for raytracer
 	bool tab_pressed = false;
 
@@ -251,6 +275,9 @@ struct ECSApp : public BaseApp {
 	float fps = 0;
 	float time = 0;
 
+	// Latest profiled frame of each name
+	std::map <std::string, Profiler::Frame> profiled;
+
 	void record(const vk::raii::CommandBuffer &cmd,
 			const vk::raii::Framebuffer &framebuffer) override {
 		// Time things
@@ -259,6 +286,16 @@ struct ECSApp : public BaseApp {
 
 		time += frame_time;
 
+		// Release the renderers of entities destroyed
+		// by frames that are no longer in flight
+		scene.ecs.frame();
+
+		// Add the entities that have finished loading, then
+		// apply any changes made to the files since
+		scene.stream();
+		if (!scene.loading())
+			scene.reload();
+
 		// Text things
 		std::vector <ui::Text> texts {
 			ui::Text {
@@ -268,9 +305,44 @@ struct ECSApp : public BaseApp {
 			},
 		};
 
+		if (scene.loading()) {
+			texts.push_back(ui::Text {
+				.text = common::sprintf("Loading: %.0f%%",
+					100.0f * scene.progress().fraction()),
+				.anchor = {scene_graph_width + 5, 25},
+				.size = 0.4f
+			});
+		}
+
 		for (auto &t : scene_graph.texts())
 			texts.push_back(t);
 
+		// Latest timings of everything that was profiled, with
+		// those of the systems one by one
+		while (Profiler::one().size() > 0) {
+			Profiler::Frame frame = Profiler::one().pop();
+			profiled.insert_or_assign(frame.name, frame);
+		}
+
+		std::vector <std::pair <std::string, double>> timings;
+		for (const auto &[name, frame] : profiled) {
+			if (name != "Systems") {
+				timings.push_back({name, frame.time});
+				continue;
+			}
+
+			for (const Profiler::Frame &system : frame.children)
+				timings.push_back({system.name, system.time});
+		}
+
+		for (size_t i = 0; i < timings.size(); i++) {
+			texts.push_back(ui::Text {
+				.text = common::sprintf("%s: %.0f us", timings[i].first.c_str(), timings[i].second),
+				.anchor = {scene_graph_width + 5, render_max.y - 20.0f * (timings.size() - i)},
+				.size = 0.4f
+			});
+		}
+
 		for (auto &t : color_picker.texts())
 			texts.push_back(t);
 
@@ -283,14 +355,34 @@ struct ECSApp : public BaseApp {
 		for (auto &s : color_picker.shapes())
 			rects.push_back(s);
 
+		// Nothing to view until the camera is loaded
+		bool has_camera = find_camera();
+
+		// Bring in the regions around the camera
+		if (partition && has_camera)
+			partition->update(camera.get <Camera> ().transform.position);
+
+		// Counters of the profiler (e.g. streaming and residency)
+		float y = 45.0f;
+		for (const auto &[name, value] : Profiler::one().counters()) {
+			texts.push_back(ui::Text {
+				.text = common::sprintf("%s: %.1f", name.c_str(), value),
+				.anchor = {scene_graph_width + 5, y},
+				.size = 0.4f
+			});
+
+			y += 20.0f;
+		}
+
 		// Input
-		active_input();
+		if (has_camera)
+			active_input();
 
 		// Begin command buffer
 		cmd.begin({});
 
 		// TODO: pass camera
-		if (mode == 1)
+		if (mode == 1 && has_camera)
 			raytracer.render(cmd, framebuffer, scene.ecs, {render_min, render_max});
 		else
 			rasterizer.render(cmd, framebuffer, scene.ecs, {render_min, render_max});
@@ -363,6 +455,9 @@ struct ECSApp : public BaseApp {
 		static float pitch = 0.0f;
 
 		auto &app = *static_cast <ECSApp *> (us);
+		if (!app.find_camera())
+			return;
+
 		auto &cam = app.camera.get <Camera> ();
 
 		// Deltas and directions
@@ -402,6 +497,11 @@ struct ECSApp : public BaseApp {
 
 int main()
 {
+	// Assets are read from the pack if it has been
+	// built (with the kpak tool), and from disk otherwise
+	if (vfs::exists("resources.kpak"))
+		vfs::mount("resources.kpak");
+
 	auto extensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 	};
@@ -1,8 +1,9 @@
 #ifndef RASTER_BINDINGS
 #define RASTER_BINDINGS
 
-const int RASTER_BINDING_ALBEDO_MAP	= 0;
-const int RASTER_BINDING_NORMAL_MAP	= 1;
 const int RASTER_BINDING_POINT_LIGHTS	= 3;
 
+// Texture table (see TextureManager), in a set of its own
+const int RASTER_SET_TEXTURES		= 1;
+
 #endif
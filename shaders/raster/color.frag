@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 #include "bindings.h"
 #include "io_set.glsl"
@@ -6,8 +7,8 @@
 
 void main()
 {
-	if (material.has_albedo > 0.5) {
-		vec3 color = texture(albedo_map, tex_coord).rgb;
+	if (material.albedo_texture >= 0) {
+		vec3 color = sample_region(material.albedo_texture, material.albedo_region, tex_coord).rgb;
 		fragment = vec4(color, 1);
 	} else {
 		fragment = vec4(material.albedo, 1.0);
@@ -8,12 +8,21 @@ layout (location = 3) in mat3		tbn;
 layout (location = 6) in vec3		tbn_inverse;
 layout (location = 9) flat in Material	material;
 
-// Sampler inputs
-layout (binding = RASTER_BINDING_ALBEDO_MAP)
-uniform sampler2D			albedo_map;
+// Texture table, indexed by the slots of materials
+layout (set = RASTER_SET_TEXTURES, binding = 0)
+uniform sampler2D			textures[];
 
-layout (binding = RASTER_BINDING_NORMAL_MAP)
-uniform sampler2D			normal_map;
+// Sample a texture in its region; coordinates repeat within the
+// region, and gradients are those of the unwrapped coordinates, so
+// that the seams do not pick the coarsest level
+vec4 sample_region(int slot, vec4 region, vec2 uv)
+{
+	return textureGrad(textures[nonuniformEXT(slot)],
+		region.zw + fract(uv) * region.xy,
+		dFdx(uv) * region.xy,
+		dFdy(uv) * region.xy
+	);
+}
 
 // Outputs
 layout (location = 0) out vec4		fragment;
@@ -5,6 +5,13 @@ struct Material {
 	vec3	albedo;
 	int	type;
 	float	hightlight;
-	float	has_albedo;
-	float	has_normal;
+
+	// Slots of the textures in the texture table, or -1
+	int	albedo_texture;
+	int	normal_texture;
+
+	// Regions of the textures in their images (atlases),
+	// as scale (xy) and offset (zw)
+	vec4	albedo_region;
+	vec4	normal_region;
 };
@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 // Modules
 #include "bindings.h"
@@ -8,9 +9,10 @@
 void main()
 {
 	vec3 n = normalize(normal);
-	if (material.has_normal > 0.5) {
-		n = texture(normal_map, tex_coord).rgb;
-		n = 2.0 * n - 1.0;
+	if (material.normal_texture >= 0) {
+		// Only two components are stored (BC5)
+		n.xy = 2.0 * sample_region(material.normal_texture, material.normal_region, tex_coord).rg - 1.0;
+		n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
 		n = normalize(tbn * n);
 	}
 
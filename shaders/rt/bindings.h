@@ -1,9 +1,6 @@
 #ifndef KOBRA_RT_MESH_BINDINGS_H_
 #define KOBRA_RT_MESH_BINDINGS_H_
 
-// Number of textures
-#define MAX_TEXTURES 100
-
 // Essential buffers
 const int MESH_BINDING_PIXELS		= 0;
 const int MESH_BINDING_VERTICES		= 1;
@@ -18,13 +15,14 @@ const int MESH_BINDING_LIGHT_INDICES	= 7;
 const int MESH_BINDING_AREA_LIGHTS	= 12;
 
 // Samplers
-const int MESH_BINDING_ALBEDOS		= 8;
-const int MESH_BINDING_NORMAL_MAPS	= 9;
 const int MESH_BINDING_ENVIRONMENT	= 10;
 
 // Output
 const int MESH_BINDING_OUTPUT		= 11;
 
+// Texture table (see TextureManager), in a set of its own
+const int MESH_SET_TEXTURES		= 1;
+
 // TODO: mesh roughness/bump map
 
 #endif
@@ -144,9 +144,6 @@ Intersection ray_sphere_intersect(Ray ray, uint a, uint d)
 		uv.x = atan(ray.direction.x, ray.direction.z) / (2.0 * PI) + 0.5;
 		uv.y = asin(ray.direction.y) / PI + 0.5;
 
-		// Get the color
-		it.mat.diffuse = texture(s2_albedo[0], uv).rgb;
-
 		// Get material index at the second element
 		it.mat = get_material(d, uv);
 	}
@@ -197,9 +194,11 @@ Intersection ray_intersect(Ray ray, uint index)
 		it.normal = normalize(n);
 
 		// Transfer normal
-		if (it.mat.normal == 1) {
-			vec3 n = texture(s2_normals[i.w], tex_coord).xyz;
-			n = 2 * n - 1;
+		if (it.mat.normal >= 0) {
+			// Only two components are stored (BC5)
+			vec3 n;
+			n.xy = 2 * texture(textures[nonuniformEXT(it.mat.normal)], region_uv(it.mat.normal_region, tex_coord)).xy - 1;
+			n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
 
 			// Get (interpolated) tangent and bitangent
 			vec3 t1 = vertices.data[VERTEX_STRIDE * i.x + 3].xyz;
@@ -35,9 +35,14 @@ struct Material {
 	float shininess;
 	float roughness;
 	float refraction;
-	int albedo;
+	int albedo;	// slots in the texture table, or -1
 	int normal;
 	int type;
+
+	// Regions of the textures in their images (atlases),
+	// as scale (xy) and offset (zw)
+	vec4 albedo_region;
+	vec4 normal_region;
 };
 
 Material def_mat()
@@ -50,8 +55,10 @@ Material def_mat()
 	m.shininess = 0.0;
 	m.roughness = 0.0;
 	m.refraction = 0.0;
-	m.albedo = 0;
-	m.normal = 0;
+	m.albedo = -1;
+	m.normal = -1;
+	m.albedo_region = vec4(1, 1, 0, 0);
+	m.normal_region = vec4(1, 1, 0, 0);
 	return m;
 }
 
@@ -76,25 +83,27 @@ layout (set = 0, binding = MESH_BINDING_AREA_LIGHTS, std430) buffer AreaLights
 	AreaLight data[];
 } area_lights;
 
-// Textures
-layout (set = 0, binding = MESH_BINDING_ALBEDOS)
-uniform sampler2D s2_albedo[MAX_TEXTURES];
-
-layout (set = 0, binding = MESH_BINDING_NORMAL_MAPS)
-uniform sampler2D s2_normals[MAX_TEXTURES];
+// Textures, indexed by the slots of materials
+layout (set = MESH_SET_TEXTURES, binding = 0)
+uniform sampler2D textures[];
 
 layout (set = 0, binding = MESH_BINDING_ENVIRONMENT)
 uniform sampler2D s2_environment;
 
+// Coordinates in the region of a texture; they
+// repeat within the region, as they do in a texture
+vec2 region_uv(vec4 region, vec2 uv)
+{
+	return region.zw + fract(uv) * region.xy;
+}
+
 // Get material and sample if needed
 Material get_material(uint i, vec2 uv)
 {
 	Material m = materials.data[i];
 
-	// TODO: .albedo should be index to texture,
-	// so we dont have to waste it on blanks
-	if (m.albedo == 1)
-		m.diffuse = texture(s2_albedo[i], uv).rgb;
+	if (m.albedo >= 0)
+		m.diffuse = texture(textures[nonuniformEXT(m.albedo)], region_uv(m.albedo_region, uv)).rgb;
 
 	return m;
 }
@@ -1,4 +1,5 @@
 #include "../include/app.hpp"
+#include "../include/texture_manager.hpp"
 
 namespace kobra {
 
@@ -58,6 +59,9 @@ void App::run()
 		// Run application frame
 		frame();
 
+		// Texture residency follows the frames
+		TextureManager::frame(phdev, device);
+
 		// TODO: mod by max frames in flight
 		frame_index = (frame_index + 1) % 2;
 
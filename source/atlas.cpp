@@ -0,0 +1,369 @@
+// Standard headers
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+
+// Engine headers
+#include "../include/atlas.hpp"
+#include "../include/bake.hpp"
+#include "../include/block_compression.hpp"
+#include "../include/logger.hpp"
+#include "../include/mipmap.hpp"
+#include "../include/vfs.hpp"
+
+namespace kobra {
+
+namespace atlas {
+
+static uint32_t round_up(uint32_t x, uint32_t multiple)
+{
+	return (x + multiple - 1)/multiple * multiple;
+}
+
+// Cell of a region, with its gutters
+static Rect cell_of(const Rect &rect)
+{
+	return Rect {
+		rect.x - gutter, rect.y - gutter,
+		round_up(rect.width + 2 * gutter, cell),
+		round_up(rect.height + 2 * gutter, cell)
+	};
+}
+
+/////////////
+// Skyline //
+/////////////
+
+Skyline::Skyline(uint32_t width, uint32_t height)
+		: _width(width), _height(height),
+		_segments {Segment {0, 0, width}} {}
+
+bool Skyline::_fit(size_t i, uint32_t width, uint32_t height, uint32_t &y) const
+{
+	if (_segments[i].x + width > _width)
+		return false;
+
+	y = _segments[i].y;
+
+	uint32_t remaining = width;
+	for (size_t j = i; remaining > 0; j++) {
+		if (j >= _segments.size())
+			return false;
+
+		y = std::max(y, _segments[j].y);
+		if (y + height > _height)
+			return false;
+
+		remaining -= std::min(remaining, _segments[j].width);
+	}
+
+	return true;
+}
+
+bool Skyline::insert(uint32_t width, uint32_t height, Rect &rect)
+{
+	size_t best = _segments.size();
+	uint32_t best_y = std::numeric_limits <uint32_t>::max();
+	uint32_t best_width = std::numeric_limits <uint32_t>::max();
+
+	for (size_t i = 0; i < _segments.size(); i++) {
+		uint32_t y;
+		if (!_fit(i, width, height, y))
+			continue;
+
+		if (y < best_y || (y == best_y && _segments[i].width < best_width)) {
+			best = i;
+			best_y = y;
+			best_width = _segments[i].width;
+		}
+	}
+
+	if (best == _segments.size())
+		return false;
+
+	rect = Rect {_segments[best].x, best_y, width, height};
+
+	// The new segment covers (or shortens) those under it
+	_segments.insert(_segments.begin() + best, Segment {rect.x, best_y + height, width});
+
+	for (size_t j = best + 1; j < _segments.size(); ) {
+		const Segment &prev = _segments[j - 1];
+		Segment &seg = _segments[j];
+
+		uint32_t end = prev.x + prev.width;
+		if (seg.x >= end)
+			break;
+
+		uint32_t overlap = end - seg.x;
+		if (seg.width <= overlap) {
+			_segments.erase(_segments.begin() + j);
+			continue;
+		}
+
+		seg.x += overlap;
+		seg.width -= overlap;
+		break;
+	}
+
+	// Neighbours at the same height become one
+	for (size_t j = 1; j < _segments.size(); ) {
+		if (_segments[j - 1].y == _segments[j].y) {
+			_segments[j - 1].width += _segments[j].width;
+			_segments.erase(_segments.begin() + j);
+		} else {
+			j++;
+		}
+	}
+
+	return true;
+}
+
+/////////////
+// Packing //
+/////////////
+
+std::vector <Sheet> pack(const std::vector <Extent> &extents, uint32_t size)
+{
+	std::vector <size_t> order(extents.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	// Tallest (then widest) first; ties by index, so
+	// that the same textures always pack the same way
+	std::sort(order.begin(), order.end(),
+		[&](size_t a, size_t b) {
+			const Extent &ea = extents[a];
+			const Extent &eb = extents[b];
+			if (ea.height != eb.height)
+				return ea.height > eb.height;
+			if (ea.width != eb.width)
+				return ea.width > eb.width;
+			return a < b;
+		}
+	);
+
+	std::vector <Sheet> sheets;
+	std::vector <Skyline> skylines;
+
+	for (size_t i : order) {
+		const Extent &extent = extents[i];
+		uint32_t width = round_up(extent.width + 2 * gutter, cell);
+		uint32_t height = round_up(extent.height + 2 * gutter, cell);
+
+		// First sheet with room for it, or a new one; textures
+		// that do not fit in an empty sheet are left out
+		Rect placed;
+		size_t s = 0;
+		while (s < sheets.size() && !skylines[s].insert(width, height, placed))
+			s++;
+
+		if (s == sheets.size()) {
+			Skyline skyline(size, size);
+			if (!skyline.insert(width, height, placed))
+				continue;
+
+			sheets.emplace_back();
+			skylines.push_back(skyline);
+		}
+
+		Sheet &sheet = sheets[s];
+		sheet.textures.push_back(i);
+		sheet.rects.push_back(Rect {
+			placed.x + gutter, placed.y + gutter,
+			extent.width, extent.height
+		});
+
+		sheet.width = std::max(sheet.width, placed.x + width);
+		sheet.height = std::max(sheet.height, placed.y + height);
+	}
+
+	// A sheet of one texture saves nothing
+	sheets.erase(std::remove_if(sheets.begin(), sheets.end(),
+		[](const Sheet &sheet) {
+			return sheet.textures.size() < 2;
+		}
+	), sheets.end());
+
+	return sheets;
+}
+
+std::vector <uint8_t> compose(const Sheet &sheet, const std::vector <const uint8_t *> &chains)
+{
+	std::vector <mip::Level> layout = mip::layout(sheet.width, sheet.height, levels);
+	std::vector <uint8_t> out(layout.back().offset + layout.back().size, 0);
+
+	for (size_t t = 0; t < sheet.textures.size(); t++) {
+		const Rect &rect = sheet.rects[t];
+		Rect cell = cell_of(rect);
+
+		std::vector <mip::Level> source = mip::layout(rect.width, rect.height, levels);
+
+		// Cells, regions and textures all halve exactly
+		for (uint32_t k = 0; k < levels; k++) {
+			const mip::Level &level = layout[k];
+			const mip::Level &src = source[k];
+			const uint8_t *pixels = chains[t] + src.offset;
+
+			int ox = int(rect.x >> k);
+			int oy = int(rect.y >> k);
+			int w = int(src.width);
+			int h = int(src.height);
+
+			for (uint32_t y = cell.y >> k; y < (cell.y + cell.height) >> k; y++) {
+				int sy = ((int(y) - oy) % h + h) % h;
+				uint8_t *row = out.data() + level.offset + size_t(y) * level.width * 4;
+
+				for (uint32_t x = cell.x >> k; x < (cell.x + cell.width) >> k; x++) {
+					int sx = ((int(x) - ox) % w + w) % w;
+					std::memcpy(row + size_t(x) * 4, pixels + (size_t(sy) * w + sx) * 4, 4);
+				}
+			}
+		}
+	}
+
+	return out;
+}
+
+/////////////
+// Regions //
+/////////////
+
+static void put(std::string &out, uint32_t v)
+{
+	out.append((const char *) &v, sizeof(v));
+}
+
+static bool get(const char *&data, const char *end, uint32_t &v)
+{
+	if (end - data < (ptrdiff_t) sizeof(v))
+		return false;
+
+	std::memcpy(&v, data, sizeof(v));
+	data += sizeof(v);
+	return true;
+}
+
+std::string write_regions(const std::vector <Region> &regions)
+{
+	std::string out = "KATL";
+	put(out, regions.size());
+
+	for (const Region &region : regions) {
+		put(out, region.rect.x);
+		put(out, region.rect.y);
+		put(out, region.rect.width);
+		put(out, region.rect.height);
+		put(out, region.path.size());
+		out += region.path;
+	}
+
+	return out;
+}
+
+bool read_regions(const char *data, size_t size, std::vector <Region> &regions)
+{
+	const char *end = data + size;
+	if (size < 4 || std::memcmp(data, "KATL", 4) != 0)
+		return false;
+
+	data += 4;
+
+	uint32_t count;
+	if (!get(data, end, count))
+		return false;
+
+	regions.clear();
+	for (uint32_t i = 0; i < count; i++) {
+		Region region;
+		uint32_t length;
+
+		bool ok = get(data, end, region.rect.x)
+			&& get(data, end, region.rect.y)
+			&& get(data, end, region.rect.width)
+			&& get(data, end, region.rect.height)
+			&& get(data, end, length)
+			&& end - data >= (ptrdiff_t) length;
+
+		if (!ok)
+			return false;
+
+		region.path.assign(data, length);
+		data += length;
+
+		regions.push_back(region);
+	}
+
+	return true;
+}
+
+// Regions of a baked sheet, after its header and levels
+static bool read_sheet(const std::string &path, bake::TextureHeader &header, std::vector <Region> &regions)
+{
+	vfs::File file = vfs::open(path);
+	if (!file.valid() || file.size() < sizeof(header))
+		return false;
+
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, "KTEX", 4) != 0
+			|| header.format > uint32_t(bc::Format::eBC7)
+			|| header.levels < 1
+			|| header.levels > mip::count(header.width, header.height))
+		return false;
+
+	mip::Level last = bc::layout(bc::Format(header.format),
+		header.width, header.height, header.levels).back();
+
+	size_t offset = sizeof(header) + last.offset + last.size;
+	if (file.size() < offset)
+		return false;
+
+	return read_regions(file.data() + offset, file.size() - offset, regions);
+}
+
+bool lookup(const std::string &path, Placement &placement)
+{
+	static std::mutex mutex;
+	static std::unordered_map <std::string, Placement> placements;
+	static std::unordered_map <std::string, bool> sheets;
+
+	std::lock_guard <std::mutex> lock(mutex);
+
+	auto it = placements.find(path);
+	if (it != placements.end()) {
+		placement = it->second;
+		return true;
+	}
+
+	std::string sheet = bake::lookup_member(bake::atlas, path);
+	if (sheet.empty() || sheets.count(sheet))
+		return false;
+
+	// Every texture of the sheet is placed at once
+	bake::TextureHeader header;
+	std::vector <Region> regions;
+
+	sheets[sheet] = read_sheet(sheet, header, regions);
+	if (!sheets[sheet]) {
+		KOBRA_LOG_FUNC(warn) << "Failed to read texture atlas: " << sheet << std::endl;
+		return false;
+	}
+
+	for (const Region &region : regions) {
+		placements[region.path] = Placement {
+			sheet, transform(region.rect, header.width, header.height)
+		};
+	}
+
+	it = placements.find(path);
+	if (it == placements.end())
+		return false;
+
+	placement = it->second;
+	return true;
+}
+
+}
+
+}
@@ -1,3 +1,7 @@
+// Standard headers
+#include <algorithm>
+#include <filesystem>
+
 // More vulkan headers
 #include <vulkan/vk_platform.h>
 #include <vulkan/vulkan_core.h>
@@ -8,7 +12,10 @@
 #include <stb/stb_image.h>
 
 #include "../include/backend.hpp"
+#include "../include/bake.hpp"
 #include "../include/core.hpp"
+#include "../include/mipmap.hpp"
+#include "../include/texture_container.hpp"
 
 namespace kobra {
 
@@ -452,12 +459,47 @@ vk::raii::Device make_device(const vk::raii::PhysicalDevice &phdev,
 		queue_priorities.data()
 	};
 
+	// Optional features, if they are supported
+	vk::PhysicalDeviceFeatures supported = phdev.getFeatures();
+
+	vk::PhysicalDeviceFeatures features;
+	features.textureCompressionBC = supported.textureCompressionBC;
+
+	// Descriptor indexing, for the bindless texture table: shaders
+	// index it with (non-uniform) material slots, slots are written
+	// while frames are in flight, and unused ones stay unwritten
+	auto supported_indexing = phdev.getFeatures2 <
+		vk::PhysicalDeviceFeatures2,
+		vk::PhysicalDeviceDescriptorIndexingFeatures
+	> ().get <vk::PhysicalDeviceDescriptorIndexingFeatures> ();
+
+	vk::PhysicalDeviceDescriptorIndexingFeatures indexing;
+	indexing.shaderSampledImageArrayNonUniformIndexing = true;
+	indexing.runtimeDescriptorArray = true;
+	indexing.descriptorBindingPartiallyBound = true;
+	indexing.descriptorBindingVariableDescriptorCount = true;
+	indexing.descriptorBindingSampledImageUpdateAfterBind = true;
+	indexing.descriptorBindingUpdateUnusedWhilePending = true;
+
+	bool bindless = supported_indexing.shaderSampledImageArrayNonUniformIndexing
+		&& supported_indexing.runtimeDescriptorArray
+		&& supported_indexing.descriptorBindingPartiallyBound
+		&& supported_indexing.descriptorBindingVariableDescriptorCount
+		&& supported_indexing.descriptorBindingSampledImageUpdateAfterBind
+		&& supported_indexing.descriptorBindingUpdateUnusedWhilePending;
+
+	if (!bindless) {
+		KOBRA_LOG_FUNC(error) << "Device does not support descriptor indexing"
+			<< " (required for the texture table)\n";
+		throw std::runtime_error("[Vulkan] Descriptor indexing is not supported");
+	}
+
 	// Create the device
 	vk::DeviceCreateInfo device_info {
 		vk::DeviceCreateFlags(),
 		queue_info,
 		{}, extensions,
-		nullptr, nullptr
+		&features, &indexing
 	};
 
 	return vk::raii::Device {
@@ -630,19 +672,22 @@ void copy_data_to_image(const vk::raii::CommandBuffer &cmd,
 		const vk::raii::Image &image,
 		const vk::Format &format,
 		uint32_t width,
-		uint32_t height)
+		uint32_t height,
+		uint32_t level,
+		vk::DeviceSize offset)
 {
 	// Image subresource
 	vk::ImageSubresourceLayers subresource {
 		vk::ImageAspectFlagBits::eColor,
-		0, 0, 1
+		level, 0, 1
 	};
 
-	// Copy region
+	// Copy region; rows are tightly packed, which
+	// for compressed formats means whole blocks
 	vk::BufferImageCopy region = vk::BufferImageCopy()
-		.setBufferOffset(0)
-		.setBufferRowLength(width)
-		.setBufferImageHeight(height)
+		.setBufferOffset(offset)
+		.setBufferRowLength(0)
+		.setBufferImageHeight(0)
 		.setImageSubresource(subresource)
 		.setImageOffset({ 0, 0, 0 })
 		.setImageExtent({ width, height, 1 });
@@ -654,6 +699,93 @@ void copy_data_to_image(const vk::raii::CommandBuffer &cmd,
 	);
 }
 
+// Check for linear blit support
+bool supports_mip_blit(const vk::raii::PhysicalDevice &phdev, const vk::Format &format)
+{
+	vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eBlitSrc
+		| vk::FormatFeatureFlagBits::eBlitDst
+		| vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+
+	vk::FormatProperties properties = phdev.getFormatProperties(format);
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+// Generate mip levels with blits, each from the previous level
+void blit_mips(const vk::raii::CommandBuffer &cmd, ImageData &img)
+{
+	vk::ImageMemoryBarrier barrier {
+		{}, {},
+		vk::ImageLayout::eUndefined, vk::ImageLayout::eUndefined,
+		VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+		*img.image,
+		vk::ImageSubresourceRange {img.aspect_mask, 0, 1, 0, 1}
+	};
+
+	int32_t width = img.extent.width;
+	int32_t height = img.extent.height;
+
+	for (uint32_t i = 1; i < img.mip_levels; i++) {
+		// Previous level becomes the source
+		barrier.subresourceRange.baseMipLevel = i - 1;
+		barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+		barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+		cmd.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eTransfer,
+			{}, {}, {}, barrier
+		);
+
+		int32_t next_width = std::max(width/2, 1);
+		int32_t next_height = std::max(height/2, 1);
+
+		vk::ImageBlit blit {
+			{img.aspect_mask, i - 1, 0, 1},
+			{vk::Offset3D {0, 0, 0}, vk::Offset3D {width, height, 1}},
+			{img.aspect_mask, i, 0, 1},
+			{vk::Offset3D {0, 0, 0}, vk::Offset3D {next_width, next_height, 1}}
+		};
+
+		cmd.blitImage(
+			*img.image, vk::ImageLayout::eTransferSrcOptimal,
+			*img.image, vk::ImageLayout::eTransferDstOptimal,
+			blit, vk::Filter::eLinear
+		);
+
+		// Done with the previous level
+		barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+		barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+		barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+		cmd.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eFragmentShader,
+			{}, {}, {}, barrier
+		);
+
+		width = next_width;
+		height = next_height;
+	}
+
+	// Last level was only written to
+	barrier.subresourceRange.baseMipLevel = img.mip_levels - 1;
+	barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+	barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+	cmd.pipelineBarrier(
+		vk::PipelineStageFlagBits::eTransfer,
+		vk::PipelineStageFlagBits::eFragmentShader,
+		{}, {}, {}, barrier
+	);
+
+	img.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+}
+
 // Create ImageData object from byte data
 ImageData make_image(const vk::raii::CommandBuffer &cmd,
 		const vk::raii::PhysicalDevice &phdev,
@@ -722,84 +854,555 @@ ImageData make_image(const vk::raii::CommandBuffer &cmd,
 	return img;
 }
 
-// Create ImageData object from a file
-// TODO: delegate to the above function
-ImageData make_image(const vk::raii::CommandBuffer &cmd,
-		const vk::raii::PhysicalDevice &phdev,
-		const vk::raii::Device &device,
-		BufferData &buffer,
+// Formats of texture pixels; compressed textures are UNORM,
+// like the uncompressed ones
+vk::Format texture_format(bc::Format format)
+{
+	switch (format) {
+	case bc::Format::eBC1:
+		return vk::Format::eBc1RgbUnormBlock;
+	case bc::Format::eBC3:
+		return vk::Format::eBc3UnormBlock;
+	case bc::Format::eBC4:
+		return vk::Format::eBc4UnormBlock;
+	case bc::Format::eBC5:
+		return vk::Format::eBc5UnormBlock;
+	case bc::Format::eBC7:
+		return vk::Format::eBc7UnormBlock;
+	default:
+		break;
+	}
+
+	return vk::Format::eR8G8B8A8Unorm;
+}
+
+bool supports_compression(const vk::raii::PhysicalDevice &phdev, vk::Format format)
+{
+	vk::FormatProperties properties = phdev.getFormatProperties(format);
+	return bool(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
+}
+
+// Place levels in staging memory, one after the other; offsets
+// are aligned for any texel (or block) size
+static void pack_levels(TexturePixels &pixels, const byte *data, const std::vector <mip::Level> &levels)
+{
+	pixels.layout.clear();
+	pixels.sources.clear();
+
+	vk::DeviceSize offset = 0;
+	for (const mip::Level &level : levels) {
+		pixels.layout.push_back(mip::Level {level.width, level.height, offset, level.size});
+		pixels.sources.push_back(data + level.offset);
+		offset += (level.size + 15) & ~vk::DeviceSize(15);
+	}
+
+	pixels.levels = levels.size();
+	pixels.size = offset;
+}
+
+// Block compressed formats whose blocks can be flipped vertically
+// without decoding them (BC6H and BC7 blocks cannot)
+enum class BlockFlip {
+	eNone,
+	eBC1,		// color endpoints, then a byte of indices per row
+	eBC2,		// 16 bits of alpha per row, then a BC1 block
+	eBC3,		// a BC4 block of alpha, then a BC1 block
+	eBC4,		// two endpoints, then 12 bits of indices per row
+	eBC5		// two BC4 blocks
+};
+
+static BlockFlip block_flip(vk::Format format)
+{
+	switch (format) {
+	case vk::Format::eBc1RgbUnormBlock:
+	case vk::Format::eBc1RgbSrgbBlock:
+	case vk::Format::eBc1RgbaUnormBlock:
+	case vk::Format::eBc1RgbaSrgbBlock:
+		return BlockFlip::eBC1;
+	case vk::Format::eBc2UnormBlock:
+	case vk::Format::eBc2SrgbBlock:
+		return BlockFlip::eBC2;
+	case vk::Format::eBc3UnormBlock:
+	case vk::Format::eBc3SrgbBlock:
+		return BlockFlip::eBC3;
+	case vk::Format::eBc4UnormBlock:
+	case vk::Format::eBc4SnormBlock:
+		return BlockFlip::eBC4;
+	case vk::Format::eBc5UnormBlock:
+	case vk::Format::eBc5SnormBlock:
+		return BlockFlip::eBC5;
+	default:
+		break;
+	}
+
+	return BlockFlip::eNone;
+}
+
+// Reverse the first rows of a BC1 color block
+static void flip_bc1(byte *block, uint32_t rows)
+{
+	std::reverse(block + 4, block + 4 + rows);
+}
+
+// Reverse the first rows of a BC4 block; its 3 bit indices are
+// a 48 bit little endian number, 12 bits per row
+static void flip_bc4(byte *block, uint32_t rows)
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= uint64_t(block[2 + i]) << (8 * i);
+
+	uint64_t flipped = bits;
+	for (uint32_t r = 0; r < rows; r++) {
+		uint64_t row = (bits >> (12 * (rows - 1 - r))) & 0xFFF;
+		flipped &= ~(uint64_t(0xFFF) << (12 * r));
+		flipped |= row << (12 * r);
+	}
+
+	for (int i = 0; i < 6; i++)
+		block[2 + i] = byte(flipped >> (8 * i));
+}
+
+static void flip_block(BlockFlip kind, byte *block, uint32_t rows)
+{
+	switch (kind) {
+	case BlockFlip::eBC1:
+		flip_bc1(block, rows);
+		break;
+	case BlockFlip::eBC2:
+		for (uint32_t r = 0; r < rows/2; r++) {
+			std::swap(block[2 * r], block[2 * (rows - 1 - r)]);
+			std::swap(block[2 * r + 1], block[2 * (rows - 1 - r) + 1]);
+		}
+
+		flip_bc1(block + 8, rows);
+		break;
+	case BlockFlip::eBC3:
+		flip_bc4(block, rows);
+		flip_bc1(block + 8, rows);
+		break;
+	case BlockFlip::eBC4:
+		flip_bc4(block, rows);
+		break;
+	case BlockFlip::eBC5:
+		flip_bc4(block, rows);
+		flip_bc4(block + 8, rows);
+		break;
+	default:
+		break;
+	}
+}
+
+void copy_texture_pixels(const TexturePixels &pixels, byte *dst, uint32_t first, uint32_t count)
+{
+	BlockFlip kind = block_flip(pixels.format);
+	size_t block = vk::blockSize(pixels.format);
+
+	uint32_t end = first + std::min(count, pixels.levels - first);
+	for (uint32_t i = first; i < end; i++) {
+		const mip::Level &level = pixels.layout[i];
+		byte *out = dst + (level.offset - pixels.layout[first].offset);
+		if (!pixels.flip) {
+			std::memcpy(out, pixels.sources[i], level.size);
+			continue;
+		}
+
+		// Rows are bottom up everywhere else
+		if (kind == BlockFlip::eNone) {
+			size_t row = level.size/level.height;
+			for (uint32_t y = 0; y < level.height; y++) {
+				std::memcpy(out + y * row,
+					pixels.sources[i] + (level.height - 1 - y) * row, row);
+			}
+
+			continue;
+		}
+
+		// Rows of blocks are reversed, and so are the rows inside
+		// each block; levels less than a block high only have as
+		// many rows as they are high
+		uint32_t block_rows = (level.height + 3)/4;
+		uint32_t rows = std::min(level.height, 4u);
+		size_t row = size_t((level.width + 3)/4) * block;
+
+		for (uint32_t y = 0; y < block_rows; y++) {
+			byte *dst_row = out + y * row;
+			std::memcpy(dst_row, pixels.sources[i] + (block_rows - 1 - y) * row, row);
+			for (size_t x = 0; x < row; x += block)
+				flip_block(kind, dst_row + x, rows);
+		}
+	}
+}
+
+// Read pixels from a baked texture (from the bake tool, or the
+// cache of compressed textures); compressed pixels are expanded
+// if the device cannot sample them
+static bool read_baked(const vk::raii::PhysicalDevice &phdev, vfs::File &&file, TexturePixels &pixels)
+{
+	bake::TextureHeader header;
+	if (file.size() < sizeof(header))
+		return false;
+
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	bc::Format format = bc::Format(header.format);
+	bool valid = std::memcmp(header.magic, "KTEX", 4) == 0
+		&& header.channels == 4
+		&& header.format <= uint32_t(bc::Format::eBC7)
+		&& header.levels >= 1
+		&& header.levels <= mip::count(header.width, header.height);
+
+	if (!valid)
+		return false;
+
+	mip::Level last = bc::layout(format, header.width, header.height, header.levels).back();
+	if (file.size() < sizeof(header) + last.offset + last.size)
+		return false;
+
+	pixels.width = header.width;
+	pixels.height = header.height;
+	pixels.levels = header.levels;
+	pixels.mip_levels = header.levels;
+	pixels.blit = false;
+	pixels.flip = false;
+
+	const byte *data = (const byte *) file.data() + sizeof(header);
+	if (supports_compression(phdev, format)) {
+		pixels.format = texture_format(format);
+		pixels.file = std::move(file);
+		pack_levels(pixels, data, bc::layout(format,
+			header.width, header.height, header.levels));
+	} else {
+		pixels.format = vk::Format::eR8G8B8A8Unorm;
+		pixels.chain = bc::decompress(data, header.width, header.height, header.levels, format);
+		pack_levels(pixels, pixels.chain.data(), mip::layout(header.width,
+			header.height, header.levels));
+	}
+
+	return true;
+}
+
+// Read pixels from a KTX2 or DDS container; levels are copied
+// straight from the mapping, in whatever format they are stored
+static bool read_container(const vk::raii::PhysicalDevice &phdev,
+		const std::string &filename,
+		TexturePixels &pixels)
+{
+	vfs::File file = vfs::open(filename);
+	if (!file.valid()) {
+		KOBRA_LOG_FUNC(error) << "File not found: " << filename << std::endl;
+		return false;
+	}
+
+	container::Texture texture;
+	if (!container::parse(filename, (const char *) file.data(), file.size(), texture)) {
+		KOBRA_LOG_FUNC(error) << "Failed to read texture container: " << filename << std::endl;
+		return false;
+	}
+
+	if (!supports_compression(phdev, texture.format)) {
+		KOBRA_LOG_FUNC(error) << "Texture format " << vk::to_string(texture.format)
+			<< " is not supported by the device: " << filename << std::endl;
+		return false;
+	}
+
+	// Rows are flipped while they are copied; so are BC1-BC5 blocks
+	// (along with the rows inside them), but not BC6H or BC7 blocks,
+	// which have to be exported y-up
+	bool compressed = vk::blockExtent(texture.format)[0] > 1;
+	bool flippable = !compressed || block_flip(texture.format) != BlockFlip::eNone;
+	if (texture.top_down && !flippable) {
+		KOBRA_LOG_FUNC(warn) << "Texture format " << vk::to_string(texture.format)
+			<< " is stored top down, and will be upside down (export it y-up): "
+			<< filename << std::endl;
+	}
+
+	// Blocks cannot move rows across their edges, so levels over a
+	// block high whose height is not a multiple of 4 end up shifted
+	if (texture.top_down && compressed && flippable) {
+		for (const mip::Level &level : texture.levels) {
+			if (level.height > 4 && level.height % 4 != 0) {
+				KOBRA_LOG_FUNC(warn) << "Height of level " << level.width << "x" << level.height
+					<< " is not a multiple of 4; its rows will be off by "
+					<< 4 - level.height % 4 << ": " << filename << std::endl;
+				break;
+			}
+		}
+	}
+
+	pixels.width = texture.width;
+	pixels.height = texture.height;
+	pixels.mip_levels = texture.levels.size();
+	pixels.blit = false;
+	pixels.flip = texture.top_down && flippable;
+	pixels.format = texture.format;
+
+	pack_levels(pixels, (const byte *) file.data(), texture.levels);
+	pixels.file = std::move(file);
+
+	return true;
+}
+
+// Decode a texture file, with its mip chain
+bool load_texture_pixels(const vk::raii::PhysicalDevice &phdev,
 		const std::string &filename,
 		vk::ImageTiling tiling,
-		vk::ImageUsageFlags usage,
-		vk::MemoryPropertyFlags memory_properties,
-		vk::ImageAspectFlags aspect_mask)
+		TexturePixels &pixels,
+		const TextureCompression &compression,
+		TextureRole role)
 {
-	// Check if the file exists
-	KOBRA_ASSERT(common::file_exists(filename), "File not found: " + filename);
+	static constexpr vk::Format format = vk::Format::eR8G8B8A8Unorm;
+
+	// Containers are uploaded as they are stored
+	if (container::is_container(filename))
+		return read_container(phdev, filename, pixels);
 
-	// Load the image
-	int width;
-	int height;
+	// So are baked textures (atlases) that are loaded directly
+	if (std::filesystem::path(filename).extension() == ".ktex") {
+		if (read_baked(phdev, vfs::open(filename), pixels))
+			return true;
+
+		KOBRA_LOG_FUNC(error) << "Failed to read baked texture: " << filename << std::endl;
+		return false;
+	}
+
+	// Use the baked version (with its mips) if it is up to date
+	std::string baked = bake::lookup(bake::texture, filename);
+	if (!baked.empty() && read_baked(phdev, vfs::open(baked), pixels))
+		return true;
+
+	vfs::File file = vfs::open(filename);
+	if (!file.valid()) {
+		KOBRA_LOG_FUNC(error) << "File not found: " << filename << std::endl;
+		return false;
+	}
+
+	// Compressed textures are cached by the contents of their source
+	// (and how they were compressed), so that they are only compressed
+	// once; decoding is skipped altogether when there is a hit
+	std::string cached;
+	if (compression.enabled) {
+		uint64_t seed = bake::hash(filename.data(), filename.size(),
+			uint64_t(compression.preset));
+		seed = bake::hash((const char *) &role, sizeof(role), seed);
+
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.ktex",
+			(unsigned long long) bake::hash(file.data(), file.size(), seed));
+
+		cached = bake::directory() + "/textures/" + name;
+
+		if (std::filesystem::exists(cached)
+				&& read_baked(phdev, vfs::open(cached), pixels)
+				&& pixels.format != format)
+			return true;
+
+		pixels = TexturePixels();
+	}
+
+	// Every loader flips, so decoding on several
+	// threads at once does not race on the flag
+	int width = 0;
+	int height = 0;
 	int channels;
 
 	stbi_set_flip_vertically_on_load(true);
-	byte *data = stbi_load(filename.c_str(), &width, &height, &channels, 4);
-	KOBRA_ASSERT(data, "Failed to load texture image");
+	byte *decoded = stbi_load_from_memory(
+		(const stbi_uc *) file.data(), file.size(),
+		&width, &height, &channels, 4
+	);
 
-	// Create the image
-	vk::Extent2D extent {
-		static_cast <uint32_t> (width),
-		static_cast <uint32_t> (height)
-	};
+	if (!decoded) {
+		KOBRA_LOG_FUNC(error) << "Failed to load texture image: " << filename << std::endl;
+		return false;
+	}
+
+	pixels.width = width;
+	pixels.height = height;
+	pixels.mip_levels = mip::count(width, height);
+
+	bc::Format target = bc::Format::eNone;
+	if (compression.enabled) {
+		target = bc::select(role, decoded, width, height, compression.preset);
+		if (!supports_compression(phdev, target))
+			target = bc::Format::eNone;
+	}
+
+	// The remaining levels are only generated with blits for
+	// uncompressed data, as blits on UNORM images do not filter
+	// sRGB content in linear space
+	bool srgb = mip::is_srgb(role);
+	pixels.blit = !srgb && target == bc::Format::eNone
+		&& tiling == vk::ImageTiling::eOptimal
+		&& supports_mip_blit(phdev, format);
+
+	uint32_t levels = 1;
+	if (pixels.blit) {
+		pixels.chain.assign(decoded, decoded + size_t(width) * height * 4);
+	} else {
+		pixels.chain = mip::generate(decoded, width, height, mip::Filter::eKaiser, srgb);
+		levels = pixels.mip_levels;
+	}
+
+	stbi_image_free(decoded);
+
+	pixels.format = texture_format(target);
+	if (target != bc::Format::eNone) {
+		pixels.chain = bc::compress(pixels.chain.data(), width, height,
+			levels, target, compression.preset);
+
+		bake::TextureHeader header {
+			.magic = {'K', 'T', 'E', 'X'},
+			.width = (uint32_t) width,
+			.height = (uint32_t) height,
+			.channels = 4,
+			.levels = levels,
+			.format = uint32_t(target)
+		};
+
+		std::string data;
+		data.append((const char *) &header, sizeof(header));
+		data.append((const char *) pixels.chain.data(), pixels.chain.size());
+
+		// Not being able to cache is not an error
+		std::error_code ec;
+		std::filesystem::create_directories(bake::directory() + "/textures", ec);
+		if (!ec)
+			common::write_file(cached, data);
+	}
+
+	pack_levels(pixels, pixels.chain.data(), bc::layout(target, width, height, levels));
+	return true;
+}
+
+// Record the upload of decoded pixels from a staging buffer
+ImageData upload_texture(const vk::raii::CommandBuffer &cmd,
+		const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &device,
+		const TexturePixels &pixels,
+		const BufferData &buffer,
+		vk::DeviceSize offset,
+		vk::ImageTiling tiling,
+		vk::ImageUsageFlags usage,
+		vk::MemoryPropertyFlags memory_properties,
+		vk::ImageAspectFlags aspect_mask,
+		uint32_t first)
+{
+	KOBRA_ASSERT(first == 0 || !pixels.blit,
+		"Textures with levels generated on the GPU are uploaded whole");
+
+	if (pixels.blit)
+		usage |= vk::ImageUsageFlagBits::eTransferSrc;
+
+	// Create the image, from the first level down
+	const mip::Level &top = pixels.layout[first];
+	uint32_t levels = pixels.mip_levels - first;
 
 	ImageData img = ImageData(
 		phdev, device,
-		vk::Format::eR8G8B8A8Unorm,
-		extent,
+		pixels.format,
+		vk::Extent2D {top.width, top.height},
 		tiling,
-		usage,
+		usage | vk::ImageUsageFlagBits::eTransferDst,
 		vk::ImageLayout::ePreinitialized,
 		memory_properties,
-		aspect_mask
+		aspect_mask,
+		levels
 	);
 
-	// Copy the image data into a staging buffer
-	vk::DeviceSize size = width * height * vk::blockSize(img.format);
-
-	buffer = BufferData(
-		phdev, device,
-		size,
-		vk::BufferUsageFlagBits::eTransferSrc,
-		vk::MemoryPropertyFlagBits::eHostVisible
-			| vk::MemoryPropertyFlagBits::eHostCoherent
-	);
+	// Single channel textures read as grayscale
+	if (pixels.format == vk::Format::eBc4UnormBlock
+			|| pixels.format == vk::Format::eR8Unorm) {
+		vk::ComponentMapping gray {
+			vk::ComponentSwizzle::eR,
+			vk::ComponentSwizzle::eR,
+			vk::ComponentSwizzle::eR,
+			vk::ComponentSwizzle::eOne
+		};
 
-	// Copy the data
-	buffer.upload(data, size);
+		img.view = vk::raii::ImageView {
+			device,
+			vk::ImageViewCreateInfo {
+				{}, *img.image, vk::ImageViewType::e2D,
+				img.format, gray, {aspect_mask, 0, img.mip_levels, 0, 1}
+			}
+		};
+	}
 
 	// First transition the image to the transfer destination layout
 	transition_image_layout(cmd,
 		*img.image, img.format,
 		vk::ImageLayout::ePreinitialized,
-		vk::ImageLayout::eTransferDstOptimal
+		vk::ImageLayout::eTransferDstOptimal,
+		levels
 	);
 
-	// Copy the buffer to the image
-	copy_data_to_image(cmd,
-		buffer.buffer, img.image,
-		img.format, width, height
-	);
+	// Copy the levels that are available
+	for (uint32_t i = first; i < pixels.levels; i++) {
+		const mip::Level &level = pixels.layout[i];
+		copy_data_to_image(cmd,
+			buffer.buffer, img.image,
+			img.format, level.width, level.height,
+			i - first, offset + (level.offset - top.offset)
+		);
+	}
 
-	// Transition the image to the shader read layout
-	transition_image_layout(cmd,
-		*img.image, img.format,
-		vk::ImageLayout::eTransferDstOptimal,
-		vk::ImageLayout::eShaderReadOnlyOptimal
-	);
+	// Generate the rest on the GPU if needed, and then
+	// transition the image to the shader read layout
+	if (pixels.blit) {
+		blit_mips(cmd, img);
+	} else {
+		transition_image_layout(cmd,
+			*img.image, img.format,
+			vk::ImageLayout::eTransferDstOptimal,
+			vk::ImageLayout::eShaderReadOnlyOptimal,
+			levels
+		);
+
+		img.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	}
 
 	return img;
 }
 
+// Create ImageData object from a file, with a full mip chain
+ImageData make_image(const vk::raii::CommandBuffer &cmd,
+		const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &device,
+		BufferData &buffer,
+		const std::string &filename,
+		vk::ImageTiling tiling,
+		vk::ImageUsageFlags usage,
+		vk::MemoryPropertyFlags memory_properties,
+		vk::ImageAspectFlags aspect_mask)
+{
+	// Not compressed, as these are also used for interface sprites
+	TexturePixels pixels;
+	KOBRA_ASSERT(load_texture_pixels(phdev, filename, tiling, pixels,
+			TextureCompression {.enabled = false}),
+		"Failed to load texture image: " + filename);
+
+	// Copy the image data into a staging buffer
+	buffer = BufferData(
+		phdev, device,
+		pixels.size,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::MemoryPropertyFlagBits::eHostVisible
+			| vk::MemoryPropertyFlagBits::eHostCoherent
+	);
+
+	byte *ptr = (byte *) buffer.memory.mapMemory(0, pixels.size);
+	copy_texture_pixels(pixels, ptr);
+	buffer.memory.unmapMemory();
+
+	return upload_texture(cmd,
+		phdev, device,
+		pixels, buffer, 0,
+		tiling, usage,
+		memory_properties, aspect_mask
+	);
+}
+
 // Buffer addresses
 vk::DeviceAddress buffer_addr(const vk::raii::Device &device, const BufferData &bd)
 {
@@ -0,0 +1,347 @@
+// Standard headers
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+// Unix headers
+#include <sys/stat.h>
+
+// Engine headers
+#include "../include/bake.hpp"
+#include "../include/common.hpp"
+#include "../include/logger.hpp"
+#include "../include/mapped_file.hpp"
+
+namespace kobra {
+
+namespace bake {
+
+const std::string &directory()
+{
+	static const std::string dir = [] {
+		const char *env = std::getenv("KOBRA_CACHE");
+		return std::string((env && env[0]) ? env : ".kobra_cache");
+	} ();
+
+	return dir;
+}
+
+// FNV-1a over 64-bit words, then bytes; not cryptographic,
+// only meant to notice that a file has changed
+uint64_t hash(const char *data, size_t size, uint64_t seed)
+{
+	uint64_t h = 0xcbf29ce484222325ull ^ seed;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t w;
+		std::memcpy(&w, data + i, 8);
+		h = (h ^ w) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+
+	for (; i < size; i++)
+		h = (h ^ (unsigned char) data[i]) * 0x100000001b3ull;
+
+	return h ^ size;
+}
+
+// xxHash64: four lanes of 64-bit words, merged, then the tail
+static constexpr uint64_t prime1 = 0x9e3779b185ebca87ull;
+static constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+static constexpr uint64_t prime3 = 0x165667b19e3779f9ull;
+static constexpr uint64_t prime4 = 0x85ebca77c2b2ae63ull;
+static constexpr uint64_t prime5 = 0x27d4eb2f165667c5ull;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix(uint64_t acc, uint64_t input)
+{
+	return rotl(acc + input * prime2, 31) * prime1;
+}
+
+static inline uint64_t merge(uint64_t h, uint64_t acc)
+{
+	return (h ^ mix(0, acc)) * prime1 + prime4;
+}
+
+uint64_t fingerprint(const char *data, size_t size, uint64_t seed)
+{
+	const char *end = data + size;
+	uint64_t h;
+
+	auto read64 = [](const char *p) {
+		uint64_t v;
+		std::memcpy(&v, p, 8);
+		return v;
+	};
+
+	if (size >= 32) {
+		uint64_t v1 = seed + prime1 + prime2;
+		uint64_t v2 = seed + prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime1;
+
+		for (; data + 32 <= end; data += 32) {
+			v1 = mix(v1, read64(data));
+			v2 = mix(v2, read64(data + 8));
+			v3 = mix(v3, read64(data + 16));
+			v4 = mix(v4, read64(data + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge(h, v1);
+		h = merge(h, v2);
+		h = merge(h, v3);
+		h = merge(h, v4);
+	} else {
+		h = seed + prime5;
+	}
+
+	h += size;
+
+	for (; data + 8 <= end; data += 8)
+		h = rotl(h ^ mix(0, read64(data)), 27) * prime1 + prime4;
+
+	if (data + 4 <= end) {
+		uint32_t v;
+		std::memcpy(&v, data, 4);
+		h = rotl(h ^ (uint64_t(v) * prime1), 23) * prime2 + prime3;
+		data += 4;
+	}
+
+	for (; data < end; data++)
+		h = rotl(h ^ ((unsigned char) *data * prime5), 11) * prime1;
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+bool hash_file(const std::string &path, uint64_t &h)
+{
+	MappedFile file(path);
+	if (file.valid()) {
+		h = hash(file.data(), file.size());
+		return true;
+	}
+
+	// Empty files are not mapped
+	struct ::stat st;
+	if (::stat(path.c_str(), &st) == 0 && st.st_size == 0) {
+		h = hash(nullptr, 0);
+		return true;
+	}
+
+	return false;
+}
+
+bool stat(const std::string &path, Dependency &dep)
+{
+	struct ::stat st;
+	if (::stat(path.c_str(), &st) != 0)
+		return false;
+
+	dep.size = st.st_size;
+	dep.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000ll + st.st_mtim.tv_nsec;
+	return true;
+}
+
+uint64_t key(const std::string &kind, const std::vector <Dependency> &deps)
+{
+	uint64_t h = hash(kind.data(), kind.size(), version);
+	for (const Dependency &dep : deps) {
+		h = hash(dep.path.data(), dep.path.size(), h);
+		h = hash((const char *) &dep.hash, sizeof(dep.hash), h);
+	}
+
+	return h;
+}
+
+// Manifest format, one line per field:
+//	[OUTPUT]
+//	kind: <kind>
+//	source: <path>
+//	output: <file>
+//	key: <hex>
+//	dependency: <size> <mtime> <hex hash> <path>
+Manifest read_manifest(const std::string &dir)
+{
+	Manifest manifest;
+
+	std::ifstream fin(dir + "/manifest");
+	if (!fin.is_open())
+		return manifest;
+
+	// Values of a "key: value" line
+	auto value = [](const std::string &line, const char *key) -> const char * {
+		size_t n = std::strlen(key);
+		if (line.compare(0, n, key) != 0 || line.size() < n + 2)
+			return nullptr;
+
+		return line.c_str() + n + 2;
+	};
+
+	Record record;
+	bool open = false;
+
+	auto flush = [&]() {
+		if (open && !record.kind.empty() && !record.output.empty())
+			manifest[id(record.kind, record.source)] = record;
+
+		record = Record {};
+	};
+
+	std::string line;
+	while (std::getline(fin, line)) {
+		const char *v;
+		if (line == "[OUTPUT]") {
+			flush();
+			open = true;
+		} else if ((v = value(line, "kind"))) {
+			record.kind = v;
+		} else if ((v = value(line, "source"))) {
+			record.source = v;
+		} else if ((v = value(line, "output"))) {
+			record.output = v;
+		} else if ((v = value(line, "key"))) {
+			record.key = std::strtoull(v, nullptr, 16);
+		} else if ((v = value(line, "dependency"))) {
+			Dependency dep;
+			unsigned long long size, hash;
+			long long mtime;
+			int n = 0;
+
+			if (std::sscanf(v, "%llu %lld %llx %n", &size, &mtime, &hash, &n) == 3 && n > 0) {
+				dep.size = size;
+				dep.mtime = mtime;
+				dep.hash = hash;
+				dep.path = v + n;
+				record.dependencies.push_back(dep);
+			}
+		}
+	}
+
+	flush();
+	return manifest;
+}
+
+bool write_manifest(const std::string &dir, const Manifest &manifest)
+{
+	std::string out;
+	for (const auto &[name, record] : manifest) {
+		char buf[64];
+
+		out += "[OUTPUT]\n";
+		out += "kind: " + record.kind + "\n";
+		out += "source: " + record.source + "\n";
+		out += "output: " + record.output + "\n";
+
+		std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) record.key);
+		out += "key: " + std::string(buf) + "\n";
+
+		for (const Dependency &dep : record.dependencies) {
+			std::snprintf(buf, sizeof(buf), "%llu %lld %016llx ",
+				(unsigned long long) dep.size,
+				(long long) dep.mtime,
+				(unsigned long long) dep.hash);
+
+			out += "dependency: " + std::string(buf) + dep.path + "\n";
+		}
+	}
+
+	return common::write_file(dir + "/manifest", out);
+}
+
+// Manifest of the cache directory, read once, when it is
+// first needed (the caller holds the lock)
+static std::mutex manifest_mutex;
+
+static const Manifest &cached_manifest()
+{
+	static bool loaded = false;
+	static Manifest manifest;
+
+	if (!loaded) {
+		manifest = read_manifest(directory());
+		loaded = true;
+	}
+
+	return manifest;
+}
+
+// Checking the contents would cost as much as loading the
+// sources, so the state of the files has to do
+static bool up_to_date(const Record &record)
+{
+	for (const Dependency &dep : record.dependencies) {
+		Dependency now;
+		if (!stat(dep.path, now) || now.size != dep.size || now.mtime != dep.mtime)
+			return false;
+	}
+
+	return true;
+}
+
+std::string lookup(const std::string &kind, const std::string &source)
+{
+	std::lock_guard <std::mutex> lock(manifest_mutex);
+
+	const Manifest &manifest = cached_manifest();
+
+	auto it = manifest.find(id(kind, source));
+	if (it == manifest.end() || !up_to_date(it->second))
+		return "";
+
+	return directory() + "/" + it->second.output;
+}
+
+std::string lookup_member(const std::string &kind, const std::string &source)
+{
+	std::lock_guard <std::mutex> lock(manifest_mutex);
+
+	const Manifest &manifest = cached_manifest();
+
+	// Outputs by their sources, and whether they are up to date;
+	// outputs have many sources, so both are only worked out once
+	static std::map <std::string, std::string> members;
+	static std::map <std::string, bool> fresh;
+	static bool indexed = false;
+
+	if (!indexed) {
+		for (const auto &[name, record] : manifest) {
+			for (const Dependency &dep : record.dependencies)
+				members[id(record.kind, dep.path)] = name;
+		}
+
+		indexed = true;
+	}
+
+	auto it = members.find(id(kind, source));
+	if (it == members.end())
+		return "";
+
+	const Record &record = manifest.at(it->second);
+
+	auto f = fresh.find(it->second);
+	if (f == fresh.end())
+		f = fresh.insert({it->second, up_to_date(record)}).first;
+
+	if (!f->second)
+		return "";
+
+	return directory() + "/" + record.output;
+}
+
+}
+
+}
@@ -0,0 +1,863 @@
+// Standard headers
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Engine headers
+#include "../include/block_compression.hpp"
+#include "../include/thread_pool.hpp"
+
+namespace kobra {
+
+namespace bc {
+
+const char *name(Format format)
+{
+	switch (format) {
+	case Format::eNone:
+		return "RGBA8";
+	case Format::eBC1:
+		return "BC1";
+	case Format::eBC3:
+		return "BC3";
+	case Format::eBC4:
+		return "BC4";
+	case Format::eBC5:
+		return "BC5";
+	case Format::eBC7:
+		return "BC7";
+	}
+
+	return "?";
+}
+
+std::vector <mip::Level> layout(Format format, uint32_t width, uint32_t height, uint32_t levels)
+{
+	if (format == Format::eNone)
+		return mip::layout(width, height, levels);
+
+	std::vector <mip::Level> result;
+
+	size_t offset = 0;
+	for (uint32_t i = 0; i < levels; i++) {
+		size_t blocks = size_t((width + 3)/4) * ((height + 3)/4);
+		size_t size = blocks * block_bytes(format);
+		result.push_back(mip::Level {width, height, offset, size});
+
+		offset += size;
+		width = std::max(width/2, 1u);
+		height = std::max(height/2, 1u);
+	}
+
+	return result;
+}
+
+Format select(TextureRole role, const uint8_t *pixels,
+		uint32_t width, uint32_t height, Preset preset)
+{
+	if (role == TextureRole::eNormal)
+		return Format::eBC5;
+
+	bool gray = true;
+	bool opaque = true;
+
+	for (size_t i = 0; i < size_t(width) * height && (gray || opaque); i++) {
+		const uint8_t *p = &pixels[4 * i];
+		gray &= (p[0] == p[1] && p[1] == p[2]);
+		opaque &= (p[3] == 255);
+	}
+
+	if (gray && opaque)
+		return Format::eBC4;
+
+	if (preset == Preset::eQuality)
+		return Format::eBC7;
+
+	return opaque ? Format::eBC1 : Format::eBC3;
+}
+
+//////////////////////
+// Block operations //
+//////////////////////
+
+// A 4x4 block of RGBA8 pixels, row by row
+using Block = std::array <std::array <uint8_t, 4>, 16>;
+
+static Block fetch(const uint8_t *pixels, uint32_t width, uint32_t height, uint32_t bx, uint32_t by)
+{
+	Block block;
+	for (uint32_t y = 0; y < 4; y++) {
+		uint32_t py = std::min(4 * by + y, height - 1);
+		for (uint32_t x = 0; x < 4; x++) {
+			uint32_t px = std::min(4 * bx + x, width - 1);
+			std::memcpy(block[4 * y + x].data(), &pixels[4 * (size_t(py) * width + px)], 4);
+		}
+	}
+
+	return block;
+}
+
+// Principal axis of the first n channels of a block, by power
+// iteration on the covariance; returns false for flat blocks
+static bool principal_axis(const Block &block, int n, int iterations,
+		float mean[4], float axis[4])
+{
+	for (int c = 0; c < 4; c++)
+		mean[c] = axis[c] = 0.0f;
+
+	for (const auto &p : block) {
+		for (int c = 0; c < n; c++)
+			mean[c] += p[c];
+	}
+
+	for (int c = 0; c < n; c++)
+		mean[c] /= 16.0f;
+
+	float cov[4][4] = {};
+	for (const auto &p : block) {
+		float d[4];
+		for (int c = 0; c < n; c++)
+			d[c] = p[c] - mean[c];
+
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++)
+				cov[i][j] += d[i] * d[j];
+		}
+	}
+
+	// Start from the diagonal of largest variance
+	float v[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	for (int c = 0; c < n; c++)
+		v[c] = cov[c][c] + 1e-3f;
+
+	for (int k = 0; k < iterations; k++) {
+		float w[4] = {};
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++)
+				w[i] += cov[i][j] * v[j];
+		}
+
+		float norm = 0.0f;
+		for (int c = 0; c < n; c++)
+			norm = std::max(norm, std::abs(w[c]));
+
+		if (norm < 1e-6f)
+			return false;
+
+		for (int c = 0; c < n; c++)
+			v[c] = w[c]/norm;
+	}
+
+	float length = 0.0f;
+	for (int c = 0; c < n; c++)
+		length += v[c] * v[c];
+
+	length = std::sqrt(length);
+	if (length < 1e-6f)
+		return false;
+
+	for (int c = 0; c < n; c++)
+		axis[c] = v[c]/length;
+
+	return true;
+}
+
+// Endpoints of the projection of a block onto an axis
+static void project(const Block &block, int n, const float mean[4], const float axis[4],
+		float e0[4], float e1[4])
+{
+	float tmin = std::numeric_limits <float> ::max();
+	float tmax = -tmin;
+
+	for (const auto &p : block) {
+		float t = 0.0f;
+		for (int c = 0; c < n; c++)
+			t += (p[c] - mean[c]) * axis[c];
+
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+
+	for (int c = 0; c < n; c++) {
+		e0[c] = std::clamp(mean[c] + tmin * axis[c], 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + tmax * axis[c], 0.0f, 255.0f);
+	}
+}
+
+// Endpoints minimizing the squared error of a block, given the weight
+// of the second endpoint for each pixel; false if they are degenerate
+static bool least_squares(const Block &block, int n, const float weights[16],
+		float e0[4], float e1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ap[4] = {}, bp[4] = {};
+
+	for (int i = 0; i < 16; i++) {
+		float b = weights[i];
+		float a = 1.0f - b;
+
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+
+		for (int c = 0; c < n; c++) {
+			ap[c] += a * block[i][c];
+			bp[c] += b * block[i][c];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (std::abs(det) < 1e-6f)
+		return false;
+
+	for (int c = 0; c < n; c++) {
+		e0[c] = std::clamp((ap[c] * bb - bp[c] * ab)/det, 0.0f, 255.0f);
+		e1[c] = std::clamp((bp[c] * aa - ap[c] * ab)/det, 0.0f, 255.0f);
+	}
+
+	return true;
+}
+
+/////////
+// BC1 //
+/////////
+
+static uint16_t pack_565(const float c[4])
+{
+	uint32_t r = std::lround(c[0] * 31.0f/255.0f);
+	uint32_t g = std::lround(c[1] * 63.0f/255.0f);
+	uint32_t b = std::lround(c[2] * 31.0f/255.0f);
+	return (r << 11) | (g << 5) | b;
+}
+
+static void unpack_565(uint16_t v, int c[3])
+{
+	int r = (v >> 11) & 31;
+	int g = (v >> 5) & 63;
+	int b = v & 31;
+
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+// Four color palette of a pair of endpoints (c0 > c1)
+static void palette_bc1(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c])/3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c])/3;
+	}
+}
+
+// Indices for a pair of endpoints, and the resulting error
+static int indices_bc1(const Block &block, uint16_t c0, uint16_t c1, uint8_t indices[16])
+{
+	int palette[4][3];
+	palette_bc1(c0, c1, palette);
+
+	int error = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = std::numeric_limits <int> ::max();
+		for (int k = 0; k < 4; k++) {
+			int d = 0;
+			for (int c = 0; c < 3; c++) {
+				int x = int(block[i][c]) - palette[k][c];
+				d += x * x;
+			}
+
+			if (d < best) {
+				best = d;
+				indices[i] = k;
+			}
+		}
+
+		error += best;
+	}
+
+	return error;
+}
+
+// Endpoints in four color mode; false if they are equal
+static bool order_bc1(const float e0[4], const float e1[4], uint16_t &c0, uint16_t &c1)
+{
+	c0 = pack_565(e1);
+	c1 = pack_565(e0);
+
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	return c0 != c1;
+}
+
+static void write_bc1(uint16_t c0, uint16_t c1, const uint8_t indices[16], uint8_t *out)
+{
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= uint32_t(indices[i]) << (2 * i);
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	std::memcpy(out + 4, &bits, 4);
+}
+
+static void encode_bc1(const Block &block, Preset preset, uint8_t *out)
+{
+	float mean[4], axis[4];
+	float e0[4], e1[4];
+
+	if (!principal_axis(block, 3, (preset == Preset::eQuality) ? 8 : 4, mean, axis)) {
+		// Flat block; the mean is the color
+		uint16_t c = pack_565(mean);
+		uint8_t indices[16] = {};
+		write_bc1(c, c, indices, out);
+		return;
+	}
+
+	project(block, 3, mean, axis, e0, e1);
+
+	uint16_t c0, c1;
+	uint8_t indices[16] = {};
+	int error = 0;
+
+	if (order_bc1(e0, e1, c0, c1))
+		error = indices_bc1(block, c0, c1, indices);
+
+	// Refine the endpoints from the current indices
+	if (preset == Preset::eQuality && c0 != c1) {
+		static constexpr float weight[4] = {0.0f, 1.0f, 1.0f/3.0f, 2.0f/3.0f};
+
+		for (int k = 0; k < 2; k++) {
+			float weights[16];
+			for (int i = 0; i < 16; i++)
+				weights[i] = weight[indices[i]];
+
+			float a[4], b[4];
+			if (!least_squares(block, 3, weights, a, b))
+				break;
+
+			uint16_t r0, r1;
+			uint8_t refined[16];
+			if (!order_bc1(a, b, r0, r1))
+				break;
+
+			int e = indices_bc1(block, r0, r1, refined);
+			if (e >= error)
+				break;
+
+			c0 = r0;
+			c1 = r1;
+			error = e;
+			std::memcpy(indices, refined, 16);
+		}
+	}
+
+	if (c0 == c1)
+		std::memset(indices, 0, 16);
+
+	write_bc1(c0, c1, indices, out);
+}
+
+static void decode_bc1(const uint8_t *in, Block &block)
+{
+	uint16_t c0 = in[0] | (in[1] << 8);
+	uint16_t c1 = in[2] | (in[3] << 8);
+
+	uint32_t bits;
+	std::memcpy(&bits, in + 4, 4);
+
+	int palette[4][3];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+
+	bool opaque = c0 > c1;
+	for (int c = 0; c < 3; c++) {
+		if (opaque) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c])/3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c])/3;
+		} else {
+			palette[2][c] = (palette[0][c] + palette[1][c])/2;
+			palette[3][c] = 0;
+		}
+	}
+
+	for (int i = 0; i < 16; i++) {
+		int k = (bits >> (2 * i)) & 3;
+		for (int c = 0; c < 3; c++)
+			block[i][c] = palette[k][c];
+
+		block[i][3] = (!opaque && k == 3) ? 0 : 255;
+	}
+}
+
+/////////
+// BC4 //
+/////////
+
+// Eight value palette (e0 > e1)
+static void palette_bc4(int e0, int e1, int palette[8])
+{
+	palette[0] = e0;
+	palette[1] = e1;
+	for (int i = 1; i < 7; i++)
+		palette[i + 1] = ((7 - i) * e0 + i * e1)/7;
+}
+
+static int indices_bc4(const uint8_t values[16], int e0, int e1, uint8_t indices[16])
+{
+	int palette[8];
+	palette_bc4(e0, e1, palette);
+
+	int error = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = std::numeric_limits <int> ::max();
+		for (int k = 0; k < 8; k++) {
+			int d = int(values[i]) - palette[k];
+			if (d * d < best) {
+				best = d * d;
+				indices[i] = k;
+			}
+		}
+
+		error += best;
+	}
+
+	return error;
+}
+
+static void encode_bc4(const uint8_t values[16], Preset preset, uint8_t *out)
+{
+	int lo = 255;
+	int hi = 0;
+	for (int i = 0; i < 16; i++) {
+		lo = std::min <int> (lo, values[i]);
+		hi = std::max <int> (hi, values[i]);
+	}
+
+	uint8_t indices[16] = {};
+	int e0 = hi;
+	int e1 = lo;
+
+	if (hi > lo) {
+		int error = indices_bc4(values, e0, e1, indices);
+
+		// Insetting the endpoints can place the palette
+		// closer to the values in between
+		int range = (preset == Preset::eQuality) ? std::min(4, (hi - lo)/4) : 0;
+		for (int a = hi; a >= hi - range; a--) {
+			for (int b = lo; b <= lo + range; b++) {
+				if (a <= b || (a == hi && b == lo))
+					continue;
+
+				uint8_t candidate[16];
+				int e = indices_bc4(values, a, b, candidate);
+				if (e < error) {
+					error = e;
+					e0 = a;
+					e1 = b;
+					std::memcpy(indices, candidate, 16);
+				}
+			}
+		}
+	}
+
+	uint64_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= uint64_t(indices[i]) << (3 * i);
+
+	out[0] = e0;
+	out[1] = e1;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+static void decode_bc4(const uint8_t *in, uint8_t values[16])
+{
+	int e0 = in[0];
+	int e1 = in[1];
+
+	int palette[8];
+	if (e0 > e1) {
+		palette_bc4(e0, e1, palette);
+	} else {
+		palette[0] = e0;
+		palette[1] = e1;
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = ((5 - i) * e0 + i * e1)/5;
+
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= uint64_t(in[2 + i]) << (8 * i);
+
+	for (int i = 0; i < 16; i++)
+		values[i] = palette[(bits >> (3 * i)) & 7];
+}
+
+static void channel(const Block &block, int c, uint8_t values[16])
+{
+	for (int i = 0; i < 16; i++)
+		values[i] = block[i][c];
+}
+
+/////////
+// BC7 //
+/////////
+
+// Interpolation weights of 4-bit indices
+static constexpr int bc7_weights[16] = {
+	0, 4, 9, 13, 17, 21, 26, 30,
+	34, 38, 43, 47, 51, 55, 60, 64
+};
+
+// Writes bits in order, least significant first
+struct BitWriter {
+	uint8_t	*out;
+	int	position = 0;
+
+	void write(uint32_t value, int count) {
+		for (int i = 0; i < count; i++, position++) {
+			if (value & (1u << i))
+				out[position/8] |= 1u << (position % 8);
+		}
+	}
+};
+
+struct BitReader {
+	const uint8_t	*in;
+	int		position = 0;
+
+	uint32_t read(int count) {
+		uint32_t value = 0;
+		for (int i = 0; i < count; i++, position++)
+			value |= uint32_t((in[position/8] >> (position % 8)) & 1) << i;
+
+		return value;
+	}
+};
+
+// Mode 6 endpoint: seven bits per channel and a shared p-bit,
+// chosen to minimize the error of the expanded value
+static void quantize_bc7(const float e[4], uint8_t q[4], uint8_t &p)
+{
+	float best = std::numeric_limits <float> ::max();
+	for (int pbit = 0; pbit < 2; pbit++) {
+		uint8_t candidate[4];
+		float error = 0.0f;
+
+		for (int c = 0; c < 4; c++) {
+			int v = std::clamp((int) std::lround((e[c] - pbit)/2.0f), 0, 127);
+			candidate[c] = v;
+
+			float d = float((v << 1) | pbit) - e[c];
+			error += d * d;
+		}
+
+		if (error < best) {
+			best = error;
+			p = pbit;
+			std::memcpy(q, candidate, 4);
+		}
+	}
+}
+
+static int indices_bc7(const Block &block, const uint8_t q0[4], uint8_t p0,
+		const uint8_t q1[4], uint8_t p1, uint8_t indices[16])
+{
+	int palette[16][4];
+	for (int c = 0; c < 4; c++) {
+		int a = (q0[c] << 1) | p0;
+		int b = (q1[c] << 1) | p1;
+		for (int k = 0; k < 16; k++)
+			palette[k][c] = ((64 - bc7_weights[k]) * a + bc7_weights[k] * b + 32) >> 6;
+	}
+
+	int error = 0;
+	for (int i = 0; i < 16; i++) {
+		int best = std::numeric_limits <int> ::max();
+		for (int k = 0; k < 16; k++) {
+			int d = 0;
+			for (int c = 0; c < 4; c++) {
+				int x = int(block[i][c]) - palette[k][c];
+				d += x * x;
+			}
+
+			if (d < best) {
+				best = d;
+				indices[i] = k;
+			}
+		}
+
+		error += best;
+	}
+
+	return error;
+}
+
+static void encode_bc7(const Block &block, Preset preset, uint8_t *out)
+{
+	float mean[4], axis[4];
+	float e0[4], e1[4];
+
+	if (principal_axis(block, 4, (preset == Preset::eQuality) ? 8 : 4, mean, axis)) {
+		project(block, 4, mean, axis, e0, e1);
+	} else {
+		std::memcpy(e0, mean, sizeof(mean));
+		std::memcpy(e1, mean, sizeof(mean));
+	}
+
+	uint8_t q0[4], q1[4], p0, p1;
+	quantize_bc7(e0, q0, p0);
+	quantize_bc7(e1, q1, p1);
+
+	uint8_t indices[16];
+	int error = indices_bc7(block, q0, p0, q1, p1, indices);
+
+	// Refine the endpoints from the current indices
+	if (preset == Preset::eQuality && error > 0) {
+		for (int k = 0; k < 2; k++) {
+			float weights[16];
+			for (int i = 0; i < 16; i++)
+				weights[i] = bc7_weights[indices[i]]/64.0f;
+
+			float a[4], b[4];
+			if (!least_squares(block, 4, weights, a, b))
+				break;
+
+			uint8_t r0[4], r1[4], rp0, rp1;
+			quantize_bc7(a, r0, rp0);
+			quantize_bc7(b, r1, rp1);
+
+			uint8_t refined[16];
+			int e = indices_bc7(block, r0, rp0, r1, rp1, refined);
+			if (e >= error)
+				break;
+
+			std::memcpy(q0, r0, 4);
+			std::memcpy(q1, r1, 4);
+			p0 = rp0;
+			p1 = rp1;
+			error = e;
+			std::memcpy(indices, refined, 16);
+		}
+	}
+
+	// The most significant bit of the first index is implied to be
+	// zero; swapping the endpoints mirrors the indices otherwise
+	if (indices[0] & 8) {
+		std::swap(q0, q1);
+		std::swap(p0, p1);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	std::memset(out, 0, 16);
+
+	BitWriter writer {out};
+	writer.write(1 << 6, 7);
+
+	for (int c = 0; c < 4; c++) {
+		writer.write(q0[c], 7);
+		writer.write(q1[c], 7);
+	}
+
+	writer.write(p0, 1);
+	writer.write(p1, 1);
+
+	writer.write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.write(indices[i], 4);
+}
+
+static void decode_bc7(const uint8_t *in, Block &block)
+{
+	BitReader reader {in};
+
+	// Only mode 6 is ever written
+	if (reader.read(7) != (1 << 6)) {
+		for (auto &p : block)
+			p = {255, 0, 255, 255};
+
+		return;
+	}
+
+	uint32_t q[2][4];
+	for (int c = 0; c < 4; c++) {
+		q[0][c] = reader.read(7);
+		q[1][c] = reader.read(7);
+	}
+
+	uint32_t p0 = reader.read(1);
+	uint32_t p1 = reader.read(1);
+
+	for (int i = 0; i < 16; i++) {
+		int k = reader.read((i == 0) ? 3 : 4);
+		for (int c = 0; c < 4; c++) {
+			int a = (q[0][c] << 1) | p0;
+			int b = (q[1][c] << 1) | p1;
+			block[i][c] = ((64 - bc7_weights[k]) * a + bc7_weights[k] * b + 32) >> 6;
+		}
+	}
+}
+
+////////////
+// Levels //
+////////////
+
+static void encode_block(const Block &block, Format format, Preset preset, uint8_t *out)
+{
+	uint8_t values[16];
+
+	switch (format) {
+	case Format::eBC1:
+		encode_bc1(block, preset, out);
+		break;
+	case Format::eBC3:
+		channel(block, 3, values);
+		encode_bc4(values, preset, out);
+		encode_bc1(block, preset, out + 8);
+		break;
+	case Format::eBC4:
+		channel(block, 0, values);
+		encode_bc4(values, preset, out);
+		break;
+	case Format::eBC5:
+		channel(block, 0, values);
+		encode_bc4(values, preset, out);
+		channel(block, 1, values);
+		encode_bc4(values, preset, out + 8);
+		break;
+	case Format::eBC7:
+		encode_bc7(block, preset, out);
+		break;
+	default:
+		break;
+	}
+}
+
+static void decode_block(const uint8_t *in, Format format, Block &block)
+{
+	uint8_t values[16];
+
+	switch (format) {
+	case Format::eBC1:
+		decode_bc1(in, block);
+		break;
+	case Format::eBC3:
+		decode_bc1(in + 8, block);
+		decode_bc4(in, values);
+		for (int i = 0; i < 16; i++)
+			block[i][3] = values[i];
+		break;
+	case Format::eBC4:
+		decode_bc4(in, values);
+		for (int i = 0; i < 16; i++)
+			block[i] = {values[i], values[i], values[i], 255};
+		break;
+	case Format::eBC5:
+		decode_bc4(in, values);
+		for (int i = 0; i < 16; i++)
+			block[i] = {values[i], 0, 0, 255};
+
+		decode_bc4(in + 8, values);
+		for (int i = 0; i < 16; i++)
+			block[i][1] = values[i];
+		break;
+	case Format::eBC7:
+		decode_bc7(in, block);
+		break;
+	default:
+		break;
+	}
+}
+
+std::vector <uint8_t> compress(const uint8_t *chain, uint32_t width, uint32_t height,
+		uint32_t levels, Format format, Preset preset)
+{
+	std::vector <mip::Level> src = mip::layout(width, height, levels);
+	std::vector <mip::Level> dst = layout(format, width, height, levels);
+
+	if (format == Format::eNone)
+		return std::vector <uint8_t> (chain, chain + src.back().offset + src.back().size);
+
+	std::vector <uint8_t> result(dst.back().offset + dst.back().size);
+	size_t bytes = block_bytes(format);
+
+	// Rows of blocks are independent; small levels
+	// end up as a single chunk, run on this thread
+	for (uint32_t l = 0; l < levels; l++) {
+		const uint8_t *pixels = chain + src[l].offset;
+		uint8_t *out = result.data() + dst[l].offset;
+
+		uint32_t w = src[l].width;
+		uint32_t h = src[l].height;
+		uint32_t bw = (w + 3)/4;
+		uint32_t bh = (h + 3)/4;
+
+		ThreadPool::one().parallel_for(bh, 8,
+			[&](size_t, size_t begin, size_t end) {
+				for (size_t by = begin; by < end; by++) {
+					for (uint32_t bx = 0; bx < bw; bx++) {
+						Block block = fetch(pixels, w, h, bx, by);
+						encode_block(block, format, preset, out + (by * bw + bx) * bytes);
+					}
+				}
+			}
+		);
+	}
+
+	return result;
+}
+
+std::vector <uint8_t> decompress(const uint8_t *data, uint32_t width, uint32_t height,
+		uint32_t levels, Format format)
+{
+	std::vector <mip::Level> src = layout(format, width, height, levels);
+	std::vector <mip::Level> dst = mip::layout(width, height, levels);
+
+	if (format == Format::eNone)
+		return std::vector <uint8_t> (data, data + dst.back().offset + dst.back().size);
+
+	std::vector <uint8_t> result(dst.back().offset + dst.back().size);
+	size_t bytes = block_bytes(format);
+
+	for (uint32_t l = 0; l < levels; l++) {
+		const uint8_t *in = data + src[l].offset;
+		uint8_t *pixels = result.data() + dst[l].offset;
+
+		uint32_t w = dst[l].width;
+		uint32_t h = dst[l].height;
+		uint32_t bw = (w + 3)/4;
+		uint32_t bh = (h + 3)/4;
+
+		for (uint32_t by = 0; by < bh; by++) {
+			for (uint32_t bx = 0; bx < bw; bx++) {
+				Block block;
+				decode_block(in + (size_t(by) * bw + bx) * bytes, format, block);
+
+				for (uint32_t y = 0; y < 4 && 4 * by + y < h; y++) {
+					for (uint32_t x = 0; x < 4 && 4 * bx + x < w; x++) {
+						size_t i = size_t(4 * by + y) * w + 4 * bx + x;
+						std::memcpy(&pixels[4 * i], block[4 * y + x].data(), 4);
+					}
+				}
+			}
+		}
+	}
+
+	return result;
+}
+
+}
+
+}
@@ -2,16 +2,109 @@
 
 namespace kobra {
 
+// Getting entities
+Entity ECS::get_entity(int i) const
+{
+	return entities[i];
+}
+
+Entity ECS::get_entity(const std::string &name) const
+{
+	return entities[slots[name_map.at(name)].index];
+}
+
 // Creating a new entity
-Entity &ECS::make_entity(const std::string &name) {
+Entity ECS::make_entity(const std::string &name)
+{
 	_expand_all();
-	int32_t id = transforms.size() - 1;
+	int32_t index = transforms.size() - 1;
+
+	// Reuse a free slot if possible
+	int32_t id;
+	if (free_slots.empty()) {
+		id = slots.size();
+		slots.push_back(_slot {});
+	} else {
+		id = free_slots.back();
+		free_slots.pop_back();
+	}
+
+	slots[id].index = index;
+	_structure_version = ++_version;
 
-	Entity e(name, id, this);
+	Entity e(name, id, slots[id].generation, this);
 	entities.push_back(e);
 
 	name_map[name] = id;
-	return entities.back();
+	return e;
+}
+
+// Destroying an entity
+void ECS::destroy_entity(const Entity &e)
+{
+	if (!valid(e)) {
+		KOBRA_LOG_FUNC(warn) << "Entity \"" << e.name << "\" (id="
+			<< e.id << ") is not a live entity\n";
+		return;
+	}
+
+	// Only erase the name if it still refers to this entity
+	auto it = name_map.find(e.name);
+	if (it != name_map.end() && it->second == e.id)
+		name_map.erase(it);
+
+	// Frames in flight may still draw with the renderers
+	int i = slots[e.id].index;
+	_retire(std::move(rasterizers[i]));
+	_retire(std::move(raytracers[i]));
+
+	_remove_all(i);
+	_structure_version = ++_version;
+
+	// Invalidate all outstanding handles and recycle
+	slots[e.id].index = -1;
+	slots[e.id].generation++;
+	free_slots.push_back(e.id);
+}
+
+// Retiring renderers
+void ECS::_retire(RasterizerPtr &&rasterizer)
+{
+	if (!rasterizer)
+		return;
+
+	if (_retired.empty())
+		_retired.emplace_back();
+
+	_retired.back().rasterizers.push_back(std::move(rasterizer));
+}
+
+void ECS::_retire(RaytracerPtr &&raytracer)
+{
+	if (!raytracer)
+		return;
+
+	if (_retired.empty())
+		_retired.emplace_back();
+
+	_retired.back().raytracers.push_back(std::move(raytracer));
+}
+
+// Advancing a frame
+void ECS::frame()
+{
+	_retired.emplace_back();
+	while (_retired.size() > MAX_FRAMES_IN_FLIGHT + 1)
+		_retired.pop_front();
+}
+
+// Handle validation
+bool ECS::valid(const Entity &e) const
+{
+	return (e.ecs == this)
+		&& (e.id >= 0 && e.id < slots.size())
+		&& (slots[e.id].index >= 0)
+		&& (slots[e.id].generation == e.generation);
 }
 
 // Private helpers
@@ -25,7 +118,62 @@ void ECS::_expand_all()
 	raytracers.push_back(nullptr);
 	transforms.push_back(Transform());
 
+	for (auto &versions : _versions)
+		versions.push_back(0);
+
 	// TODO: assert that all arrays are the same size
 }
 
+// Remove the components at the dense index by moving the last entity into
+// its place, so that removal is O(1) and the arrays stay packed
+void ECS::_remove_all(int i)
+{
+	int last = entities.size() - 1;
+
+	if (i != last) {
+		cameras[i] = std::move(cameras[last]);
+		lights[i] = std::move(lights[last]);
+		materials[i] = std::move(materials[last]);
+		meshes[i] = std::move(meshes[last]);
+		rasterizers[i] = std::move(rasterizers[last]);
+		raytracers[i] = std::move(raytracers[last]);
+		transforms[i] = transforms[last];
+		entities[i] = entities[last];
+
+		for (auto &versions : _versions)
+			versions[i] = versions[last];
+
+		slots[entities[i].id].index = i;
+	}
+
+	cameras.pop_back();
+	lights.pop_back();
+	materials.pop_back();
+	meshes.pop_back();
+	rasterizers.pop_back();
+	raytracers.pop_back();
+	transforms.pop_back();
+	entities.pop_back();
+
+	for (auto &versions : _versions)
+		versions.pop_back();
+}
+
+// Allocation statistics of the component pools
+void ECS::pool_info()
+{
+	std::cout << "Component pools:" << std::endl;
+	std::cout << "\tCamera: " << Pool <Camera> ::one().stats().str() << std::endl;
+	std::cout << "\tLight: " << Pool <Light> ::one().stats().str() << std::endl;
+	std::cout << "\tMaterial: " << Pool <Material> ::one().stats().str() << std::endl;
+	std::cout << "\tMesh: " << Pool <Mesh> ::one().stats().str() << std::endl;
+	std::cout << "\tRasterizer: " << Pool <Rasterizer> ::one().stats().str() << std::endl;
+	std::cout << "\tRaytracer: " << Pool <Raytracer> ::one().stats().str() << std::endl;
+}
+
+int ECS::_index(const Entity &e) const
+{
+	return slots[e.id].index;
+}
+
 }
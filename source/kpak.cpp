@@ -0,0 +1,167 @@
+// Standard headers
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+// Compression
+#include <zlib.h>
+
+// Engine headers
+#include "../include/kpak.hpp"
+#include "../include/logger.hpp"
+#include "../include/mapped_file.hpp"
+
+namespace kobra {
+
+namespace kpak {
+
+std::string normalize(const std::string &path)
+{
+	std::string out = std::filesystem::path(path).lexically_normal().generic_string();
+	while (out.size() >= 2 && out[0] == '.' && out[1] == '/')
+		out.erase(0, 2);
+
+	return out;
+}
+
+uint64_t hash(std::string_view path)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (char c : path) {
+		h ^= (unsigned char) c;
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+// Pad the output up to the alignment
+static void pad(std::ofstream &fout, uint64_t &offset, uint64_t align)
+{
+	static const char zeros[alignment] {};
+
+	uint64_t aligned = (offset + align - 1) & ~(align - 1);
+	fout.write(zeros, aligned - offset);
+	offset = aligned;
+}
+
+bool build(const std::string &path, const std::vector <std::string> &files, bool compress)
+{
+	std::ofstream fout(path, std::ios::binary);
+	if (!fout.is_open()) {
+		KOBRA_LOG_FUNC(error) << "Failed to open file: " << path << std::endl;
+		return false;
+	}
+
+	// Header is written last
+	Header header {};
+	fout.write((const char *) &header, sizeof(header));
+
+	uint64_t offset = sizeof(header);
+
+	std::vector <Entry> entries;
+	std::string strings;
+	std::set <std::string> seen;
+
+	uint64_t total = 0;
+	uint64_t stored = 0;
+
+	for (const std::string &file : files) {
+		std::string name = normalize(file);
+		if (!seen.insert(name).second) {
+			KOBRA_LOG_FUNC(warn) << "Duplicate file, skipping: " << file << std::endl;
+			continue;
+		}
+
+		// Empty files are not mapped, but are valid entries
+		MappedFile mf(file);
+		if (!mf.valid() && !std::filesystem::is_regular_file(file)) {
+			KOBRA_LOG_FUNC(error) << "Failed to open file: " << file << std::endl;
+			return false;
+		}
+
+		Entry entry {
+			.hash = hash(name),
+			.offset = 0,
+			.size = mf.size(),
+			.original_size = mf.size(),
+			.flags = 0,
+			.path = (uint32_t) strings.size()
+		};
+
+		strings += name;
+		strings.push_back('\0');
+
+		const char *data = mf.data();
+
+		// Only keep compressed data which is noticeably smaller
+		std::vector <Bytef> compressed;
+		if (compress && mf.size() > 0) {
+			uLongf size = compressBound(mf.size());
+			compressed.resize(size);
+
+			int r = compress2(compressed.data(), &size,
+				(const Bytef *) mf.data(), mf.size(),
+				Z_BEST_COMPRESSION);
+
+			if (r == Z_OK && size < mf.size() - mf.size()/10) {
+				entry.size = size;
+				entry.flags |= eCompressed;
+				data = (const char *) compressed.data();
+			}
+		}
+
+		pad(fout, offset, alignment);
+		entry.offset = offset;
+
+		fout.write(data, entry.size);
+		offset += entry.size;
+
+		total += entry.original_size;
+		stored += entry.size;
+
+		entries.push_back(entry);
+	}
+
+	// Index, sorted for binary search
+	std::sort(entries.begin(), entries.end(),
+		[](const Entry &a, const Entry &b) {
+			return a.hash < b.hash;
+		}
+	);
+
+	pad(fout, offset, alignof(Entry));
+	header.index = offset;
+
+	fout.write((const char *) entries.data(), entries.size() * sizeof(Entry));
+	offset += entries.size() * sizeof(Entry);
+
+	header.strings = offset;
+	header.strings_size = strings.size();
+	fout.write(strings.data(), strings.size());
+
+	// Fill in the header
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.entries = entries.size();
+
+	fout.seekp(0);
+	fout.write((const char *) &header, sizeof(header));
+	fout.flush();
+
+	if (!fout.good()) {
+		KOBRA_LOG_FUNC(error) << "Failed to write file: " << path << std::endl;
+		return false;
+	}
+
+	KOBRA_LOG_FUNC(ok) << "Packed " << entries.size() << " files into "
+		<< path << " (" << total << " bytes, " << stored << " stored)" << std::endl;
+
+	return true;
+}
+
+}
+
+}
@@ -1,5 +1,12 @@
+// Standard headers
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
 // Engine headers
 #include "../../include/layers/raster.hpp"
+#include "../../include/profiler.hpp"
+#include "../../include/texture_manager.hpp"
 #include "../../shaders/raster/bindings.h"
 
 namespace kobra {
@@ -11,18 +18,6 @@ namespace layers {
 //////////////////////
 
 const std::vector <DSLB> Raster::_dsl_bindings {
-	DSLB {
-		RASTER_BINDING_ALBEDO_MAP,
-		vk::DescriptorType::eCombinedImageSampler,
-		1, vk::ShaderStageFlagBits::eFragment
-	},
-
-	DSLB {
-		RASTER_BINDING_NORMAL_MAP,
-		vk::DescriptorType::eCombinedImageSampler,
-		1, vk::ShaderStageFlagBits::eFragment
-	},
-
 	DSLB {
 		RASTER_BINDING_POINT_LIGHTS,
 		vk::DescriptorType::eUniformBuffer,
@@ -34,6 +29,16 @@ const std::vector <DSLB> Raster::_dsl_bindings {
 // Aux structures //
 ////////////////////
 
+// Textures of a rasterizer's material (blank if there is none)
+static std::pair <std::string, std::string> material_textures(const Rasterizer *rasterizer)
+{
+	const Material *material = rasterizer->material;
+	return {
+		material->has_albedo() ? material->albedo_texture : "blank",
+		material->has_normal() ? material->normal_texture : "blank"
+	};
+}
+
 struct Raster::PushConstants {
 	glm::mat4	model;
 	glm::mat4	view;
@@ -42,8 +47,17 @@ struct Raster::PushConstants {
 	glm::vec3	albedo;
 	int		type;
 	float		highlight;
-	float		has_albedo;
-	float		has_normal;
+
+	// Slots of the textures in the texture table, or -1
+	int		albedo_texture;
+	int		normal_texture;
+
+	// Regions of the textures in their images (atlases)
+	alignas(16)
+	glm::vec4	albedo_region {1, 1, 0, 0};
+
+	alignas(16)
+	glm::vec4	normal_region {1, 1, 0, 0};
 };
 
 
@@ -92,10 +106,15 @@ Raster::Raster(const Context &ctx, const vk::AttachmentLoadOp &load)
 		0, sizeof(PushConstants)
 	};
 
-	// Pipeline layout
+	// Pipeline layout; textures are sampled from the texture table
+	std::array <vk::DescriptorSetLayout, 2> dsls {
+		*_dsl,
+		*TextureManager::table_layout(*_ctx.phdev, *_ctx.device)
+	};
+
 	_ppl = vk::raii::PipelineLayout(
 		*_ctx.device,
-		{{}, *_dsl, push_constants}
+		{{}, dsls, push_constants}
 	);
 
 	// Pipeline cache
@@ -140,37 +159,220 @@ Raster::Raster(const Context &ctx, const vk::AttachmentLoadOp &load)
 	grp_info.fragment_shader = std::move(shaders[3]);
 	_p_phong = make_graphics_pipeline(grp_info);
 
-	// Create buffer for lights
+	// Create buffer for lights, and the set every draw uses
 	_b_lights = BufferData(*_ctx.phdev, *_ctx.device, sizeof(LightsData),
 		vk::BufferUsageFlagBits::eUniformBuffer,
 		vk::MemoryPropertyFlagBits::eHostVisible |
 			vk::MemoryPropertyFlagBits::eHostCoherent
 	);
 
-	// Create box for rendering area lights
-	{
-		auto box = Mesh::box({0, 0, 0}, {0.5, 0.01, 0.5});
+	auto dsets = vk::raii::DescriptorSets {
+		*_ctx.device,
+		{**_ctx.descriptor_pool, *_dsl}
+	};
 
-		_area_light = new Rasterizer({_ctx.phdev, _ctx.device}, box, new Material());
+	_ds_lights = std::move(dsets.front());
 
-		// Setup descriptor set for area light
-		_ds_components.insert({_area_light, _make_ds()});
-		const auto &ds = _ds_components.at(_area_light);
+	bind_ds(*_ctx.device, _ds_lights, _b_lights,
+		vk::DescriptorType::eUniformBuffer,
+		RASTER_BINDING_POINT_LIGHTS
+	);
 
-		Device dev {
-			_ctx.phdev,
-				_ctx.device
-		};
+	// Rasterizer for the area light box; its buffers are
+	// created right away (and are never evicted)
+	_area_light = new Rasterizer({_ctx.phdev, _ctx.device}, new Material());
+	_area_light->upload(_area_light_box);
 
-		// Update descriptor set
-		_area_light->bind_material(dev, ds);
+	_add_systems();
+}
 
-		// Bind lights buffer
-		bind_ds(*_ctx.device, ds, _b_lights,
-			vk::DescriptorType::eUniformBuffer,
-			RASTER_BINDING_POINT_LIGHTS
-		);
-	}
+/////////////
+// Systems //
+/////////////
+
+// Per frame work of the layer, as systems over the ECS; they run in
+// parallel where they do not depend on each other's results. Only
+// the residency system changes rasterizers, but every system that
+// submits to the queue declares them as written, so that they run
+// one after the other
+void Raster::_add_systems()
+{
+	using Access = Scheduler::Access;
+
+	_systems.add <Reads <Camera>, Writes <>> ("Raster camera",
+		[this](Access &access) {
+			const ECS &ecs = access.ecs();
+
+			_state.found_camera = false;
+			for (int i = 0; i < ecs.size(); i++) {
+				if (ecs.exists <Camera> (i)) {
+					_state.camera = ecs.get <Camera> (i);
+					_state.found_camera = true;
+				}
+			}
+		}
+	);
+
+	// Only changes since the last consumed version matter
+	_systems.add <Reads <Light, Transform>, Writes <>> ("Raster lights",
+		[this](Access &access) {
+			const ECS &ecs = access.ecs();
+
+			bool dirty_lights = ecs.structure_changed(_version)
+				|| ecs.changed <Light> (_version);
+
+			bool dirty_transforms = ecs.changed <Transform> (_version);
+
+			LightsData lights_data {
+				.count = 0,
+			};
+
+			_state.area_lights.clear();
+			for (int i = 0; i < ecs.size(); i++) {
+				if (!ecs.exists <Light> (i))
+					continue;
+
+				const Light *light = &ecs.get <Light> (i);
+
+				// Transform
+				const auto &transform = ecs.get <Transform> (i);
+				auto pos = transform.position;
+
+				if (dirty_transforms && ecs.changed <Transform> (i, _version))
+					dirty_lights = true;
+
+				// Update lights data
+				_light l {.position = pos, .intensity = light->color * light->power};
+				lights_data.lights[lights_data.count++] = l;
+
+				if (light->type == Light::Type::eArea)
+					_state.area_lights.push_back({transform, light->color});
+			}
+
+			// Only upload lights if they have changed
+			if (dirty_lights)
+				_b_lights.upload(&lights_data, sizeof(lights_data));
+		}
+	);
+
+	// Cull entities outside the camera frustum
+	_systems.add <Reads <Mesh, Transform>, Writes <>> ("Raster culling",
+		[this](Access &access) {
+			const ECS &ecs = access.ecs();
+
+			_spatial.update(ecs);
+
+			_state.visible.assign(ecs.size(), !_state.found_camera);
+			if (_state.found_camera) {
+				Frustum frustum = Frustum::from(_state.camera.projection());
+				for (int i : _spatial.query(frustum))
+					_state.visible[i] = true;
+			}
+		},
+		{"Raster camera"}
+	);
+
+	_systems.add <Reads <Mesh>, Writes <Rasterizer>> ("Raster residency",
+		[this](Access &access) {
+			const ECS &ecs = access.ecs();
+
+			// Buffers of destroyed entities went with them
+			std::set <const Rasterizer *> live_rasterizers {_area_light};
+			for (int i = 0; i < ecs.size(); i++) {
+				if (ecs.exists <Rasterizer> (i))
+					live_rasterizers.insert(&ecs.get <Rasterizer> (i));
+			}
+
+			for (auto it = _resident.begin(); it != _resident.end(); ) {
+				if (live_rasterizers.count(it->first) == 0) {
+					_residency_stats.bytes -= it->second.bytes;
+					it = _resident.erase(it);
+				} else {
+					it++;
+				}
+			}
+
+			_update_residency(access, _state.visible);
+		},
+		{"Raster culling"}
+	);
+
+	// Textures of what is drawn are in use, and their levels are
+	// requested from how large the entity is on screen; those that
+	// are not loaded yet (or were evicted) are loaded in one batch.
+	// Replaced and refined ones are in the texture table already
+	_systems.add <Reads <Mesh>, Writes <Rasterizer>> ("Raster textures",
+		[this](Access &access) {
+			const ECS &ecs = access.ecs();
+
+			std::vector <const Rasterizer *> unloaded;
+			for (int i = 0; i < ecs.size(); i++) {
+				if (!ecs.exists <Rasterizer> (i))
+					continue;
+
+				if (ecs.exists <Mesh> (i) && !_state.visible[i])
+					continue;
+
+				const Rasterizer *rasterizer = &ecs.get <Rasterizer> (i);
+				if (!rasterizer->resident())
+					continue;
+
+				float footprint = _footprint(_state.camera, ecs.get_entity(i));
+
+				auto [albedo, normal] = material_textures(rasterizer);
+				TextureManager::request(*_ctx.device, albedo, footprint);
+				TextureManager::request(*_ctx.device, normal, footprint);
+
+				if (!_textures_loaded(rasterizer))
+					unloaded.push_back(rasterizer);
+			}
+
+			_load_textures(unloaded);
+		},
+		{"Raster residency"}
+	);
+
+	// What is drawn, in the order of the entities, with the
+	// texture slots and regions of their materials
+	_systems.add <Reads <Rasterizer, Mesh, Transform, Material>, Writes <>> ("Raster draws",
+		[this](Access &access) {
+			const ECS &ecs = access.ecs();
+			uint64_t slots = TextureManager::slot_version(*_ctx.device);
+
+			_state.draws.clear();
+			for (int i = 0; i < ecs.size(); i++) {
+				if (!ecs.exists <Rasterizer> (i))
+					continue;
+
+				// Bounds are only known for meshes
+				if (ecs.exists <Mesh> (i) && !_state.visible[i])
+					continue;
+
+				// Its buffers may still be on the way
+				const Rasterizer *rasterizer = &ecs.get <Rasterizer> (i);
+				if (!rasterizer->resident())
+					continue;
+
+				_state.draws.push_back(_draw {
+					rasterizer,
+					ecs.get <Transform> (i).matrix(),
+					&_resolve_textures(ecs, i, rasterizer, slots)
+				});
+			}
+
+			// Forget rasterizers that have not been drawn in a while
+			// (the frame only advances with the residency system)
+			if (_texture_states.size() > 2 * _state.draws.size() + 64) {
+				for (auto it = _texture_states.begin(); it != _texture_states.end(); ) {
+					if (it->second.frame != _frame)
+						it = _texture_states.erase(it);
+					else
+						it++;
+				}
+			}
+		},
+		{"Raster textures"}
+	);
 }
 
 ////////////
@@ -179,7 +381,7 @@ Raster::Raster(const Context &ctx, const vk::AttachmentLoadOp &load)
 
 void Raster::render(const vk::raii::CommandBuffer &cmd,
 		const vk::raii::Framebuffer &framebuffer,
-		const ECS &ecs, const RenderArea &ra)
+		ECS &ecs, const RenderArea &ra)
 {
 	// Apply render area
 	ra.apply(cmd, _ctx.extent);
@@ -213,91 +415,34 @@ void Raster::render(const vk::raii::CommandBuffer &cmd,
 		vk::SubpassContents::eInline
 	);
 
-	// Initialization phase
-	Camera camera;
-	bool found_camera = false;
-
-	LightsData lights_data {
-		.count = 0,
-	};
-
-	std::vector <std::pair <Transform, glm::vec3>> area_light_transforms;
-
-	for (int i = 0; i < ecs.size(); i++) {
-		// Deal with camera component
-		if (ecs.exists <Camera> (i)) {
-			camera = ecs.get <Camera> (i);
-			found_camera = true;
-		}
-
-		// Deal with rasterizer component
-		if (ecs.exists <Rasterizer> (i)) {
-			// Initialize corresponding descriptor
-			// set if not done yet
-			const Rasterizer *rasterizer = &ecs.get <Rasterizer> (i);
-			if (_ds_components.count(rasterizer) == 0) {
-				_ds_components.insert({rasterizer, _make_ds()});
-				const auto &ds = _ds_components.at(rasterizer);
-
-				Device dev {
-					_ctx.phdev,
-					_ctx.device
-				};
-
-				// Update descriptor set
-				rasterizer->bind_material(dev, ds);
-
-				// Bind lights buffer
-				bind_ds(*_ctx.device, ds, _b_lights,
-					vk::DescriptorType::eUniformBuffer,
-					RASTER_BINDING_POINT_LIGHTS
-				);
-			}
-		}
-
-		// Deal with light component
-		if (ecs.exists <Light> (i)) {
-			// Initialize corresponding descriptor
-			// set if not done yet
-			const Light *light = &ecs.get <Light> (i);
+	// Gather what is drawn (and load what it needs) on the thread
+	// pool, then record it here
+	_systems.run(ecs, &Profiler::one());
+	_version = ecs.version();
 
-			// Transform
-			const auto &transform = ecs.get <Transform> (i);
-			auto pos = transform.position;
+	// Every draw uses the same sets: the lights,
+	// and the texture table for this frame
+	const auto &table = TextureManager::table(*_ctx.phdev, *_ctx.device);
 
-			// Update lights data
-			_light l {.position = pos, .intensity = light->color * light->power};
-			lights_data.lights[lights_data.count++] = l;
-
-			if (light->type == Light::Type::eArea)
-				area_light_transforms.push_back({transform, light->color});
-		}
-	}
-
-	_b_lights.upload(&lights_data, sizeof(lights_data));
+	cmd.bindDescriptorSets(
+		vk::PipelineBindPoint::eGraphics,
+		*_ppl, 0, {*_ds_lights, *table}, {}
+	);
 
 	// Render all rasterizer components
 	PushConstants push_constants {
-		.view = camera.view(),
-		.perspective = camera.perspective(),
+		.view = _state.camera.view(),
+		.perspective = _state.camera.perspective(),
 		.type = Shading::eDiffuse,
 		.highlight = false,
-		.has_albedo = false,
-		.has_normal = false
+		.albedo_texture = -1,
+		.normal_texture = -1
 	};
 
 	// Render all regular meshes
-	for (int i = 0; i < ecs.size(); i++) {
-		if (!ecs.exists <Rasterizer> (i))
-			continue;
-
-		// Get transform
-		Transform transform = ecs.get <Transform> (i);
-		push_constants.model = transform.matrix();
-
-		// Get rasterizer
-		const Rasterizer *rasterizer = &ecs.get <Rasterizer> (i);
-		const auto &ds = _ds_components.at(rasterizer);
+	for (const _draw &draw : _state.draws) {
+		const Rasterizer *rasterizer = draw.rasterizer;
+		push_constants.model = draw.model;
 
 		// Bind pipeline
 		cmd.bindPipeline(
@@ -305,19 +450,15 @@ void Raster::render(const vk::raii::CommandBuffer &cmd,
 			*get_pipeline(rasterizer->mode)
 		);
 
-		// Bind descriptor set
-		cmd.bindDescriptorSets(
-			vk::PipelineBindPoint::eGraphics,
-			*_ppl, 0, *ds, {}
-		);
-
 		// Bind vertex and index buffers
 		rasterizer->bind_buffers(cmd);
 
 		// Update push constants
 		push_constants.albedo = rasterizer->material->diffuse;
-		push_constants.has_albedo = rasterizer->material->has_albedo();
-		push_constants.has_normal = rasterizer->material->has_normal();
+		push_constants.albedo_texture = draw.textures->albedo;
+		push_constants.normal_texture = draw.textures->normal;
+		push_constants.albedo_region = draw.textures->albedo_region;
+		push_constants.normal_region = draw.textures->normal_region;
 
 		// Push constant
 		cmd.pushConstants <PushConstants> (
@@ -338,21 +479,15 @@ void Raster::render(const vk::raii::CommandBuffer &cmd,
 		);
 
 		// Update push constants
-		push_constants.has_albedo = false;
-		push_constants.has_normal = false;
-
-		// Bind descriptor set
-		const auto &ds = _ds_components.at(_area_light);
-
-		cmd.bindDescriptorSets(
-			vk::PipelineBindPoint::eGraphics,
-			*_ppl, 0, *ds, {}
-		);
+		push_constants.albedo_texture = -1;
+		push_constants.normal_texture = -1;
+		push_constants.albedo_region = {1, 1, 0, 0};
+		push_constants.normal_region = {1, 1, 0, 0};
 
 		// Bind vertex and index buffers
 		_area_light->bind_buffers(cmd);
 
-		for (const auto &pr: area_light_transforms) {
+		for (const auto &pr: _state.area_lights) {
 			push_constants.model = pr.first.matrix();
 			push_constants.albedo = pr.second;
 
@@ -375,6 +510,205 @@ void Raster::render(const vk::raii::CommandBuffer &cmd,
 // Private methods //
 /////////////////////
 
+// Size of an entity on screen, in pixels across; textures are
+// assumed to span the entity once. Entities without bounds, and
+// those around the camera, get everything
+float Raster::_footprint(const Camera &camera, const Entity &entity) const
+{
+	BoundingBox box;
+	if (!_spatial.bounds(entity, box))
+		return std::numeric_limits <float>::max();
+
+	glm::vec3 center = 0.5f * (box.min + box.max);
+	float radius = 0.5f * glm::length(box.max - box.min);
+	float distance = glm::length(center - camera.transform.position);
+	if (distance <= radius)
+		return std::numeric_limits <float>::max();
+
+	// Projected diameter, relative to the height of the view
+	float size = radius/(distance * camera.tunings.scale);
+	return size * _ctx.extent.height;
+}
+
+// Whether the textures of a rasterizer are loaded; they are marked as used
+bool Raster::_textures_loaded(const Rasterizer *rasterizer) const
+{
+	auto [albedo, normal] = material_textures(rasterizer);
+	bool albedo_loaded = TextureManager::use(*_ctx.device, albedo) != 0;
+	bool normal_loaded = TextureManager::use(*_ctx.device, normal) != 0;
+	return albedo_loaded && normal_loaded;
+}
+
+// Load the textures of rasterizers in a single batch
+void Raster::_load_textures(const std::vector <const Rasterizer *> &rasterizers)
+{
+	if (rasterizers.empty())
+		return;
+
+	std::vector <std::string> textures;
+	std::vector <TextureRole> roles;
+	for (const Rasterizer *rasterizer : rasterizers) {
+		auto [albedo, normal] = material_textures(rasterizer);
+		textures.push_back(albedo);
+		textures.push_back(normal);
+		roles.push_back(TextureRole::eColor);
+		roles.push_back(TextureRole::eNormal);
+	}
+
+	TextureManager::load_textures(*_ctx.phdev, *_ctx.device, textures, roles);
+}
+
+// Texture slots and regions of a rasterizer, resolved
+// again only when something they depend on changed
+const Raster::_texture_state &Raster::_resolve_textures(const ECS &ecs, int i,
+		const Rasterizer *rasterizer, uint64_t slots)
+{
+	auto [it, inserted] = _texture_states.try_emplace(rasterizer);
+
+	_texture_state &state = it->second;
+	state.frame = _frame;
+
+	bool stale = inserted
+		|| state.slots != slots
+		|| ecs.changed <Rasterizer> (i, state.version)
+		|| (ecs.exists <Material> (i) && ecs.changed <Material> (i, state.version));
+
+	if (!stale)
+		return state;
+
+	std::tie(state.albedo, state.normal) = _texture_slots(rasterizer);
+
+	auto [albedo, normal] = material_textures(rasterizer);
+	state.albedo_region = TextureManager::region(albedo);
+	state.normal_region = TextureManager::region(normal);
+
+	state.version = ecs.version();
+	state.slots = slots;
+	return state;
+}
+
+// Slots of the textures of a rasterizer (-1 if it has none)
+std::pair <int, int> Raster::_texture_slots(const Rasterizer *rasterizer) const
+{
+	const Material *material = rasterizer->material;
+
+	std::pair <int, int> slots {-1, -1};
+	if (material->has_albedo())
+		slots.first = TextureManager::slot(*_ctx.phdev, *_ctx.device, material->albedo_texture);
+	if (material->has_normal())
+		slots.second = TextureManager::slot(*_ctx.phdev, *_ctx.device,
+			material->normal_texture, TextureRole::eNormal);
+
+	return slots;
+}
+
+// Create the buffers of visible rasterizers (then of prefetched ones),
+// a batch per frame, and evict buffers that have not been drawn for a
+// while when over budget; frames in flight cannot refer to those
+void Raster::_update_residency(Scheduler::Access &access, const std::vector <bool> &visible)
+{
+	const ECS &ecs = access.ecs();
+
+	_frame++;
+
+	// Entity of the rasterizer, and its mesh
+	using Pending = std::pair <int, const Mesh *>;
+
+	std::vector <Pending> drawn;
+	std::vector <Pending> prefetched;
+
+	for (int i = 0; i < ecs.size(); i++) {
+		if (!ecs.exists <Rasterizer> (i))
+			continue;
+
+		const Rasterizer *rasterizer = &ecs.get <Rasterizer> (i);
+
+		// Replaced in place (same address), or created elsewhere
+		auto it = _resident.find(rasterizer);
+		if (it != _resident.end() && !rasterizer->resident()) {
+			_residency_stats.bytes -= it->second.bytes;
+			_resident.erase(it);
+		} else if (it == _resident.end() && rasterizer->resident()) {
+			_resident[rasterizer] = _residence {rasterizer->bytes(), _frame, i};
+			_residency_stats.bytes += rasterizer->bytes();
+		}
+
+		// Visible ones are not to be evicted below
+		bool visible_now = !ecs.exists <Mesh> (i) || visible[i];
+		if (rasterizer->resident()) {
+			_residence &residence = _resident.at(rasterizer);
+			residence.entity = i;
+			if (visible_now)
+				residence.frame = _frame;
+
+			continue;
+		}
+
+		// Nothing to create the buffers from
+		if (!ecs.exists <Mesh> (i))
+			continue;
+
+		const Mesh *mesh = &ecs.get <Mesh> (i);
+		if (visible_now)
+			drawn.push_back({i, mesh});
+		else if (rasterizer->prefetching())
+			prefetched.push_back({i, mesh});
+	}
+
+	size_t uploaded = 0;
+	size_t pending = drawn.size() + prefetched.size();
+
+	auto upload = [&](const Pending &p) {
+		auto [i, mesh] = p;
+
+		size_t bytes = Rasterizer::bytes(*mesh);
+		if (uploaded > 0 && uploaded + bytes > _residency.batch)
+			return false;
+
+		Rasterizer &rasterizer = access.write <Rasterizer> (i);
+		rasterizer.upload(*mesh);
+		_resident[&rasterizer] = _residence {bytes, _frame, i};
+
+		_residency_stats.bytes += bytes;
+		_residency_stats.uploads++;
+		uploaded += bytes;
+		pending--;
+		return true;
+	};
+
+	bool room = true;
+	for (size_t i = 0; i < drawn.size() && room; i++)
+		room = upload(drawn[i]);
+
+	for (size_t i = 0; i < prefetched.size() && room; i++)
+		room = upload(prefetched[i]);
+
+	// Least recently drawn first
+	if (_residency_stats.bytes > _residency.budget) {
+		uint64_t after = std::max <uint64_t> (_residency.evict_after, MAX_FRAMES_IN_FLIGHT + 1);
+
+		std::vector <std::pair <uint64_t, const Rasterizer *>> idle;
+		for (const auto &[rasterizer, residence] : _resident) {
+			if (residence.frame + after <= _frame)
+				idle.push_back({residence.frame, rasterizer});
+		}
+
+		std::sort(idle.begin(), idle.end());
+		for (const auto &[frame, rasterizer] : idle) {
+			if (_residency_stats.bytes <= _residency.budget)
+				break;
+
+			access.write <Rasterizer> (_resident.at(rasterizer).entity).evict();
+			_residency_stats.bytes -= _resident.at(rasterizer).bytes;
+			_residency_stats.evictions++;
+			_resident.erase(rasterizer);
+		}
+	}
+
+	_residency_stats.resident = _resident.size();
+	_residency_stats.pending = pending;
+}
+
 const vk::raii::Pipeline &Raster::get_pipeline(RasterMode mode)
 {
 	switch (mode) {
@@ -391,16 +725,6 @@ const vk::raii::Pipeline &Raster::get_pipeline(RasterMode mode)
 	KOBRA_ASSERT(false, "Rasterizer: invalid raster mode");
 }
 
-vk::raii::DescriptorSet	Raster::_make_ds() const
-{
-	auto dsets = vk::raii::DescriptorSets {
-		*_ctx.device,
-		{**_ctx.descriptor_pool, *_dsl}
-	};
-
-	return std::move(dsets.front());
-}
-
 }
 
 }
@@ -1,7 +1,13 @@
+// Standard headers
+#include <cstring>
+#include <limits>
+#include <set>
+
 // Engine headers
 #include "../../include/layers/raytracer.hpp"
 #include "../../include/profiler.hpp"
 #include "../../include/texture_manager.hpp"
+#include "../../include/thread_pool.hpp"
 
 namespace kobra {
 
@@ -69,19 +75,8 @@ const std::vector <DSLB> Raytracer::_dslb_raytracing {
 		1, vk::ShaderStageFlagBits::eCompute,
 	},
 
-	// Texture samplers
-	DSLB {
-		MESH_BINDING_ALBEDOS,
-		vk::DescriptorType::eCombinedImageSampler,
-		MAX_TEXTURES, vk::ShaderStageFlagBits::eCompute,
-	},
-
-	DSLB {
-		MESH_BINDING_NORMAL_MAPS,
-		vk::DescriptorType::eCombinedImageSampler,
-		MAX_TEXTURES, vk::ShaderStageFlagBits::eCompute,
-	},
-
+	// Environment sampler; other textures are
+	// sampled from the texture table
 	DSLB {
 		MESH_BINDING_ENVIRONMENT,
 		vk::DescriptorType::eCombinedImageSampler,
@@ -259,32 +254,6 @@ Raytracer::Raytracer(const Context &ctx, SyncQueue *sq, const vk::AttachmentLoad
 		_samplers.result_image,
 		MESH_BINDING_PIXELS
 	);
-
-	// Albedos
-	while (_albedo_image_descriptors.size() < MAX_TEXTURES) {
-		_albedo_image_descriptors.push_back(
-			vk::DescriptorImageInfo(
-				*_samplers.empty,
-				*_samplers.empty_image.view,
-				vk::ImageLayout::eShaderReadOnlyOptimal
-			)
-		);
-	}
-
-	_update_samplers(_albedo_image_descriptors, MESH_BINDING_ALBEDOS);
-
-	// Normals
-	while (_normal_image_descriptors.size() < MAX_TEXTURES) {
-		_normal_image_descriptors.push_back(
-			vk::DescriptorImageInfo(
-				*_samplers.empty,
-				*_samplers.empty_image.view,
-				vk::ImageLayout::eShaderReadOnlyOptimal
-			)
-		);
-	}
-
-	_update_samplers(_normal_image_descriptors, MESH_BINDING_NORMAL_MAPS);
 }
 
 /////////////
@@ -309,6 +278,9 @@ void Raytracer::environment_map(const std::string &path)
 		_ds_raytracing,
 		path, MESH_BINDING_ENVIRONMENT
 	);
+
+	_environment = path;
+	_environment_generation = TextureManager::use(*_ctx.device, path);
 }
 
 ////////////
@@ -370,110 +342,212 @@ void Raytracer::render(const vk::raii::CommandBuffer &cmd,
 	bool found_camera = false;
 
 	kobra::Raytracer::HostBuffers host_buffers {
-		.albedo_textures = _albedo_image_descriptors,
-		.normal_textures = _normal_image_descriptors,
 		.id = 1
 	};
 
-	int light_index = 0;
-	int raytracers_index = 0;
-	bool dirty_lights = false;
-	bool dirty_raytracers = false;
-	std::vector <Transform> light_transforms;
+	// Only changes since the last consumed version matter; creating
+	// or destroying entities invalidates everything
+	bool structure = ecs.structure_changed(_version);
+
+	bool dirty_lights = structure || ecs.changed <Light> (_version);
+	bool dirty_raytracers = structure
+		|| ecs.changed <kobra::Raytracer> (_version)
+		|| ecs.changed <Material> (_version)
+		|| ecs.changed <Mesh> (_version);
+
+	bool dirty_transforms = ecs.changed <Transform> (_version);
+
 	std::vector <const kobra::Raytracer *> raytracers;
 	std::vector <Transform> raytracer_transforms;
+	std::vector <int> raytracer_entities;
 
 	_area_light_info alight_info {.count = 0};
 
 	profiler.frame("Raytracer frame");
 	profiler.frame("Iterating through entities");
 
-	// TODO: this loop ccan be parallelised
-	for (int i = 0; i < ecs.size(); i++) {
-		// TODO: how to avoid constructing BVH every single
-		// frame?
-		// GPU construction?
-		// NOTE: CudaRaytracer will rely on OptiX for this
+	// Gather the entities in parallel chunks; each chunk collects
+	// into its own structure, and the chunks are merged in order so
+	// that the result is the same as a sequential pass
+	struct _gather {
+		const Camera			*camera = nullptr;
+		std::vector <const kobra::Raytracer *>	raytracers;
+		std::vector <Transform>		transforms;
+		std::vector <int>		entities;
+		std::vector <_area_light>	area_lights;
+		bool				dirty_raytracers = false;
+		bool				dirty_lights = false;
+	};
 
-		// Deal with camera component
-		if (ecs.exists <Camera> (i)) {
-			camera = ecs.get <Camera> (i);
-			found_camera = true;
+	auto &pool = ThreadPool::one();
+	std::vector <_gather> gathers(ThreadPool::chunks(ecs.size(), _chunk));
+
+	pool.parallel_for(ecs.size(), _chunk,
+		[&](size_t chunk, size_t begin, size_t end) {
+			_gather &g = gathers[chunk];
+
+			for (int i = begin; i < end; i++) {
+				// Deal with camera component
+				if (ecs.exists <Camera> (i))
+					g.camera = &ecs.get <Camera> (i);
+
+				if (ecs.exists <kobra::Raytracer> (i)) {
+					g.raytracers.push_back(&ecs.get <kobra::Raytracer> (i));
+					g.transforms.push_back(ecs.get <Transform> (i));
+					g.entities.push_back(i);
+
+					if (dirty_transforms && ecs.changed <Transform> (i, _version))
+						g.dirty_raytracers = true;
+				}
+
+				// Deal with light
+				if (!ecs.exists <Light> (i))
+					continue;
+
+				const Light &light = ecs.get <Light> (i);
+				const Transform &transform = ecs.get <Transform> (i);
+
+				// Check if lights have moved
+				if (dirty_transforms && ecs.changed <Transform> (i, _version))
+					g.dirty_lights = true;
+
+				// Area light
+				if (light.type == Light::Type::eArea) {
+					// New vertices (square 1x1 in center)
+					glm::vec3 a {-0.5f, 0, -0.5f};
+					glm::vec3 b {0.5f, 0, -0.5f};
+					glm::vec3 c {-0.5f, 0, 0.5f};
+
+					a = transform.apply(a);
+					b = transform.apply(b);
+					c = transform.apply(c);
+
+					_area_light alight;
+					alight.a = a;
+					alight.ab = b - a;
+					alight.ac = c - a;
+					alight.color = light.color;
+					alight.power = light.power;
+
+					g.area_lights.push_back(alight);
+				}
+			}
 		}
+	);
 
-		if (ecs.exists <kobra::Raytracer> (i)) {
-			// TODO: account for changing transforms
-			const kobra::Raytracer *raytracer = &ecs.get <kobra::Raytracer> (i);
+	// Merge in order
+	for (const _gather &g : gathers) {
+		if (g.camera) {
+			camera = *g.camera;
+			found_camera = true;
+		}
 
-			if (raytracers_index >= _p_raytracers.size())
-				dirty_raytracers = true;
-			else if (_p_raytracers[raytracers_index] != raytracer)
-				dirty_raytracers = true;
+		raytracers.insert(raytracers.end(), g.raytracers.begin(), g.raytracers.end());
+		raytracer_transforms.insert(raytracer_transforms.end(), g.transforms.begin(), g.transforms.end());
+		raytracer_entities.insert(raytracer_entities.end(), g.entities.begin(), g.entities.end());
 
-			raytracers.push_back(raytracer);
+		dirty_raytracers |= g.dirty_raytracers;
+		dirty_lights |= g.dirty_lights;
 
-			const Transform &transform = ecs.get <Transform> (i);
+		for (const _area_light &alight : g.area_lights) {
+			if (alight_info.count >= 32) {
+				KOBRA_LOG_FUNC(warn) << "Too many area lights, ignoring the rest\n";
+				break;
+			}
 
-			raytracer_transforms.push_back(transform);
-			raytracers_index++;
+			alight_info.lights[alight_info.count++] = alight;
 		}
+	}
 
-		// Deal with light
-		// TODO: methods...
-		if (ecs.exists <Light> (i)) {
-			const Light &light = ecs.get <Light> (i);
+	profiler.end();
 
-			const Transform &transform = ecs.get <Transform> (i);
+	if (!found_camera) {
+		// Actually just skip
+		throw std::runtime_error("No camera found");
+	}
 
-			// Check if lights have moved
-			// TODO: also check if color has changed (i.e. same
-			// strategy as for raytracers)
-			if (light_index >= _p_light_transforms.size())
-				dirty_lights = true;
-			else if (transform != _p_light_transforms[light_index])
-				dirty_lights = true;
+	// Every texture is in use while raytracing, at full resolution;
+	// the texture table follows replaced and refined textures, so
+	// only those that were evicted are loaded again (in one batch)
+	std::vector <bool> cached(raytracers.size(), false);
+	std::vector <bool> unloaded(raytracers.size(), false);
 
-			light_transforms.push_back(transform);
-			light_index++;
+	for (int i = 0; i < raytracers.size(); i++) {
+		cached[i] = (_serialized_cache.count(raytracers[i]) > 0);
+		if (!cached[i])
+			continue;
 
-			// Area light
-			if (light.type == Light::Type::eArea) {
-				profiler.frame("Serializing area light");
+		const Material *material = raytracers[i]->material;
+		if (material->has_albedo())
+			TextureManager::request(*_ctx.device, material->albedo_texture, std::numeric_limits <float>::max());
+		if (material->has_normal())
+			TextureManager::request(*_ctx.device, material->normal_texture, std::numeric_limits <float>::max());
 
-				// New vertices (square 1x1 in center)
-				glm::vec3 a {-0.5f, 0, -0.5f};
-				glm::vec3 b {0.5f, 0, -0.5f};
-				glm::vec3 c {-0.5f, 0, 0.5f};
+		unloaded[i] = !_textures_loaded(raytracers[i]);
+	}
 
-				a = transform.apply(a);
-				b = transform.apply(b);
-				c = transform.apply(c);
+	_texture_list textures = _textures(raytracers, unloaded);
+	TextureManager::load_textures(*_ctx.phdev, *_ctx.device, textures.paths, textures.roles);
 
-				// TODO: this only applies if the light is an area light
-				_area_light alight;
-				alight.a = a;
-				alight.ab = b - a;
-				alight.ac = c - a;
-				alight.color = light.color;
-				alight.power = light.power;
+	// Slots only change if a texture was reloaded while others
+	// shared its image; the materials of those components change
+	std::vector <bool> retextured(raytracers.size(), false);
+	bool any_retextured = false;
 
-				alight_info.lights[alight_info.count++] = alight;
+	for (int i = 0; i < raytracers.size(); i++) {
+		if (!cached[i])
+			continue;
 
-				profiler.end();
-			}
-		}
+		retextured[i] = (_texture_slots(raytracers[i]) != _serialized_cache.at(raytracers[i]).slots);
+		any_retextured |= retextured[i];
 	}
 
-	profiler.end();
-
-	if (!found_camera) {
-		// Actually just skip
-		throw std::runtime_error("No camera found");
+	// So is the environment map, which is bound again if replaced
+	if (!_environment.empty()) {
+		TextureManager::request(*_ctx.device, _environment, std::numeric_limits <float>::max());
+
+		uint64_t generation = TextureManager::use(*_ctx.device, _environment);
+		if (generation != _environment_generation) {
+			_environment_generation = generation;
+			_sync_queue->push(
+				[&]() {
+					TextureManager::bind(
+						*_ctx.phdev, *_ctx.device,
+						_ds_raytracing,
+						_environment, MESH_BINDING_ENVIRONMENT
+					);
+				}
+			);
+		}
 	}
 
 	// Upload to device buffers
 	bool rebinding = false;
 
+	// Geometry stays as it is if only slots changed; materials
+	// follow the order of the components
+	if (any_retextured && !dirty_raytracers) {
+		for (int i = 0; i < raytracers.size(); i++) {
+			_serialized &s = _serialized_cache.at(raytracers[i]);
+			if (retextured[i]) {
+				s.slots = _texture_slots(raytracers[i]);
+				for (auto &material : s.materials) {
+					material.albedo = s.slots.first;
+					material.normal = s.slots.second;
+				}
+			}
+
+			host_buffers.materials.insert(host_buffers.materials.end(),
+				s.materials.begin(), s.materials.end());
+		}
+
+		rebinding |= _dev.materials.upload(host_buffers.materials, 0);
+
+		_accumulated = 0;
+		_offsetx = 0;
+		_offsety = 0;
+	}
+
 	profiler.frame("Updating buffers");
 	if (dirty_raytracers) {
 		KOBRA_LOG_FILE(warn) << "Raytracer components have been modified, rebuilding...\n";
@@ -482,15 +556,85 @@ void Raytracer::render(const vk::raii::CommandBuffer &cmd,
 
 		profiler.frame("Serializing");
 
+		// Drop the components that are gone
+		std::set <const kobra::Raytracer *> live(raytracers.begin(), raytracers.end());
+		for (auto it = _serialized_cache.begin(); it != _serialized_cache.end(); ) {
+			if (live.count(it->first) == 0)
+				it = _serialized_cache.erase(it);
+			else
+				it++;
+		}
+
+		// Components to serialize again; their textures
+		// are loaded up front, in a single batch
+		std::vector <bool> stale(raytracers.size());
 		for (int i = 0; i < raytracers.size(); i++) {
-			profiler.frame("Serializing raytracer component");
+			int e = raytracer_entities[i];
+
+			stale[i] = (_serialized_cache.count(raytracers[i]) == 0)
+				|| retextured[i]
+				|| ecs.changed <kobra::Raytracer> (e, _version)
+				|| ecs.changed <Transform> (e, _version)
+				|| ecs.changed <Material> (e, _version)
+				|| ecs.changed <Mesh> (e, _version);
+		}
 
-			raytracers[i]->serialize({_ctx.phdev, _ctx.device},
-				raytracer_transforms[i],
-				host_buffers
-			);
+		_texture_list textures = _textures(raytracers, stale);
+		TextureManager::load_textures(*_ctx.phdev, *_ctx.device, textures.paths, textures.roles);
+
+		for (int i = 0; i < raytracers.size(); i++) {
+			auto it = _serialized_cache.find(raytracers[i]);
+			if (stale[i]) {
+				profiler.frame("Serializing raytracer component");
+
+				_serialized s;
+				kobra::Raytracer::HostBuffers hb {
+					.id = 1
+				};
+
+				raytracers[i]->serialize({_ctx.phdev, _ctx.device},
+					raytracer_transforms[i], hb
+				);
+
+				s.vertices = std::move(hb.vertices);
+				s.triangles = std::move(hb.triangles);
+				s.materials = std::move(hb.materials);
+				s.transforms = std::move(hb.transforms);
+				s.slots = _texture_slots(raytracers[i]);
+
+				it = _serialized_cache.insert_or_assign(raytracers[i], std::move(s)).first;
+				profiler.end();
+			}
+
+			// Append, with the indices and object id
+			// as if everything was serialized at once
+			const _serialized &s = it->second;
+
+			uint offset = host_buffers.vertices.size()/VERTEX_STRIDE;
+			uint obj_id = host_buffers.id - 1;
+
+			host_buffers.vertices.insert(host_buffers.vertices.end(),
+				s.vertices.begin(), s.vertices.end());
+
+			for (const aligned_vec4 &t : s.triangles) {
+				glm::vec4 tri = t.data;
+
+				uint ids[4];
+				std::memcpy(ids, &tri, sizeof(ids));
+				for (int k = 0; k < 3; k++)
+					ids[k] += offset;
+				ids[3] = obj_id;
+
+				std::memcpy(&tri, ids, sizeof(ids));
+				host_buffers.triangles.push_back(tri);
+			}
+
+			host_buffers.materials.insert(host_buffers.materials.end(),
+				s.materials.begin(), s.materials.end());
+			host_buffers.transforms.insert(host_buffers.transforms.end(),
+				s.transforms.begin(), s.transforms.end());
 
-			profiler.end();
+			host_buffers.id++;
 		}
 
 		profiler.end();
@@ -515,7 +659,8 @@ void Raytracer::render(const vk::raii::CommandBuffer &cmd,
 		profiler.end();
 	}
 
-	rebinding |= _dev.area_lights.upload(&alight_info, sizeof(alight_info));
+	if (dirty_lights)
+		rebinding |= _dev.area_lights.upload(&alight_info, sizeof(alight_info));
 	profiler.end();
 
 	profiler.end();
@@ -529,14 +674,6 @@ void Raytracer::render(const vk::raii::CommandBuffer &cmd,
 			}
 		);
 
-		// TODO: check if desciptors actually changed
-		_sync_queue->push(
-			[&]() {
-				_update_samplers(_albedo_image_descriptors, MESH_BINDING_ALBEDOS);
-				_update_samplers(_normal_image_descriptors, MESH_BINDING_NORMAL_MAPS);
-			}
-		);
-
 		return;
 	}
 
@@ -551,16 +688,14 @@ void Raytracer::render(const vk::raii::CommandBuffer &cmd,
 
 	// Dirty means reset samples
 	bool dirty = (_ptransform != camera.transform);
-	if (dirty || dirty_lights) {
+	if (dirty || dirty_lights || dirty_raytracers) {
 		_accumulated = 0;
 		_offsetx = 0;
 		_offsety = 0;
 	}
 
 	_ptransform = camera.transform;
-
-	_p_light_transforms = light_transforms;
-	_p_raytracers = raytracers;
+	_version = ecs.version();
 
 	// TODO: using progressive rendering, we can skip pixels (every
 	// other) and then increment samples after each complete pass.
@@ -603,11 +738,13 @@ void Raytracer::render(const vk::raii::CommandBuffer &cmd,
 		}
 	};
 
-	// Bind descriptor set
+	// Bind descriptor sets, with the texture table for this frame
+	const auto &table = TextureManager::table(*_ctx.phdev, *_ctx.device);
+
 	cmd.bindDescriptorSets(
 		vk::PipelineBindPoint::eCompute,
 		*_ppl_raytracing,
-		0, { *_ds_raytracing }, {}
+		0, { *_ds_raytracing, *table }, {}
 	);
 
 	// Push constants
@@ -738,9 +875,15 @@ void Raytracer::_initialize_vuklan_structures(const vk::AttachmentLoadOp &load)
 		0, sizeof(PushConstants)
 	};
 
+	// Textures are sampled from the texture table
+	std::array <vk::DescriptorSetLayout, 2> rt_dsls {
+		*_dsl_raytracing,
+		*TextureManager::table_layout(*_ctx.phdev, *_ctx.device)
+	};
+
 	_ppl_raytracing = vk::raii::PipelineLayout {
 		*_ctx.device,
-		{{}, *_dsl_raytracing, pcr}
+		{{}, rt_dsls, pcr}
 	};
 
 	vk::PipelineShaderStageCreateInfo rt_stage {
@@ -844,17 +987,54 @@ std::vector <BoundingBox> Raytracer::_get_bboxes(const kobra::Raytracer::HostBuf
 	return bboxes;
 }
 
-void Raytracer::_update_samplers(const ImageDescriptors &descriptors, uint32_t binding)
+// Textures of some of the components, with their roles
+Raytracer::_texture_list Raytracer::_textures(const std::vector <const kobra::Raytracer *> &raytracers,
+		const std::vector <bool> &which) const
 {
-	// Update descriptor set
-	vk::WriteDescriptorSet dset_write {
-		*_ds_raytracing,
-		binding, 0,
-		vk::DescriptorType::eCombinedImageSampler,
-		descriptors
-	};
+	_texture_list list;
+	for (int i = 0; i < raytracers.size(); i++) {
+		const Material *material = raytracers[i]->material;
+		if (which[i] && material->has_albedo()) {
+			list.paths.push_back(material->albedo_texture);
+			list.roles.push_back(TextureRole::eColor);
+		}
+
+		if (which[i] && material->has_normal()) {
+			list.paths.push_back(material->normal_texture);
+			list.roles.push_back(TextureRole::eNormal);
+		}
+	}
+
+	return list;
+}
+
+// Whether the textures of a component are loaded; they are marked as used
+bool Raytracer::_textures_loaded(const kobra::Raytracer *raytracer) const
+{
+	const Material *material = raytracer->material;
+
+	bool loaded = true;
+	if (material->has_albedo())
+		loaded &= (TextureManager::use(*_ctx.device, material->albedo_texture) != 0);
+	if (material->has_normal())
+		loaded &= (TextureManager::use(*_ctx.device, material->normal_texture) != 0);
+
+	return loaded;
+}
+
+// Slots of the textures of a component (-1 if it has none)
+std::pair <int, int> Raytracer::_texture_slots(const kobra::Raytracer *raytracer) const
+{
+	const Material *material = raytracer->material;
+
+	std::pair <int, int> slots {-1, -1};
+	if (material->has_albedo())
+		slots.first = TextureManager::slot(*_ctx.phdev, *_ctx.device, material->albedo_texture);
+	if (material->has_normal())
+		slots.second = TextureManager::slot(*_ctx.phdev, *_ctx.device,
+			material->normal_texture, TextureRole::eNormal);
 
-	_ctx.device->updateDescriptorSets(dset_write, nullptr);
+	return slots;
 }
 
 }
@@ -0,0 +1,71 @@
+// Unix headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Engine headers
+#include "../include/mapped_file.hpp"
+
+namespace kobra {
+
+// Map a whole file; empty files are
+// not mapped (and are not valid)
+MappedFile::MappedFile(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			_data = data;
+			_size = st.st_size;
+
+			// Mostly read front to back
+			madvise(_data, _size, MADV_SEQUENTIAL);
+		}
+	}
+
+	close(fd);
+}
+
+MappedFile::MappedFile(MappedFile &&other)
+		: _data(other._data), _size(other._size)
+{
+	other._data = nullptr;
+	other._size = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other)
+{
+	if (this != &other) {
+		reset();
+
+		_data = other._data;
+		_size = other._size;
+
+		other._data = nullptr;
+		other._size = 0;
+	}
+
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	reset();
+}
+
+void MappedFile::reset()
+{
+	if (_data)
+		munmap(_data, _size);
+
+	_data = nullptr;
+	_size = 0;
+}
+
+}
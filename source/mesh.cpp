@@ -1,13 +1,102 @@
+// Standard headers
+#include <algorithm>
+#include <cstring>
+
 // Assimp headers
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 // Engine headers
+#include "../include/bake.hpp"
 #include "../include/mesh.hpp"
+#include "../include/vfs.hpp"
 
 namespace kobra {
 
+// Assimp reads files (including the ones that a model refers
+// to, such as materials) through the virtual file layer
+class VFSStream : public Assimp::IOStream {
+	vfs::File	_file;
+	size_t		_pos = 0;
+public:
+	VFSStream(vfs::File &&file) : _file(std::move(file)) {}
+
+	size_t Read(void *buffer, size_t size, size_t count) override {
+		if (size == 0)
+			return 0;
+
+		size_t n = std::min(count, (_file.size() - _pos)/size);
+		std::memcpy(buffer, _file.data() + _pos, n * size);
+		_pos += n * size;
+		return n;
+	}
+
+	size_t Write(const void *, size_t, size_t) override {
+		return 0;
+	}
+
+	aiReturn Seek(size_t offset, aiOrigin origin) override {
+		size_t base = 0;
+		if (origin == aiOrigin_CUR)
+			base = _pos;
+		else if (origin == aiOrigin_END)
+			base = _file.size();
+
+		if (base + offset > _file.size())
+			return aiReturn_FAILURE;
+
+		_pos = base + offset;
+		return aiReturn_SUCCESS;
+	}
+
+	size_t Tell() const override {
+		return _pos;
+	}
+
+	size_t FileSize() const override {
+		return _file.size();
+	}
+
+	void Flush() override {}
+};
+
+class VFSSystem : public Assimp::IOSystem {
+	// Files that have been opened, if requested
+	std::vector <std::string> *_opened = nullptr;
+public:
+	VFSSystem(std::vector <std::string> *opened = nullptr) : _opened(opened) {}
+
+	bool Exists(const char *path) const override {
+		return vfs::exists(path);
+	}
+
+	char getOsSeparator() const override {
+		return '/';
+	}
+
+	// Read only
+	Assimp::IOStream *Open(const char *path, const char *mode) override {
+		if (mode[0] != 'r')
+			return nullptr;
+
+		vfs::File file = vfs::open(path);
+		if (!file.valid())
+			return nullptr;
+
+		if (_opened)
+			_opened->push_back(path);
+
+		return new VFSStream(std::move(file));
+	}
+
+	void Close(Assimp::IOStream *stream) override {
+		delete stream;
+	}
+};
+
 // Submesh
 
 // Mesh
@@ -361,21 +450,35 @@ static Mesh process_node(aiNode *node, const aiScene *scene)
 	return Mesh {submeshes};
 }
 
-std::optional <Mesh> Mesh::load(const std::string &path)
+std::optional <Mesh> Mesh::load(const std::string &path, std::vector <std::string> *files)
 {
 	// Special cases
 	if (path == "box")
 		return box({0, 0, 0}, {0.5, 0.5, 0.5});
 
+	// Baked version
+	if (!files) {
+		std::string baked = bake::lookup(bake::mesh, path);
+		if (!baked.empty()) {
+			vfs::File file = vfs::open(baked);
+			auto mesh = from_baked(file.view(), path);
+			if (mesh.has_value())
+				return mesh;
+
+			KOBRA_LOG_FUNC(warn) << "Invalid baked mesh " << baked
+				<< ", importing " << path << " instead" << std::endl;
+		}
+	}
+
 	// Check if the file exists
-	std::ifstream file(path);
-	if (!file.is_open()) {
+	if (!vfs::exists(path)) {
 		Logger::error("[Mesh] Could not open file: " + path);
 		return {};
 	}
 
-	// Create the Assimp importer
+	// Create the Assimp importer (which owns the IO handler)
 	Assimp::Importer importer;
+	importer.SetIOHandler(new VFSSystem(files));
 
 	// Read scene
 	const aiScene *scene = importer.ReadFile(
@@ -397,4 +500,72 @@ std::optional <Mesh> Mesh::load(const std::string &path)
 	return m;
 }
 
+// Baked meshes
+//	"KMSH", version, number of submeshes, then for each submesh
+//	the number of vertices and indices, followed by both arrays
+std::string Mesh::bake() const
+{
+	std::string out = "KMSH";
+
+	auto put = [&](const void *data, size_t size) {
+		out.append((const char *) data, size);
+	};
+
+	uint32_t header[2] = {bake::version, (uint32_t) submeshes.size()};
+	put(header, sizeof(header));
+
+	for (const Submesh &submesh : submeshes) {
+		uint32_t counts[2] = {
+			(uint32_t) submesh.vertices.size(),
+			(uint32_t) submesh.indices.size()
+		};
+
+		put(counts, sizeof(counts));
+		put(submesh.vertices.data(), submesh.vertices.size() * sizeof(Vertex));
+		put(submesh.indices.data(), submesh.indices.size() * sizeof(uint32_t));
+	}
+
+	return out;
+}
+
+std::optional <Mesh> Mesh::from_baked(std::string_view data, const std::string &source)
+{
+	size_t offset = 0;
+	auto get = [&](void *out, size_t size) {
+		if (offset + size > data.size())
+			return false;
+
+		std::memcpy(out, data.data() + offset, size);
+		offset += size;
+		return true;
+	};
+
+	char magic[4];
+	uint32_t header[2];
+	if (!get(magic, 4) || std::memcmp(magic, "KMSH", 4) != 0
+			|| !get(header, sizeof(header)) || header[0] != bake::version)
+		return {};
+
+	std::vector <Submesh> submeshes;
+	for (uint32_t i = 0; i < header[1]; i++) {
+		uint32_t counts[2];
+		if (!get(counts, sizeof(counts)))
+			return {};
+
+		VertexList vertices(counts[0]);
+		Indices indices(counts[1]);
+
+		if (!get(vertices.data(), vertices.size() * sizeof(Vertex))
+				|| !get(indices.data(), indices.size() * sizeof(uint32_t)))
+			return {};
+
+		// Tangents were computed when baking
+		submeshes.emplace_back(vertices, indices, false);
+	}
+
+	Mesh m {submeshes};
+	m._source = source;
+	return m;
+}
+
 }
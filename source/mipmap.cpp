@@ -0,0 +1,266 @@
+// Standard headers
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+// Engine headers
+#include "../include/mipmap.hpp"
+
+namespace kobra {
+
+namespace mip {
+
+uint32_t count(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	while (width > 1 || height > 1) {
+		width = std::max(width/2, 1u);
+		height = std::max(height/2, 1u);
+		levels++;
+	}
+
+	return levels;
+}
+
+std::vector <Level> layout(uint32_t width, uint32_t height, uint32_t levels, size_t pixel)
+{
+	std::vector <Level> result;
+
+	size_t offset = 0;
+	for (uint32_t i = 0; i < levels; i++) {
+		size_t size = size_t(width) * height * pixel;
+		result.push_back(Level {width, height, offset, size});
+
+		offset += size;
+		width = std::max(width/2, 1u);
+		height = std::max(height/2, 1u);
+	}
+
+	return result;
+}
+
+// sRGB transfer functions; decoding is a table lookup, and
+// encoding goes through a table fine enough for 8 bits
+static const std::array <float, 256> &decode_table()
+{
+	static const std::array <float, 256> table = [] {
+		std::array <float, 256> t;
+		for (int i = 0; i < 256; i++) {
+			float v = i/255.0f;
+			t[i] = (v <= 0.04045f) ? v/12.92f : std::pow((v + 0.055f)/1.055f, 2.4f);
+		}
+
+		return t;
+	} ();
+
+	return table;
+}
+
+static constexpr int encode_size = 4096;
+
+static const std::array <uint8_t, encode_size> &encode_table()
+{
+	static const std::array <uint8_t, encode_size> table = [] {
+		std::array <uint8_t, encode_size> t;
+		for (int i = 0; i < encode_size; i++) {
+			float v = i/float(encode_size - 1);
+			float s = (v <= 0.0031308f) ? v * 12.92f : 1.055f * std::pow(v, 1.0f/2.4f) - 0.055f;
+			t[i] = uint8_t(std::clamp(s, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+
+		return t;
+	} ();
+
+	return table;
+}
+
+// Filter kernels, and their radii (in destination pixels)
+static float sinc(float x)
+{
+	if (std::abs(x) < 1e-6f)
+		return 1.0f;
+
+	x *= float(M_PI);
+	return std::sin(x)/x;
+}
+
+static float bessel_i0(float x)
+{
+	// Power series; converges quickly for the values used here
+	float sum = 1.0f;
+	float term = 1.0f;
+	for (int k = 1; k < 32; k++) {
+		float f = x/(2.0f * k);
+		term *= f * f;
+		sum += term;
+
+		if (term < 1e-8f * sum)
+			break;
+	}
+
+	return sum;
+}
+
+static float radius(Filter filter)
+{
+	return (filter == Filter::eBox) ? 0.5f : 3.0f;
+}
+
+static float kernel(Filter filter, float x)
+{
+	x = std::abs(x);
+
+	switch (filter) {
+	case Filter::eBox:
+		return (x < 0.5f) ? 1.0f : ((x == 0.5f) ? 0.5f : 0.0f);
+	case Filter::eKaiser: {
+		static constexpr float alpha = 4.0f;
+		static const float norm = 1.0f/bessel_i0(alpha);
+
+		float r = x/3.0f;
+		if (r >= 1.0f)
+			return 0.0f;
+
+		return sinc(x) * bessel_i0(alpha * std::sqrt(1.0f - r * r)) * norm;
+	}
+	case Filter::eLanczos:
+		return (x < 3.0f) ? sinc(x) * sinc(x/3.0f) : 0.0f;
+	}
+
+	return 0.0f;
+}
+
+// Source pixels and weights for each destination pixel along an axis;
+// every destination pixel has the same number of taps, some of which
+// may have zero weight
+struct Taps {
+	int			count;
+	std::vector <int>	index;
+	std::vector <float>	weight;
+};
+
+static Taps make_taps(uint32_t src, uint32_t dst, Filter filter)
+{
+	float scale = float(src)/float(dst);
+	float support = radius(filter) * std::max(scale, 1.0f);
+
+	Taps taps;
+	taps.count = int(std::ceil(2.0f * support)) + 2;
+	taps.index.resize(size_t(dst) * taps.count);
+	taps.weight.resize(size_t(dst) * taps.count);
+
+	for (uint32_t x = 0; x < dst; x++) {
+		float center = (x + 0.5f) * scale;
+		int first = int(std::floor(center - support));
+
+		float total = 0.0f;
+		for (int k = 0; k < taps.count; k++) {
+			int i = first + k;
+			float w = kernel(filter, (i + 0.5f - center)/std::max(scale, 1.0f));
+
+			// Wrap around, as the samplers repeat
+			int wrapped = ((i % int(src)) + int(src)) % int(src);
+
+			taps.index[x * taps.count + k] = wrapped;
+			taps.weight[x * taps.count + k] = w;
+			total += w;
+		}
+
+		for (int k = 0; k < taps.count; k++)
+			taps.weight[x * taps.count + k] /= total;
+	}
+
+	return taps;
+}
+
+// Downsample a level (four floats per pixel), horizontally
+// then vertically; inner loops are over contiguous channels,
+// so that they vectorize
+static std::vector <float> downsample(const std::vector <float> &src,
+		uint32_t sw, uint32_t sh, uint32_t dw, uint32_t dh, Filter filter)
+{
+	Taps h = make_taps(sw, dw, filter);
+	Taps v = make_taps(sh, dh, filter);
+
+	std::vector <float> tmp(size_t(dw) * sh * 4, 0.0f);
+	for (uint32_t y = 0; y < sh; y++) {
+		const float *row = &src[size_t(y) * sw * 4];
+		float *out = &tmp[size_t(y) * dw * 4];
+
+		for (uint32_t x = 0; x < dw; x++) {
+			float acc[4] = {0, 0, 0, 0};
+			for (int k = 0; k < h.count; k++) {
+				float w = h.weight[x * h.count + k];
+				const float *p = &row[size_t(h.index[x * h.count + k]) * 4];
+				for (int c = 0; c < 4; c++)
+					acc[c] += w * p[c];
+			}
+
+			std::memcpy(&out[x * 4], acc, sizeof(acc));
+		}
+	}
+
+	std::vector <float> dst(size_t(dw) * dh * 4, 0.0f);
+	for (uint32_t y = 0; y < dh; y++) {
+		float *out = &dst[size_t(y) * dw * 4];
+
+		for (int k = 0; k < v.count; k++) {
+			float w = v.weight[y * v.count + k];
+			const float *row = &tmp[size_t(v.index[y * v.count + k]) * dw * 4];
+			for (size_t i = 0; i < size_t(dw) * 4; i++)
+				out[i] += w * row[i];
+		}
+	}
+
+	return dst;
+}
+
+std::vector <uint8_t> generate(const uint8_t *pixels, uint32_t width, uint32_t height,
+		Filter filter, bool srgb)
+{
+	std::vector <Level> levels = layout(width, height, count(width, height));
+	std::vector <uint8_t> chain(levels.back().offset + levels.back().size);
+
+	std::memcpy(chain.data(), pixels, levels[0].size);
+	if (levels.size() == 1)
+		return chain;
+
+	const auto &decode = decode_table();
+	const auto &encode = encode_table();
+
+	// Levels are filtered from the previous level, kept as floats
+	// so that rounding does not accumulate down the chain
+	std::vector <float> current(size_t(width) * height * 4);
+	for (size_t i = 0; i < size_t(width) * height; i++) {
+		for (int c = 0; c < 3; c++) {
+			uint8_t v = pixels[4 * i + c];
+			current[4 * i + c] = srgb ? decode[v] : v/255.0f;
+		}
+
+		current[4 * i + 3] = pixels[4 * i + 3]/255.0f;
+	}
+
+	for (size_t l = 1; l < levels.size(); l++) {
+		const Level &prev = levels[l - 1];
+		const Level &level = levels[l];
+
+		current = downsample(current, prev.width, prev.height,
+			level.width, level.height, filter);
+
+		uint8_t *out = chain.data() + level.offset;
+		for (size_t i = 0; i < size_t(level.width) * level.height * 4; i++) {
+			float v = std::clamp(current[i], 0.0f, 1.0f);
+			if (srgb && (i % 4) != 3)
+				out[i] = encode[int(v * (encode_size - 1) + 0.5f)];
+			else
+				out[i] = uint8_t(v * 255.0f + 0.5f);
+		}
+	}
+
+	return chain;
+}
+
+}
+
+}
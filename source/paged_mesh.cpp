@@ -0,0 +1,711 @@
+// Standard headers
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+
+// Unix headers
+#include <sys/mman.h>
+
+// Engine headers
+#include "../include/logger.hpp"
+#include "../include/paged_mesh.hpp"
+
+namespace kobra {
+
+// Size of a page in the file, before padding
+static size_t page_size(const PagedMesh::Entry &entry)
+{
+	return size_t(entry.vertices) * sizeof(Vertex)
+		+ size_t(entry.indices) * sizeof(uint32_t);
+}
+
+// Range of whole memory pages covering a page of the mesh
+static void memory_range(const MappedFile &file, const PagedMesh::Entry &entry,
+		void *&start, size_t &length)
+{
+	size_t size = page_size(entry);
+	size_t end = std::min(file.size(), size_t(entry.offset) + size);
+	end = (end + PagedMesh::alignment - 1) & ~(PagedMesh::alignment - 1);
+
+	start = (void *) (file.data() + entry.offset);
+	length = std::min(end, file.size()) - entry.offset;
+}
+
+//////////////////
+// Paged writer //
+//////////////////
+
+PagedMesh::Writer::Writer(const std::string &path, size_t triangles)
+		: _path(path), _triangles(std::max <size_t> (triangles, 1))
+{
+	_fout.open(_path + ".tmp", std::ios::binary | std::ios::trunc);
+	if (!_fout.is_open()) {
+		KOBRA_LOG_FUNC(error) << "Failed to open file: " << _path << ".tmp" << std::endl;
+		return;
+	}
+
+	std::memcpy(_header.magic, "KPMS", 4);
+	_header.version = version;
+
+	// The header is written again once everything is known
+	_fout.write((const char *) &_header, sizeof(_header));
+	_offset = sizeof(_header);
+	_good = _pad();
+}
+
+// Pad the file up to the next page boundary
+bool PagedMesh::Writer::_pad()
+{
+	static const char zeros[alignment] = {};
+
+	size_t padding = (alignment - _offset % alignment) % alignment;
+	_fout.write(zeros, padding);
+	_offset += padding;
+
+	return _fout.good();
+}
+
+// Write the triangles of a submesh as a single page; the remap table
+// is all ones on entry, and is restored before returning
+bool PagedMesh::Writer::_page(const Vertex *source_vertices,
+		const uint32_t *source_indices,
+		const std::vector <uint32_t> &triangles,
+		std::vector <uint32_t> &remap)
+{
+	VertexList vertices;
+	Indices indices;
+
+	indices.reserve(3 * triangles.size());
+	for (uint32_t t : triangles) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = source_indices[3 * t + k];
+			if (remap[v] == ~0u) {
+				remap[v] = vertices.size();
+				vertices.push_back(source_vertices[v]);
+			}
+
+			indices.push_back(remap[v]);
+		}
+	}
+
+	for (uint32_t t : triangles) {
+		for (int k = 0; k < 3; k++)
+			remap[source_indices[3 * t + k]] = ~0u;
+	}
+
+	Entry entry {};
+	entry.submesh = _header.submeshes;
+	entry.vertices = vertices.size();
+	entry.indices = indices.size();
+	entry.offset = _offset;
+
+	glm::vec3 min = vertices[0].position;
+	glm::vec3 max = vertices[0].position;
+	for (const Vertex &v : vertices) {
+		min = glm::min(min, v.position);
+		max = glm::max(max, v.position);
+	}
+
+	for (int k = 0; k < 3; k++) {
+		entry.min[k] = min[k];
+		entry.max[k] = max[k];
+	}
+
+	_fout.write((const char *) vertices.data(), vertices.size() * sizeof(Vertex));
+	_fout.write((const char *) indices.data(), indices.size() * sizeof(uint32_t));
+	_offset += page_size(entry);
+
+	_entries.push_back(entry);
+	_header.vertices += entry.vertices;
+	_header.indices += entry.indices;
+
+	return _pad();
+}
+
+// Split the triangles of a submesh at the median centroid along the
+// longest axis, until the pieces fit in a page
+bool PagedMesh::Writer::add(const Submesh &submesh)
+{
+	return add(submesh.vertices.data(), submesh.vertices.size(),
+		submesh.indices.data(), submesh.indices.size());
+}
+
+bool PagedMesh::Writer::add(const Vertex *vertices, size_t vertex_count,
+		const uint32_t *indices, size_t index_count)
+{
+	if (!_good)
+		return false;
+
+	size_t count = index_count/3;
+	if (count == 0) {
+		_header.submeshes++;
+		return true;
+	}
+
+	for (size_t i = 0; i < 3 * count; i++) {
+		if (indices[i] >= vertex_count) {
+			KOBRA_LOG_FUNC(error) << "Index out of range in submesh "
+				<< _header.submeshes << std::endl;
+			return (_good = false);
+		}
+	}
+
+	std::vector <glm::vec3> centroids(count);
+	for (size_t t = 0; t < count; t++) {
+		centroids[t] = (vertices[indices[3 * t]].position
+			+ vertices[indices[3 * t + 1]].position
+			+ vertices[indices[3 * t + 2]].position)/3.0f;
+	}
+
+	std::vector <uint32_t> order(count);
+	std::iota(order.begin(), order.end(), 0);
+
+	std::vector <uint32_t> remap(vertex_count, ~0u);
+	std::vector <uint32_t> triangles;
+
+	std::vector <std::pair <size_t, size_t>> stack {{0, count}};
+	while (!stack.empty() && _good) {
+		auto [begin, end] = stack.back();
+		stack.pop_back();
+
+		if (end - begin <= _triangles) {
+			triangles.assign(order.begin() + begin, order.begin() + end);
+			_good = _page(vertices, indices, triangles, remap);
+			continue;
+		}
+
+		glm::vec3 min = centroids[order[begin]];
+		glm::vec3 max = min;
+		for (size_t i = begin; i < end; i++) {
+			min = glm::min(min, centroids[order[i]]);
+			max = glm::max(max, centroids[order[i]]);
+		}
+
+		glm::vec3 extent = max - min;
+		int axis = (extent.x > extent.y)
+			? (extent.x > extent.z ? 0 : 2)
+			: (extent.y > extent.z ? 1 : 2);
+
+		size_t mid = begin + (end - begin)/2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](uint32_t a, uint32_t b) {
+				return centroids[a][axis] < centroids[b][axis];
+			}
+		);
+
+		// Right first, so that pages come out in order
+		stack.push_back({mid, end});
+		stack.push_back({begin, mid});
+	}
+
+	_header.submeshes++;
+	return _good;
+}
+
+bool PagedMesh::Writer::finish()
+{
+	if (!_good) {
+		_fout.close();
+		std::remove((_path + ".tmp").c_str());
+		return false;
+	}
+
+	_header.pages = _entries.size();
+	_header.table = _offset;
+
+	_fout.write((const char *) _entries.data(), _entries.size() * sizeof(Entry));
+	_fout.seekp(0);
+	_fout.write((const char *) &_header, sizeof(_header));
+	_fout.close();
+
+	_good = false;
+	if (_fout.fail()) {
+		KOBRA_LOG_FUNC(error) << "Failed to write file: " << _path << ".tmp" << std::endl;
+		std::remove((_path + ".tmp").c_str());
+		return false;
+	}
+
+	if (std::rename((_path + ".tmp").c_str(), _path.c_str()) != 0) {
+		KOBRA_LOG_FUNC(error) << "Failed to replace file: " << _path << std::endl;
+		std::remove((_path + ".tmp").c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool PagedMesh::write(const std::string &path, const Mesh &mesh, size_t triangles)
+{
+	Writer writer(path, triangles);
+	for (const Submesh &submesh : mesh.submeshes) {
+		if (!writer.add(submesh))
+			break;
+	}
+
+	return writer.finish();
+}
+
+////////////////
+// Paged mesh //
+////////////////
+
+PagedMesh::PagedMesh(const std::string &path, size_t budget)
+		: _file(path), _budget(budget)
+{
+	if (!_file.valid()) {
+		KOBRA_LOG_FUNC(error) << "Failed to open paged mesh: " << path << std::endl;
+		return;
+	}
+
+	auto fail = [&](const char *msg) {
+		KOBRA_LOG_FUNC(error) << msg << ": " << path << std::endl;
+		_file.reset();
+		_pages.clear();
+	};
+
+	if (_file.size() < sizeof(Header)) {
+		fail("Truncated paged mesh");
+		return;
+	}
+
+	std::memcpy(&_header, _file.data(), sizeof(Header));
+	if (std::memcmp(_header.magic, "KPMS", 4) != 0 || _header.version != version) {
+		fail("Not a paged mesh (or an older version)");
+		return;
+	}
+
+	if (_header.table > _file.size()
+			|| (_file.size() - _header.table)/sizeof(Entry) < _header.pages) {
+		fail("Truncated paged mesh");
+		return;
+	}
+
+	// Accessed in no particular order
+	madvise((void *) _file.data(), _file.size(), MADV_RANDOM);
+
+	std::vector <BoundingBox> boxes;
+	for (uint32_t i = 0; i < _header.pages; i++) {
+		Entry entry;
+		std::memcpy(&entry, _file.data() + _header.table + i * sizeof(Entry), sizeof(Entry));
+
+		if (entry.offset % alignment != 0 || entry.offset > _header.table
+				|| page_size(entry) > _header.table - entry.offset) {
+			fail("Corrupt page table in paged mesh");
+			return;
+		}
+
+		// Indices are used unchecked once pages are pinned, so
+		// they are checked here; the page is dropped again after
+		const uint32_t *indices = (const uint32_t *) (_file.data()
+			+ entry.offset + size_t(entry.vertices) * sizeof(Vertex));
+
+		bool bounded = std::all_of(indices, indices + entry.indices,
+			[&](uint32_t index) { return index < entry.vertices; }
+		);
+
+		void *start;
+		size_t length;
+		memory_range(_file, entry, start, length);
+		madvise(start, length, MADV_DONTNEED);
+
+		if (!bounded) {
+			fail("Index out of range in paged mesh");
+			return;
+		}
+
+		_page page;
+		page.entry = entry;
+		page.bytes = page_size(entry);
+		page.box = BoundingBox {
+			.min = {entry.min[0], entry.min[1], entry.min[2]},
+			.max = {entry.max[0], entry.max[1], entry.max[2]},
+			.id = int(i)
+		};
+
+		_box = (i == 0) ? page.box : BoundingBox::merge(_box, page.box);
+		boxes.push_back(page.box);
+		_pages.push_back(page);
+	}
+
+	if (!boxes.empty())
+		_flatten(partition(boxes));
+
+	_stats.pages = _pages.size();
+}
+
+// Copy the BVH into an array, returning the index of the root
+int PagedMesh::_flatten(const BVHPtr &node)
+{
+	int index = _nodes.size();
+	_nodes.push_back(_node {.box = node->bbox});
+
+	if (node->is_leaf()) {
+		_nodes[index].page = node->object;
+	} else {
+		int left = node->left ? _flatten(node->left) : -1;
+		int right = node->right ? _flatten(node->right) : -1;
+
+		_nodes[index].left = left;
+		_nodes[index].right = right;
+	}
+
+	return index;
+}
+
+// Evict unpinned pages, least recently used first, while over budget;
+// the mapping is read-only, so evicted pages are simply read again
+void PagedMesh::_evict()
+{
+	while (_stats.resident_bytes > _budget && !_lru.empty()) {
+		uint32_t i = _lru.back();
+		_lru.pop_back();
+
+		_page &page = _pages[i];
+
+		void *start;
+		size_t length;
+		memory_range(_file, page.entry, start, length);
+		madvise(start, length, MADV_DONTNEED);
+
+		page.resident = false;
+		_stats.resident--;
+		_stats.resident_bytes -= page.bytes;
+		_stats.evictions++;
+	}
+}
+
+PagedMesh::Page PagedMesh::_pin(uint32_t i)
+{
+	KOBRA_ASSERT(i < _pages.size(), "Page index out of range: " + std::to_string(i));
+
+	std::lock_guard <std::mutex> lock(_mutex);
+
+	_page &page = _pages[i];
+	if (!page.resident) {
+		void *start;
+		size_t length;
+		memory_range(_file, page.entry, start, length);
+		madvise(start, length, MADV_WILLNEED);
+
+		page.resident = true;
+		_stats.resident++;
+		_stats.resident_bytes += page.bytes;
+		_stats.faults++;
+	} else if (page.pins == 0) {
+		_lru.erase(page.lru);
+	}
+
+	if (page.pins++ == 0)
+		_stats.pinned++;
+
+	// Pinned pages do not count as candidates
+	_evict();
+
+	const char *data = _file.data() + page.entry.offset;
+	return Page {
+		.box = page.box,
+		.submesh = page.entry.submesh,
+		.vertices = (const Vertex *) data,
+		.vertex_count = page.entry.vertices,
+		.indices = (const uint32_t *) (data + page.entry.vertices * sizeof(Vertex)),
+		.index_count = page.entry.indices
+	};
+}
+
+void PagedMesh::_unpin(uint32_t i)
+{
+	std::lock_guard <std::mutex> lock(_mutex);
+
+	_page &page = _pages[i];
+	KOBRA_ASSERT(page.pins > 0, "Page is not pinned: " + std::to_string(i));
+
+	if (--page.pins == 0) {
+		_stats.pinned--;
+		_lru.push_front(i);
+		page.lru = _lru.begin();
+		_evict();
+	}
+}
+
+PagedMesh::Pin PagedMesh::pin(uint32_t i)
+{
+	return Pin(this, i, _pin(i));
+}
+
+void PagedMesh::budget(size_t bytes)
+{
+	std::lock_guard <std::mutex> lock(_mutex);
+	_budget = bytes;
+	_evict();
+}
+
+PagedMesh::Stats PagedMesh::stats() const
+{
+	std::lock_guard <std::mutex> lock(_mutex);
+	return _stats;
+}
+
+std::vector <uint32_t> PagedMesh::query(const BoundingBox &box) const
+{
+	std::vector <uint32_t> result;
+	if (_nodes.empty())
+		return result;
+
+	std::vector <int> stack {0};
+	while (!stack.empty()) {
+		const _node &node = _nodes[stack.back()];
+		stack.pop_back();
+
+		if (!node.box.intersects(box))
+			continue;
+
+		if (node.page != -1) {
+			result.push_back(node.page);
+			continue;
+		}
+
+		if (node.left != -1)
+			stack.push_back(node.left);
+
+		if (node.right != -1)
+			stack.push_back(node.right);
+	}
+
+	return result;
+}
+
+// Entry distance of a ray into a box (negative if missed)
+static float ray_box(const Ray &ray, const glm::vec3 &inv,
+		const BoundingBox &box, float tmax)
+{
+	glm::vec3 t0 = (box.min - ray.origin) * inv;
+	glm::vec3 t1 = (box.max - ray.origin) * inv;
+
+	glm::vec3 tsmall = glm::min(t0, t1);
+	glm::vec3 tbig = glm::max(t0, t1);
+
+	float tnear = std::max(0.0f, std::max(tsmall.x, std::max(tsmall.y, tsmall.z)));
+	float tfar = std::min(tmax, std::min(tbig.x, std::min(tbig.y, tbig.z)));
+
+	return (tnear <= tfar) ? tnear : -1.0f;
+}
+
+// Ray-triangle intersection (Moller-Trumbore)
+static bool ray_triangle(const Ray &ray, const glm::vec3 &a,
+		const glm::vec3 &b, const glm::vec3 &c,
+		float &t, float &u, float &v)
+{
+	static constexpr float epsilon = 1e-8f;
+
+	glm::vec3 e1 = b - a;
+	glm::vec3 e2 = c - a;
+
+	glm::vec3 p = glm::cross(ray.direction, e2);
+	float det = glm::dot(e1, p);
+	if (std::abs(det) < epsilon)
+		return false;
+
+	float inv = 1.0f/det;
+
+	glm::vec3 s = ray.origin - a;
+	u = glm::dot(s, p) * inv;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	glm::vec3 q = glm::cross(s, e1);
+	v = glm::dot(ray.direction, q) * inv;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	t = glm::dot(e2, q) * inv;
+	return t > 0.0f;
+}
+
+std::optional <PagedMesh::Hit> PagedMesh::raycast(const Ray &ray, float tmax)
+{
+	if (_nodes.empty())
+		return std::nullopt;
+
+	glm::vec3 inv = 1.0f/ray.direction;
+
+	std::optional <Hit> best;
+	float tbest = tmax;
+
+	// Nodes with their entry distances; the nearer child is
+	// visited first, and nodes behind the best hit are skipped
+	std::vector <std::pair <int, float>> stack;
+
+	float troot = ray_box(ray, inv, _nodes[0].box, tbest);
+	if (troot >= 0.0f)
+		stack.push_back({0, troot});
+
+	while (!stack.empty()) {
+		auto [index, tnear] = stack.back();
+		stack.pop_back();
+
+		if (tnear > tbest)
+			continue;
+
+		const _node &node = _nodes[index];
+		if (node.page != -1) {
+			Pin page = pin(node.page);
+			for (uint32_t i = 0; i + 2 < page->index_count; i += 3) {
+				float t, u, v;
+				bool hit = ray_triangle(ray,
+					page->vertices[page->indices[i]].position,
+					page->vertices[page->indices[i + 1]].position,
+					page->vertices[page->indices[i + 2]].position,
+					t, u, v
+				);
+
+				if (hit && t < tbest) {
+					tbest = t;
+					best = Hit {
+						.t = t,
+						.u = u,
+						.v = v,
+						.page = uint32_t(node.page),
+						.triangle = i/3,
+						.submesh = page->submesh
+					};
+				}
+			}
+
+			continue;
+		}
+
+		float tl = (node.left != -1) ? ray_box(ray, inv, _nodes[node.left].box, tbest) : -1.0f;
+		float tr = (node.right != -1) ? ray_box(ray, inv, _nodes[node.right].box, tbest) : -1.0f;
+
+		// Farther child goes on the stack first
+		if (tl >= 0.0f && tr >= 0.0f) {
+			if (tl < tr) {
+				stack.push_back({node.right, tr});
+				stack.push_back({node.left, tl});
+			} else {
+				stack.push_back({node.left, tl});
+				stack.push_back({node.right, tr});
+			}
+		} else if (tl >= 0.0f) {
+			stack.push_back({node.left, tl});
+		} else if (tr >= 0.0f) {
+			stack.push_back({node.right, tr});
+		}
+	}
+
+	return best;
+}
+
+void PagedMesh::upload(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &device,
+		const vk::raii::CommandPool &command_pool,
+		BufferData &vertex_buffer, BufferData &index_buffer,
+		size_t staging_size)
+{
+	KOBRA_ASSERT(vertex_buffer.size >= _header.vertices * sizeof(Vertex),
+		"Vertex buffer is too small for paged mesh");
+	KOBRA_ASSERT(index_buffer.size >= _header.indices * sizeof(uint32_t),
+		"Index buffer is too small for paged mesh");
+	KOBRA_ASSERT((vertex_buffer.flags & vk::BufferUsageFlagBits::eTransferDst)
+			&& (index_buffer.flags & vk::BufferUsageFlagBits::eTransferDst),
+		"Paged mesh buffers must be transfer destinations");
+
+	if (_pages.empty())
+		return;
+
+	// Every page has to fit in the staging buffer on its own
+	for (const _page &page : _pages)
+		staging_size = std::max(staging_size, page.bytes);
+
+	BufferData staging {
+		phdev, device, staging_size,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::MemoryPropertyFlagBits::eHostVisible
+			| vk::MemoryPropertyFlagBits::eHostCoherent
+	};
+
+	char *sptr = (char *) staging.memory.mapMemory(0, staging.size);
+
+	vk::raii::Queue queue {device, 0, 0};
+	vk::raii::Fence fence {device, vk::FenceCreateInfo {}};
+
+	std::vector <vk::BufferCopy> vertex_copies;
+	std::vector <vk::BufferCopy> index_copies;
+	size_t used = 0;
+
+	// Copy whatever is in the staging buffer, and wait
+	// for it before the staging buffer is filled again
+	auto flush = [&]() {
+		if (used == 0)
+			return;
+
+		auto cmd = make_command_buffer(device, command_pool);
+		cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+		if (!vertex_copies.empty())
+			cmd.copyBuffer(*staging.buffer, *vertex_buffer.buffer, vertex_copies);
+
+		if (!index_copies.empty())
+			cmd.copyBuffer(*staging.buffer, *index_buffer.buffer, index_copies);
+
+		cmd.end();
+
+		queue.submit(
+			vk::SubmitInfo {
+				0, nullptr, nullptr, 1, &*cmd
+			},
+			*fence
+		);
+
+		while (vk::Result(device.waitForFences(
+			*fence,
+			true,
+			std::numeric_limits <uint64_t>::max()
+		)) == vk::Result::eTimeout);
+
+		device.resetFences(*fence);
+
+		vertex_copies.clear();
+		index_copies.clear();
+		used = 0;
+	};
+
+	uint32_t voffset = 0;
+	uint64_t ioffset = 0;
+
+	for (uint32_t i = 0; i < _pages.size(); i++) {
+		if (used + _pages[i].bytes > staging.size)
+			flush();
+
+		// Unpinned as soon as it is in the staging buffer
+		Pin page = pin(i);
+
+		size_t vbytes = size_t(page->vertex_count) * sizeof(Vertex);
+		size_t ibytes = size_t(page->index_count) * sizeof(uint32_t);
+
+		if (vbytes > 0) {
+			std::memcpy(sptr + used, page->vertices, vbytes);
+			vertex_copies.push_back({used, size_t(voffset) * sizeof(Vertex), vbytes});
+			used += vbytes;
+		}
+
+		if (ibytes > 0) {
+			uint32_t *iptr = (uint32_t *) (sptr + used);
+			for (uint32_t j = 0; j < page->index_count; j++)
+				iptr[j] = page->indices[j] + voffset;
+
+			index_copies.push_back({used, ioffset * sizeof(uint32_t), ibytes});
+			used += ibytes;
+		}
+
+		voffset += page->vertex_count;
+		ioffset += page->index_count;
+	}
+
+	flush();
+	staging.memory.unmapMemory();
+}
+
+}
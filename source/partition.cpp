@@ -0,0 +1,331 @@
+// Standard headers
+#include <algorithm>
+#include <cmath>
+
+// Engine headers
+#include "../include/logger.hpp"
+#include "../include/partition.hpp"
+#include "../include/profiler.hpp"
+#include "../include/thread_pool.hpp"
+#include "../include/timer.hpp"
+
+namespace kobra {
+
+// Key of a grid cell; 21 bits per coordinate
+static int64_t grid_key(const glm::ivec3 &c)
+{
+	constexpr int64_t mask = (1 << 21) - 1;
+	return ((int64_t(c.x) & mask) << 42)
+		| ((int64_t(c.y) & mask) << 21)
+		| (int64_t(c.z) & mask);
+}
+
+// Size of the mesh data of a description
+static size_t mesh_bytes(const SceneEntity &e)
+{
+	if (!e.mesh)
+		return 0;
+
+	size_t bytes = 0;
+	for (const Submesh &s : e.mesh->submeshes) {
+		bytes += s.vertices.size() * sizeof(Vertex);
+		bytes += s.indices.size() * sizeof(uint32_t);
+	}
+
+	return bytes;
+}
+
+WorldPartition::WorldPartition(Scene &scene, const Device &dev,
+		const std::string &path, const Settings &settings)
+		: _scene(scene), _dev(dev), _settings(settings)
+{
+	KOBRA_ASSERT(_settings.cell_size > 0.0f, "Cell size must be positive");
+	KOBRA_ASSERT(_settings.unload_radius >= _settings.load_radius,
+		"Unload radius must be at least the load radius");
+
+	// Only describe the entities; meshes are imported by the loaders
+	std::string environment_map;
+	auto emit = [&](SceneEntity &&e) {
+		_descriptions.push_back(std::move(e));
+		return true;
+	};
+
+	_valid = Scene::is_binary(path)
+		? Scene::parse_binary(path, environment_map, emit, nullptr, false)
+		: Scene::parse(path, environment_map, emit, nullptr, false);
+
+	if (!_valid) {
+		KOBRA_LOG_FUNC(error) << "Failed to read scene: " << path << std::endl;
+		_descriptions.clear();
+		return;
+	}
+
+	_scene.p_environment_map = environment_map;
+
+	// Entities without meshes are always resident; the others
+	// go into the cell that contains their position
+	for (size_t i = 0; i < _descriptions.size(); i++) {
+		SceneEntity &d = _descriptions[i];
+		if (!d.mesh && d.mesh_source.empty()) {
+			_scene.instantiate(_dev, SceneEntity(d));
+			continue;
+		}
+
+		glm::ivec3 c = glm::ivec3(glm::floor(d.transform.position/_settings.cell_size));
+
+		auto it = _grid.find(grid_key(c));
+		if (it == _grid.end()) {
+			glm::vec3 min = glm::vec3(c) * _settings.cell_size;
+
+			_cell cell;
+			cell.box = BoundingBox {
+				.min = min,
+				.max = min + glm::vec3(_settings.cell_size)
+			};
+
+			it = _grid.insert({grid_key(c), _cells.size()}).first;
+			_cells.push_back(std::move(cell));
+		}
+
+		_cells[it->second].entities.push_back(i);
+	}
+
+	_stats.cells = _cells.size();
+
+	size_t loaders = std::max <size_t> (_settings.loaders, 1);
+	for (size_t i = 0; i < loaders; i++)
+		_loaders.emplace_back(&WorldPartition::_loader, this);
+
+	KOBRA_LOG_FUNC(ok) << "Partitioned " << _descriptions.size()
+		<< " entities into " << _cells.size() << " cells" << std::endl;
+}
+
+WorldPartition::~WorldPartition()
+{
+	{
+		std::lock_guard <std::mutex> lock(_mutex);
+		_stop = true;
+	}
+
+	_cv.notify_all();
+	for (std::thread &thread : _loaders)
+		thread.join();
+}
+
+// Import the meshes of requested cells; descriptions are not
+// modified after construction, so they are read without locking
+void WorldPartition::_loader()
+{
+	while (true) {
+		_request request;
+
+		{
+			std::unique_lock <std::mutex> lock(_mutex);
+			_cv.wait(lock, [&]() { return _stop || !_requests.empty(); });
+			if (_stop)
+				return;
+
+			request = _requests.front();
+			_requests.pop_front();
+		}
+
+		_result result {
+			.cell = request.cell,
+			.generation = request.generation,
+			.bytes = 0
+		};
+
+		for (size_t i : _cells[request.cell].entities) {
+			SceneEntity e = _descriptions[i];
+			if (!e.mesh && !e.mesh_source.empty())
+				e.mesh = Mesh::load(e.mesh_source);
+
+			if (!e.mesh) {
+				KOBRA_LOG_FUNC(warn) << "Failed to load mesh " << e.mesh_source
+					<< " for entity " << e.name << std::endl;
+			}
+
+			result.bytes += mesh_bytes(e);
+			result.entities.push_back(std::move(e));
+		}
+
+		std::lock_guard <std::mutex> lock(_mutex);
+		_results.push_back(std::move(result));
+	}
+}
+
+// Remove the entities of a cell from the ECS
+void WorldPartition::_unload(size_t i, bool evicted)
+{
+	_cell &cell = _cells[i];
+
+	for (Entity e : cell.live)
+		_scene.ecs.destroy_entity(e);
+
+	if (cell.state == State::eResident || cell.state == State::eReady)
+		_stats.resident_bytes -= cell.bytes;
+
+	cell.live.clear();
+	cell.ready.clear();
+	cell.bytes = 0;
+	cell.state = State::eUnloaded;
+	cell.generation++;
+	cell.evicted = evicted;
+	_stats.unloads++;
+}
+
+void WorldPartition::update(const glm::vec3 &position)
+{
+	if (!_valid)
+		return;
+
+	Profiler::one().frame("World partition");
+
+	// Distances of the cells, in chunks on the thread pool
+	ThreadPool::one().parallel_for(_cells.size(), 1024,
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				_cells[i].distance = std::sqrt(_cells[i].box.distance2(position));
+		}
+	);
+
+	// Collect finished loads; results for cells that have
+	// been unloaded in the meantime are dropped
+	{
+		std::lock_guard <std::mutex> lock(_mutex);
+		for (_result &result : _results) {
+			_cell &cell = _cells[result.cell];
+			if (cell.state != State::eLoading || cell.generation != result.generation)
+				continue;
+
+			cell.ready = std::move(result.entities);
+			cell.bytes = result.bytes;
+			cell.state = State::eReady;
+			_stats.resident_bytes += cell.bytes;
+			_stats.loads++;
+		}
+
+		_results.clear();
+	}
+
+	// Nearest cells first, for both adding entities and loading
+	std::vector <size_t> order(_cells.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(),
+		[&](size_t a, size_t b) {
+			return _cells[a].distance < _cells[b].distance;
+		}
+	);
+
+	// Unload cells that are out of range, then the farthest ones
+	// while over budget
+	size_t bytes = _stats.resident_bytes;
+
+	for (auto it = order.rbegin(); it != order.rend(); it++) {
+		_cell &cell = _cells[*it];
+
+		// Evicted cells may be requested again once out of range
+		if (cell.distance > _settings.load_radius)
+			cell.evicted = false;
+
+		if (cell.state == State::eUnloaded)
+			continue;
+
+		bool far = cell.distance > _settings.unload_radius;
+		bool over = bytes > _settings.budget
+			&& (cell.state == State::eReady || cell.state == State::eResident);
+
+		if (!far && !over)
+			continue;
+
+		if (cell.state == State::eReady || cell.state == State::eResident)
+			bytes -= cell.bytes;
+
+		// Going over budget holds back requests for a while
+		if (!far)
+			_throttled = true;
+
+		_unload(*it, !far && cell.distance <= _settings.load_radius);
+	}
+
+	if (_stats.resident_bytes < _settings.resume * _settings.budget)
+		_throttled = false;
+
+	// Add the entities of loaded cells, within the time budget
+	Timer timer;
+	for (size_t i : order) {
+		_cell &cell = _cells[i];
+		if (cell.state != State::eReady)
+			continue;
+
+		while (!cell.ready.empty()
+				&& timer.elapsed_start() < _settings.stream_budget * 1000.0f) {
+			Entity e = _scene.instantiate(_dev, std::move(cell.ready.back()));
+			cell.ready.pop_back();
+
+			// Nearby, so likely to be drawn soon
+			if (e.exists <Rasterizer> ())
+				e.get <Rasterizer> ().prefetch();
+
+			cell.live.push_back(e);
+		}
+
+		if (!cell.ready.empty())
+			break;
+
+		cell.state = State::eResident;
+	}
+
+	// Request the nearest cells in range, as long as
+	// the budget allows for them
+	size_t loading = 0;
+	for (const _cell &cell : _cells)
+		loading += (cell.state == State::eLoading);
+
+	{
+		std::lock_guard <std::mutex> lock(_mutex);
+		for (size_t i : order) {
+			_cell &cell = _cells[i];
+			if (cell.distance > _settings.load_radius || loading >= _settings.max_loads)
+				break;
+
+			if (cell.state != State::eUnloaded || cell.evicted)
+				continue;
+
+			// Sizes are not known until meshes are imported, so
+			// the budget is only checked against what is resident
+			if (_throttled || _stats.resident_bytes >= _settings.budget)
+				break;
+
+			cell.state = State::eLoading;
+			_requests.push_back(_request {i, cell.generation});
+			loading++;
+		}
+	}
+
+	_cv.notify_all();
+
+	// Statistics
+	_stats.resident = 0;
+	_stats.loading = loading;
+	_stats.entities = 0;
+
+	for (const _cell &cell : _cells) {
+		_stats.resident += (cell.state == State::eResident);
+		_stats.entities += cell.live.size();
+	}
+
+	Profiler &profiler = Profiler::one();
+	profiler.counter("Partition cells resident", _stats.resident);
+	profiler.counter("Partition cells loading", _stats.loading);
+	profiler.counter("Partition entities", _stats.entities);
+	profiler.counter("Partition resident MB", _stats.resident_bytes/double(1 << 20));
+	profiler.counter("Partition loads", _stats.loads);
+	profiler.counter("Partition unloads", _stats.unloads);
+
+	profiler.end();
+}
+
+}
@@ -1,27 +1,31 @@
 // Engine headers
 #include "../include/renderer.hpp"
 #include "../include/texture_manager.hpp"
-#include "../shaders/raster/bindings.h"
 
 namespace kobra {
 
 // Rasterizer
-Rasterizer::Rasterizer(const Device &dev, const Mesh &mesh, Material *mat)
-		: Renderer(mat), indices(mesh.indices())
+Rasterizer::Rasterizer(const Device &dev, Material *mat)
+		: Renderer(mat), _dev(dev) {}
+
+void Rasterizer::upload(const Mesh &mesh)
 {
+	if (_resident)
+		return;
+
 	// Buffer sizes
 	vk::DeviceSize vertex_buffer_size = mesh.vertices() * sizeof(Vertex);
 	vk::DeviceSize index_buffer_size = mesh.indices() * sizeof(uint32_t);
 
 	// Create buffers
-	vertex_buffer = BufferData(*dev.phdev, *dev.device,
+	vertex_buffer = BufferData(*_dev.phdev, *_dev.device,
 		vertex_buffer_size,
 		vk::BufferUsageFlagBits::eVertexBuffer,
 		vk::MemoryPropertyFlagBits::eHostVisible
 			| vk::MemoryPropertyFlagBits::eHostCoherent
 	);
 
-	index_buffer = BufferData(*dev.phdev, *dev.device,
+	index_buffer = BufferData(*_dev.phdev, *_dev.device,
 		index_buffer_size,
 		vk::BufferUsageFlagBits::eIndexBuffer,
 		vk::MemoryPropertyFlagBits::eHostVisible
@@ -32,47 +36,39 @@ Rasterizer::Rasterizer(const Device &dev, const Mesh &mesh, Material *mat)
 	vk::DeviceSize ioffset = 0;
 
 	for (size_t i = 0; i < mesh.submeshes.size(); i++) {
-		vk::DeviceSize vbuf_size = mesh[i].vertices.size() * sizeof(Vertex);
-		vk::DeviceSize ibuf_size = mesh[i].indices.size() * sizeof(uint32_t);
+		const Submesh &submesh = mesh[i];
+
+		vk::DeviceSize vbuf_size = submesh.vertices.size() * sizeof(Vertex);
+		vk::DeviceSize ibuf_size = submesh.indices.size() * sizeof(uint32_t);
 
 		// Upload data to buffers
-		vertex_buffer.upload(mesh[i].vertices, voffset);
-		index_buffer.upload(mesh[i].indices, ioffset);
+		vertex_buffer.upload(submesh.vertices, voffset);
+		index_buffer.upload(submesh.indices, ioffset);
 
 		// Increment offsets
 		voffset += vbuf_size;
 		ioffset += ibuf_size;
 	}
+
+	indices = mesh.indices();
+	_bytes = bytes(mesh);
+	_resident = true;
+	_prefetch = false;
 }
 
-void Rasterizer::bind_buffers(const vk::raii::CommandBuffer &cmd) const
+void Rasterizer::evict()
 {
-	cmd.bindVertexBuffers(0, *vertex_buffer.buffer, {0});
-	cmd.bindIndexBuffer(*index_buffer.buffer, 0, vk::IndexType::eUint32);
+	vertex_buffer = nullptr;
+	index_buffer = nullptr;
+	indices = 0;
+	_bytes = 0;
+	_resident = false;
 }
 
-void Rasterizer::bind_material(const Device &dev, const vk::raii::DescriptorSet &dset) const
+void Rasterizer::bind_buffers(const vk::raii::CommandBuffer &cmd) const
 {
-	std::string albedo = "blank";
-	if (material->has_albedo())
-		albedo = material->albedo_texture;
-
-	std::string normal = "blank";
-	if (material->has_normal())
-		normal = material->normal_texture;
-
-	TextureManager::bind(
-		*dev.phdev, *dev.device,
-		dset, albedo,
-		// TODO: enum like RasterBindings::eAlbedo
-		RASTER_BINDING_ALBEDO_MAP
-	);
-
-	TextureManager::bind(
-		*dev.phdev, *dev.device,
-		dset, normal,
-		RASTER_BINDING_NORMAL_MAP
-	);
+	cmd.bindVertexBuffers(0, *vertex_buffer.buffer, {0});
+	cmd.bindIndexBuffer(*index_buffer.buffer, 0, vk::IndexType::eUint32);
 }
 
 // Raytracer
@@ -140,30 +136,26 @@ void Raytracer::serialize_submesh(const Device &dev, const Submesh &submesh, con
 	smat.shininess = material->shininess;
 	smat.roughness = material->roughness;
 	smat.refraction = material->refraction;
-	smat.albedo = material->has_albedo();
-	smat.normal = material->has_normal();
+	smat.albedo = -1;
+	smat.normal = -1;
 	smat.type = material->type;
+	smat.albedo_region = glm::vec4 {1, 1, 0, 0};
+	smat.normal_region = glm::vec4 {1, 1, 0, 0};
 
-	hb.materials.push_back(smat);
-
+	// Textures are referred to by their slots in the texture table
 	if (material->has_albedo()) {
-		auto albedo_descriptor = TextureManager::make_descriptor(
-			*dev.phdev, *dev.device,
-			material->albedo_texture
-		);
-
-		hb.albedo_textures[obj_id] = albedo_descriptor;
+		smat.albedo = TextureManager::slot(*dev.phdev, *dev.device, material->albedo_texture);
+		smat.albedo_region = TextureManager::region(material->albedo_texture);
 	}
 
 	if (material->has_normal()) {
-		auto normal_descriptor = TextureManager::make_descriptor(
-			*dev.phdev, *dev.device,
-			material->normal_texture
-		);
-
-		hb.normal_textures[obj_id] = normal_descriptor;
+		smat.normal = TextureManager::slot(*dev.phdev, *dev.device,
+			material->normal_texture, TextureRole::eNormal);
+		smat.normal_region = TextureManager::region(material->normal_texture);
 	}
 
+	hb.materials.push_back(smat);
+
 	// Write the transform
 	hb.transforms.push_back(transform.matrix());
 
@@ -0,0 +1,89 @@
+// Standard headers
+#include <cstring>
+
+// Engine headers
+#include "../include/sampler_cache.hpp"
+
+namespace kobra {
+
+/////////////////////////////
+// Static member variables //
+/////////////////////////////
+
+SamplerCache::DeviceMap <std::map <SamplerCache::Key, vk::raii::Sampler>>
+	SamplerCache::_samplers;
+SamplerCache::DeviceMap <SamplerCache::Stats>
+	SamplerCache::_stats;
+std::mutex SamplerCache::_mutex;
+
+////////////////////
+// Static methods //
+////////////////////
+
+static uint32_t bits(float x)
+{
+	uint32_t b;
+	std::memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+// Key of a sampler state
+SamplerCache::Key SamplerCache::_key(const vk::SamplerCreateInfo &info)
+{
+	KOBRA_ASSERT(info.pNext == nullptr, "Sampler cache does not support chained structures");
+
+	return Key {
+		uint32_t(VkSamplerCreateFlags(info.flags)),
+		uint32_t(info.magFilter),
+		uint32_t(info.minFilter),
+		uint32_t(info.mipmapMode),
+		uint32_t(info.addressModeU),
+		uint32_t(info.addressModeV),
+		uint32_t(info.addressModeW),
+		bits(info.mipLodBias),
+		uint32_t(info.anisotropyEnable),
+		bits(info.maxAnisotropy),
+		uint32_t(info.compareEnable),
+		uint32_t(info.compareOp),
+		bits(info.minLod),
+		bits(info.maxLod),
+		uint32_t(info.borderColor)
+			| (uint32_t(info.unnormalizedCoordinates) << 31)
+	};
+}
+
+// Sampler with some state
+const vk::raii::Sampler &SamplerCache::get(const vk::raii::Device &dev, const vk::SamplerCreateInfo &info)
+{
+	Key key = _key(info);
+
+	std::lock_guard <std::mutex> lock(_mutex);
+
+	Stats &stats = _stats[*dev];
+	stats.requests++;
+
+	auto &samplers = _samplers[*dev];
+	auto it = samplers.find(key);
+	if (it != samplers.end())
+		return it->second;
+
+	it = samplers.insert({key, vk::raii::Sampler {dev, info}}).first;
+	if (++stats.samplers == warn_at) {
+		KOBRA_LOG_FUNC(warn) << stats.samplers << " distinct samplers for "
+			<< stats.requests << " requests, devices may allow as few as 4000\n";
+	}
+
+	return it->second;
+}
+
+// Counts of a device
+SamplerCache::Stats SamplerCache::stats(const vk::raii::PhysicalDevice &phdev, const vk::raii::Device &dev)
+{
+	std::lock_guard <std::mutex> lock(_mutex);
+
+	Stats stats = _stats[*dev];
+	stats.limit = phdev.getProperties().limits.maxSamplerAllocationCount;
+	return stats;
+}
+
+}
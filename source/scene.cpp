@@ -1,8 +1,26 @@
+// Standard headers
+#include <cerrno>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+// Unix headers
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Engine headers
 #include "../include/scene.hpp"
+#include "../include/texture_manager.hpp"
+#include "../include/timer.hpp"
 
 namespace kobra {
 
-// Scene saving functions and loading functions
+// Scene saving functions
 static constexpr char transform_format[]
 = R"(position: %f %f %f
 rotation: %f %f %f
@@ -25,26 +43,12 @@ static constexpr char rasterizer_format[]
 = R"(mode: %s
 )";
 
-static const std::array <std::string, 4> rasterizer_modes {
-	"Phong",
-	"Normal",
-	"Albedo",
-	"Wireframe"
-};
-
 static constexpr char light_format[]
 = R"(color: %f %f %f
 power: %f
 type: %s
 )";
 
-static const std::array <std::string, 4> light_types {
-	"Point",
-	"Spot",
-	"Directional",
-	"Area"
-};
-
 // TODO: get rid of the transform portion
 static constexpr char camera_format[]
 = R"(position: %f %f %f
@@ -55,20 +59,20 @@ scale: %f
 aspect: %f
 )";
 
-static void save_transform(const Transform &transform, std::ofstream &fout)
+static void save_transform(const Transform &transform, std::string &out)
 {
-	fout << "\n[TRANSFORM]\n";
-	fout << common::sprintf(transform_format,
+	out += "\n[TRANSFORM]\n";
+	out += common::sprintf(transform_format,
 		transform.position.x, transform.position.y, transform.position.z,
 		transform.rotation.x, transform.rotation.y, transform.rotation.z,
 		transform.scale.x, transform.scale.y, transform.scale.z
 	);
 }
 
-static void save_material(const Material &mat, std::ofstream &fout)
+static void save_material(const Material &mat, std::string &out)
 {
-	fout << "\n[MATERIAL]\n";
-	fout << common::sprintf(material_format,
+	out += "\n[MATERIAL]\n";
+	out += common::sprintf(material_format,
 		mat.diffuse.r, mat.diffuse.g, mat.diffuse.b,
 		mat.specular.r, mat.specular.g, mat.specular.b,
 		mat.emission.r, mat.emission.g, mat.emission.b,
@@ -79,36 +83,36 @@ static void save_material(const Material &mat, std::ofstream &fout)
 		mat.albedo_texture.empty() ? "0" : mat.albedo_texture.c_str(),
 		mat.normal_texture.empty() ? "0" : mat.normal_texture.c_str()
 	);
-	fout << "shading_type: " << shading_str(mat.type) << "\n";
+	out += "shading_type: " + shading_str(mat.type) + "\n";
 }
 
-static void save_rasterizer(const Rasterizer &rasterizer, std::ofstream &fout)
+static void save_rasterizer(RasterMode mode, std::string &out)
 {
-	fout << "\n[RASTERIZER]\n";
-	fout << common::sprintf(rasterizer_format,
-		rasterizer_modes[rasterizer.mode].c_str()
+	out += "\n[RASTERIZER]\n";
+	out += common::sprintf(rasterizer_format,
+		rasterizer_modes[mode].c_str()
 	);
 }
 
-static void save_raytracer(const Raytracer &raytracer, std::ofstream &fout)
+static void save_raytracer(std::string &out)
 {
-	fout << "\n[RAYTRACER]\n";
+	out += "\n[RAYTRACER]\n";
 }
 
-static void save_light(const Light &light, std::ofstream &fout)
+static void save_light(const Light &light, std::string &out)
 {
-	fout << "\n[LIGHT]\n";
-	fout << common::sprintf(light_format,
+	out += "\n[LIGHT]\n";
+	out += common::sprintf(light_format,
 		light.color.r, light.color.g, light.color.b,
 		light.power,
 		light_types[light.type].c_str()
 	);
 }
 
-static void save_camera(const Camera &cam, std::ofstream &fout)
+static void save_camera(const Camera &cam, std::string &out)
 {
-	fout << "\n[CAMERA]\n";
-	fout << common::sprintf(camera_format,
+	out += "\n[CAMERA]\n";
+	out += common::sprintf(camera_format,
 		cam.transform.position.x, cam.transform.position.y, cam.transform.position.z,
 		cam.transform.rotation.x, cam.transform.rotation.y, cam.transform.rotation.z,
 		cam.transform.scale.x, cam.transform.scale.y, cam.transform.scale.z,
@@ -118,422 +122,1038 @@ static void save_camera(const Camera &cam, std::ofstream &fout)
 	);
 }
 
-static void save_mesh(const Mesh &mesh, std::ofstream &fout)
+static void save_mesh(const SceneEntity &e, std::string &out)
 {
-	fout << "\n[MESH]\n";
-	fout << "source: " << (mesh.source().empty() ? "0" : mesh.source().c_str()) << "\n";
+	const std::string &source = e.mesh_source;
 
-	if (mesh.source().empty()) {
+	out += "\n[MESH]\n";
+	out += "source: " + (source.empty() ? std::string("0") : source) + "\n";
+
+	if (source.empty() && e.geometry()) {
 		// No source, raw data
-		for (const auto &submesh : mesh.submeshes) {
-			fout << "submesh {\n";
+		for (const auto &submesh : e.geometry()->submeshes) {
+			out += "submesh {\n";
 			for (const auto &vert : submesh.vertices) {
-				fout << common::sprintf("\tv %.2f %.2f %.2f\n",
+				out += common::sprintf("\tv %.9g %.9g %.9g\n",
 					vert.position.x, vert.position.y, vert.position.z
 				);
 			}
 
-			fout << "\n";
+			out += "\n";
 			for (int i = 0; i < submesh.indices.size(); i += 3) {
-				fout << common::sprintf("\tf %d %d %d\n",
+				out += common::sprintf("\tf %d %d %d\n",
 					submesh.indices[i], submesh.indices[i + 1], submesh.indices[i + 2]
 				);
 			}
 
-			fout << "}\n";
+			out += "}\n";
 		}
 	}
 }
 
-static void save_components(const Entity &e, std::ofstream &fout)
+// Text block of an entity
+static std::string save_entity(const SceneEntity &e)
 {
+	std::string out = "\n[ENTITY]\nname: " + e.name + "\n";
+
 	// Case by case...
-	save_transform(e.get <Transform> (), fout);
+	save_transform(e.transform, out);
+
+	if (e.material)
+		save_material(*e.material, out);
 
-	if (e.exists <Material> ())
-		save_material(e.get <Material> (), fout);
+	if (e.has_mesh())
+		save_mesh(e, out);
 
-	if (e.exists <Mesh> ())
-		save_mesh(e.get <Mesh> (), fout);
+	if (e.rasterizer)
+		save_rasterizer(*e.rasterizer, out);
 
-	if (e.exists <Rasterizer> ())
-		save_rasterizer(e.get <Rasterizer> (), fout);
+	if (e.raytracer)
+		save_raytracer(out);
 
-	if (e.exists <Raytracer> ())
-		save_raytracer(e.get <Raytracer> (), fout);
+	if (e.light)
+		save_light(*e.light, out);
 
-	if (e.exists <Light> ())
-		save_light(e.get <Light> (), fout);
+	if (e.camera)
+		save_camera(*e.camera, out);
 
-	if (e.exists <Camera> ())
-		save_camera(e.get <Camera> (), fout);
+	return out;
 }
 
+// Contents of a text scene file
+std::string Scene::write_text(const std::string &environment_map,
+		const std::vector <SceneEntity> &entities)
+{
+	std::string out;
+	out += "[PROPERTIES]\n";
+	out += "environment_map: " + environment_map + "\n";
+
+	for (const SceneEntity &e : entities)
+		out += save_entity(e);
+
+	return out;
+}
+
+// Description of an entity currently in the ECS
+//	(through a const reference, so that nothing is marked as changed)
+SceneEntity Scene::describe(int i) const
+{
+	const ECS &cecs = ecs;
+
+	SceneEntity e;
+	e.name = cecs.get_entity(i).name;
+	e.transform = cecs.get <Transform> (i);
+
+	if (cecs.exists <Material> (i))
+		e.material = cecs.get <Material> (i);
+
+	if (cecs.exists <Mesh> (i)) {
+		const Mesh &mesh = cecs.get <Mesh> (i);
+		e.mesh_source = mesh.source();
+
+		// Inline geometry is shared with the previous
+		// description, unless the mesh has changed since
+		if (e.mesh_source.empty()) {
+			Entity entity = cecs.get_entity(i);
+			_mesh_snapshot &snapshot = _mesh_snapshots[entity.id];
+
+			if (!snapshot.mesh || snapshot.generation != entity.generation
+					|| cecs.changed <Mesh> (i, snapshot.version)) {
+				snapshot = _mesh_snapshot {
+					entity.generation,
+					cecs.version(),
+					std::make_shared <const Mesh> (mesh)
+				};
+			}
+
+			e.shared_mesh = snapshot.mesh;
+		}
+	}
+
+	if (cecs.exists <Rasterizer> (i))
+		e.rasterizer = cecs.get <Rasterizer> (i).mode;
+
+	e.raytracer = cecs.exists <Raytracer> (i);
+
+	if (cecs.exists <Light> (i))
+		e.light = cecs.get <Light> (i);
+
+	if (cecs.exists <Camera> (i))
+		e.camera = cecs.get <Camera> (i);
+
+	return e;
+}
+
+// State of asynchronous saves
+struct Scene::_saver {
+	std::thread			thread;
+	std::atomic <bool>		busy = false;
+
+	// Text of the entities as of the last save (text format only)
+	struct _cached {
+		uint32_t	generation;
+		std::string	text;
+	};
+
+	std::string			path;
+	std::map <int32_t, _cached>	cache;
+	uint64_t			version = 0;
+};
+
 void Scene::save(const std::string &path)
 {
-	std::ofstream fout(path);
-	if (!fout.is_open()) {
-		KOBRA_LOG_FUNC(error) << "Failed to open file: " << path << std::endl;
+	save_async(path, false);
+	wait_save();
+}
+
+// Snapshot the scene, then serialize and write it on a worker thread
+void Scene::save_async(const std::string &path, bool incremental)
+{
+	// One save at a time
+	wait_save();
+
+	if (!_save_state)
+		_save_state = std::make_unique <_saver> ();
+
+	_saver *saver = _save_state.get();
+
+	// Binary scenes are always written in whole
+	if (is_binary(path)) {
+		std::vector <SceneEntity> entities;
+		for (int i = 0; i < ecs.size(); i++)
+			entities.push_back(describe(i));
+
+		saver->busy = true;
+		saver->thread = std::thread(
+			[saver, path, env = p_environment_map, entities = std::move(entities)]() {
+				common::write_file(path, write_binary(env, entities));
+				saver->busy = false;
+			}
+		);
+
 		return;
 	}
 
-	fout << "[PROPERTIES]" << std::endl;
-	fout << "environment_map: " << p_environment_map << std::endl;
+	// Cached text is only valid for the same file
+	if (!incremental || saver->path != path) {
+		saver->cache.clear();
+		saver->version = 0;
+		saver->path = path;
+	}
+
+	// Snapshot: only entities that changed since the
+	// last save are copied, the others reuse their text
+	struct _item {
+		int32_t				slot;
+		uint32_t			generation;
+		std::optional <SceneEntity>	entity;
+	};
+
+	std::vector <_item> items;
+	items.reserve(ecs.size());
 
+	size_t dirty = 0;
 	for (int i = 0; i < ecs.size(); i++) {
-		const auto &entity = ecs.get_entity(i);
-		fout << "\n[ENTITY]" << std::endl;
-		fout << "name: " << entity.name << std::endl;
+		Entity e = ecs.get_entity(i);
 
-		save_components(entity, fout);
+		auto it = saver->cache.find(e.id);
+		bool cached = (it != saver->cache.end())
+			&& (it->second.generation == e.generation)
+			&& !ecs.entity_changed(i, saver->version);
+
+		_item item {e.id, e.generation};
+		if (!cached) {
+			item.entity = describe(i);
+			dirty++;
+		}
+
+		items.push_back(std::move(item));
 	}
+
+	saver->version = ecs.version();
+
+	KOBRA_LOG_FUNC(notify) << "Saving " << path << ": " << dirty << "/"
+		<< items.size() << " entities changed" << std::endl;
+
+	saver->busy = true;
+	saver->thread = std::thread(
+		[saver, path, env = p_environment_map, items = std::move(items)]() mutable {
+			std::map <int32_t, _saver::_cached> cache;
+
+			std::string out;
+			out += "[PROPERTIES]\n";
+			out += "environment_map: " + env + "\n";
+
+			for (auto &item : items) {
+				if (item.entity) {
+					cache[item.slot] = _saver::_cached {
+						item.generation,
+						save_entity(*item.entity)
+					};
+				} else {
+					cache[item.slot] = std::move(saver->cache[item.slot]);
+				}
+
+				out += cache[item.slot].text;
+			}
+
+			// Entities that were destroyed are dropped from the cache
+			saver->cache = std::move(cache);
+
+			common::write_file(path, out);
+			saver->busy = false;
+		}
+	);
 }
 
-// Scene loading functions and helpers
-inline std::string get_header(std::ifstream &fin)
+// Whether a save is in progress
+bool Scene::saving() const
 {
-	std::string line;
-
-	do {
-		std::getline(fin, line);
-	} while (line.empty() && !fin.eof());
+	return _save_state && _save_state->busy;
+}
 
-	return line;
+// Wait for the save in progress, if any
+void Scene::wait_save()
+{
+	if (_save_state && _save_state->thread.joinable())
+		_save_state->thread.join();
 }
 
-template <class ... Args>
-static void read_fmt(std::ifstream &fin, const char *fmt, Args ... args)
+// Add a described entity to the ECS
+Entity Scene::instantiate(const Device &dev, SceneEntity &&d)
 {
-	// Count number of lines to read
-	int count = 0;
-	for (const char *c = fmt; *c != '\0'; c++) {
-		if (*c == '\n')
-			count++;
+	Entity e = ecs.make_entity(d.name);
+	e.get <Transform> () = d.transform;
+
+	if (d.material)
+		e.add <Material> (std::move(*d.material));
+
+	if (d.mesh)
+		e.add <Mesh> (std::move(*d.mesh));
+
+	// Renderers need a mesh and material
+	bool renderable = e.exists <Mesh> () && e.exists <Material> ();
+
+	if (d.rasterizer) {
+		if (renderable) {
+			e.add <Rasterizer> (dev, &e.get <Material> ());
+			e.get <Rasterizer> ().mode = *d.rasterizer;
+		} else {
+			KOBRA_LOG_FUNC(warn) << "No mesh or material for rasterizer in entity "
+				<< d.name << std::endl;
+		}
 	}
 
-	// Read lines
-	std::string line;
-	std::string whole;
-	for (int i = 0; i < count; i++) {
-		std::getline(fin, line);
-		whole += line + "\n";
+	if (d.raytracer) {
+		if (renderable) {
+			e.add <Raytracer> (&e.get <Mesh> (), &e.get <Material> ());
+		} else {
+			KOBRA_LOG_FUNC(warn) << "No mesh or material for raytracer in entity "
+				<< d.name << std::endl;
+		}
 	}
 
-	// Parse
-	int read = sscanf(whole.c_str(), fmt, std::forward <Args> (args)...);
-	if (read != sizeof...(Args))
-		KOBRA_LOG_FUNC(warn) << "Failed to read field after #" << read << " fields\n";
+	if (d.light)
+		e.add <Light> (*d.light);
+
+	if (d.camera)
+		e.add <Camera> (*d.camera);
+
+	return e;
 }
 
-// Component basis
-void load_transform(Entity &e, std::ifstream &fin)
+void Scene::load(const Device &dev, const std::string &path)
 {
-	// TODO: eventually just use the format
-	e.add <Transform> ();
+	auto emit = [&](SceneEntity &&e) {
+		instantiate(dev, std::move(e));
+		return true;
+	};
+
+	if (is_binary(path))
+		parse_binary(path, p_environment_map, emit);
+	else
+		parse(path, p_environment_map, emit);
+}
 
-	Transform &transform = e.get <Transform> ();
+// State of an asynchronous load
+struct Scene::_loader {
+	Device				dev;
+	std::thread			thread;
+
+	// Entities that are ready to be instantiated
+	std::mutex			mutex;
+	std::deque <SceneEntity>	ready;
+	std::string			environment_map;
+
+	// Progress
+	std::atomic <size_t>		bytes_read = 0;
+	std::atomic <size_t>		bytes_total = 0;
+	std::atomic <size_t>		parsed = 0;
+	std::atomic <size_t>		loaded = 0;
+	std::atomic <bool>		cancelled = false;
+	std::atomic <bool>		done = false;
+};
 
-	read_fmt(fin, transform_format,
-		&transform.position.x, &transform.position.y, &transform.position.z,
-		&transform.rotation.x, &transform.rotation.y, &transform.rotation.z,
-		&transform.scale.x, &transform.scale.y, &transform.scale.z
-	);
+// Start loading a scene in the background
+void Scene::load_async(const Device &dev, const std::string &path)
+{
+	// One load at a time
+	cancel();
+
+	_async = std::make_unique <_loader> ();
+	_async->dev = dev;
+
+	std::ifstream fin(path, std::ios::binary | std::ios::ate);
+	if (fin.is_open())
+		_async->bytes_total = fin.tellg();
+
+	_loader *loader = _async.get();
+	loader->thread = std::thread([loader, path]() {
+		std::string environment_map;
+
+		auto emit = [&](SceneEntity &&e) {
+			if (loader->cancelled)
+				return false;
+
+			std::lock_guard <std::mutex> lock(loader->mutex);
+			loader->ready.push_back(std::move(e));
+			loader->environment_map = environment_map;
+			loader->parsed++;
+			return true;
+		};
+
+		if (is_binary(path))
+			parse_binary(path, environment_map, emit, &loader->bytes_read);
+		else
+			parse(path, environment_map, emit, &loader->bytes_read);
+
+		{
+			std::lock_guard <std::mutex> lock(loader->mutex);
+			loader->environment_map = environment_map;
+		}
+
+		loader->bytes_read = loader->bytes_total.load();
+		loader->done = true;
+	});
 }
 
-void load_material(Entity &e, std::ifstream &fin)
+// Add the entities that are ready, within a time budget
+void Scene::stream(float budget)
 {
-	static char buf_albedo[1024];
-	static char buf_normal[1024];
+	if (!_async)
+		return;
 
-	e.add <Material> ();
+	Timer timer;
+	while (timer.elapsed_start() < budget * 1000.0f) {
+		SceneEntity e;
 
-	Material &material = e.get <Material> ();
+		{
+			std::lock_guard <std::mutex> lock(_async->mutex);
+			p_environment_map = _async->environment_map;
 
-	read_fmt(fin, material_format,
-		&material.diffuse.x, &material.diffuse.y, &material.diffuse.z,
-		&material.specular.x, &material.specular.y, &material.specular.z,
-		&material.emission.x, &material.emission.y, &material.emission.z,
-		&material.ambient.x, &material.ambient.y, &material.ambient.z,
-		&material.shininess,
-		&material.roughness,
-		&material.refraction,
-		buf_albedo, buf_normal
-	);
+			if (_async->ready.empty())
+				break;
 
-	material.shininess = glm::clamp(material.shininess, 0.0f, 1.0f);
-	material.roughness = glm::clamp(material.roughness, 0.0f, 1.0f);
+			e = std::move(_async->ready.front());
+			_async->ready.pop_front();
+		}
 
-	std::string line;
-	std::getline(fin, line);
+		instantiate(_async->dev, std::move(e));
+		_async->loaded++;
+	}
 
-	std::string field = line.substr(0, 14);
-	std::string value = line.substr(14);
+	// Finished: everything parsed has been instantiated
+	if (_async->done && _async->loaded == _async->parsed) {
+		_async->thread.join();
+		_async.reset();
+	}
+}
 
-	if (field != "shading_type: ") {
-		KOBRA_LOG_FUNC(warn) << "Failed to read shading type: field = \""
-			<< field  << "\": value = \"" << value << "\"" << std::endl;
+// Stop loading; entities that were already added are kept
+void Scene::cancel()
+{
+	if (!_async)
 		return;
-	}
 
-	if (std::string(buf_albedo) != "0")
-		material.albedo_texture = buf_albedo;
+	_async->cancelled = true;
+	if (_async->thread.joinable())
+		_async->thread.join();
 
-	if (std::string(buf_normal) != "0")
-		material.normal_texture = buf_normal;
+	_async.reset();
+}
 
-	material.type = *shading_from_str(value);
+bool Scene::loading() const
+{
+	return _async != nullptr;
 }
 
-void load_mesh(Entity &e, std::ifstream &fin)
+SceneProgress Scene::progress() const
 {
-	static char buf_source[1024];
+	if (!_async)
+		return SceneProgress {.done = true};
+
+	return SceneProgress {
+		.bytes_read = _async->bytes_read,
+		.bytes_total = _async->bytes_total,
+		.entities_parsed = _async->parsed,
+		.entities_loaded = _async->loaded,
+		.done = false,
+		.cancelled = _async->cancelled
+	};
+}
 
+// Time without events before a change is processed (milliseconds);
+// editors tend to write files in several steps
+static constexpr int debounce_time = 100;
 
-	std::string line;
-	std::getline(fin, line);
+// Comparison of components, as far as scene files are concerned
+static bool same(const Material &a, const Material &b)
+{
+	return a.diffuse == b.diffuse
+		&& a.specular == b.specular
+		&& a.emission == b.emission
+		&& a.ambient == b.ambient
+		&& a.shininess == b.shininess
+		&& a.roughness == b.roughness
+		&& a.refraction == b.refraction
+		&& a.albedo_texture == b.albedo_texture
+		&& a.normal_texture == b.normal_texture
+		&& a.type == b.type;
+}
 
-	sscanf(line.c_str(), "source: %s", buf_source);
+static bool same(const Light &a, const Light &b)
+{
+	return a.type == b.type
+		&& a.color == b.color
+		&& a.power == b.power;
+}
 
-	if (std::string(buf_source) != "0") {
-		auto mptr = Mesh::load(buf_source);
+static bool same(const Camera &a, const Camera &b)
+{
+	return a.transform == b.transform
+		&& a.tunings.fov == b.tunings.fov
+		&& a.tunings.scale == b.tunings.scale
+		&& a.tunings.aspect == b.tunings.aspect;
+}
 
-		if (!mptr.has_value()) {
-			KOBRA_LOG_FUNC(warn) << "Failed to load mesh: " << buf_source << std::endl;
-			return;
+// Raw meshes only store positions and indices
+static bool same(const Mesh &a, const Mesh &b)
+{
+	if (a.source() != b.source() || a.submeshes.size() != b.submeshes.size())
+		return false;
+
+	for (size_t i = 0; i < a.submeshes.size(); i++) {
+		const Submesh &sa = a[i];
+		const Submesh &sb = b[i];
+
+		if (sa.vertices.size() != sb.vertices.size() || sa.indices != sb.indices)
+			return false;
+
+		for (size_t j = 0; j < sa.vertices.size(); j++) {
+			if (sa.vertices[j].position != sb.vertices[j].position)
+				return false;
 		}
+	}
 
-		e.add <Mesh> (*mptr);
-	} else {
-		// Raw mesh
-		std::vector <Submesh> submeshes;
-		while (true) {
-			// Iterate over submeshes
-			std::getline(fin, line);
-			if (line.empty())
-				break;
+	return true;
+}
 
-			if (line != "submesh {") {
-				KOBRA_LOG_FUNC(warn) << "Expected submesh, got: " << line << std::endl;
+static bool same(const RasterMode &a, const RasterMode &b)
+{
+	return a == b;
+}
+
+template <class T>
+static bool same(const std::optional <T> &a, const std::optional <T> &b)
+{
+	if (a.has_value() != b.has_value())
+		return false;
+
+	return !a.has_value() || same(*a, *b);
+}
+
+// State of the scene watcher
+struct Scene::_watcher {
+	// Components of a description that have changed
+	enum : uint32_t {
+		eTransform	= 1 << 0,
+		eMaterial	= 1 << 1,
+		eMesh		= 1 << 2,
+		eRasterizer	= 1 << 3,
+		eRaytracer	= 1 << 4,
+		eLight		= 1 << 5,
+		eCamera		= 1 << 6
+	};
+
+	// Changes to one entity
+	struct _change {
+		SceneEntity	entity;
+		uint32_t	components = 0;
+
+		// Not in the previous version of the file
+		bool		created = false;
+
+		// Components have been removed, so the entity
+		// has to be made again
+		bool		rebuild = false;
+	};
+
+	// Changes between two versions of the files
+	struct _diff {
+		std::optional <std::string>	environment_map;
+		std::vector <_change>		changes;
+		std::vector <std::string>	removed;
+		std::vector <std::string>	textures;
+
+		bool empty() const {
+			return !environment_map && changes.empty()
+				&& removed.empty() && textures.empty();
+		}
+	};
+
+	Device				dev;
+	std::string			path;
+	std::thread			thread;
+
+	// Inotify instance, and a pipe to wake the thread up
+	int				fd = -1;
+	int				wake[2] = {-1, -1};
+
+	// Watched directories (editors often replace files instead of
+	// writing to them, which would drop watches on the files), and
+	// watched files (absolute path --> path as in the scene)
+	std::map <int, std::filesystem::path>	dirs;
+	std::set <std::filesystem::path>	watched;
+	std::map <std::string, std::string>	files;
+
+	// Last version of the file that was read
+	std::unordered_map <std::string, SceneEntity>	previous;
+	std::string					environment_map;
+
+	// Differences that are ready to be applied
+	std::mutex			mutex;
+	std::deque <_diff>		diffs;
+
+	// Watch a file, through its directory
+	void track(const std::string &file) {
+		std::filesystem::path abs = std::filesystem::absolute(file).lexically_normal();
+		std::filesystem::path dir = abs.parent_path();
+
+		if (watched.count(dir) == 0) {
+			int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (wd < 0) {
+				KOBRA_LOG_FUNC(warn) << "Failed to watch directory: " << dir << std::endl;
 				return;
 			}
 
-			// Submesh in creation
-			std::vector <Vertex> vertices;
-			std::vector <uint32_t> indices;
+			dirs[wd] = dir;
+			watched.insert(dir);
+		}
+
+		files[abs.string()] = file;
+	}
+
+	// Read the scene file; meshes are imported only if their source
+	// file has changed, or if no entity used them before
+	bool read(const std::set <std::string> &dirty, _diff &diff) {
+		std::vector <SceneEntity> entities;
+		auto emit = [&](SceneEntity &&e) {
+			entities.push_back(std::move(e));
+			return true;
+		};
+
+		std::string env;
+
+		bool ok = is_binary(path)
+			? parse_binary(path, env, emit, nullptr, false)
+			: parse(path, env, emit, nullptr, false);
+
+		if (!ok) {
+			KOBRA_LOG_FUNC(warn) << "Failed to read scene " << path
+				<< ", keeping the current version" << std::endl;
+			return false;
+		}
+
+		// Mesh sources before this version
+		std::set <std::string> sources;
+		for (const auto &[name, e] : previous) {
+			if (!e.mesh_source.empty())
+				sources.insert(e.mesh_source);
+		}
+
+		// Meshes imported for this version
+		std::map <std::string, std::optional <Mesh>> imported;
+
+		std::unordered_map <std::string, SceneEntity> next;
+		std::set <std::string> next_textures;
+
+		for (SceneEntity &e : entities) {
+			_change c;
+
+			auto it = previous.find(e.name);
+			if (it == previous.end()) {
+				c.created = true;
+				c.components = eTransform | eMaterial | eMesh
+					| eRasterizer | eRaytracer | eLight | eCamera;
+			} else {
+				const SceneEntity &p = it->second;
 
-			// Read submesh vertices
-			while (true) {
-				std::getline(fin, line);
-				if (line.empty())
-					break;
+				if (p.transform != e.transform)
+					c.components |= eTransform;
 
-				glm::vec3 vertex;
-				sscanf(line.c_str(), "\tv %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-				vertices.push_back(vertex);
+				if (!same(p.material, e.material))
+					c.components |= eMaterial;
+
+				bool mesh = (p.mesh_source != e.mesh_source)
+					|| (e.mesh_source.empty() && !same(p.mesh, e.mesh))
+					|| (dirty.count(e.mesh_source) > 0);
+
+				if (mesh)
+					c.components |= eMesh;
+
+				if (!same(p.rasterizer, e.rasterizer))
+					c.components |= eRasterizer;
+
+				if (p.raytracer != e.raytracer)
+					c.components |= eRaytracer;
+
+				if (!same(p.light, e.light))
+					c.components |= eLight;
+
+				if (!same(p.camera, e.camera))
+					c.components |= eCamera;
+
+				c.rebuild = (p.material && !e.material)
+					|| ((p.mesh || !p.mesh_source.empty())
+						&& !e.mesh && e.mesh_source.empty())
+					|| (p.rasterizer && !e.rasterizer)
+					|| (p.raytracer && !e.raytracer)
+					|| (p.light && !e.light)
+					|| (p.camera && !e.camera);
 			}
 
-			// Read faces
-			while (true) {
-				std::getline(fin, line);
+			if (e.material) {
+				if (e.material->has_albedo())
+					next_textures.insert(e.material->albedo_texture);
 
-				// TODO: check amount read
-				int v0, v1, v2;
-				int read = sscanf(line.c_str(), "\tf %d %d %d", &v0, &v1, &v2);
+				if (e.material->has_normal())
+					next_textures.insert(e.material->normal_texture);
+			}
+
+			// Keep the description, without imported meshes
+			next[e.name] = e;
+
+			if (!(c.components & eMesh) && !c.rebuild)
+				e.mesh.reset();
 
-				if (read == 0)
-					break;
+			// Import the meshes that are needed
+			const std::string &source = e.mesh_source;
+			if ((c.components & eMesh) && !source.empty()
+					&& (dirty.count(source) || sources.count(source) == 0)) {
+				if (imported.count(source) == 0)
+					imported[source] = Mesh::load(source);
 
-				indices.push_back(v0);
-				indices.push_back(v1);
-				indices.push_back(v2);
+				if (imported[source])
+					e.mesh = *imported[source];
+				else
+					KOBRA_LOG_FUNC(warn) << "Failed to load mesh: " << source << std::endl;
 			}
 
-			// Assert closure
-			if (line != "}") {
-				KOBRA_LOG_FUNC(warn) << "Expected closure, got: " << line << std::endl;
-				return;
+			if (c.components != 0 || c.rebuild) {
+				c.entity = std::move(e);
+				diff.changes.emplace_back(std::move(c));
 			}
+		}
 
-			// Append submesh
-			submeshes.push_back({vertices, indices});
+		for (const auto &[name, e] : previous) {
+			if (next.count(name) == 0)
+				diff.removed.push_back(name);
 		}
 
-		// Create mesh
-		e.add <Mesh> (submeshes);
-	}
-}
+		// Textures whose files have changed
+		for (const std::string &texture : next_textures) {
+			if (dirty.count(texture))
+				diff.textures.push_back(texture);
+		}
 
-void load_rasterizer(Entity &e, std::ifstream &fin, const Device &dev)
-{
-	static char buf_mode[1024];
+		if (env != environment_map)
+			diff.environment_map = env;
 
-	// Mkae sure we have a mesh and material
-	if (!e.exists <Mesh> ()) {
-		KOBRA_LOG_FUNC(warn) << "No mesh for rasterizer" << std::endl;
-		return;
-	}
+		// Watch the files of the new version
+		track(path);
+		for (const auto &[name, e] : next) {
+			if (!e.mesh_source.empty())
+				track(e.mesh_source);
+		}
 
-	if (!e.exists <Material> ()) {
-		KOBRA_LOG_FUNC(warn) << "No material for rasterizer" << std::endl;
-		return;
+		for (const std::string &texture : next_textures)
+			track(texture);
+
+		previous = std::move(next);
+		environment_map = env;
+
+		return true;
 	}
 
-	e.add <Rasterizer> (dev, e.get <Mesh> (), &e.get <Material> ());
+	// Wait for changes, until woken up
+	void run() {
+		// Initial version, which the ECS is assumed to match
+		_diff initial;
+		read({}, initial);
 
-	// Read mode
-	std::string line;
-	std::getline(fin, line);
+		std::set <std::string> dirty;
+		alignas(inotify_event) char buffer[4096];
 
-	sscanf(line.c_str(), "mode: %s", buf_mode);
+		while (true) {
+			pollfd fds[2] {
+				{fd, POLLIN, 0},
+				{wake[0], POLLIN, 0}
+			};
 
-	// Get index
-	int index = 0;
-	while (rasterizer_modes[index] != buf_mode)
-		index++;
+			int r = poll(fds, 2, dirty.empty() ? -1 : debounce_time);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
 
-	if (index >= rasterizer_modes.size()) {
-		KOBRA_LOG_FUNC(warn) << "Unknown rasterizer mode: " << buf_mode << std::endl;
-		return;
+				KOBRA_LOG_FUNC(error) << "Failed to wait for file changes" << std::endl;
+				break;
+			}
+
+			// Woken up to stop
+			if (fds[1].revents & POLLIN)
+				break;
+
+			// Quiet for long enough: process the changes
+			if (r == 0) {
+				_diff diff;
+				if (read(dirty, diff) && !diff.empty()) {
+					std::lock_guard <std::mutex> lock(mutex);
+					diffs.emplace_back(std::move(diff));
+				}
+
+				dirty.clear();
+				continue;
+			}
+
+			if (!(fds[0].revents & POLLIN))
+				continue;
+
+			ssize_t n = ::read(fd, buffer, sizeof(buffer));
+			for (char *ptr = buffer; ptr < buffer + n; ) {
+				inotify_event *ev = (inotify_event *) ptr;
+				ptr += sizeof(inotify_event) + ev->len;
+
+				if (ev->len == 0 || dirs.count(ev->wd) == 0)
+					continue;
+
+				std::string file = (dirs[ev->wd] / ev->name).string();
+
+				auto it = files.find(file);
+				if (it != files.end())
+					dirty.insert(it->second);
+			}
+		}
 	}
+};
 
-	// Set mode
-	e.get <Rasterizer> ().mode = RasterMode(index);
+Scene::Scene() = default;
+
+Scene::~Scene()
+{
+	unwatch();
+	cancel();
+	wait_save();
 }
 
-void load_raytracer(Entity &e, std::ifstream &fin)
+// Start watching a scene file and its assets
+void Scene::watch(const Device &dev, const std::string &path)
 {
-	// Make sure we have a mesh and material
-	if (!e.exists <Mesh> ()) {
-		KOBRA_LOG_FUNC(warn) << "No mesh for raytracer" << std::endl;
+	unwatch();
+
+	auto watcher = std::make_unique <_watcher> ();
+	watcher->dev = dev;
+	watcher->path = path;
+
+	watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watcher->fd < 0) {
+		KOBRA_LOG_FUNC(error) << "Failed to initialize inotify" << std::endl;
 		return;
 	}
 
-	if (!e.exists <Material> ()) {
-		KOBRA_LOG_FUNC(warn) << "No material for raytracer" << std::endl;
+	if (pipe(watcher->wake) != 0) {
+		KOBRA_LOG_FUNC(error) << "Failed to create pipe" << std::endl;
+		close(watcher->fd);
 		return;
 	}
 
-	e.add <Raytracer> (&e.get <Mesh> (), &e.get <Material> ());
+	_watcher *w = watcher.get();
+	w->thread = std::thread([w]() { w->run(); });
+
+	_watch_state = std::move(watcher);
+	KOBRA_LOG_FUNC(notify) << "Watching scene: " << path << std::endl;
 }
 
-void load_camera(Entity &e, std::ifstream &fin)
+// Stop watching; changes that were not applied are dropped
+void Scene::unwatch()
 {
-	e.add <Camera> ();
+	if (!_watch_state)
+		return;
 
-	Camera &camera = e.get <Camera> ();
-	read_fmt(fin, camera_format,
-		&camera.transform.position.x, &camera.transform.position.y, &camera.transform.position.z,
-		&camera.transform.rotation.x, &camera.transform.rotation.y, &camera.transform.rotation.z,
-		&camera.transform.scale.x, &camera.transform.scale.y, &camera.transform.scale.z,
-		&camera.tunings.fov, &camera.tunings.scale, &camera.tunings.aspect
-	);
+	char c = 0;
+	if (write(_watch_state->wake[1], &c, 1) != 1)
+		KOBRA_LOG_FUNC(warn) << "Failed to wake the scene watcher" << std::endl;
+
+	if (_watch_state->thread.joinable())
+		_watch_state->thread.join();
+
+	close(_watch_state->fd);
+	close(_watch_state->wake[0]);
+	close(_watch_state->wake[1]);
+
+	_watch_state.reset();
 }
 
-void load_light(Entity &e, std::ifstream &fin)
+bool Scene::watching() const
 {
-	static char buf_type[1024];
+	return _watch_state != nullptr;
+}
 
-	e.add <Light> ();
+// Apply the changes to the watched files
+bool Scene::reload()
+{
+	using W = _watcher;
 
-	Light &light = e.get <Light> ();
-	read_fmt(fin, light_format,
-		&light.color.x, &light.color.y, &light.color.z,
-		&light.power, buf_type
-	);
+	if (!_watch_state)
+		return false;
 
-	// Get light type
-	int index = 0;
-	while (light_types[index] != buf_type)
-		index++;
+	std::deque <W::_diff> diffs;
 
-	if (index >= light_types.size()) {
-		KOBRA_LOG_FUNC(warn) << "Unknown light type: " << buf_type << std::endl;
-		return;
+	{
+		std::lock_guard <std::mutex> lock(_watch_state->mutex);
+		diffs.swap(_watch_state->diffs);
 	}
 
-	light.type = Light::Type(index);
-}
+	if (diffs.empty())
+		return false;
 
-std::string load_components(Entity &e, std::ifstream &fin, const Device &dev)
-{
-	std::string header;
+	// Replaced renderers and textures are retired, as frames
+	// in flight may still use them
+	const Device &dev = _watch_state->dev;
 
-	// Go in order of the components
-	while (true) {
-		header = get_header(fin);
-		if (header == "[TRANSFORM]") {
-			load_transform(e, fin);
-			continue;
-		}
+	const ECS &cecs = ecs;
 
-		if (header == "[MATERIAL]") {
-			load_material(e, fin);
-			continue;
-		}
+	// Meshes which did not need to be imported
+	// again are copied from the live entities
+	auto resolve = [&](SceneEntity &d) {
+		if (d.mesh || d.mesh_source.empty())
+			return;
 
-		if (header == "[MESH]") {
-			load_mesh(e, fin);
-			continue;
+		for (int i = 0; i < cecs.size(); i++) {
+			if (cecs.exists <Mesh> (i) && cecs.get <Mesh> (i).source() == d.mesh_source) {
+				d.mesh = cecs.get <Mesh> (i);
+				return;
+			}
 		}
 
-		if (header == "[RASTERIZER]") {
-			load_rasterizer(e, fin, dev);
-			continue;
+		auto mesh = Mesh::load(d.mesh_source);
+		if (mesh.has_value())
+			d.mesh = std::move(*mesh);
+		else
+			KOBRA_LOG_FUNC(warn) << "Failed to load mesh: " << d.mesh_source << std::endl;
+	};
+
+	size_t applied = 0;
+	for (W::_diff &diff : diffs) {
+		if (diff.environment_map)
+			p_environment_map = *diff.environment_map;
+
+		for (const std::string &name : diff.removed) {
+			if (ecs.has_entity(name)) {
+				ecs.destroy_entity(ecs.get_entity(name));
+				applied++;
+			}
 		}
 
-		if (header == "[RAYTRACER]") {
-			load_raytracer(e, fin);
-			continue;
-		}
+		for (W::_change &c : diff.changes) {
+			SceneEntity &d = c.entity;
 
-		if (header == "[CAMERA]") {
-			load_camera(e, fin);
-			continue;
-		}
+			if (c.rebuild && ecs.has_entity(d.name)) {
+				// Before the live mesh goes away
+				resolve(d);
+				ecs.destroy_entity(ecs.get_entity(d.name));
+			}
 
-		if (header == "[LIGHT]") {
-			load_light(e, fin);
-			continue;
-		}
+			if (!ecs.has_entity(d.name)) {
+				resolve(d);
+				instantiate(dev, std::move(d));
+				applied++;
+				continue;
+			}
 
-		break;
-	}
+			// Only the components that differ are written, so
+			// that the layers see nothing else as changed
+			Entity e = ecs.get_entity(d.name);
+			const Entity &ce = e;
 
-	return header;
-}
+			size_t before = applied;
 
-void Scene::load(const Device &dev, const std::string &path)
-{
-	static char buf[1024] = "";
+			if ((c.components & W::eTransform) && ce.get <Transform> () != d.transform) {
+				e.get <Transform> () = d.transform;
+				applied++;
+			}
 
-	std::ifstream fin(path);
-	if (!fin.is_open()) {
-		KOBRA_LOG_FUNC(error) << "Failed to open file: " << path << std::endl;
-		return;
-	}
+			if ((c.components & W::eMaterial) && d.material) {
+				if (!ce.exists <Material> ()) {
+					e.add <Material> (*d.material);
+					applied++;
+				} else if (!same(ce.get <Material> (), *d.material)) {
+					e.get <Material> () = *d.material;
+					applied++;
+				}
+			}
 
-	// Load properties
-	if (get_header(fin) != "[PROPERTIES]") {
-		KOBRA_LOG_FUNC(error) << "Failed to load properties" << std::endl;
-		return;
-	}
+			bool mesh = false;
+			if ((c.components & W::eMesh) && (d.mesh || !d.mesh_source.empty())) {
+				resolve(d);
+				if (d.mesh) {
+					if (!ce.exists <Mesh> ())
+						e.add <Mesh> (std::move(*d.mesh));
+					else
+						e.get <Mesh> () = std::move(*d.mesh);
+
+					mesh = true;
+					applied++;
+				}
+			}
+
+			bool renderable = ce.exists <Mesh> () && ce.exists <Material> ();
+
+			// The buffers of the rasterizer are a copy of the old
+			// mesh, so a new mesh needs a new rasterizer
+			if (d.rasterizer && renderable) {
+				if (!ce.exists <Rasterizer> () || mesh) {
+					e.add <Rasterizer> (dev, &e.get <Material> ());
+					e.get <Rasterizer> ().mode = *d.rasterizer;
+					applied++;
+				} else if (ce.get <Rasterizer> ().mode != *d.rasterizer) {
+					e.get <Rasterizer> ().mode = *d.rasterizer;
+					applied++;
+				}
+			}
 
-	read_fmt(fin, "environment_map: %s\n", buf);
-	p_environment_map = buf;
+			// The raytracer refers to the mesh, which changes in place
+			if (d.raytracer && renderable && !ce.exists <Raytracer> ()) {
+				e.add <Raytracer> (&e.get <Mesh> (), &e.get <Material> ());
+				applied++;
+			}
 
-	// Load entities
-	std::string header = get_header(fin);
-	while (fin.good()) {
-		if (header != "[ENTITY]") {
-			KOBRA_LOG_FUNC(error) << "Invalid header: " << header << std::endl;
-			return;
+			if ((c.components & W::eLight) && d.light) {
+				if (!ce.exists <Light> ()) {
+					e.add <Light> (*d.light);
+					applied++;
+				} else if (!same(ce.get <Light> (), *d.light)) {
+					e.get <Light> () = *d.light;
+					applied++;
+				}
+			}
+
+			if ((c.components & W::eCamera) && d.camera) {
+				if (!ce.exists <Camera> ()) {
+					e.add <Camera> (*d.camera);
+					applied++;
+				} else if (!same(ce.get <Camera> (), *d.camera)) {
+					e.get <Camera> () = *d.camera;
+					applied++;
+				}
+			}
+
+			if (applied > before) {
+				KOBRA_LOG_FUNC(notify) << "Reloaded entity "
+					<< d.name << std::endl;
+			}
 		}
 
-		read_fmt(fin, "name: %s\n", buf);
-		Entity &e = ecs.make_entity(buf);
+		// Textures are replaced in place; the materials that
+		// use them are marked so that they are bound again
+		for (const std::string &texture : diff.textures) {
+			if (!TextureManager::reload_texture(*dev.phdev, *dev.device, texture))
+				continue;
+
+			for (int i = 0; i < cecs.size(); i++) {
+				if (!cecs.exists <Material> (i))
+					continue;
+
+				const Material &material = cecs.get <Material> (i);
+				if (material.albedo_texture == texture
+						|| material.normal_texture == texture)
+					ecs.touch <Material> (i);
+			}
 
-		header = load_components(e, fin, dev);
+			applied++;
+		}
 	}
+
+	return applied > 0;
 }
 
 }
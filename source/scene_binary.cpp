@@ -0,0 +1,587 @@
+// Standard headers
+#include <cstring>
+#include <type_traits>
+
+// Engine headers
+#include "../include/mapped_file.hpp"
+#include "../include/scene.hpp"
+
+namespace kobra {
+
+// Binary scene format (.kobrab)
+//
+// The file is a header, followed by a table of sections; each section is
+// a tightly packed array of fixed size records, starting at a 16 byte
+// aligned offset. Strings live in a single string table and are referred
+// to by offset and length. Everything is little endian.
+//
+// Entities refer to their components by index into the component
+// sections (-1 if absent), so loading is a matter of walking the
+// entity records and copying the referenced records into the ECS.
+namespace kobrab {
+
+static constexpr char		magic[8] = "KOBRAB";
+static constexpr uint32_t	version = 1;
+static constexpr size_t		alignment = 16;
+
+enum Section : uint32_t {
+	eStrings,
+	eProperties,
+	eEntities,
+	eMaterials,
+	eMeshes,
+	eSubmeshes,
+	eVertices,
+	eIndices,
+	eRasterizers,
+	eLights,
+	eCameras,
+	eSectionCount
+};
+
+struct Header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	sections;
+	uint64_t	size;
+};
+
+struct SectionEntry {
+	uint32_t	type;
+	uint32_t	stride;
+	uint64_t	count;
+	uint64_t	offset;
+};
+
+struct String {
+	uint32_t	offset;
+	uint32_t	length;
+};
+
+struct TransformRecord {
+	glm::vec3	position;
+	glm::vec3	rotation;
+	glm::vec3	scale;
+};
+
+struct Properties {
+	String		environment_map;
+};
+
+struct EntityRecord {
+	String		name;
+	TransformRecord	transform;
+	int32_t		material;
+	int32_t		mesh;
+	int32_t		rasterizer;
+	int32_t		light;
+	int32_t		camera;
+	uint32_t	raytracer;
+};
+
+struct MaterialRecord {
+	glm::vec3	diffuse;
+	glm::vec3	specular;
+	glm::vec3	emission;
+	glm::vec3	ambient;
+	float		shininess;
+	float		roughness;
+	float		refraction;
+	uint32_t	type;
+	String		albedo_texture;
+	String		normal_texture;
+};
+
+// Meshes either have a source file, or raw submeshes
+struct MeshRecord {
+	String		source;
+	uint32_t	first_submesh;
+	uint32_t	submeshes;
+};
+
+struct SubmeshRecord {
+	uint64_t	first_vertex;
+	uint64_t	vertices;
+	uint64_t	first_index;
+	uint64_t	indices;
+};
+
+struct RasterizerRecord {
+	uint32_t	mode;
+};
+
+struct LightRecord {
+	glm::vec3	color;
+	float		power;
+	uint32_t	type;
+};
+
+struct CameraRecord {
+	TransformRecord	transform;
+	float		fov;
+	float		scale;
+	float		aspect;
+};
+
+// Records are copied as they are, so they must not have padding
+// that differs between compilers
+static_assert(sizeof(glm::vec3) == 12, "Unexpected glm::vec3 layout");
+static_assert(sizeof(EntityRecord) == 68, "Unexpected EntityRecord layout");
+static_assert(sizeof(MaterialRecord) == 80, "Unexpected MaterialRecord layout");
+static_assert(std::is_trivially_copyable <Vertex> ::value, "Vertex must be trivially copyable");
+
+// Sections under construction
+struct Writer {
+	std::vector <char>		strings;
+	std::vector <Properties>	properties;
+	std::vector <EntityRecord>	entities;
+	std::vector <MaterialRecord>	materials;
+	std::vector <MeshRecord>	meshes;
+	std::vector <SubmeshRecord>	submeshes;
+	std::vector <Vertex>		vertices;
+	std::vector <uint32_t>		indices;
+	std::vector <RasterizerRecord>	rasterizers;
+	std::vector <LightRecord>	lights;
+	std::vector <CameraRecord>	cameras;
+
+	String string(const std::string &str) {
+		String s {uint32_t(strings.size()), uint32_t(str.size())};
+		strings.insert(strings.end(), str.begin(), str.end());
+		return s;
+	}
+
+	static TransformRecord transform(const Transform &t) {
+		return TransformRecord {t.position, t.rotation, t.scale};
+	}
+};
+
+// Mapped file, validated on open
+class Reader {
+	MappedFile		_file;
+	const SectionEntry	*_sections = nullptr;
+	uint32_t		_count = 0;
+public:
+	Reader(const std::string &path) : _file(path) {
+		if (!_file.valid() || _file.size() < sizeof(Header)) {
+			KOBRA_LOG_FUNC(error) << "Failed to map file: " << path << std::endl;
+			_file.reset();
+			return;
+		}
+
+		size_t size = _file.size();
+
+		const Header *header = (const Header *) _file.data();
+		if (std::memcmp(header->magic, magic, sizeof(magic)) != 0
+				|| header->version != version
+				|| header->size != size
+				|| sizeof(Header) + header->sections * sizeof(SectionEntry) > size) {
+			KOBRA_LOG_FUNC(error) << "Invalid binary scene: " << path << std::endl;
+			_file.reset();
+			return;
+		}
+
+		_sections = (const SectionEntry *) (header + 1);
+		_count = header->sections;
+
+		// Check the bounds of all sections
+		for (uint32_t i = 0; i < _count; i++) {
+			const SectionEntry &s = _sections[i];
+			if (s.offset % alignment != 0
+					|| s.offset > size
+					|| (s.stride > 0 && s.count > (size - s.offset)/s.stride)) {
+				KOBRA_LOG_FUNC(error) << "Invalid section #" << i
+					<< " in binary scene: " << path << std::endl;
+				_file.reset();
+				_sections = nullptr;
+				_count = 0;
+				return;
+			}
+		}
+	}
+
+	bool valid() const {
+		return _file.valid();
+	}
+
+	size_t size() const {
+		return _file.size();
+	}
+
+	// Records of a section (empty if missing or mismatched)
+	template <class T>
+	std::pair <const T *, size_t> section(Section type) const {
+		for (uint32_t i = 0; i < _count; i++) {
+			const SectionEntry &s = _sections[i];
+			if (s.type != type)
+				continue;
+
+			if (s.stride != sizeof(T)) {
+				KOBRA_LOG_FUNC(warn) << "Mismatched stride for section "
+					<< type << std::endl;
+				break;
+			}
+
+			return {(const T *) (_file.data() + s.offset), s.count};
+		}
+
+		return {nullptr, 0};
+	}
+};
+
+}
+
+// Contents of a binary scene file
+std::string Scene::write_binary(const std::string &environment_map,
+		const std::vector <SceneEntity> &entities)
+{
+	using namespace kobrab;
+
+	Writer w;
+	w.properties.push_back(Properties {w.string(environment_map)});
+
+	for (const SceneEntity &e : entities) {
+		EntityRecord record {
+			.name = w.string(e.name),
+			.transform = Writer::transform(e.transform),
+			.material = -1,
+			.mesh = -1,
+			.rasterizer = -1,
+			.light = -1,
+			.camera = -1,
+			.raytracer = e.raytracer
+		};
+
+		if (e.material) {
+			const Material &mat = *e.material;
+
+			record.material = w.materials.size();
+			w.materials.push_back(MaterialRecord {
+				.diffuse = mat.diffuse,
+				.specular = mat.specular,
+				.emission = mat.emission,
+				.ambient = mat.ambient,
+				.shininess = mat.shininess,
+				.roughness = mat.roughness,
+				.refraction = mat.refraction,
+				.type = uint32_t(mat.type),
+				.albedo_texture = w.string(mat.albedo_texture),
+				.normal_texture = w.string(mat.normal_texture)
+			});
+		}
+
+		if (e.has_mesh()) {
+			MeshRecord mr {
+				.source = w.string(e.mesh_source),
+				.first_submesh = uint32_t(w.submeshes.size()),
+				.submeshes = 0
+			};
+
+			// Raw data only if there is no source
+			if (e.mesh_source.empty() && e.geometry()) {
+				const Mesh &mesh = *e.geometry();
+				for (const auto &submesh : mesh.submeshes) {
+					w.submeshes.push_back(SubmeshRecord {
+						.first_vertex = w.vertices.size(),
+						.vertices = submesh.vertices.size(),
+						.first_index = w.indices.size(),
+						.indices = submesh.indices.size()
+					});
+
+					w.vertices.insert(w.vertices.end(),
+						submesh.vertices.begin(),
+						submesh.vertices.end()
+					);
+
+					w.indices.insert(w.indices.end(),
+						submesh.indices.begin(),
+						submesh.indices.end()
+					);
+				}
+
+				mr.submeshes = mesh.submeshes.size();
+			}
+
+			record.mesh = w.meshes.size();
+			w.meshes.push_back(mr);
+		}
+
+		if (e.rasterizer) {
+			record.rasterizer = w.rasterizers.size();
+			w.rasterizers.push_back(RasterizerRecord {
+				uint32_t(*e.rasterizer)
+			});
+		}
+
+		if (e.light) {
+			const Light &light = *e.light;
+
+			record.light = w.lights.size();
+			w.lights.push_back(LightRecord {
+				light.color, light.power, uint32_t(light.type)
+			});
+		}
+
+		if (e.camera) {
+			const Camera &camera = *e.camera;
+
+			record.camera = w.cameras.size();
+			w.cameras.push_back(CameraRecord {
+				Writer::transform(camera.transform),
+				camera.tunings.fov,
+				camera.tunings.scale,
+				camera.tunings.aspect
+			});
+		}
+
+		w.entities.push_back(record);
+	}
+
+	// Lay out the sections
+	struct Blob {
+		Section		type;
+		uint32_t	stride;
+		uint64_t	count;
+		const void	*data;
+	};
+
+	auto blob = [](Section type, const auto &v) {
+		using T = typename std::decay_t <decltype(v)> ::value_type;
+		return Blob {type, sizeof(T), v.size(), v.data()};
+	};
+
+	std::vector <Blob> blobs {
+		blob(eStrings, w.strings),
+		blob(eProperties, w.properties),
+		blob(eEntities, w.entities),
+		blob(eMaterials, w.materials),
+		blob(eMeshes, w.meshes),
+		blob(eSubmeshes, w.submeshes),
+		blob(eVertices, w.vertices),
+		blob(eIndices, w.indices),
+		blob(eRasterizers, w.rasterizers),
+		blob(eLights, w.lights),
+		blob(eCameras, w.cameras)
+	};
+
+	auto align = [](uint64_t x) {
+		return (x + alignment - 1) & ~(alignment - 1);
+	};
+
+	std::vector <SectionEntry> table;
+
+	uint64_t offset = align(sizeof(Header) + blobs.size() * sizeof(SectionEntry));
+	for (const auto &b : blobs) {
+		table.push_back(SectionEntry {b.type, b.stride, b.count, offset});
+		offset = align(offset + b.stride * b.count);
+	}
+
+	Header header {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.sections = table.size();
+	header.size = offset;
+
+	// Everything goes into one buffer (zero padded)
+	std::string out(offset, '\0');
+
+	std::memcpy(&out[0], &header, sizeof(header));
+	std::memcpy(&out[sizeof(header)], table.data(), table.size() * sizeof(SectionEntry));
+
+	for (size_t i = 0; i < blobs.size(); i++) {
+		if (blobs[i].count > 0) {
+			std::memcpy(&out[table[i].offset], blobs[i].data,
+				blobs[i].stride * blobs[i].count);
+		}
+	}
+
+	return out;
+}
+
+// Save in the binary format
+void Scene::save_binary(const std::string &path)
+{
+	std::vector <SceneEntity> entities;
+	for (int i = 0; i < ecs.size(); i++)
+		entities.push_back(describe(i));
+
+	common::write_file(path, write_binary(p_environment_map, entities));
+}
+
+// Read the entity descriptions of a binary scene
+bool Scene::parse_binary(const std::string &path, std::string &environment_map,
+		const Emit &emit, std::atomic <size_t> *bytes, bool import)
+{
+	using namespace kobrab;
+
+	Reader reader(path);
+	if (!reader.valid())
+		return false;
+
+	// NOTE: not a structured binding, since it is captured below
+	std::pair <const char *, size_t> strings = reader.section <char> (eStrings);
+
+	auto [properties, n_properties] = reader.section <Properties> (eProperties);
+	auto [entities, n_entities] = reader.section <EntityRecord> (eEntities);
+	auto [materials, n_materials] = reader.section <MaterialRecord> (eMaterials);
+	auto [meshes, n_meshes] = reader.section <MeshRecord> (eMeshes);
+	auto [submeshes, n_submeshes] = reader.section <SubmeshRecord> (eSubmeshes);
+	auto [vertices, n_vertices] = reader.section <Vertex> (eVertices);
+	auto [indices, n_indices] = reader.section <uint32_t> (eIndices);
+	auto [rasterizers, n_rasterizers] = reader.section <RasterizerRecord> (eRasterizers);
+	auto [lights, n_lights] = reader.section <LightRecord> (eLights);
+	auto [cameras, n_cameras] = reader.section <CameraRecord> (eCameras);
+
+	auto string = [&](const String &s) {
+		if (uint64_t(s.offset) + s.length > strings.second) {
+			KOBRA_LOG_FUNC(warn) << "Invalid string reference" << std::endl;
+			return std::string();
+		}
+
+		return std::string(strings.first + s.offset, s.length);
+	};
+
+	auto transform = [](const TransformRecord &t) {
+		return Transform {t.position, t.rotation, t.scale};
+	};
+
+	if (n_properties > 0)
+		environment_map = string(properties[0].environment_map);
+
+	// Bytes of the records consumed so far (approximate,
+	// since the mesh data is not read in order)
+	size_t consumed = reader.size() - n_entities * sizeof(EntityRecord);
+
+	for (size_t i = 0; i < n_entities; i++) {
+		const EntityRecord &record = entities[i];
+
+		SceneEntity e;
+		e.name = string(record.name);
+		e.transform = transform(record.transform);
+
+		if (record.material >= 0 && record.material < n_materials) {
+			const MaterialRecord &mr = materials[record.material];
+
+			e.material = Material {};
+
+			Material &material = *e.material;
+			material.diffuse = mr.diffuse;
+			material.specular = mr.specular;
+			material.emission = mr.emission;
+			material.ambient = mr.ambient;
+			material.shininess = mr.shininess;
+			material.roughness = mr.roughness;
+			material.refraction = mr.refraction;
+			material.type = Shading(mr.type);
+			material.albedo_texture = string(mr.albedo_texture);
+			material.normal_texture = string(mr.normal_texture);
+		}
+
+		if (record.mesh >= 0 && record.mesh < n_meshes) {
+			const MeshRecord &mr = meshes[record.mesh];
+			std::string source = string(mr.source);
+			e.mesh_source = source;
+
+			if (!source.empty()) {
+				auto mptr = import ? Mesh::load(source) : std::nullopt;
+				if (mptr.has_value())
+					e.mesh = std::move(*mptr);
+				else if (import)
+					KOBRA_LOG_FUNC(warn) << "Failed to load mesh: " << source << std::endl;
+			} else if (uint64_t(mr.first_submesh) + mr.submeshes <= n_submeshes) {
+				// Raw mesh, vertices are stored as they are
+				std::vector <Submesh> sms;
+				for (uint32_t j = 0; j < mr.submeshes; j++) {
+					const SubmeshRecord &sr = submeshes[mr.first_submesh + j];
+					if (sr.first_vertex + sr.vertices > n_vertices
+							|| sr.first_index + sr.indices > n_indices) {
+						KOBRA_LOG_FUNC(warn) << "Invalid submesh in entity "
+							<< e.name << std::endl;
+						continue;
+					}
+
+					sms.push_back(Submesh {
+						VertexList(vertices + sr.first_vertex,
+							vertices + sr.first_vertex + sr.vertices),
+						Indices(indices + sr.first_index,
+							indices + sr.first_index + sr.indices),
+						false
+					});
+				}
+
+				e.mesh = Mesh(sms);
+			}
+		}
+
+		if (record.rasterizer >= 0 && record.rasterizer < n_rasterizers)
+			e.rasterizer = RasterMode(rasterizers[record.rasterizer].mode);
+
+		e.raytracer = record.raytracer;
+
+		if (record.light >= 0 && record.light < n_lights) {
+			const LightRecord &lr = lights[record.light];
+
+			e.light = Light {};
+			e.light->color = lr.color;
+			e.light->power = lr.power;
+			e.light->type = Light::Type(lr.type);
+		}
+
+		if (record.camera >= 0 && record.camera < n_cameras) {
+			const CameraRecord &cr = cameras[record.camera];
+
+			e.camera = Camera {};
+			e.camera->transform = transform(cr.transform);
+			e.camera->tunings.fov = cr.fov;
+			e.camera->tunings.scale = cr.scale;
+			e.camera->tunings.aspect = cr.aspect;
+		}
+
+		if (bytes)
+			*bytes = consumed + (i + 1) * sizeof(EntityRecord);
+
+		if (!emit(std::move(e)))
+			return false;
+	}
+
+	return true;
+}
+
+// Load from the binary format
+void Scene::load_binary(const Device &dev, const std::string &path)
+{
+	parse_binary(path, p_environment_map,
+		[&](SceneEntity &&e) {
+			instantiate(dev, std::move(e));
+			return true;
+		}
+	);
+}
+
+// Convert between the text and binary formats
+bool Scene::convert(const std::string &src, const std::string &dst)
+{
+	std::string environment_map;
+	std::vector <SceneEntity> entities;
+
+	auto emit = [&](SceneEntity &&e) {
+		entities.push_back(std::move(e));
+		return true;
+	};
+
+	bool parsed = is_binary(src)
+		? parse_binary(src, environment_map, emit, nullptr, false)
+		: parse(src, environment_map, emit, nullptr, false);
+
+	if (!parsed) {
+		KOBRA_LOG_FUNC(error) << "Failed to read scene: " << src << std::endl;
+		return false;
+	}
+
+	std::string out = is_binary(dst)
+		? write_binary(environment_map, entities)
+		: write_text(environment_map, entities);
+
+	return common::write_file(dst, out);
+}
+
+}
@@ -0,0 +1,430 @@
+// Standard headers
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+
+// Engine headers
+#include "../include/mapped_file.hpp"
+#include "../include/scene.hpp"
+
+namespace kobra {
+
+// Parser for the text scene format
+//	works on a memory mapped file and slices it into string views, so
+//	that nothing is copied until a value is stored; it keeps no global
+//	state, so that several scenes can be parsed at the same time
+class SceneParser {
+	const std::string	&_path;
+	const char		*_begin;
+	const char		*_ptr;
+	const char		*_end;
+
+	// Current line (1-based) and its start
+	size_t			_line = 0;
+	const char		*_line_start = nullptr;
+
+	// First error (parsing stops there)
+	bool			_failed = false;
+
+	// Whether meshes with a source file are imported
+	bool			_import = true;
+
+	// Error at a position within the current line
+	void _error(const char *at, const std::string &msg) {
+		if (_failed)
+			return;
+
+		size_t column = (at && _line_start) ? (at - _line_start) + 1 : 1;
+		KOBRA_LOG_FUNC(error) << _path << ":" << _line << ":" << column
+			<< ": " << msg << std::endl;
+
+		_failed = true;
+	}
+
+	// Skip spaces and tabs
+	static void _skip(std::string_view &s) {
+		size_t i = 0;
+		while (i < s.size() && (s[i] == ' ' || s[i] == '\t'))
+			i++;
+
+		s.remove_prefix(i);
+	}
+
+	// Remove trailing spaces, tabs and carriage returns
+	static std::string_view _trim(std::string_view s) {
+		while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+			s.remove_suffix(1);
+
+		return s;
+	}
+public:
+	SceneParser(const std::string &path, std::string_view buffer, bool import)
+			: _path(path), _begin(buffer.data()), _ptr(buffer.data()),
+			_end(buffer.data() + buffer.size()), _import(import) {}
+
+	bool failed() const {
+		return _failed;
+	}
+
+	// Error at a token of the current line
+	void error(std::string_view at, const std::string &msg) {
+		_error(at.data(), msg);
+	}
+
+	bool eof() const {
+		return _ptr >= _end;
+	}
+
+	// Bytes consumed so far
+	size_t offset() const {
+		return _ptr - _begin;
+	}
+
+	// Next line, without the line break
+	std::string_view line() {
+		const char *start = _ptr;
+		const char *nl = (const char *) memchr(_ptr, '\n', _end - _ptr);
+		const char *stop = nl ? nl : _end;
+
+		_ptr = nl ? nl + 1 : _end;
+		_line++;
+		_line_start = start;
+
+		return _trim(std::string_view(start, stop - start));
+	}
+
+	// Look at the next line without consuming it
+	std::string_view peek() const {
+		const char *nl = (const char *) memchr(_ptr, '\n', _end - _ptr);
+		return _trim(std::string_view(_ptr, (nl ? nl : _end) - _ptr));
+	}
+
+	// Next non-empty line
+	std::string_view header() {
+		std::string_view s;
+		while (!eof()) {
+			s = line();
+			if (!s.empty())
+				return s;
+		}
+
+		return s;
+	}
+
+	// Next line, as "key: value"; returns the value
+	std::string_view field(std::string_view key) {
+		if (eof()) {
+			_error(nullptr, "Unexpected end of file, expected \""
+				+ std::string(key) + "\"");
+			return {};
+		}
+
+		std::string_view s = line();
+		if (s.size() < key.size() + 1
+				|| s.substr(0, key.size()) != key
+				|| s[key.size()] != ':') {
+			_error(s.data(), "Expected field \"" + std::string(key) + "\"");
+			return {};
+		}
+
+		s.remove_prefix(key.size() + 1);
+		_skip(s);
+		return s;
+	}
+
+	// Numbers from a value
+	template <class T>
+	bool numbers(std::string_view s, T *out, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			_skip(s);
+
+			auto [next, ec] = std::from_chars(s.data(), s.data() + s.size(), out[i]);
+			if (ec != std::errc()) {
+				_error(s.data(), "Expected a number");
+				return false;
+			}
+
+			s.remove_prefix(next - s.data());
+		}
+
+		return true;
+	}
+
+	// Fields with numbers
+	template <class T>
+	void field(std::string_view key, T *out, size_t n) {
+		std::string_view s = field(key);
+		if (!_failed)
+			numbers(s, out, n);
+	}
+
+	void field(std::string_view key, glm::vec3 &v) {
+		float f[3] = {0.0f, 0.0f, 0.0f};
+		field(key, f, 3);
+		v = glm::vec3 {f[0], f[1], f[2]};
+	}
+
+	void field(std::string_view key, float &f) {
+		field(key, &f, 1);
+	}
+
+	// Fields with paths, where "0" means none
+	std::string path(std::string_view key) {
+		std::string_view s = field(key);
+		return (s == "0") ? std::string() : std::string(s);
+	}
+
+	// Index of a value in a list of names
+	template <size_t N>
+	int lookup(std::string_view key, const std::array <std::string, N> &names) {
+		std::string_view s = field(key);
+		if (_failed)
+			return -1;
+
+		for (size_t i = 0; i < N; i++) {
+			if (names[i] == s)
+				return i;
+		}
+
+		_error(s.data(), "Unknown value \"" + std::string(s)
+			+ "\" for \"" + std::string(key) + "\"");
+		return -1;
+	}
+
+	// Components
+	void transform(Transform &transform) {
+		field("position", transform.position);
+		field("rotation", transform.rotation);
+		field("scale", transform.scale);
+	}
+
+	void material(SceneEntity &e) {
+		Material material;
+
+		field("diffuse", material.diffuse);
+		field("specular", material.specular);
+		field("emission", material.emission);
+		field("ambient", material.ambient);
+		field("shininess", material.shininess);
+		field("roughness", material.roughness);
+		field("refraction", material.refraction);
+
+		material.shininess = glm::clamp(material.shininess, 0.0f, 1.0f);
+		material.roughness = glm::clamp(material.roughness, 0.0f, 1.0f);
+
+		material.albedo_texture = path("albedo_texture");
+		material.normal_texture = path("normal_texture");
+
+		std::string_view shading = field("shading_type");
+		if (_failed)
+			return;
+
+		auto type = shading_from_str(std::string(shading));
+		if (!type.has_value()) {
+			_error(shading.data(), "Unknown shading type \""
+				+ std::string(shading) + "\"");
+			return;
+		}
+
+		material.type = *type;
+		e.material = std::move(material);
+	}
+
+	void mesh(SceneEntity &e) {
+		std::string source = path("source");
+		if (_failed)
+			return;
+
+		e.mesh_source = source;
+		if (!source.empty() && !_import)
+			return;
+
+		if (!source.empty()) {
+			auto mesh = Mesh::load(source);
+			if (!mesh.has_value()) {
+				KOBRA_LOG_FUNC(warn) << _path << ":" << _line
+					<< ": Failed to load mesh: " << source << std::endl;
+				return;
+			}
+
+			e.mesh = std::move(*mesh);
+			return;
+		}
+
+		// Raw mesh, as a list of submeshes
+		std::vector <Submesh> submeshes;
+		while (!eof() && peek() == "submesh {") {
+			line();
+
+			std::string_view s;
+			VertexList vertices;
+			Indices indices;
+
+			// Vertices, up to an empty line
+			while (!eof()) {
+				s = line();
+				_skip(s);
+
+				if (s.empty())
+					break;
+
+				if (s[0] != 'v') {
+					_error(s.data(), "Expected a vertex");
+					return;
+				}
+
+				float v[3];
+				if (!numbers(s.substr(1), v, 3))
+					return;
+
+				vertices.push_back(Vertex {glm::vec3 {v[0], v[1], v[2]}});
+			}
+
+			// Faces, up to the closing brace
+			while (true) {
+				if (eof()) {
+					_error(nullptr, "Unexpected end of file, expected \"}\"");
+					return;
+				}
+
+				s = line();
+				_skip(s);
+
+				if (s == "}")
+					break;
+
+				if (s.empty() || s[0] != 'f') {
+					_error(s.data(), "Expected a face or \"}\"");
+					return;
+				}
+
+				uint32_t f[3];
+				if (!numbers(s.substr(1), f, 3))
+					return;
+
+				for (uint32_t i : f) {
+					if (i >= vertices.size()) {
+						_error(s.data(), "Face index " + std::to_string(i)
+							+ " out of range");
+						return;
+					}
+
+					indices.push_back(i);
+				}
+			}
+
+			submeshes.push_back(Submesh {vertices, indices});
+		}
+
+		e.mesh = Mesh(submeshes);
+	}
+
+	void rasterizer(SceneEntity &e) {
+		int mode = lookup("mode", rasterizer_modes);
+		if (mode >= 0)
+			e.rasterizer = RasterMode(mode);
+	}
+
+	void light(SceneEntity &e) {
+		Light light;
+
+		field("color", light.color);
+		field("power", light.power);
+
+		int type = lookup("type", light_types);
+		if (type < 0)
+			return;
+
+		light.type = Light::Type(type);
+		e.light = light;
+	}
+
+	void camera(SceneEntity &e) {
+		Camera camera;
+
+		transform(camera.transform);
+		field("fov", camera.tunings.fov);
+		field("scale", camera.tunings.scale);
+		field("aspect", camera.tunings.aspect);
+
+		e.camera = camera;
+	}
+
+	// Components of an entity; returns the header that follows
+	// them (the next entity, or empty at the end of the file)
+	std::string_view components(SceneEntity &e) {
+		while (!_failed) {
+			std::string_view h = header();
+			if (h.empty() || h == "[ENTITY]")
+				return h;
+
+			if (h == "[TRANSFORM]")
+				transform(e.transform);
+			else if (h == "[MATERIAL]")
+				material(e);
+			else if (h == "[MESH]")
+				mesh(e);
+			else if (h == "[RASTERIZER]")
+				rasterizer(e);
+			else if (h == "[RAYTRACER]")
+				e.raytracer = true;
+			else if (h == "[CAMERA]")
+				camera(e);
+			else if (h == "[LIGHT]")
+				light(e);
+			else
+				_error(h.data(), "Unknown header \"" + std::string(h) + "\"");
+		}
+
+		return {};
+	}
+};
+
+// Read the entity descriptions of a text scene
+bool Scene::parse(const std::string &path, std::string &environment_map,
+		const Emit &emit, std::atomic <size_t> *bytes, bool import)
+{
+	MappedFile file(path);
+	if (!file.valid()) {
+		KOBRA_LOG_FUNC(error) << "Failed to open file: " << path << std::endl;
+		return false;
+	}
+
+	SceneParser parser(path, file.view(), import);
+
+	// Properties
+	std::string_view h = parser.header();
+	if (h != "[PROPERTIES]") {
+		parser.error(h, "Expected [PROPERTIES]");
+		return false;
+	}
+
+	environment_map = parser.path("environment_map");
+
+	// Entities
+	h = parser.header();
+	while (!parser.failed() && !h.empty()) {
+		if (h != "[ENTITY]") {
+			parser.error(h, "Expected [ENTITY]");
+			return false;
+		}
+
+		SceneEntity e;
+		e.name = parser.field("name");
+		h = parser.components(e);
+
+		if (parser.failed())
+			return false;
+
+		if (bytes)
+			*bytes = parser.offset();
+
+		if (!emit(std::move(e)))
+			return false;
+	}
+
+	return !parser.failed();
+}
+
+}
@@ -0,0 +1,110 @@
+// Standard headers
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+// Engine headers
+#include "../include/scheduler.hpp"
+
+namespace kobra {
+
+// Build the dependency graph: every pair of conflicting systems
+// gets an edge in the order they were added, as does every system
+// and those it was declared to come after
+void Scheduler::_build_graph()
+{
+	size_t n = _systems.size();
+
+	_dependents.assign(n, {});
+	_dependencies.assign(n, 0);
+
+	for (size_t j = 0; j < n; j++) {
+		for (size_t i = 0; i < j; i++) {
+			bool after = std::find(_systems[j].after.begin(),
+				_systems[j].after.end(),
+				_systems[i].name) != _systems[j].after.end();
+
+			if (after || conflict(_systems[i], _systems[j])) {
+				_dependents[i].push_back(j);
+				_dependencies[j]++;
+			}
+		}
+
+		for (const std::string &name : _systems[j].after) {
+			bool found = std::find_if(_systems.begin(), _systems.begin() + j,
+				[&](const System &system) {
+					return system.name == name;
+				}
+			) != _systems.begin() + j;
+
+			KOBRA_ASSERT(found, "System \"" + _systems[j].name
+				+ "\" comes after unknown system \"" + name + "\"");
+		}
+	}
+
+	_dirty = false;
+}
+
+// Run all systems; ecs is null if systems may only read
+void Scheduler::_run(ECS *ecs, const ECS &cecs, Profiler *profiler)
+{
+	if (_dirty)
+		_build_graph();
+
+	bool writes = std::any_of(_systems.begin(), _systems.end(),
+		[](const System &system) {
+			return system.writes.any();
+		}
+	);
+
+	KOBRA_ASSERT(ecs || !writes, "Systems that write need a mutable ECS");
+
+	size_t n = _systems.size();
+	_timings.assign(n, 0.0);
+
+	if (profiler)
+		profiler->frame("Systems");
+
+	// Remaining dependencies per system
+	std::unique_ptr <std::atomic <size_t> []> pending
+		(new std::atomic <size_t> [n]);
+
+	for (size_t i = 0; i < n; i++)
+		pending[i] = _dependencies[i];
+
+	std::atomic <size_t> remaining = n;
+
+	// Runs a system, then releases its dependents
+	std::function <void (size_t)> launch = [&](size_t i) {
+		_pool->push([&, i]() {
+			Access access(ecs, &cecs, _systems[i].writes);
+
+			Timer timer;
+			_systems[i].run(access);
+			_timings[i] = timer.elapsed_start();
+
+			for (size_t j : _dependents[i]) {
+				if (--pending[j] == 0)
+					launch(j);
+			}
+
+			remaining--;
+		}, remaining);
+	};
+
+	for (size_t i = 0; i < n; i++) {
+		if (_dependencies[i] == 0)
+			launch(i);
+	}
+
+	_pool->wait(remaining);
+
+	if (profiler) {
+		for (size_t i = 0; i < n; i++)
+			profiler->record(_systems[i].name, _timings[i]);
+
+		profiler->end();
+	}
+}
+
+}
@@ -0,0 +1,576 @@
+// Standard headers
+#include <algorithm>
+#include <queue>
+
+// Engine headers
+#include "../include/spatial.hpp"
+
+namespace kobra {
+
+///////////////////
+// Frustum culling
+///////////////////
+
+// Extract the planes from a view-projection matrix
+//	the near plane is taken from the [-1, 1] depth range,
+//	which is conservative for [0, 1] projections
+Frustum Frustum::from(const glm::mat4 &m)
+{
+	// Rows of the matrix (GLM is column major)
+	glm::vec4 r0 {m[0][0], m[1][0], m[2][0], m[3][0]};
+	glm::vec4 r1 {m[0][1], m[1][1], m[2][1], m[3][1]};
+	glm::vec4 r2 {m[0][2], m[1][2], m[2][2], m[3][2]};
+	glm::vec4 r3 {m[0][3], m[1][3], m[2][3], m[3][3]};
+
+	Frustum frustum {{
+		r3 + r0, r3 - r0,
+		r3 + r1, r3 - r1,
+		r3 + r2, r3 - r2
+	}};
+
+	for (auto &plane : frustum.planes) {
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f)
+			plane /= length;
+	}
+
+	return frustum;
+}
+
+// Whether a box is (at least partially) inside
+bool Frustum::intersects(const BoundingBox &box) const
+{
+	for (const auto &plane : planes) {
+		// Corner furthest along the plane normal
+		glm::vec3 p {
+			(plane.x >= 0.0f) ? box.max.x : box.min.x,
+			(plane.y >= 0.0f) ? box.max.y : box.min.y,
+			(plane.z >= 0.0f) ? box.max.z : box.min.z
+		};
+
+		if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f)
+			return false;
+	}
+
+	return true;
+}
+
+// Entry distance of a ray into a box (negative if missed)
+static float ray_box(const Ray &ray, const glm::vec3 &inv,
+		const BoundingBox &box, float tmax)
+{
+	glm::vec3 t0 = (box.min - ray.origin) * inv;
+	glm::vec3 t1 = (box.max - ray.origin) * inv;
+
+	glm::vec3 tsmall = glm::min(t0, t1);
+	glm::vec3 tbig = glm::max(t0, t1);
+
+	float tnear = std::max(0.0f, std::max(tsmall.x, std::max(tsmall.y, tsmall.z)));
+	float tfar = std::min(tmax, std::min(tbig.x, std::min(tbig.y, tbig.z)));
+
+	return (tnear <= tfar) ? tnear : -1.0f;
+}
+
+/////////////////////
+// Node management
+/////////////////////
+
+int SpatialIndex::_allocate()
+{
+	if (!_free.empty()) {
+		int i = _free.back();
+		_free.pop_back();
+
+		_nodes[i] = _node {};
+		return i;
+	}
+
+	_nodes.push_back(_node {});
+	return _nodes.size() - 1;
+}
+
+void SpatialIndex::_release(int i)
+{
+	_nodes[i] = _node {};
+	_free.push_back(i);
+}
+
+/////////////////////
+// Tree operations
+/////////////////////
+
+// Insert a leaf, descending along the cheapest (surface area) path
+void SpatialIndex::_insert(int leaf)
+{
+	if (_root == -1) {
+		_root = leaf;
+		_nodes[leaf].parent = -1;
+		return;
+	}
+
+	BoundingBox box = _nodes[leaf].box;
+
+	// Find the best sibling
+	int i = _root;
+	while (!_nodes[i].leaf()) {
+		const _node &node = _nodes[i];
+
+		float area = node.box.surface_area();
+		float combined = BoundingBox::merge(node.box, box).surface_area();
+
+		// Cost of creating a new parent here, and the
+		// cost pushed down to the children otherwise
+		float cost = 2.0f * combined;
+		float inherited = 2.0f * (combined - area);
+
+		auto descend = [&](int c) {
+			const _node &child = _nodes[c];
+			float merged = BoundingBox::merge(child.box, box).surface_area();
+			if (child.leaf())
+				return merged + inherited;
+
+			return merged - child.box.surface_area() + inherited;
+		};
+
+		float cost_left = descend(node.left);
+		float cost_right = descend(node.right);
+
+		if (cost < cost_left && cost < cost_right)
+			break;
+
+		i = (cost_left < cost_right) ? node.left : node.right;
+	}
+
+	// New parent for the sibling and the leaf
+	int sibling = i;
+	int old_parent = _nodes[sibling].parent;
+	int parent = _allocate();
+
+	_nodes[parent].parent = old_parent;
+	_nodes[parent].box = BoundingBox::merge(_nodes[sibling].box, box);
+	_nodes[parent].height = _nodes[sibling].height + 1;
+	_nodes[parent].left = sibling;
+	_nodes[parent].right = leaf;
+
+	if (old_parent != -1) {
+		if (_nodes[old_parent].left == sibling)
+			_nodes[old_parent].left = parent;
+		else
+			_nodes[old_parent].right = parent;
+	} else {
+		_root = parent;
+	}
+
+	_nodes[sibling].parent = parent;
+	_nodes[leaf].parent = parent;
+
+	_refit(_nodes[leaf].parent);
+}
+
+// Remove a leaf (the node itself is kept)
+void SpatialIndex::_remove(int leaf)
+{
+	if (leaf == _root) {
+		_root = -1;
+		return;
+	}
+
+	int parent = _nodes[leaf].parent;
+	int grandparent = _nodes[parent].parent;
+	int sibling = (_nodes[parent].left == leaf)
+		? _nodes[parent].right
+		: _nodes[parent].left;
+
+	if (grandparent != -1) {
+		if (_nodes[grandparent].left == parent)
+			_nodes[grandparent].left = sibling;
+		else
+			_nodes[grandparent].right = sibling;
+
+		_nodes[sibling].parent = grandparent;
+		_release(parent);
+		_refit(grandparent);
+	} else {
+		_root = sibling;
+		_nodes[sibling].parent = -1;
+		_release(parent);
+	}
+
+	_nodes[leaf].parent = -1;
+}
+
+// Update the bounds of a leaf; the tree is only
+// restructured if they escape the fattened bounds
+void SpatialIndex::_move(int leaf, const BoundingBox &tight)
+{
+	_nodes[leaf].tight = tight;
+	if (_nodes[leaf].box.contains(tight))
+		return;
+
+	_remove(leaf);
+	_nodes[leaf].box = _fatten(tight);
+	_insert(leaf);
+}
+
+// Rotate the subtree at a node if it is unbalanced,
+// returning the index of the new subtree root
+int SpatialIndex::_balance(int a)
+{
+	_node &A = _nodes[a];
+	if (A.leaf() || A.height < 2)
+		return a;
+
+	int b = A.left;
+	int c = A.right;
+
+	_node &B = _nodes[b];
+	_node &C = _nodes[c];
+
+	int balance = C.height - B.height;
+
+	// Rotate the right child up
+	if (balance > 1) {
+		int f = C.left;
+		int g = C.right;
+
+		_node &F = _nodes[f];
+		_node &G = _nodes[g];
+
+		C.left = a;
+		C.parent = A.parent;
+		A.parent = c;
+
+		if (C.parent != -1) {
+			if (_nodes[C.parent].left == a)
+				_nodes[C.parent].left = c;
+			else
+				_nodes[C.parent].right = c;
+		} else {
+			_root = c;
+		}
+
+		if (F.height > G.height) {
+			C.right = f;
+			A.right = g;
+			G.parent = a;
+
+			A.box = BoundingBox::merge(B.box, G.box);
+			C.box = BoundingBox::merge(A.box, F.box);
+
+			A.height = 1 + std::max(B.height, G.height);
+			C.height = 1 + std::max(A.height, F.height);
+		} else {
+			C.right = g;
+			A.right = f;
+			F.parent = a;
+
+			A.box = BoundingBox::merge(B.box, F.box);
+			C.box = BoundingBox::merge(A.box, G.box);
+
+			A.height = 1 + std::max(B.height, F.height);
+			C.height = 1 + std::max(A.height, G.height);
+		}
+
+		return c;
+	}
+
+	// Rotate the left child up
+	if (balance < -1) {
+		int d = B.left;
+		int e = B.right;
+
+		_node &D = _nodes[d];
+		_node &E = _nodes[e];
+
+		B.left = a;
+		B.parent = A.parent;
+		A.parent = b;
+
+		if (B.parent != -1) {
+			if (_nodes[B.parent].left == a)
+				_nodes[B.parent].left = b;
+			else
+				_nodes[B.parent].right = b;
+		} else {
+			_root = b;
+		}
+
+		if (D.height > E.height) {
+			B.right = d;
+			A.left = e;
+			E.parent = a;
+
+			A.box = BoundingBox::merge(C.box, E.box);
+			B.box = BoundingBox::merge(A.box, D.box);
+
+			A.height = 1 + std::max(C.height, E.height);
+			B.height = 1 + std::max(A.height, D.height);
+		} else {
+			B.right = e;
+			A.left = d;
+			D.parent = a;
+
+			A.box = BoundingBox::merge(C.box, D.box);
+			B.box = BoundingBox::merge(A.box, E.box);
+
+			A.height = 1 + std::max(C.height, D.height);
+			B.height = 1 + std::max(A.height, E.height);
+		}
+
+		return b;
+	}
+
+	return a;
+}
+
+// Rebalance and recompute bounds from a node up to the root
+void SpatialIndex::_refit(int i)
+{
+	while (i != -1) {
+		i = _balance(i);
+
+		_node &node = _nodes[i];
+		const _node &left = _nodes[node.left];
+		const _node &right = _nodes[node.right];
+
+		node.height = 1 + std::max(left.height, right.height);
+		node.box = BoundingBox::merge(left.box, right.box);
+
+		i = node.parent;
+	}
+}
+
+// World space bounds of a leaf
+BoundingBox SpatialIndex::_bounds(const _node &leaf, const Transform &transform)
+{
+	if (leaf.has_mesh)
+		return leaf.local.transform(transform.matrix());
+
+	return BoundingBox {transform.position, transform.position};
+}
+
+// Fattened bounds of a leaf
+BoundingBox SpatialIndex::_fatten(const BoundingBox &box)
+{
+	glm::vec3 margin = glm::max(
+		glm::vec3 {fat_min},
+		fat_ratio * (box.max - box.min)
+	);
+
+	return BoundingBox {box.min - margin, box.max + margin};
+}
+
+//////////////////////
+// Public interface
+//////////////////////
+
+// Bring the index up to date with the ECS
+void SpatialIndex::update(const ECS &ecs)
+{
+	bool structure = ecs.structure_changed(_version) || !_initialized;
+	bool transforms = ecs.changed <Transform> (_version);
+	bool meshes = ecs.changed <Mesh> (_version);
+
+	if (!structure && !transforms && !meshes)
+		return;
+
+	// Leaves not seen after a structural change are removed
+	if (structure)
+		_stamp++;
+
+	for (int i = 0; i < ecs.size(); i++) {
+		const Entity &e = ecs.entities[i];
+
+		if (e.id >= _leaves.size())
+			_leaves.resize(e.id + 1, -1);
+
+		int leaf = _leaves[e.id];
+
+		// Slot was recycled by another entity
+		if (leaf != -1 && _nodes[leaf].generation != e.generation) {
+			_remove(leaf);
+			_release(leaf);
+			_count--;
+			leaf = -1;
+		}
+
+		const Transform &transform = ecs.get <Transform> (i);
+
+		if (leaf == -1) {
+			leaf = _allocate();
+			_leaves[e.id] = leaf;
+
+			_node &node = _nodes[leaf];
+			node.slot = e.id;
+			node.generation = e.generation;
+			node.has_mesh = ecs.exists <Mesh> (i);
+			if (node.has_mesh)
+				node.local = ecs.get <Mesh> (i).bbox();
+
+			node.tight = _bounds(node, transform);
+			node.box = _fatten(node.tight);
+
+			_insert(leaf);
+			_count++;
+		} else {
+			bool mesh_changed = meshes && ecs.changed <Mesh> (i, _version);
+			bool transform_changed = transforms && ecs.changed <Transform> (i, _version);
+
+			if (mesh_changed) {
+				_node &node = _nodes[leaf];
+				node.has_mesh = ecs.exists <Mesh> (i);
+				if (node.has_mesh)
+					node.local = ecs.get <Mesh> (i).bbox();
+			}
+
+			if (mesh_changed || transform_changed)
+				_move(leaf, _bounds(_nodes[leaf], transform));
+		}
+
+		_nodes[leaf].index = i;
+		_nodes[leaf].stamp = _stamp;
+	}
+
+	// Remove leaves of destroyed entities
+	if (structure) {
+		for (int &leaf : _leaves) {
+			if (leaf != -1 && _nodes[leaf].stamp != _stamp) {
+				_remove(leaf);
+				_release(leaf);
+				_count--;
+				leaf = -1;
+			}
+		}
+	}
+
+	_version = ecs.version();
+	_initialized = true;
+}
+
+// Remove everything
+void SpatialIndex::clear()
+{
+	_nodes.clear();
+	_free.clear();
+	_leaves.clear();
+
+	_root = -1;
+	_count = 0;
+	_version = 0;
+	_initialized = false;
+}
+
+// Entities overlapping a box
+std::vector <int> SpatialIndex::query(const BoundingBox &box) const
+{
+	std::vector <int> result;
+	_traverse(
+		[&](const BoundingBox &b) { return box.intersects(b); },
+		[&](const _node &leaf) { result.push_back(leaf.index); }
+	);
+
+	return result;
+}
+
+// Entities (partially) inside a frustum
+std::vector <int> SpatialIndex::query(const Frustum &frustum) const
+{
+	std::vector <int> result;
+	_traverse(
+		[&](const BoundingBox &b) { return frustum.intersects(b); },
+		[&](const _node &leaf) { result.push_back(leaf.index); }
+	);
+
+	return result;
+}
+
+// Entities overlapping a sphere
+std::vector <int> SpatialIndex::query(const glm::vec3 &center, float radius) const
+{
+	float r2 = radius * radius;
+
+	std::vector <int> result;
+	_traverse(
+		[&](const BoundingBox &b) { return b.distance2(center) <= r2; },
+		[&](const _node &leaf) { result.push_back(leaf.index); }
+	);
+
+	return result;
+}
+
+// Entities hit by a ray, sorted by distance along the ray
+std::vector <SpatialIndex::Hit> SpatialIndex::raycast(const Ray &ray, float tmax) const
+{
+	glm::vec3 inv = 1.0f/ray.direction;
+
+	std::vector <Hit> result;
+	_traverse(
+		[&](const BoundingBox &b) { return ray_box(ray, inv, b, tmax) >= 0.0f; },
+		[&](const _node &leaf) {
+			result.push_back(Hit {leaf.index, ray_box(ray, inv, leaf.tight, tmax)});
+		}
+	);
+
+	std::sort(result.begin(), result.end(),
+		[](const Hit &a, const Hit &b) { return a.t < b.t; }
+	);
+
+	return result;
+}
+
+// The k entities closest to a point, closest first
+//	best first search: node bounds are lower bounds on
+//	the distance to the leaves below them
+std::vector <int> SpatialIndex::nearest(const glm::vec3 &point, int k) const
+{
+	std::vector <int> result;
+	if (_root == -1 || k <= 0)
+		return result;
+
+	using Entry = std::pair <float, int>;
+	std::priority_queue <Entry, std::vector <Entry>, std::greater <Entry>> queue;
+
+	auto push = [&](int i) {
+		const _node &node = _nodes[i];
+		const BoundingBox &box = node.leaf() ? node.tight : node.box;
+		queue.push({box.distance2(point), i});
+	};
+
+	push(_root);
+	while (!queue.empty() && result.size() < k) {
+		int i = queue.top().second;
+		queue.pop();
+
+		const _node &node = _nodes[i];
+		if (node.leaf()) {
+			result.push_back(node.index);
+		} else {
+			push(node.left);
+			push(node.right);
+		}
+	}
+
+	return result;
+}
+
+// Bounds of an entity, if it is indexed with a mesh
+bool SpatialIndex::bounds(const Entity &e, BoundingBox &box) const
+{
+	if (e.id >= _leaves.size() || _leaves[e.id] == -1)
+		return false;
+
+	const _node &node = _nodes[_leaves[e.id]];
+	if (node.generation != e.generation || !node.has_mesh)
+		return false;
+
+	box = node.tight;
+	return true;
+}
+
+// Number of indexed entities
+size_t SpatialIndex::size() const
+{
+	return _count;
+}
+
+}
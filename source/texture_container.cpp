@@ -0,0 +1,450 @@
+// Standard headers
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+// Vulkan headers
+#include <vulkan/vulkan_format_traits.hpp>
+
+// Engine headers
+#include "../include/logger.hpp"
+#include "../include/texture_container.hpp"
+
+namespace kobra {
+
+namespace container {
+
+bool is_container(const std::string &path)
+{
+	std::string ext = std::filesystem::path(path).extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == ".ktx2" || ext == ".dds";
+}
+
+// sRGB formats are sampled as UNORM, like the textures that
+// are decoded with stb_image (which are not linearized either)
+static vk::Format unorm(vk::Format format)
+{
+	switch (format) {
+	case vk::Format::eR8G8B8A8Srgb:
+		return vk::Format::eR8G8B8A8Unorm;
+	case vk::Format::eB8G8R8A8Srgb:
+		return vk::Format::eB8G8R8A8Unorm;
+	case vk::Format::eBc1RgbSrgbBlock:
+		return vk::Format::eBc1RgbUnormBlock;
+	case vk::Format::eBc1RgbaSrgbBlock:
+		return vk::Format::eBc1RgbaUnormBlock;
+	case vk::Format::eBc2SrgbBlock:
+		return vk::Format::eBc2UnormBlock;
+	case vk::Format::eBc3SrgbBlock:
+		return vk::Format::eBc3UnormBlock;
+	case vk::Format::eBc7SrgbBlock:
+		return vk::Format::eBc7UnormBlock;
+	default:
+		break;
+	}
+
+	return format;
+}
+
+// Size of a level of some format
+static size_t level_size(vk::Format format, uint32_t width, uint32_t height)
+{
+	auto extent = vk::blockExtent(format);
+	size_t bw = (width + extent[0] - 1)/extent[0];
+	size_t bh = (height + extent[1] - 1)/extent[1];
+	return bw * bh * vk::blockSize(format);
+}
+
+// Whether the levels of a texture are within a file
+static bool check_levels(const Texture &texture, size_t size)
+{
+	for (size_t i = 0; i < texture.levels.size(); i++) {
+		const mip::Level &level = texture.levels[i];
+		if (level.offset > size || level.size > size - level.offset)
+			return false;
+
+		if (level.size < level_size(texture.format, level.width, level.height))
+			return false;
+	}
+
+	return !texture.levels.empty();
+}
+
+//////////
+// KTX2 //
+//////////
+
+struct KTX2Header {
+	uint8_t		identifier[12];
+	uint32_t	format;
+	uint32_t	type_size;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	depth;
+	uint32_t	layers;
+	uint32_t	faces;
+	uint32_t	levels;
+	uint32_t	supercompression;
+
+	// Index
+	uint32_t	dfd_offset;
+	uint32_t	dfd_length;
+	uint32_t	kvd_offset;
+	uint32_t	kvd_length;
+	uint64_t	sgd_offset;
+	uint64_t	sgd_length;
+};
+
+static_assert(sizeof(KTX2Header) == 80, "Unexpected KTX2 header size");
+
+struct KTX2Level {
+	uint64_t	offset;
+	uint64_t	length;
+	uint64_t	uncompressed_length;
+};
+
+static constexpr uint8_t ktx2_identifier[12] = {
+	0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+// Orientation from the key/value data; rows
+// are top down unless it says otherwise
+static bool ktx2_top_down(const char *data, size_t size)
+{
+	static constexpr char key[] = "KTXorientation";
+
+	size_t i = 0;
+	while (i + 4 <= size) {
+		uint32_t length;
+		std::memcpy(&length, data + i, 4);
+		i += 4;
+
+		if (length > size - i)
+			break;
+
+		const char *pair = data + i;
+		if (length > sizeof(key) && std::memcmp(pair, key, sizeof(key)) == 0) {
+			// Value is like "rd" or "ru"; the second axis is y
+			const char *value = pair + sizeof(key);
+			size_t n = length - sizeof(key);
+			return !(n >= 2 && value[1] == 'u');
+		}
+
+		i += (length + 3) & ~size_t(3);
+	}
+
+	return true;
+}
+
+bool parse_ktx2(const char *data, size_t size, Texture &texture)
+{
+	KTX2Header header;
+	if (size < sizeof(header)) {
+		KOBRA_LOG_FUNC(error) << "KTX2 file is too small" << std::endl;
+		return false;
+	}
+
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.identifier, ktx2_identifier, sizeof(ktx2_identifier)) != 0) {
+		KOBRA_LOG_FUNC(error) << "Not a KTX2 file" << std::endl;
+		return false;
+	}
+
+	if (header.format == 0 || header.supercompression != 0) {
+		KOBRA_LOG_FUNC(error) << "Supercompressed (or Basis) KTX2 files are not supported" << std::endl;
+		return false;
+	}
+
+	if (header.depth > 1 || header.layers > 1 || header.faces != 1) {
+		KOBRA_LOG_FUNC(error) << "Only 2D KTX2 textures are supported" << std::endl;
+		return false;
+	}
+
+	if (header.width == 0 || header.height == 0) {
+		KOBRA_LOG_FUNC(error) << "KTX2 texture is empty" << std::endl;
+		return false;
+	}
+
+	uint32_t levels = std::max(header.levels, 1u);
+	if (levels > mip::count(header.width, header.height)
+			|| sizeof(header) + levels * sizeof(KTX2Level) > size) {
+		KOBRA_LOG_FUNC(error) << "Invalid KTX2 level index" << std::endl;
+		return false;
+	}
+
+	texture.format = unorm(vk::Format(header.format));
+	texture.width = header.width;
+	texture.height = header.height;
+	texture.levels.clear();
+
+	if (header.kvd_length > 0 && header.kvd_offset <= size
+			&& header.kvd_length <= size - header.kvd_offset)
+		texture.top_down = ktx2_top_down(data + header.kvd_offset, header.kvd_length);
+
+	// Level 0 is the largest, although it is stored last
+	uint32_t width = header.width;
+	uint32_t height = header.height;
+
+	for (uint32_t i = 0; i < levels; i++) {
+		KTX2Level level;
+		std::memcpy(&level, data + sizeof(header) + i * sizeof(KTX2Level), sizeof(level));
+
+		texture.levels.push_back(mip::Level {
+			width, height,
+			size_t(level.offset), size_t(level.length)
+		});
+
+		width = std::max(width/2, 1u);
+		height = std::max(height/2, 1u);
+	}
+
+	if (!check_levels(texture, size)) {
+		KOBRA_LOG_FUNC(error) << "KTX2 levels are out of bounds" << std::endl;
+		return false;
+	}
+
+	// Levels may be padded; only the texels are copied
+	for (mip::Level &level : texture.levels)
+		level.size = level_size(texture.format, level.width, level.height);
+
+	return true;
+}
+
+/////////
+// DDS //
+/////////
+
+struct DDSPixelFormat {
+	uint32_t	size;
+	uint32_t	flags;
+	uint32_t	fourcc;
+	uint32_t	bits;
+	uint32_t	r_mask;
+	uint32_t	g_mask;
+	uint32_t	b_mask;
+	uint32_t	a_mask;
+};
+
+struct DDSHeader {
+	char		magic[4];
+	uint32_t	size;
+	uint32_t	flags;
+	uint32_t	height;
+	uint32_t	width;
+	uint32_t	pitch;
+	uint32_t	depth;
+	uint32_t	levels;
+	uint32_t	reserved[11];
+	DDSPixelFormat	format;
+	uint32_t	caps[4];
+	uint32_t	reserved2;
+};
+
+static_assert(sizeof(DDSHeader) == 128, "Unexpected DDS header size");
+
+struct DDSHeaderDX10 {
+	uint32_t	format;
+	uint32_t	dimension;
+	uint32_t	flags;
+	uint32_t	array_size;
+	uint32_t	flags2;
+};
+
+// Flags
+static constexpr uint32_t dds_mip_count = 0x20000;
+static constexpr uint32_t dds_fourcc = 0x4;
+static constexpr uint32_t dds_rgb = 0x40;
+static constexpr uint32_t dds_luminance = 0x20000;
+static constexpr uint32_t dds_cubemap = 0x200;
+static constexpr uint32_t dds_volume = 0x200000;
+
+static constexpr uint32_t fourcc(const char (&s)[5])
+{
+	return uint32_t(uint8_t(s[0])) | (uint32_t(uint8_t(s[1])) << 8)
+		| (uint32_t(uint8_t(s[2])) << 16) | (uint32_t(uint8_t(s[3])) << 24);
+}
+
+static vk::Format dxgi_format(uint32_t format)
+{
+	switch (format) {
+	case 2:		return vk::Format::eR32G32B32A32Sfloat;
+	case 10:	return vk::Format::eR16G16B16A16Sfloat;
+	case 28:	return vk::Format::eR8G8B8A8Unorm;
+	case 29:	return vk::Format::eR8G8B8A8Srgb;
+	case 49:	return vk::Format::eR8G8Unorm;
+	case 61:	return vk::Format::eR8Unorm;
+	case 71:	return vk::Format::eBc1RgbaUnormBlock;
+	case 72:	return vk::Format::eBc1RgbaSrgbBlock;
+	case 74:	return vk::Format::eBc2UnormBlock;
+	case 75:	return vk::Format::eBc2SrgbBlock;
+	case 77:	return vk::Format::eBc3UnormBlock;
+	case 78:	return vk::Format::eBc3SrgbBlock;
+	case 80:	return vk::Format::eBc4UnormBlock;
+	case 81:	return vk::Format::eBc4SnormBlock;
+	case 83:	return vk::Format::eBc5UnormBlock;
+	case 84:	return vk::Format::eBc5SnormBlock;
+	case 87:	return vk::Format::eB8G8R8A8Unorm;
+	case 91:	return vk::Format::eB8G8R8A8Srgb;
+	case 95:	return vk::Format::eBc6HUfloatBlock;
+	case 96:	return vk::Format::eBc6HSfloatBlock;
+	case 98:	return vk::Format::eBc7UnormBlock;
+	case 99:	return vk::Format::eBc7SrgbBlock;
+	default:
+		break;
+	}
+
+	return vk::Format::eUndefined;
+}
+
+// Formats of files without the DX10 header
+static vk::Format legacy_format(const DDSPixelFormat &pf)
+{
+	if (pf.flags & dds_fourcc) {
+		switch (pf.fourcc) {
+		case fourcc("DXT1"):
+			return vk::Format::eBc1RgbaUnormBlock;
+		case fourcc("DXT2"):
+		case fourcc("DXT3"):
+			return vk::Format::eBc2UnormBlock;
+		case fourcc("DXT4"):
+		case fourcc("DXT5"):
+			return vk::Format::eBc3UnormBlock;
+		case fourcc("ATI1"):
+		case fourcc("BC4U"):
+			return vk::Format::eBc4UnormBlock;
+		case fourcc("BC4S"):
+			return vk::Format::eBc4SnormBlock;
+		case fourcc("ATI2"):
+		case fourcc("BC5U"):
+			return vk::Format::eBc5UnormBlock;
+		case fourcc("BC5S"):
+			return vk::Format::eBc5SnormBlock;
+		case 113:	// D3DFMT_A16B16G16R16F
+			return vk::Format::eR16G16B16A16Sfloat;
+		case 116:	// D3DFMT_A32B32G32R32F
+			return vk::Format::eR32G32B32A32Sfloat;
+		default:
+			break;
+		}
+
+		return vk::Format::eUndefined;
+	}
+
+	if ((pf.flags & dds_rgb) && pf.bits == 32) {
+		if (pf.r_mask == 0xff && pf.g_mask == 0xff00 && pf.b_mask == 0xff0000)
+			return vk::Format::eR8G8B8A8Unorm;
+
+		if (pf.r_mask == 0xff0000 && pf.g_mask == 0xff00 && pf.b_mask == 0xff)
+			return vk::Format::eB8G8R8A8Unorm;
+	}
+
+	if ((pf.flags & dds_luminance) && pf.bits == 8)
+		return vk::Format::eR8Unorm;
+
+	return vk::Format::eUndefined;
+}
+
+bool parse_dds(const char *data, size_t size, Texture &texture)
+{
+	DDSHeader header;
+	if (size < sizeof(header)) {
+		KOBRA_LOG_FUNC(error) << "DDS file is too small" << std::endl;
+		return false;
+	}
+
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, "DDS ", 4) != 0 || header.size != 124) {
+		KOBRA_LOG_FUNC(error) << "Not a DDS file" << std::endl;
+		return false;
+	}
+
+	if (header.caps[1] & (dds_cubemap | dds_volume)) {
+		KOBRA_LOG_FUNC(error) << "Only 2D DDS textures are supported" << std::endl;
+		return false;
+	}
+
+	if (header.width == 0 || header.height == 0) {
+		KOBRA_LOG_FUNC(error) << "DDS texture is empty" << std::endl;
+		return false;
+	}
+
+	size_t offset = sizeof(header);
+
+	vk::Format format;
+	if ((header.format.flags & dds_fourcc) && header.format.fourcc == fourcc("DX10")) {
+		DDSHeaderDX10 dx10;
+		if (size < offset + sizeof(dx10)) {
+			KOBRA_LOG_FUNC(error) << "DDS file is too small" << std::endl;
+			return false;
+		}
+
+		std::memcpy(&dx10, data + offset, sizeof(dx10));
+		offset += sizeof(dx10);
+
+		// Dimension 3 is a 2D texture
+		if (dx10.dimension != 3 || dx10.array_size > 1 || (dx10.flags & 0x4)) {
+			KOBRA_LOG_FUNC(error) << "Only 2D DDS textures are supported" << std::endl;
+			return false;
+		}
+
+		format = dxgi_format(dx10.format);
+	} else {
+		format = legacy_format(header.format);
+	}
+
+	if (format == vk::Format::eUndefined) {
+		KOBRA_LOG_FUNC(error) << "Unsupported DDS pixel format" << std::endl;
+		return false;
+	}
+
+	uint32_t levels = 1;
+	if ((header.flags & dds_mip_count) && header.levels > 0)
+		levels = header.levels;
+
+	if (levels > mip::count(header.width, header.height)) {
+		KOBRA_LOG_FUNC(error) << "Invalid DDS level count" << std::endl;
+		return false;
+	}
+
+	texture.format = unorm(format);
+	texture.width = header.width;
+	texture.height = header.height;
+	texture.top_down = true;
+	texture.levels.clear();
+
+	// Levels are packed, largest first
+	uint32_t width = header.width;
+	uint32_t height = header.height;
+
+	for (uint32_t i = 0; i < levels; i++) {
+		size_t bytes = level_size(texture.format, width, height);
+		texture.levels.push_back(mip::Level {width, height, offset, bytes});
+
+		offset += bytes;
+		width = std::max(width/2, 1u);
+		height = std::max(height/2, 1u);
+	}
+
+	if (!check_levels(texture, size)) {
+		KOBRA_LOG_FUNC(error) << "DDS levels are out of bounds" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool parse(const std::string &path, const char *data, size_t size, Texture &texture)
+{
+	std::string ext = std::filesystem::path(path).extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	if (ext == ".ktx2")
+		return parse_ktx2(data, size, texture);
+
+	return parse_dds(data, size, texture);
+}
+
+}
+
+}
@@ -1,7 +1,88 @@
+// Standard headers
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <set>
+#include <thread>
+
+// Engine headers
+#include "../include/atlas.hpp"
+#include "../include/bake.hpp"
 #include "../include/texture_manager.hpp"
+#include "../include/thread_pool.hpp"
+#include "../include/vfs.hpp"
 
 namespace kobra {
 
+// How the images of textures are created
+static constexpr vk::ImageTiling texture_tiling = vk::ImageTiling::eOptimal;
+
+static const vk::ImageUsageFlags texture_usage = vk::ImageUsageFlagBits::eSampled
+	| vk::ImageUsageFlagBits::eTransferDst
+	| vk::ImageUsageFlagBits::eTransferSrc;
+
+// Thread that decodes dropped levels again; they take a while, so
+// they are kept off the workers of the thread pool, which frames
+// need (like the loaders of world partitions)
+class StreamDecoder {
+	std::thread				_thread;
+	std::deque <std::function <void ()>>	_tasks;
+	std::mutex				_mutex;
+	std::condition_variable			_cv;
+	bool					_stop = false;
+
+	void _run() {
+		while (true) {
+			std::function <void ()> task;
+
+			{
+				std::unique_lock <std::mutex> lock(_mutex);
+				_cv.wait(lock, [&]() { return _stop || !_tasks.empty(); });
+				if (_stop)
+					return;
+
+				task = std::move(_tasks.front());
+				_tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+public:
+	// Decoding compresses on the thread pool, which
+	// must then outlive the thread (so it is made first)
+	StreamDecoder() {
+		ThreadPool::one();
+		_thread = std::thread(&StreamDecoder::_run, this);
+	}
+
+	~StreamDecoder() {
+		{
+			std::lock_guard <std::mutex> lock(_mutex);
+			_stop = true;
+		}
+
+		_cv.notify_all();
+		_thread.join();
+	}
+
+	void push(std::function <void ()> task) {
+		{
+			std::lock_guard <std::mutex> lock(_mutex);
+			_tasks.push_back(std::move(task));
+		}
+
+		_cv.notify_one();
+	}
+
+	static StreamDecoder &one() {
+		static StreamDecoder decoder;
+		return decoder;
+	}
+};
+
 /////////////////////////////
 // Static member variables //
 /////////////////////////////
@@ -10,91 +91,1104 @@ TextureManager::DeviceMap <vk::raii::CommandPool>
 	TextureManager::_command_pools;
 TextureManager::DeviceMap <TextureManager::ImageMap>
 	TextureManager::_image_map;
-TextureManager::DeviceMap <std::vector <ImageData>>
+TextureManager::DeviceMap <TextureManager::ContentMap>
+	TextureManager::_content_map;
+TextureManager::DeviceMap <std::deque <ImageData>>
 	TextureManager::_images;
-TextureManager::DeviceMap <TextureManager::SamplerMap>
-	TextureManager::_samplers;
 TextureManager::DeviceMap <std::mutex>
 	TextureManager::_mutexes {};
+TextureManager::DeviceMap <std::deque <TextureManager::_residence>>
+	TextureManager::_residences;
+TextureManager::DeviceMap <uint64_t>
+	TextureManager::_frames;
+TextureManager::DeviceMap <uint64_t>
+	TextureManager::_generations;
+TextureManager::DeviceMap <uint64_t>
+	TextureManager::_slot_versions;
+TextureManager::DeviceMap <TextureManager::Stats>
+	TextureManager::_stats;
+TextureManager::DeviceMap <std::deque <TextureManager::_garbage>>
+	TextureManager::_retired;
+TextureManager::DeviceMap <std::unordered_map <size_t, TexturePixels>>
+	TextureManager::_streams;
+TextureManager::DeviceMap <std::unordered_map <size_t, std::shared_ptr <TextureManager::_decode>>>
+	TextureManager::_decodes;
+TextureManager::DeviceMap <TextureManager::_stream_batch>
+	TextureManager::_stream_batches;
+TextureManager::DeviceMap <BufferData>
+	TextureManager::_stream_staging;
+TextureManager::DeviceMap <BufferData>
+	TextureManager::_staging;
+TextureManager::DeviceMap <std::mutex>
+	TextureManager::_upload_mutexes {};
+TextureManager::DeviceMap <TextureManager::_table>
+	TextureManager::_tables;
+std::unordered_map <std::string, TextureManager::_alias>
+	TextureManager::_aliases;
+std::mutex TextureManager::_alias_mutex;
+
+TextureCompression TextureManager::compression;
+TextureManager::Budget TextureManager::budget;
+TextureManager::Streaming TextureManager::streaming;
 
 ////////////////////
 // Static methods //
 ////////////////////
 
-// Load a texture
-const ImageData &TextureManager::load_texture
+// Where a texture is stored
+TextureManager::_alias TextureManager::_resolve(const std::string &path)
+{
+	std::lock_guard <std::mutex> lock(_alias_mutex);
+
+	auto it = _aliases.find(path);
+	if (it != _aliases.end())
+		return it->second;
+
+	_alias alias {path};
+
+	atlas::Placement placement;
+	if (path != "blank" && atlas::lookup(path, placement))
+		alias = _alias {placement.sheet, placement.transform};
+
+	return _aliases.insert({path, alias}).first->second;
+}
+
+// Hashes of the contents of files, from their mappings (which
+// decoding reads next), and of their roles, as the same file is
+// stored differently for each; zero for files that cannot be read
+static std::vector <uint64_t> content_hashes(const std::vector <std::string> &paths,
+		const std::vector <TextureRole> &roles)
+{
+	std::vector <uint64_t> hashes(paths.size(), 0);
+
+	ThreadPool::one().parallel_for(paths.size(), 1,
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				if (paths[i] == "blank")
+					continue;
+
+				vfs::File file = vfs::open(paths[i]);
+				if (!file.valid())
+					continue;
+
+				hashes[i] = bake::fingerprint(file.data(), file.size());
+				if (roles[i] != TextureRole::eColor) {
+					hashes[i] = bake::hash((const char *) &roles[i],
+						sizeof(TextureRole), hashes[i]);
+				}
+			}
+		}
+	);
+
+	return hashes;
+}
+
+// Staging memory of at least some size
+BufferData &TextureManager::_staging_buffer
 		(const vk::raii::PhysicalDevice &phdev,
 		const vk::raii::Device &dev,
-		const std::string &path) {
-	// Get corresponding command pool
+		DeviceMap <BufferData> &buffers,
+		vk::DeviceSize bytes) {
+	auto it = buffers.find(*dev);
+	if (it == buffers.end() || it->second.size < bytes) {
+		vk::DeviceSize size = bytes;
+		if (it != buffers.end())
+			size = std::max(bytes, 2 * it->second.size);
+
+		it = buffers.insert_or_assign(*dev,
+			BufferData(phdev, dev, size,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible
+					| vk::MemoryPropertyFlagBits::eHostCoherent
+			)
+		).first;
+	}
+
+	return it->second;
+}
+
+// Create the images for a batch of textures
+std::vector <TextureManager::_texture> TextureManager::_make_textures
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev,
+		const std::vector <std::string> &paths,
+		const std::vector <TextureRole> &roles) {
+	// Decode (and compress) everything first, in parallel
+	std::vector <TexturePixels> pixels(paths.size());
+	std::vector <char> loaded(paths.size(), false);
+
+	TextureCompression settings = compression;
+
+	ThreadPool::one().parallel_for(paths.size(), 1,
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				if (paths[i] == "blank")
+					continue;
+
+				KOBRA_LOG_FUNC(ok) << "Loading texture from file: " << paths[i] << "\n";
+				loaded[i] = load_texture_pixels(phdev, paths[i], texture_tiling,
+					pixels[i], settings, roles[i]);
+			}
+		}
+	);
+
+	// Only the coarse levels of textures with a full chain on the
+	// CPU are uploaded now; the rest are streamed in on request
+	Streaming stream = streaming;
+
+	std::vector <uint32_t> bases(paths.size(), 0);
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (!loaded[i] || !stream.enabled || pixels[i].levels < pixels[i].mip_levels)
+			continue;
+
+		const auto &layout = pixels[i].layout;
+		while (bases[i] + 1 < layout.size()
+				&& std::max(layout[bases[i]].width, layout[bases[i]].height) > stream.initial)
+			bases[i]++;
+	}
+
+	// Place the pixels in the staging arena; offsets are kept
+	// aligned for any texel (or block) size
+	std::vector <vk::DeviceSize> offsets(paths.size(), 0);
+	vk::DeviceSize total = 0;
+
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (!loaded[i])
+			continue;
+
+		offsets[i] = total;
+		total += staging_size(pixels[i], bases[i], pixels[i].levels);
+	}
+
+	std::lock_guard <std::mutex> lock(_upload_mutexes[*dev]);
+
+	BufferData *staging = nullptr;
+	if (total > 0) {
+		staging = &_staging_buffer(phdev, dev, _staging, total);
+		byte *ptr = (byte *) staging->memory.mapMemory(0, total);
+
+		ThreadPool::one().parallel_for(paths.size(), 1,
+			[&](size_t, size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					if (loaded[i])
+						copy_texture_pixels(pixels[i], ptr + offsets[i], bases[i]);
+				}
+			}
+		);
+
+		staging->memory.unmapMemory();
+	}
+
+	// Record all the copies and transitions, and wait for them once
 	auto &command_pool = get_command_pool(phdev, dev);
-	auto &image_map = _image_map[*dev];
+	auto cmd = make_command_buffer(dev, command_pool);
+	cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+	std::vector <_texture> textures(paths.size());
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (paths[i] == "blank") {
+			textures[i].image = ImageData::blank(phdev, dev);
+			textures[i].image.transition_layout(cmd, vk::ImageLayout::eShaderReadOnlyOptimal);
+		} else if (loaded[i]) {
+			textures[i].image = upload_texture(cmd,
+				phdev, dev,
+				pixels[i], *staging, offsets[i],
+				texture_tiling, texture_usage,
+				vk::MemoryPropertyFlagBits::eDeviceLocal,
+				vk::ImageAspectFlagBits::eColor,
+				bases[i]
+			);
+
+			textures[i].base = bases[i];
+		}
+	}
+
+	cmd.end();
+
+	vk::raii::Fence fence {dev, vk::FenceCreateInfo {}};
+	vk::raii::Queue queue {dev, 0, 0};
+
+	queue.submit(
+		vk::SubmitInfo {
+			0, nullptr, nullptr, 1, &*cmd
+		},
+		*fence
+	);
+
+	while (vk::Result(dev.waitForFences(
+		*fence,
+		true,
+		std::numeric_limits <uint64_t>::max()
+	)) == vk::Result::eTimeout);
+
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (textures[i].base > 0)
+			textures[i].pixels = std::move(pixels[i]);
+	}
+
+	return textures;
+}
+
+// Place a new texture
+void TextureManager::_place(const vk::raii::Device &dev,
+		size_t index,
+		uint64_t content,
+		_texture &&texture) {
 	auto &images = _images[*dev];
+	auto &residences = _residences[*dev];
+	auto &streams = _streams[*dev];
+	auto &content_map = _content_map[*dev];
+	Stats &stats = _stats[*dev];
+
+	_residence &residence = residences[index];
+	if (*images[index].image) {
+		stats.resident--;
+		stats.bytes -= residence.bytes;
+		_retire(*dev, std::move(images[index]));
+	}
+
+	if (streams.erase(index))
+		stats.streaming--;
+
+	// Contents that changed are no longer shared
+	auto it = content_map.find(residence.content);
+	if (it != content_map.end() && it->second == index)
+		content_map.erase(it);
+
+	if (content != 0)
+		content_map[content] = index;
+
+	images[index] = std::move(texture.image);
+
+	residence.bytes = images[index].image.getMemoryRequirements().size;
+	residence.frame = _frames[*dev];
+	residence.generation = ++_generations[*dev];
+	residence.base = texture.base;
+	residence.wanted = ~0u;
+	residence.content = content;
+
+	if (texture.base > 0) {
+		residence.extent = std::max(texture.pixels.width, texture.pixels.height);
+		residence.levels = texture.pixels.mip_levels;
+		residence.refined = _frames[*dev];
+
+		streams[index] = std::move(texture.pixels);
+		stats.streaming++;
+	}
+
+	stats.resident++;
+	stats.bytes += residence.bytes;
+
+	_write_slot(dev, index);
+}
+
+// Refer to an image from another path
+void TextureManager::_share(const vk::Device &dev, const std::string &path, size_t index)
+{
+	auto &image_map = _image_map[dev];
+	auto &residences = _residences[dev];
+	Stats &stats = _stats[dev];
+
+	auto it = image_map.find(path);
+	if (it == image_map.end()) {
+		image_map.insert({path, index});
+	} else if (it->second != index) {
+		residences[it->second].paths--;
+		it->second = index;
+		_slot_versions[dev]++;
+	} else {
+		return;
+	}
+
+	residences[index].paths++;
+	stats.duplicates++;
+	stats.saved += residences[index].bytes;
+}
+
+///////////////////
+// Texture table //
+///////////////////
+
+// Slots of the table; room is left for the
+// other samplers of the pipelines that use it
+static uint32_t table_capacity(const vk::raii::PhysicalDevice &phdev)
+{
+	static constexpr uint32_t reserved = 16;
+
+	auto properties = phdev.getProperties2 <
+		vk::PhysicalDeviceProperties2,
+		vk::PhysicalDeviceDescriptorIndexingProperties
+	> ();
+
+	const auto &indexing = properties.get <vk::PhysicalDeviceDescriptorIndexingProperties> ();
+
+	uint32_t limit = std::min({
+		indexing.maxDescriptorSetUpdateAfterBindSampledImages,
+		indexing.maxDescriptorSetUpdateAfterBindSamplers,
+		indexing.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexing.maxPerStageDescriptorUpdateAfterBindSamplers
+	});
+
+	KOBRA_ASSERT(limit > reserved, "Device cannot index enough textures");
+	return std::min(TextureManager::table_size, limit - reserved);
+}
+
+// Table of a device
+TextureManager::_table &TextureManager::_get_table
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev) {
 	auto &mutex = _mutexes[*dev];
 
 	mutex.lock();
-	if (image_map.find(path) != image_map.end()) {
+	auto it = _tables.find(*dev);
+	if (it != _tables.end()) {
 		mutex.unlock();
-		size_t index = image_map[path];
-		return images[index];
+		return it->second;
 	}
 	mutex.unlock();
 
-	// TODO: convert channels to image format
-	ImageData img = nullptr;
+	// The blank texture fills the slots of evicted images
+	load_texture(phdev, dev, "blank");
+
+	std::lock_guard <std::mutex> lock(mutex);
+
+	it = _tables.find(*dev);
+	if (it != _tables.end())
+		return it->second;
+
+	_table table;
+	table.capacity = table_capacity(phdev);
+
+	// One variable sized array; slots are written while frames
+	// in flight use others, and slots that are not sampled (yet)
+	// may stay unwritten
+	vk::DescriptorSetLayoutBinding binding {
+		0, vk::DescriptorType::eCombinedImageSampler,
+		table.capacity,
+		vk::ShaderStageFlagBits::eFragment
+			| vk::ShaderStageFlagBits::eCompute
+	};
+
+	vk::DescriptorBindingFlags binding_flags =
+		vk::DescriptorBindingFlagBits::ePartiallyBound
+		| vk::DescriptorBindingFlagBits::eUpdateAfterBind
+		| vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending
+		| vk::DescriptorBindingFlagBits::eVariableDescriptorCount;
+
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo flags_info {binding_flags};
+
+	table.layout = vk::raii::DescriptorSetLayout {dev,
+		vk::DescriptorSetLayoutCreateInfo {
+			vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool,
+			binding, &flags_info
+		}
+	};
+
+	vk::DescriptorPoolSize pool_size {
+		vk::DescriptorType::eCombinedImageSampler,
+		table.capacity * MAX_FRAMES_IN_FLIGHT
+	};
+
+	table.pool = vk::raii::DescriptorPool {dev,
+		vk::DescriptorPoolCreateInfo {
+			vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind
+				| vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+			MAX_FRAMES_IN_FLIGHT, pool_size
+		}
+	};
+
+	std::vector <vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, *table.layout);
+	std::vector <uint32_t> counts(MAX_FRAMES_IN_FLIGHT, table.capacity);
+
+	vk::DescriptorSetVariableDescriptorCountAllocateInfo count_info {counts};
+
+	vk::raii::DescriptorSets sets {dev,
+		vk::DescriptorSetAllocateInfo {
+			*table.pool, layouts, &count_info
+		}
+	};
+
+	for (auto &set : sets)
+		table.sets.emplace_back(std::move(set));
+
+	// Images loaded so far are written on first use
+	std::set <size_t> loaded;
+	for (size_t i = 0; i < _images[*dev].size() && i < table.capacity; i++)
+		loaded.insert(i);
 
-	if (path == "blank") {
-		KOBRA_LOG_FUNC(ok) << "Loading blank texture\n";
-		img = ImageData::blank(phdev, dev);
-		img.transition_layout(
-			dev, command_pool,
+	table.dirty.assign(MAX_FRAMES_IN_FLIGHT, loaded);
+
+	KOBRA_LOG_FUNC(ok) << "Texture table with " << table.capacity << " slots\n";
+	return _tables.insert({*dev, std::move(table)}).first->second;
+}
+
+// Queue the slot of an image to be written
+void TextureManager::_write_slot(const vk::raii::Device &dev, size_t index)
+{
+	auto it = _tables.find(*dev);
+	if (it == _tables.end())
+		return;
+
+	_table &table = it->second;
+	if (index >= table.capacity) {
+		KOBRA_LOG_FUNC(warn) << "Texture table is full, image "
+			<< index << " has no slot\n";
+		return;
+	}
+
+	for (auto &dirty : table.dirty)
+		dirty.insert(index);
+
+	// Only the frame being recorded uses the open copy, and it
+	// sees the write when it is submitted (update after bind)
+	if (table.open)
+		_flush_table(dev, table.current);
+}
+
+// Apply the queued writes of a copy
+void TextureManager::_flush_table(const vk::raii::Device &dev, uint32_t copy)
+{
+	_table &table = _tables.at(*dev);
+
+	std::set <size_t> &dirty = table.dirty[copy];
+	if (dirty.empty())
+		return;
+
+	auto &images = _images[*dev];
+
+	// Images only hold the levels that are streamed, so
+	// they all sample from their first with the same state
+	const vk::raii::Sampler &sampler = SamplerCache::get(dev, sampler_info());
+
+	// Slots of evicted images show the blank texture
+	size_t blank = std::numeric_limits <size_t>::max();
+	auto it = _image_map[*dev].find("blank");
+	if (it != _image_map[*dev].end())
+		blank = it->second;
+
+	std::vector <vk::DescriptorImageInfo> infos;
+	std::vector <vk::WriteDescriptorSet> writes;
+
+	infos.reserve(dirty.size());
+	writes.reserve(dirty.size());
+
+	for (size_t index : dirty) {
+		size_t source = *images[index].image ? index : blank;
+		if (source >= images.size() || !*images[source].image)
+			continue;
+
+		infos.push_back(vk::DescriptorImageInfo {
+			*sampler,
+			*images[source].view,
 			vk::ImageLayout::eShaderReadOnlyOptimal
-		);
-	} else{
-		KOBRA_LOG_FUNC(ok) << "Loading texture from file: " << path << "\n";
-		img = make_image(phdev, dev,
-			command_pool, path,
-			vk::ImageTiling::eOptimal,
-			vk::ImageUsageFlagBits::eSampled
-				| vk::ImageUsageFlagBits::eTransferDst
-				| vk::ImageUsageFlagBits::eTransferSrc,
-			vk::MemoryPropertyFlagBits::eDeviceLocal,
-			vk::ImageAspectFlagBits::eColor
-		);
+		});
+
+		writes.push_back(vk::WriteDescriptorSet {
+			*table.sets[copy],
+			0, uint32_t(index), 1,
+			vk::DescriptorType::eCombinedImageSampler,
+			&infos.back()
+		});
 	}
 
+	dev.updateDescriptorSets(writes, nullptr);
+	dirty.clear();
+}
+
+// Layout of the table
+const vk::raii::DescriptorSetLayout &TextureManager::table_layout
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev) {
+	return _get_table(phdev, dev).layout;
+}
+
+// Copy of the table for the frame being recorded
+const vk::raii::DescriptorSet &TextureManager::table
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev) {
+	_table &table = _get_table(phdev, dev);
+
+	std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+	if (!table.open) {
+		_flush_table(dev, table.current);
+		table.open = true;
+	}
+
+	return table.sets[table.current];
+}
+
+// Slot of a texture in the table
+int TextureManager::slot(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev,
+		const std::string &source,
+		TextureRole role) {
+	std::string path = _resolve(source).key;
+
+	const _table &table = _get_table(phdev, dev);
+	load_texture(phdev, dev, path, role);
+
+	std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+
+	size_t index = _image_map[*dev].at(path);
+	return (index < table.capacity) ? int(index) : -1;
+}
+
+// Load a texture
+const ImageData &TextureManager::load_texture
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev,
+		const std::string &source,
+		TextureRole role) {
+	std::string path = _resolve(source).key;
+
+	auto &image_map = _image_map[*dev];
+	auto &images = _images[*dev];
+	auto &mutex = _mutexes[*dev];
+
+	// Evicted textures are loaded again, in the same place
 	mutex.lock();
-	images.emplace_back(std::move(img));
-	image_map[path] = images.size() - 1;
-	const ImageData &ret = images.back();
+	auto it = image_map.find(path);
+	if (it == image_map.end() || !*images[it->second].image) {
+		mutex.unlock();
+		load_textures(phdev, dev, {path}, {role});
+		mutex.lock();
+	}
+
+	it = image_map.find(path);
+	const ImageData *ret = nullptr;
+	if (it != image_map.end() && *images[it->second].image) {
+		ret = &images[it->second];
+		_residences[*dev][it->second].frame = _frames[*dev];
+	}
 	mutex.unlock();
 
-	return ret;
+	KOBRA_ASSERT(ret, "Failed to load texture image: " + path);
+	return *ret;
 }
 
-// Create a sampler
-const vk::raii::Sampler &TextureManager::load_sampler
+// Load a batch of textures
+void TextureManager::load_textures
 		(const vk::raii::PhysicalDevice &phdev,
 		const vk::raii::Device &dev,
-		const std::string &path) {
-	auto &sampler_map = _samplers[*dev];
+		const std::vector <std::string> &sources,
+		const std::vector <TextureRole> &source_roles) {
+	// Textures in the same atlas are loaded once
+	std::vector <std::string> paths;
+	for (const std::string &source : sources)
+		paths.push_back(_resolve(source).key);
+
+	std::vector <TextureRole> roles = source_roles;
+	roles.resize(paths.size(), TextureRole::eColor);
+
+	auto &image_map = _image_map[*dev];
+	auto &content_map = _content_map[*dev];
+	auto &images = _images[*dev];
+	auto &residences = _residences[*dev];
 	auto &mutex = _mutexes[*dev];
+	auto &stats = _stats[*dev];
+
+	// Only the textures that are missing (or evicted), once each;
+	// evicted ones come back in the role they were loaded in
+	std::vector <std::string> missing;
+	std::vector <TextureRole> missing_roles;
 
 	mutex.lock();
-	if (sampler_map.find(path) != sampler_map.end()) {
-		mutex.unlock();
-		return sampler_map.at(path);
+	std::set <std::string> seen;
+	for (size_t i = 0; i < paths.size(); i++) {
+		auto it = image_map.find(paths[i]);
+		bool resident = (it != image_map.end()) && *images[it->second].image;
+		if (resident || !seen.insert(paths[i]).second)
+			continue;
+
+		missing.push_back(paths[i]);
+		missing_roles.push_back(it != image_map.end()
+			? residences[it->second].role : roles[i]);
+	}
+	mutex.unlock();
+
+	if (missing.empty())
+		return;
+
+	// Files with the same contents (under other names, or through
+	// other relative paths) share an image; contents are hashed
+	// before anything is decoded, so that copies never are
+	std::vector <uint64_t> hashes = content_hashes(missing, missing_roles);
+
+	std::vector <std::string> unique;
+	std::vector <TextureRole> unique_roles;
+	std::vector <uint64_t> unique_hashes;
+	std::vector <std::pair <std::string, uint64_t>> copies;
+
+	mutex.lock();
+	size_t duplicates = stats.duplicates;
+	size_t saved = stats.saved;
+
+	std::set <uint64_t> batch;
+	for (size_t i = 0; i < missing.size(); i++) {
+		uint64_t hash = hashes[i];
+		if (hash != 0) {
+			auto it = content_map.find(hash);
+			if (it != content_map.end() && *images[it->second].image) {
+				_share(*dev, missing[i], it->second);
+				continue;
+			}
+
+			// Copies within the batch wait for the first
+			if (!batch.insert(hash).second) {
+				copies.push_back({missing[i], hash});
+				continue;
+			}
+		}
+
+		unique.push_back(missing[i]);
+		unique_roles.push_back(missing_roles[i]);
+		unique_hashes.push_back(hash);
+	}
+	mutex.unlock();
+
+	std::vector <_texture> loaded = _make_textures(phdev, dev, unique, unique_roles);
+
+	// Another batch may have loaded some of
+	// the same textures in the meantime
+	size_t count = 0;
+
+	mutex.lock();
+	for (size_t i = 0; i < unique.size(); i++) {
+		if (!*loaded[i].image.image)
+			continue;
+
+		auto it = image_map.find(unique[i]);
+		if (it == image_map.end()) {
+			images.emplace_back(nullptr);
+			residences.emplace_back();
+			residences.back().paths = 1;
+			residences.back().role = unique_roles[i];
+			it = image_map.insert({unique[i], images.size() - 1}).first;
+		} else if (!*images[it->second].image) {
+			stats.reloads++;
+		} else {
+			continue;
+		}
+
+		residences[it->second].source = unique[i];
+		_place(dev, it->second, unique_hashes[i], std::move(loaded[i]));
+		count++;
 	}
+
+	for (const auto &[path, hash] : copies) {
+		auto it = content_map.find(hash);
+		if (it != content_map.end() && *images[it->second].image)
+			_share(*dev, path, it->second);
+	}
+
+	duplicates = stats.duplicates - duplicates;
+	saved = stats.saved - saved;
+	mutex.unlock();
+
+	if (missing.size() > 1) {
+		KOBRA_LOG_FUNC(ok) << "Loaded " << count << "/" << missing.size()
+			<< " textures in one batch\n";
+	}
+
+	if (duplicates > 0) {
+		KOBRA_LOG_FUNC(ok) << duplicates << " textures are copies of others,"
+			<< " saving " << saved/1024 << " KiB\n";
+	}
+}
+
+// Load a texture again after its file has changed
+bool TextureManager::reload_texture
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev,
+		const std::string &source) {
+	std::string path = _resolve(source).key;
+
+	auto &image_map = _image_map[*dev];
+	auto &images = _images[*dev];
+	auto &residences = _residences[*dev];
+	auto &mutex = _mutexes[*dev];
+
+	mutex.lock();
+	auto it = image_map.find(path);
+	bool loaded = (it != image_map.end());
+	TextureRole role = loaded ? residences[it->second].role : TextureRole::eColor;
 	mutex.unlock();
 
-	auto sampler = make_sampler(dev, load_texture(phdev, dev, path));
+	if (!loaded)
+		return false;
 
+	KOBRA_LOG_FUNC(notify) << "Reloading texture: " << path << "\n";
+	uint64_t hash = content_hashes({path}, {role})[0];
+	std::vector <_texture> textures = _make_textures(phdev, dev, {path}, {role});
+	if (!*textures[0].image.image)
+		return false;
+
+	// References to the entry stay valid; the old image
+	// is released once no frame in flight can use it
 	mutex.lock();
-	sampler_map.insert({path, std::move(sampler)});
-	const vk::raii::Sampler &ret = sampler_map.at(path);
+
+	// Other paths keep the image they shared
+	size_t index = image_map[path];
+	if (residences[index].paths > 1) {
+		residences[index].paths--;
+
+		index = images.size();
+		images.emplace_back(nullptr);
+		residences.emplace_back();
+		residences.back().paths = 1;
+		residences.back().role = role;
+		image_map[path] = index;
+		_slot_versions[*dev]++;
+	}
+
+	residences[index].source = path;
+	_place(dev, index, hash, std::move(textures[0]));
 	mutex.unlock();
 
-	return ret;
+	return true;
+}
+
+// Advance a frame
+void TextureManager::frame(const vk::raii::PhysicalDevice &phdev, const vk::raii::Device &dev)
+{
+	std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+
+	uint64_t now = ++_frames[*dev];
+
+	// The next frame records with the next copy of the table
+	auto table = _tables.find(*dev);
+	if (table != _tables.end()) {
+		table->second.current = (table->second.current + 1) % MAX_FRAMES_IN_FLIGHT;
+		table->second.open = false;
+	}
+
+	// Frames are throttled by their fences, so images retired this
+	// many frames ago are no longer referred to by any command buffer
+	auto &retired = _retired[*dev];
+	retired.emplace_back();
+	while (retired.size() > (size_t) MAX_FRAMES_IN_FLIGHT + 1)
+		retired.pop_front();
+
+	_stream_levels(phdev, dev);
+
+	Stats &stats = _stats[*dev];
+	if (stats.bytes <= budget.bytes)
+		return;
+
+	auto &images = _images[*dev];
+	auto &residences = _residences[*dev];
+	auto &streams = _streams[*dev];
+
+	// The blank texture stands in for missing ones, and stays
+	size_t blank = std::numeric_limits <size_t>::max();
+	auto it = _image_map[*dev].find("blank");
+	if (it != _image_map[*dev].end())
+		blank = it->second;
+
+	// Least recently used first
+	uint64_t after = std::max <uint64_t> (budget.evict_after, MAX_FRAMES_IN_FLIGHT + 1);
+
+	std::vector <std::pair <uint64_t, size_t>> idle;
+	for (size_t i = 0; i < images.size(); i++) {
+		if (i != blank && *images[i].image && residences[i].frame + after <= now)
+			idle.push_back({residences[i].frame, i});
+	}
+
+	std::sort(idle.begin(), idle.end());
+	for (const auto &[frame, index] : idle) {
+		if (stats.bytes <= budget.bytes)
+			break;
+
+		_retire(*dev, std::move(images[index]));
+		images[index] = nullptr;
+
+		stats.resident--;
+		stats.bytes -= residences[index].bytes;
+		stats.evictions++;
+
+		if (streams.erase(index))
+			stats.streaming--;
+
+		residences[index].generation = 0;
+		_write_slot(dev, index);
+	}
+}
+
+// Stream requested levels
+void TextureManager::_stream_levels(const vk::raii::PhysicalDevice &phdev, const vk::raii::Device &dev)
+{
+	auto &images = _images[*dev];
+	auto &residences = _residences[*dev];
+	auto &streams = _streams[*dev];
+	auto &decodes = _decodes[*dev];
+	auto &batch = _stream_batches[*dev];
+	Stats &stats = _stats[*dev];
+
+	uint64_t now = _frames[*dev];
+
+	std::lock_guard <std::mutex> upload_lock(_upload_mutexes[*dev]);
+
+	// Requests only last a frame
+	std::vector <uint32_t> wanted(residences.size());
+	for (size_t i = 0; i < residences.size(); i++) {
+		wanted[i] = residences[i].wanted;
+		residences[i].wanted = ~0u;
+
+		if (wanted[i] < residences[i].base)
+			residences[i].refined = now;
+	}
+
+	// Pixels decoded again are streamed like the others, unless the
+	// texture was evicted or replaced in the meantime
+	for (auto it = decodes.begin(); it != decodes.end(); ) {
+		auto [index, decode] = *it;
+		if (!decode->done.load(std::memory_order_acquire)) {
+			it++;
+			continue;
+		}
+
+		it = decodes.erase(it);
+
+		const _residence &residence = residences[index];
+		bool current = decode->loaded
+			&& *images[index].image
+			&& residence.base > 0
+			&& residence.content == decode->content
+			&& decode->pixels.levels == residence.levels
+			&& streams.count(index) == 0;
+
+		if (current) {
+			streams[index] = std::move(decode->pixels);
+			stats.streaming++;
+		}
+	}
+
+	// Decoded levels that have not been asked for in a while are
+	// dropped; those of mapped files cost no more than the mapping
+	for (auto it = streams.begin(); it != streams.end(); ) {
+		bool idle = !it->second.chain.empty()
+			&& residences[it->first].refined + streaming.drop_after <= now;
+
+		if (idle) {
+			it = streams.erase(it);
+			stats.streaming--;
+		} else {
+			it++;
+		}
+	}
+
+	// Levels of the last batch become visible once it is done;
+	// images that were replaced since are left alone
+	if (*batch.fence) {
+		if (batch.fence.getStatus() != vk::Result::eSuccess)
+			return;
+
+		for (auto &upload : batch.uploads) {
+			_residence &residence = residences[upload.index];
+			if (residence.generation != upload.generation)
+				continue;
+
+			_retire(*dev, std::move(images[upload.index]));
+			images[upload.index] = std::move(upload.image);
+
+			size_t bytes = images[upload.index].image.getMemoryRequirements().size;
+			stats.bytes += bytes;
+			stats.bytes -= residence.bytes;
+
+			residence.bytes = bytes;
+			residence.base = upload.base;
+			residence.generation = ++_generations[*dev];
+			stats.streamed += upload.bytes;
+
+			_write_slot(dev, upload.index);
+
+			if (upload.base == 0 && streams.erase(upload.index))
+				stats.streaming--;
+		}
+
+		batch = _stream_batch {};
+	}
+
+	// Requested levels, one at a time for each texture
+	// (coarsest first), until the batch is full; textures
+	// whose pixels were dropped are decoded again first
+	struct Candidate {
+		size_t		index;
+		uint32_t	first;
+		uint32_t	base;
+	};
+
+	std::vector <Candidate> candidates;
+	for (size_t i = 0; i < residences.size(); i++) {
+		const _residence &residence = residences[i];
+		if (!*images[i].image || wanted[i] >= residence.base)
+			continue;
+
+		if (streams.count(i)) {
+			candidates.push_back({i, residence.base, residence.base});
+			continue;
+		}
+
+		if (decodes.count(i))
+			continue;
+
+		auto decode = std::make_shared <_decode> ();
+		decode->content = residence.content;
+		decodes[i] = decode;
+
+		const vk::raii::PhysicalDevice *device = &phdev;
+		std::string source = residence.source;
+		TextureRole role = residence.role;
+		TextureCompression settings = compression;
+
+		StreamDecoder::one().push([decode, device, source, role, settings]() {
+			decode->loaded = load_texture_pixels(*device, source,
+				texture_tiling, decode->pixels, settings, role);
+			decode->done.store(true, std::memory_order_release);
+		});
+	}
+
+	if (candidates.empty())
+		return;
+
+	// Largest deficit first; ties are broken by index
+	std::sort(candidates.begin(), candidates.end(),
+		[&](const Candidate &a, const Candidate &b) {
+			uint32_t da = a.base - wanted[a.index];
+			uint32_t db = b.base - wanted[b.index];
+			return (da != db) ? (da > db) : (a.index < b.index);
+		}
+	);
+
+	// A new image also takes the levels that are already on the
+	// GPU; they are at most a third of it, and this way the old
+	// image is never written to while frames sample it
+	vk::DeviceSize total = 0;
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		for (Candidate &c : candidates) {
+			const TexturePixels &pixels = streams.at(c.index);
+			if (c.first <= wanted[c.index])
+				continue;
+
+			uint32_t count = (c.first == c.base) ? pixels.levels - c.first + 1 : 1;
+			vk::DeviceSize bytes = staging_size(pixels, c.first - 1, count);
+			if (total > 0 && total + bytes > streaming.batch)
+				continue;
+
+			c.first--;
+			total += bytes;
+			progress = true;
+		}
+	}
+
+	BufferData &staging = _staging_buffer(phdev, dev, _stream_staging, total);
+	byte *ptr = (byte *) staging.memory.mapMemory(0, total);
+
+	auto &command_pool = get_command_pool(phdev, dev);
+	batch.cmd = make_command_buffer(dev, command_pool);
+	batch.cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+	vk::DeviceSize offset = 0;
+	for (const Candidate &c : candidates) {
+		if (c.first == c.base)
+			continue;
+
+		const TexturePixels &pixels = streams.at(c.index);
+		vk::DeviceSize bytes = staging_size(pixels, c.first, pixels.levels - c.first);
+
+		copy_texture_pixels(pixels, ptr + offset, c.first);
+		ImageData image = upload_texture(batch.cmd,
+			phdev, dev,
+			pixels, staging, offset,
+			texture_tiling, texture_usage,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			vk::ImageAspectFlagBits::eColor,
+			c.first
+		);
+
+		batch.uploads.push_back({
+			c.index, residences[c.index].generation,
+			c.first, size_t(bytes), std::move(image)
+		});
+
+		offset += bytes;
+	}
+
+	staging.memory.unmapMemory();
+	batch.cmd.end();
+
+	batch.fence = vk::raii::Fence {dev, vk::FenceCreateInfo {}};
+
+	vk::raii::Queue queue {dev, 0, 0};
+	queue.submit(
+		vk::SubmitInfo {
+			0, nullptr, nullptr, 1, &*batch.cmd
+		},
+		*batch.fence
+	);
+}
+
+// Request levels of a texture
+void TextureManager::request(const vk::raii::Device &dev, const std::string &source, float footprint)
+{
+	// Textures in atlases cover a part of their sheet
+	_alias alias = _resolve(source);
+	const std::string &path = alias.key;
+	footprint /= std::max(alias.transform.x, alias.transform.y);
+
+	std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+
+	auto &image_map = _image_map[*dev];
+	auto it = image_map.find(path);
+	if (it == image_map.end())
+		return;
+
+	// Fully resident textures have nothing left to stream
+	_residence &residence = _residences[*dev][it->second];
+	if (residence.base == 0)
+		return;
+
+	// A level is enough while its texels are no smaller than pixels
+	float size = float(residence.extent);
+
+	uint32_t level = 0;
+	if (footprint < size) {
+		float lod = std::log2(size/std::max(footprint, 1.0f));
+		level = std::min(uint32_t(lod), residence.levels - 1);
+	}
+
+	residence.wanted = std::min(residence.wanted, level);
+}
+
+// Mark a texture as used
+uint64_t TextureManager::use(const vk::raii::Device &dev, const std::string &source)
+{
+	std::string path = _resolve(source).key;
+
+	std::lock_guard <std::mutex> lock(_mutexes[*dev]);
+
+	auto &image_map = _image_map[*dev];
+	auto it = image_map.find(path);
+	if (it == image_map.end())
+		return 0;
+
+	_residence &residence = _residences[*dev][it->second];
+	residence.frame = _frames[*dev];
+	return residence.generation;
+}
+
+// Sampler of a texture
+const vk::raii::Sampler &TextureManager::load_sampler
+		(const vk::raii::PhysicalDevice &phdev,
+		const vk::raii::Device &dev,
+		const std::string &source) {
+	std::string path = _resolve(source).key;
+
+	// Every image samples with the same state
+	load_texture(phdev, dev, path);
+	return SamplerCache::get(dev, sampler_info());
 }
 
 // Create an image descriptor for an image
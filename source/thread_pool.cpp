@@ -0,0 +1,189 @@
+// Standard headers
+#include <algorithm>
+
+// Engine headers
+#include "../include/thread_pool.hpp"
+
+namespace kobra {
+
+// Index of the worker running on this thread (-1 if not a worker)
+static thread_local int _worker_index = -1;
+static thread_local const ThreadPool *_worker_pool = nullptr;
+
+// Constructor
+ThreadPool::ThreadPool(size_t workers)
+{
+	if (workers == 0)
+		workers = 1;
+
+	for (size_t i = 0; i < workers; i++)
+		_queues.emplace_back(new _queue);
+
+	for (size_t i = 0; i < workers; i++)
+		_threads.emplace_back(&ThreadPool::_worker, this, i);
+}
+
+// Destructor
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard <std::mutex> lock(_mutex);
+		_stop = true;
+	}
+
+	_cv.notify_all();
+	for (auto &thread : _threads)
+		thread.join();
+}
+
+// Push a task
+void ThreadPool::push(const Task &task)
+{
+	_push(task, nullptr);
+}
+
+void ThreadPool::push(const Task &task, const std::atomic <size_t> &batch)
+{
+	_push(task, &batch);
+}
+
+void ThreadPool::_push(const Task &task, const std::atomic <size_t> *batch)
+{
+	size_t index;
+	if (_worker_pool == this)
+		index = _worker_index;
+	else
+		index = _next.fetch_add(1) % _queues.size();
+
+	{
+		std::lock_guard <std::mutex> lock(_queues[index]->mutex);
+		_queues[index]->tasks.push_back(_entry {task, batch});
+	}
+
+	{
+		std::lock_guard <std::mutex> lock(_mutex);
+		_queued++;
+	}
+
+	_cv.notify_one();
+}
+
+// Pop or steal a task
+bool ThreadPool::_pop(size_t index, Task &task, const std::atomic <size_t> *batch)
+{
+	size_t n = _queues.size();
+
+	auto matches = [&](const _entry &entry) {
+		return !batch || entry.batch == batch;
+	};
+
+	// Own queue first (LIFO, for locality)
+	{
+		auto &q = *_queues[index % n];
+		std::lock_guard <std::mutex> lock(q.mutex);
+
+		auto it = std::find_if(q.tasks.rbegin(), q.tasks.rend(), matches);
+		if (it != q.tasks.rend()) {
+			task = std::move(it->task);
+			q.tasks.erase(std::next(it).base());
+			_queued--;
+			return true;
+		}
+	}
+
+	// Steal from the others (FIFO)
+	for (size_t i = 1; i < n; i++) {
+		auto &q = *_queues[(index + i) % n];
+		std::lock_guard <std::mutex> lock(q.mutex);
+
+		auto it = std::find_if(q.tasks.begin(), q.tasks.end(), matches);
+		if (it != q.tasks.end()) {
+			task = std::move(it->task);
+			q.tasks.erase(it);
+			_queued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Worker loop
+void ThreadPool::_worker(size_t index)
+{
+	_worker_index = index;
+	_worker_pool = this;
+
+	while (true) {
+		Task task;
+		if (_pop(index, task)) {
+			task();
+			continue;
+		}
+
+		std::unique_lock <std::mutex> lock(_mutex);
+		_cv.wait(lock, [&]() { return _stop || _queued > 0; });
+		if (_stop && _queued == 0)
+			return;
+	}
+}
+
+// Run a task of a batch on the calling thread
+bool ThreadPool::run_one(const std::atomic <size_t> &batch)
+{
+	size_t index = (_worker_pool == this) ? _worker_index : 0;
+
+	Task task;
+	if (_pop(index, task, &batch)) {
+		task();
+		return true;
+	}
+
+	return false;
+}
+
+// Wait on a counter
+void ThreadPool::wait(const std::atomic <size_t> &counter)
+{
+	while (counter > 0) {
+		if (!run_one(counter))
+			std::this_thread::yield();
+	}
+}
+
+// Chunked parallel loop
+void ThreadPool::parallel_for(size_t n, size_t chunk,
+		const std::function <void (size_t, size_t, size_t)> &ftn)
+{
+	size_t count = chunks(n, chunk);
+	if (count == 0)
+		return;
+
+	// Not worth the overhead
+	if (count == 1) {
+		ftn(0, 0, n);
+		return;
+	}
+
+	std::atomic <size_t> remaining = count;
+	for (size_t i = 0; i < count; i++) {
+		size_t begin = i * chunk;
+		size_t end = std::min(begin + chunk, n);
+
+		push([&, i, begin, end]() {
+			ftn(i, begin, end);
+			remaining--;
+		}, remaining);
+	}
+
+	wait(remaining);
+}
+
+// Singleton
+ThreadPool &ThreadPool::one()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+}
@@ -0,0 +1,211 @@
+// Standard headers
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+// Unix headers
+#include <sys/mman.h>
+
+// Compression
+#include <zlib.h>
+
+// Engine headers
+#include "../include/kpak.hpp"
+#include "../include/logger.hpp"
+#include "../include/vfs.hpp"
+
+namespace kobra {
+
+namespace vfs {
+
+// A mounted pack
+struct Pack {
+	std::string		path;
+	MappedFile		file;
+
+	const kpak::Entry	*entries = nullptr;
+	uint32_t		count = 0;
+
+	const char		*strings = nullptr;
+	uint64_t		strings_size = 0;
+
+	// Entry of a normalized path, if any
+	const kpak::Entry *find(const std::string &name) const {
+		uint64_t h = kpak::hash(name);
+
+		const kpak::Entry *end = entries + count;
+		const kpak::Entry *it = std::lower_bound(entries, end, h,
+			[](const kpak::Entry &e, uint64_t h) {
+				return e.hash < h;
+			}
+		);
+
+		// Hashes may collide, so check the paths
+		for (; it != end && it->hash == h; it++) {
+			if (it->path < strings_size && name == (strings + it->path))
+				return it;
+		}
+
+		return nullptr;
+	}
+};
+
+// Mounted packs, latest last
+static std::vector <std::shared_ptr <const Pack>> packs;
+static std::mutex mutex;
+
+// Files
+File::File(std::shared_ptr <const Pack> pack, const char *data, size_t size)
+		: _pack(pack), _data(data), _size(size), _valid(true) {}
+
+File::File(std::vector <char> &&buffer)
+		: _buffer(std::move(buffer)), _valid(true)
+{
+	_data = _buffer.data();
+	_size = _buffer.size();
+}
+
+File::File(MappedFile &&mapped)
+		: _mapped(std::move(mapped))
+{
+	_data = _mapped.data();
+	_size = _mapped.size();
+	_valid = _mapped.valid();
+}
+
+bool mount(const std::string &path)
+{
+	auto pack = std::make_shared <Pack> ();
+	pack->path = path;
+	pack->file = MappedFile(path);
+
+	const MappedFile &file = pack->file;
+	if (!file.valid() || file.size() < sizeof(kpak::Header)) {
+		KOBRA_LOG_FUNC(error) << "Failed to open pack: " << path << std::endl;
+		return false;
+	}
+
+	// Entries are accessed randomly
+	madvise((void *) file.data(), file.size(), MADV_RANDOM);
+
+	kpak::Header header;
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	if (std::memcmp(header.magic, kpak::magic, sizeof(kpak::magic)) != 0
+			|| header.version != kpak::version) {
+		KOBRA_LOG_FUNC(error) << "Not a (supported) pack: " << path << std::endl;
+		return false;
+	}
+
+	uint64_t index_size = uint64_t(header.entries) * sizeof(kpak::Entry);
+	if (header.index % alignof(kpak::Entry) != 0
+			|| header.index + index_size > file.size()
+			|| header.strings + header.strings_size > file.size()) {
+		KOBRA_LOG_FUNC(error) << "Corrupted pack: " << path << std::endl;
+		return false;
+	}
+
+	pack->entries = (const kpak::Entry *) (file.data() + header.index);
+	pack->count = header.entries;
+	pack->strings = file.data() + header.strings;
+	pack->strings_size = header.strings_size;
+
+	// Make sure that paths are terminated
+	if (header.strings_size > 0 && pack->strings[header.strings_size - 1] != '\0') {
+		KOBRA_LOG_FUNC(error) << "Corrupted pack: " << path << std::endl;
+		return false;
+	}
+
+	{
+		std::lock_guard <std::mutex> lock(mutex);
+		packs.push_back(pack);
+	}
+
+	KOBRA_LOG_FUNC(ok) << "Mounted pack " << path << " ("
+		<< header.entries << " files)" << std::endl;
+
+	return true;
+}
+
+void unmount()
+{
+	std::lock_guard <std::mutex> lock(mutex);
+	packs.clear();
+}
+
+// Pack and entry of a path, if any
+static std::pair <std::shared_ptr <const Pack>, const kpak::Entry *>
+lookup(const std::string &path)
+{
+	std::lock_guard <std::mutex> lock(mutex);
+	if (packs.empty())
+		return {nullptr, nullptr};
+
+	std::string name = kpak::normalize(path);
+	for (auto it = packs.rbegin(); it != packs.rend(); it++) {
+		const kpak::Entry *entry = (*it)->find(name);
+		if (entry)
+			return {*it, entry};
+	}
+
+	return {nullptr, nullptr};
+}
+
+bool exists(const std::string &path)
+{
+	if (lookup(path).second)
+		return true;
+
+	std::error_code ec;
+	return std::filesystem::is_regular_file(path, ec);
+}
+
+File open(const std::string &path)
+{
+	auto [pack, entry] = lookup(path);
+	if (!entry) {
+		File file {MappedFile(path)};
+
+		// Empty files are not mapped
+		if (!file.valid() && std::filesystem::is_regular_file(path))
+			return File {std::vector <char> ()};
+
+		return file;
+	}
+
+	if (entry->offset + entry->size > pack->file.size()) {
+		KOBRA_LOG_FUNC(error) << "Corrupted entry " << path
+			<< " in pack " << pack->path << std::endl;
+		return File {};
+	}
+
+	const char *data = pack->file.data() + entry->offset;
+	if (!(entry->flags & kpak::eCompressed))
+		return File {pack, data, entry->size};
+
+	std::vector <char> buffer(entry->original_size);
+
+	uLongf size = buffer.size();
+	int r = uncompress((Bytef *) buffer.data(), &size, (const Bytef *) data, entry->size);
+	if (r != Z_OK || size != buffer.size()) {
+		KOBRA_LOG_FUNC(error) << "Failed to decompress " << path
+			<< " in pack " << pack->path << std::endl;
+		return File {};
+	}
+
+	return File {std::move(buffer)};
+}
+
+std::string read(const std::string &path)
+{
+	File file = open(path);
+	if (!file.valid())
+		return "";
+
+	return std::string(file.view());
+}
+
+}
+
+}
@@ -0,0 +1,504 @@
+// Standard headers
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <set>
+
+// STBI headers
+#include <stb/stb_image.h>
+
+// Engine headers
+#include "../include/atlas.hpp"
+#include "../include/bake.hpp"
+#include "../include/block_compression.hpp"
+#include "../include/mipmap.hpp"
+#include "../include/scene.hpp"
+#include "../include/texture_container.hpp"
+#include "../include/thread_pool.hpp"
+#include "../include/timer.hpp"
+#include "../include/vfs.hpp"
+
+using namespace kobra;
+
+// An output to bring up to date
+struct Task {
+	std::string	kind;
+	std::string	source;
+
+	// Textures (and atlases): what the materials use them for
+	TextureRole	role = TextureRole::eColor;
+
+	// Atlases: the textures of the sheet, and where they go
+	std::vector <std::string>	members;
+	atlas::Sheet			sheet;
+
+	// Results
+	bake::Record	record;
+	bool		hit = false;
+	bool		failed = false;
+	double		time = 0;	// milliseconds
+};
+
+// Hash and stat the dependencies of an output
+static bool scan(std::vector <bake::Dependency> &deps)
+{
+	for (bake::Dependency &dep : deps) {
+		if (!bake::stat(dep.path, dep) || !bake::hash_file(dep.path, dep.hash))
+			return false;
+	}
+
+	return true;
+}
+
+// Dependencies from a list of files, without duplicates
+static std::vector <bake::Dependency> dependencies(const std::string &source,
+		const std::vector <std::string> &files)
+{
+	std::vector <bake::Dependency> deps {bake::Dependency {.path = source}};
+
+	std::set <std::string> seen {source};
+	for (const std::string &file : files) {
+		if (seen.insert(file).second)
+			deps.push_back(bake::Dependency {.path = file});
+	}
+
+	return deps;
+}
+
+// Compression of textures (none if empty)
+static std::optional <bc::Preset> compression = bc::Preset::eQuality;
+
+// Textures no larger than this are packed into atlases (none if zero)
+static uint32_t atlas_threshold = atlas::threshold;
+
+// Key of an output; textures also depend on how they are compressed,
+// and atlases on which textures they hold, and where
+static uint64_t output_key(const Task &task, const std::vector <bake::Dependency> &deps)
+{
+	uint64_t key = bake::key(task.kind, deps);
+	if (task.kind == bake::texture || task.kind == bake::atlas) {
+		int32_t preset = compression ? int32_t(*compression) : -1;
+		key = bake::hash((const char *) &preset, sizeof(preset), key);
+		key = bake::hash((const char *) &task.role, sizeof(task.role), key);
+	}
+
+	if (task.kind == bake::atlas) {
+		for (size_t i = 0; i < task.members.size(); i++) {
+			const atlas::Rect &rect = task.sheet.rects[i];
+			key = bake::hash(task.members[i].data(), task.members[i].size(), key);
+			key = bake::hash((const char *) &rect, sizeof(rect), key);
+		}
+	}
+
+	return key;
+}
+
+// Name of an output file
+static std::string output_name(const std::string &kind, uint64_t key)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) key);
+	return kind + "_" + buf + (kind == bake::mesh ? ".kmesh" : ".ktex");
+}
+
+// Decode a texture (RGBA8, bottom row first)
+static stbi_uc *decode(const std::string &source, int &width, int &height)
+{
+	vfs::File file = vfs::open(source);
+	if (!file.valid())
+		return nullptr;
+
+	int channels;
+	return stbi_load_from_memory(
+		(const stbi_uc *) file.data(), file.size(),
+		&width, &height, &channels, 4
+	);
+}
+
+// Baked texture, from its levels (RGBA8, packed as in mip::layout);
+// the format is picked from its role and the first level
+static std::string bake_texture(TextureRole role, std::vector <uint8_t> &&chain,
+		uint32_t width, uint32_t height, uint32_t levels)
+{
+	bc::Format format = bc::Format::eNone;
+	if (compression) {
+		format = bc::select(role, chain.data(), width, height, *compression);
+		if (format != bc::Format::eNone)
+			chain = bc::compress(chain.data(), width, height, levels, format, *compression);
+	}
+
+	bake::TextureHeader header {
+		.magic = {'K', 'T', 'E', 'X'},
+		.width = width,
+		.height = height,
+		.channels = 4,
+		.levels = levels,
+		.format = uint32_t(format)
+	};
+
+	std::string data;
+	data.append((const char *) &header, sizeof(header));
+	data.append((const char *) chain.data(), chain.size());
+	return data;
+}
+
+// Sheet of an atlas, with the regions of its textures after the levels
+static bool bake_atlas(const Task &task, std::string &data)
+{
+	std::vector <std::vector <uint8_t>> chains;
+	std::vector <const uint8_t *> pointers;
+	std::vector <atlas::Region> regions;
+
+	for (size_t i = 0; i < task.members.size(); i++) {
+		const std::string &member = task.members[i];
+		const atlas::Rect &rect = task.sheet.rects[i];
+
+		int width, height;
+		stbi_uc *pixels = decode(member, width, height);
+		if (!pixels)
+			return false;
+
+		// The sizes were read before packing
+		if (uint32_t(width) != rect.width || uint32_t(height) != rect.height) {
+			stbi_image_free(pixels);
+			return false;
+		}
+
+		chains.push_back(mip::generate(pixels, width, height,
+			mip::Filter::eKaiser, mip::is_srgb(task.role)));
+		stbi_image_free(pixels);
+
+		regions.push_back(atlas::Region {member, rect});
+	}
+
+	for (const auto &chain : chains)
+		pointers.push_back(chain.data());
+
+	// Sheets hold either normal maps or the rest, and are
+	// compressed accordingly
+	data = bake_texture(task.role,
+		atlas::compose(task.sheet, pointers),
+		task.sheet.width, task.sheet.height, atlas::levels);
+
+	data += atlas::write_regions(regions);
+	return true;
+}
+
+// Build an output from scratch
+static bool build(Task &task, const std::string &dir)
+{
+	std::string data;
+	std::vector <bake::Dependency> deps;
+
+	if (task.kind == bake::mesh) {
+		std::vector <std::string> files;
+
+		auto mesh = Mesh::load(task.source, &files);
+		if (!mesh.has_value())
+			return false;
+
+		data = mesh->bake();
+		deps = dependencies(task.source, files);
+	} else if (task.kind == bake::atlas) {
+		if (!bake_atlas(task, data))
+			return false;
+
+		// Sheets are not files; they only depend on their textures
+		for (const std::string &member : task.members)
+			deps.push_back(bake::Dependency {.path = member});
+	} else {
+		int width, height;
+		stbi_uc *pixels = decode(task.source, width, height);
+		if (!pixels)
+			return false;
+
+		// Full mip chain, filtered in linear space for color
+		std::vector <uint8_t> chain = mip::generate(pixels, width, height,
+			mip::Filter::eKaiser, mip::is_srgb(task.role));
+
+		stbi_image_free(pixels);
+
+		data = bake_texture(task.role, std::move(chain),
+			width, height, mip::count(width, height));
+
+		deps = dependencies(task.source, {});
+	}
+
+	if (!scan(deps))
+		return false;
+
+	task.record = bake::Record {
+		.kind = task.kind,
+		.source = task.source,
+		.key = output_key(task, deps),
+		.dependencies = deps
+	};
+
+	task.record.output = output_name(task.kind, task.record.key);
+	return common::write_file(dir + "/" + task.record.output, data);
+}
+
+// Size of a texture, without decoding it
+static bool extent(const std::string &source, atlas::Extent &extent)
+{
+	vfs::File file = vfs::open(source);
+	if (!file.valid())
+		return false;
+
+	int width, height, channels;
+	if (!stbi_info_from_memory((const stbi_uc *) file.data(), file.size(),
+			&width, &height, &channels))
+		return false;
+
+	extent = atlas::Extent {uint32_t(width), uint32_t(height)};
+	return true;
+}
+
+// Pack the small textures into atlases; the textures that are
+// packed are removed from the list
+static std::vector <Task> pack_atlases(std::vector <std::string> &textures,
+		const std::set <std::string> &normals)
+{
+	std::vector <Task> tasks;
+	if (atlas_threshold == 0)
+		return tasks;
+
+	// Normal maps are compressed differently, so they
+	// get sheets of their own
+	std::vector <std::string> groups[2];
+	std::vector <atlas::Extent> extents[2];
+
+	std::vector <std::string> rest;
+	for (const std::string &texture : textures) {
+		atlas::Extent e;
+		if (!extent(texture, e) || !atlas::eligible(e, atlas_threshold)) {
+			rest.push_back(texture);
+			continue;
+		}
+
+		int g = normals.count(texture);
+		groups[g].push_back(texture);
+		extents[g].push_back(e);
+	}
+
+	for (int g = 0; g < 2; g++) {
+		std::vector <atlas::Sheet> sheets = atlas::pack(extents[g]);
+
+		std::set <size_t> packed;
+		for (size_t s = 0; s < sheets.size(); s++) {
+			Task task {
+				.kind = bake::atlas,
+				.source = std::string(g ? "normal" : "color") + "/" + std::to_string(s),
+				.role = g ? TextureRole::eNormal : TextureRole::eColor,
+				.sheet = sheets[s]
+			};
+
+			for (size_t i : sheets[s].textures) {
+				task.members.push_back(groups[g][i]);
+				packed.insert(i);
+			}
+
+			tasks.push_back(task);
+		}
+
+		for (size_t i = 0; i < groups[g].size(); i++) {
+			if (!packed.count(i))
+				rest.push_back(groups[g][i]);
+		}
+	}
+
+	textures = rest;
+	return tasks;
+}
+
+// Bake the assets of scenes into the cache directory
+//	kobra_bake [-o <cache directory>] [-c quality|fast|none]
+//		[-a <atlas threshold, 0 for none>] <scenes...>
+int main(int argc, char *argv[])
+{
+	std::string dir = bake::directory();
+	std::vector <std::string> scenes;
+	bool usage = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			dir = argv[++i];
+		} else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			std::string preset = argv[++i];
+			if (preset == "quality")
+				compression = bc::Preset::eQuality;
+			else if (preset == "fast")
+				compression = bc::Preset::eFast;
+			else if (preset == "none")
+				compression.reset();
+			else
+				usage = true;
+		} else if (std::strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			atlas_threshold = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			scenes.push_back(argv[i]);
+		}
+	}
+
+	if (scenes.empty() || usage) {
+		std::cerr << "Usage: " << argv[0]
+			<< " [-o <cache directory>] [-c quality|fast|none]"
+			" [-a <atlas threshold>] <scenes...>" << std::endl;
+		return 1;
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if (ec) {
+		KOBRA_LOG_FUNC(error) << "Failed to create directory: " << dir << std::endl;
+		return 1;
+	}
+
+	// Walk the assets of the scenes
+	std::set <std::pair <std::string, std::string>> assets;
+	std::set <std::string> environments;
+	std::set <std::string> normals;
+	for (const std::string &scene : scenes) {
+		std::string env;
+		auto emit = [&](SceneEntity &&e) {
+			if (!e.mesh_source.empty() && e.mesh_source != "box")
+				assets.insert({bake::mesh, e.mesh_source});
+
+			if (e.material && e.material->has_albedo())
+				assets.insert({bake::texture, e.material->albedo_texture});
+
+			if (e.material && e.material->has_normal()) {
+				assets.insert({bake::texture, e.material->normal_texture});
+				normals.insert(e.material->normal_texture);
+			}
+
+			return true;
+		};
+
+		bool ok = Scene::is_binary(scene)
+			? Scene::parse_binary(scene, env, emit, nullptr, false)
+			: Scene::parse(scene, env, emit, nullptr, false);
+
+		if (!ok) {
+			KOBRA_LOG_FUNC(error) << "Failed to read scene: " << scene << std::endl;
+			return 1;
+		}
+
+		if (!env.empty()) {
+			assets.insert({bake::texture, env});
+			environments.insert(env);
+		}
+	}
+
+	// Containers are already in their final form
+	std::vector <Task> tasks;
+	std::vector <std::string> textures;
+
+	for (const auto &[kind, source] : assets) {
+		if (kind == bake::texture && container::is_container(source))
+			continue;
+
+		// Environment maps are sampled as whole images
+		if (kind == bake::texture && !environments.count(source))
+			textures.push_back(source);
+		else
+			tasks.push_back(Task {.kind = kind, .source = source});
+	}
+
+	// Small textures are baked into atlases, and the rest by themselves
+	for (Task &task : pack_atlases(textures, normals))
+		tasks.push_back(task);
+
+	for (const std::string &texture : textures) {
+		tasks.push_back(Task {
+			.kind = bake::texture,
+			.source = texture,
+			.role = normals.count(texture) ? TextureRole::eNormal : TextureRole::eColor
+		});
+	}
+
+	bake::Manifest manifest = bake::read_manifest(dir);
+
+	// Outputs are up to date if the contents of everything they were
+	// built from are the same; otherwise they are built again
+	Timer timer;
+
+	stbi_set_flip_vertically_on_load(true);
+	ThreadPool::one().parallel_for(tasks.size(), 1,
+		[&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				Task &task = tasks[i];
+				Timer t;
+
+				auto it = manifest.find(bake::id(task.kind, task.source));
+				if (it != manifest.end()
+						&& std::filesystem::exists(dir + "/" + it->second.output)) {
+					bake::Record record = it->second;
+					if (scan(record.dependencies)
+							&& output_key(task, record.dependencies) == record.key) {
+						task.record = record;
+						task.hit = true;
+					}
+				}
+
+				if (!task.hit)
+					task.failed = !build(task, dir);
+
+				task.time = t.elapsed_start()/1000.0;
+			}
+		}
+	);
+
+	// Report, and update the manifest
+	size_t hits = 0;
+	size_t failed = 0;
+
+	std::set <std::string> sheets;
+	for (const Task &task : tasks) {
+		std::string id = bake::id(task.kind, task.source);
+
+		const char *status = task.hit ? "cached" : (task.failed ? "FAILED" : "baked");
+		std::printf("%-8s %-7s %8.2f ms  %s\n", task.kind.c_str(), status,
+			task.time, task.source.c_str());
+
+		if (task.failed) {
+			failed++;
+			continue;
+		}
+
+		// Remove the output that has been replaced
+		auto it = manifest.find(id);
+		if (it != manifest.end() && it->second.output != task.record.output)
+			std::filesystem::remove(dir + "/" + it->second.output, ec);
+
+		manifest[id] = task.record;
+		hits += task.hit;
+
+		if (task.kind == bake::atlas)
+			sheets.insert(id);
+	}
+
+	// Sheets from earlier packings would claim the same textures
+	for (auto it = manifest.begin(); it != manifest.end(); ) {
+		if (it->second.kind == bake::atlas && !sheets.count(it->first)) {
+			std::filesystem::remove(dir + "/" + it->second.output, ec);
+			it = manifest.erase(it);
+		} else {
+			it++;
+		}
+	}
+
+	if (!bake::write_manifest(dir, manifest))
+		return 1;
+
+	double rate = tasks.empty() ? 1.0 : double(hits)/double(tasks.size());
+	std::printf("%zu assets, %zu cached (%.1f%% hit rate), %zu failed, %.2f ms\n",
+		tasks.size(), hits, 100.0 * rate, failed,
+		timer.elapsed_start()/1000.0);
+
+	return failed > 0;
+}
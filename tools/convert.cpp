@@ -0,0 +1,18 @@
+// Standard headers
+#include <iostream>
+
+// Engine headers
+#include "../include/scene.hpp"
+
+// Scene conversion tool
+//	convert <input> <output>
+// scenes ending in .kobrab are binary, others text
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <input> <output>" << std::endl;
+		return 1;
+	}
+
+	return kobra::Scene::convert(argv[1], argv[2]) ? 0 : 1;
+}
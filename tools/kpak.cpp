@@ -0,0 +1,50 @@
+// Standard headers
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+// Engine headers
+#include "../include/kpak.hpp"
+
+// Pack building tool
+//	kpak [-c] <output.kpak> <files or directories...>
+int main(int argc, char *argv[])
+{
+	bool compress = false;
+
+	int i = 1;
+	if (i < argc && std::strcmp(argv[i], "-c") == 0) {
+		compress = true;
+		i++;
+	}
+
+	if (argc - i < 2) {
+		std::cerr << "Usage: " << argv[0]
+			<< " [-c] <output.kpak> <files or directories...>" << std::endl;
+		return 1;
+	}
+
+	std::string output = argv[i++];
+
+	// Directories are packed recursively, in a stable order
+	std::vector <std::string> files;
+	for (; i < argc; i++) {
+		std::filesystem::path path = argv[i];
+		if (!std::filesystem::is_directory(path)) {
+			files.push_back(path.string());
+			continue;
+		}
+
+		std::vector <std::string> dir;
+		for (const auto &entry : std::filesystem::recursive_directory_iterator(path)) {
+			if (entry.is_regular_file())
+				dir.push_back(entry.path().string());
+		}
+
+		std::sort(dir.begin(), dir.end());
+		files.insert(files.end(), dir.begin(), dir.end());
+	}
+
+	return kobra::kpak::build(output, files, compress) ? 0 : 1;
+}